@@ -12,9 +12,13 @@
 #include <future>
 #include <memory>
 #include <type_traits>
+#include <deque>
+#include <vector>
 
 #include "singleton.h"
 #include "rpc.h"
+#include "timer_wheel.h"
+#include "asyncLogger.h"
 #include "uv.h"
 
 namespace DSCPP
@@ -48,13 +52,21 @@ namespace DSCPP
 	typedef void(*LPFN_SEND_COMPLETE)(void*, size_t);
 
 	// IOHandler that takes care of sending and receiving data.
+	// It should hand over the received data to _dsclientBase through handle_server_data() (in
+	// pieces of any size), report the connection state through on_connection_established()
+	// and on_connection_lost(), and drive its timers with on_timers_tick() (at timers().resolution()).
+	// For the results sent in pieces, it tells the bytes not yet written out (queued_bytes()), calls
+	// on_writable() once they drain (after notify_writable()), and sends the pieces with send_piece().
+	// See uvIOHandler.h and wsIOHandler.h for the TCP and WebSocket transports over libuv,
+	// and uringIOHandler.h for TCP over io_uring (Linux).
 	// Implement your own and supply it to the _dsclientBase class
 	// as template argument and constructor parameter. 
 	// For the send and recv methods, return 
 	//		-1  to indicate failure, and
 	//		>=0 to indicate success.
 	// The alloc_send_buffer should allocate a buffer of given size, which
-	// will then be used in the call to the send.
+	// will then be used in the call to the send. The replies written in place into a
+	// received buffer are sent with the owner of that buffer, which gets released instead of buf.
 	struct simpleIOHandler
 	{
 		static inline void* alloc_send_buffer(size_t size)
@@ -65,17 +77,33 @@ namespace DSCPP
 		{
 			POOLED_FREE(buf);
 		}
-		int send(void* buf, size_t len, LPFN_SEND_COMPLETE cb = release_send_buffer)
+		int send(void* buf, size_t len, LPFN_SEND_COMPLETE cb = release_send_buffer, void* owner = nullptr)
 		{
 			if(len >0 && buf != nullptr) // ensure valid buffer (usually obtained from alloc_send_buffer())
-				fprintf(stderr, "sending: %*s", len, (char*)buf);
-			(*cb)(buf, len);
+				DSLOG_DEBUG("sending: %s", log_string((char*)buf, len));
+			(*cb)(owner != nullptr ? owner : buf, len);
 			return 0;
 		}
+		// sends a piece of a message that goes out in several (bFirst and bLast tell which one it is)
+		int send_piece(void* buf, size_t len, bool bFirst, bool bLast, LPFN_SEND_COMPLETE cb = release_send_buffer, void* owner = nullptr)
+		{
+			return send(buf, len, cb, owner);
+		}
+		inline size_t queued_bytes() const
+		{
+			return 0;	// sends complete right away
+		}
+		inline void notify_writable(size_t nLowWater)
+		{	}
 		int disconnect()
 		{
 			// stop any pending send/recv operations. 
 		}
+		int reconnect()
+		{
+			// re-establish the connection (to the same server) after a disconnect.
+			return -1;	// not supported
+		}
 	};
 
 
@@ -93,9 +121,29 @@ namespace DSCPP
 		typedef unique_ptr<void> unique_bufptr;
 
 		typedef int(*LPFNRPCMethod)(unique_ptr<_rpcCall>, _MyType*);
+		typedef int(*LPFNRPCBatchMethod)(unique_ptr<_rpcCall>* calls, size_t nCalls, _MyType*);	// see register_rpc_batch_provider()
 		typedef trie_array<LPFNRPCMethod> TRPCTrieArray;
 
 		enum { SENDBUF_SIZE = 4096, MAX_UID_LEN = 64, MAX_METHODNAME_LEN = 128, MAX_USERNAME_LEN = 32, MAX_PASSWORD_LEN = 32 };
+		enum { MAX_MESSAGE_LEN = 16 * 1024 * 1024 };	// messages that span reads are assembled up to this size
+		enum 
+		{ 
+			TIMER_RESOLUTION = 100,			// granularity of the timers in milliseconds
+			HEARTBEAT_TIMEOUT = 65000,		// server pings every 30 seconds; connection is considered dead after two missed pings
+			RECONNECT_DELAY_MIN = 500,		// first reconnect attempt after this delay, doubles with every failure
+			RECONNECT_DELAY_MAX = 30000,
+			RPC_RESPONSE_TIMEOUT = 10000,	// the calls made (make_rpc_call()) fail if not answered in this time
+			POOL_TRIM_INTERVAL = 10000,		// the pools of the thread give back what went unused this long (see bufPool::trim())
+			POOL_TRIM_BATCH = 256			// at most this many chunks (and objects of each type) per trim
+		};
+		enum
+		{
+			RESULT_CHUNK_SIZE = 16 * 1024,		// the pieces of the streamed results are made into send buffers of this size
+			RESULT_HIGH_WATER = 256 * 1024,		// the producers are not pulled while the IO handler has this much queued
+			RESULT_LOW_WATER = 64 * 1024,		// and are pulled again once it drains to this
+			RESULT_MAX_HOLD = 5000,				// the messages held behind a result on the wire wait at most this long (ms),
+			RESULT_MAX_HELD = 64 * 1024			// and at most this many bytes: the result is then cut off, with the connection
+		};
 
 	protected:
 		struct _statehandlers
@@ -105,7 +153,7 @@ namespace DSCPP
 				MAX_DIRECTIVE_LEN = 32, // this governs the prefixMatch results array size, usually should be equal to the length of the longest directive string
 				MAX_HANDLERS_COUNT = 16 // this governs the handler array size, usually should be equal to the no. of handlers (no. of directives)
 			};
-			typedef int(_MyType::*LPFNStateHandler)(unique_bufptr, size_t);
+			typedef int(_MyType::*LPFNStateHandler)(unique_bufptr, char*, size_t);	// (owner of the message, message, message size)
 			typedef trie_prefixed_array<LPFNStateHandler, static_array<LPFNStateHandler, MAX_HANDLERS_COUNT>> TRIE_ARRAY;
 			TRIE_ARRAY handlerArray;
 			inline _statehandlers()
@@ -121,7 +169,11 @@ namespace DSCPP
 					"A|E|INVALID_AUTH_DATA|",			&_MyType::on_login_invalid,
 					"A|E|TOO_MANY_AUTH_ATTEMPTS|",		&_MyType::on_toomany_auth_attempts,
 					"P|A|S|",							&_MyType::on_provider_acknowledged,
+					"P|A|",								&_MyType::on_rpc_request_acknowledged,
 					"P|REQ|",							&_MyType::on_rpc_call_received,
+					"P|RES|",							&_MyType::on_rpc_response,
+					"P|E|",								&_MyType::on_rpc_error,
+					"C|PI+",							&_MyType::on_server_ping,
 				};
 				
 				assert( MAX_HANDLERS_COUNT > (sizeof(stateDirectives) / sizeof(stateDirectives[0])) ); // increase the MAX_HANDLERS_COUNT value if needed
@@ -148,13 +200,61 @@ namespace DSCPP
 		};
 		static _statehandlers	s_stateHandlers;	// the state handler methods
 		TRPCTrieArray			m_rpcRouter;		// maps method_names -> method_handlers
+		_rpcLimiter				m_rpcLimiter;		// the calls in flight, per method id (the key in m_rpcRouter)
+		uint64_t				m_nReadAtUs;		// when the data being handled was read (rpc_clock_us())
+		struct _rpcBatch
+		{
+			LPFNRPCBatchMethod				handler = nullptr;	// nullptr: the method is not batched
+			size_t							nMaxCalls = 0;
+			uint32_t						nMaxDelayUs = 0;
+			uint64_t						nOpenedUs = 0;		// the read time of the first call in the batch
+			std::vector<unique_ptr<_rpcCall>>	calls;
+		};
+		std::vector<_rpcBatch>	m_rpcBatches;		// per method id, as in m_rpcLimiter
+		size_t					m_nBatchedCalls;	// waiting in all the batches
+		_rpcRequest				m_requests;			// sentinel of the (circular) list of the calls made, waiting for the response
+		uint64_t				m_nNextRequestUid;
 		int						m_nLoginRetryCount;
 		bool					m_bReadyForTransfer;	// indicates connected & successful auth state
+		timer_wheel				m_timers;			// all the timeouts of the connection (driven by the IO handler)
+		timer_wheel::entry		m_heartbeatTimer;	// fires when the server has been silent for too long
+		timer_wheel::entry		m_reconnectTimer;
+		timer_wheel::entry		m_poolTrimTimer;
+		timer_wheel::entry		m_holdTimer;		// bounds the wait of the held messages (see RESULT_MAX_HOLD)
+		int						m_nReconnectAttempts;
+		bool					m_bAutoReconnect;
+		unique_bufptr			m_spPartial;		// the message that spans reads, assembled so far
+		size_t					m_nPartialLen;
+		size_t					m_nPartialCapacity;
+		struct _heldSend { void* buf; size_t len; LPFN_SEND_COMPLETE cb; void* owner; };
+		std::deque<_rpcResultStream*> m_resultStreams;	// the results sent in pieces, one after the other (the front one is on the wire)
+		std::vector<_heldSend>	m_heldSends;		// the messages that wait for the result on the wire to end
+		size_t					m_nHeldBytes;
+		bool					m_bPumping;
 	public:
 		inline _dsclientBase() :
+			m_nReadAtUs(0),
+			m_nBatchedCalls(0),
+			m_nNextRequestUid(1),
 			m_nLoginRetryCount(0),
-			m_bReadyForTransfer(false)
+			m_bReadyForTransfer(false),
+			m_timers(0, TIMER_RESOLUTION),
+			m_nReconnectAttempts(0),
+			m_bAutoReconnect(true),
+			m_nPartialLen(0),
+			m_nPartialCapacity(0),
+			m_nHeldBytes(0),
+			m_bPumping(false)
 		{
+			m_timers.init(m_heartbeatTimer, on_heartbeat_missed, this);
+			m_timers.init(m_reconnectTimer, on_reconnect_due, this);
+			m_timers.init(m_poolTrimTimer, on_pool_trim_due, this);
+			m_timers.init(m_holdTimer, on_hold_expired, this);
+			m_requests.pPrev = m_requests.pNext = &m_requests;
+		}
+		inline ~_dsclientBase()
+		{
+			drop_results();
 		}
 
 		inline bool is_ready_for_transfer() const
@@ -162,13 +262,181 @@ namespace DSCPP
 			return m_bReadyForTransfer;
 		}
 
-		inline int handle_server_directive(unique_bufptr spbuf, size_t size)
+		// Framer: takes the data received from the server, in pieces of any size, and dispatches the
+		// complete messages. spOwner owns the memory that pData points into (usually the read buffer).
+		// The messages are handled in place: when a read has several of them, they all share the read
+		// buffer (see bufPoolChunk::addRef()). Only a message that spans reads gets assembled by copying.
+		inline int handle_server_data(unique_bufptr spOwner, char* pData, size_t len)
+		{
+			int nResult = 0;
+			m_nReadAtUs = rpc_clock_us();	// the calls of the read wait for one another from here
+			if (m_nPartialLen > 0)	// complete the pending message first
+			{
+				char* pEnd = (char*)memchr(pData, DS_MESSAGE_SEPERATOR, len);
+				size_t nTaken = (pEnd == nullptr) ? len : (pEnd - pData + 1);
+				if (append_partial(pData, nTaken) != 0) return disconnect_on_overflow();
+				pData += nTaken;
+				len -= nTaken;
+				if (pEnd == nullptr) return 0;	// still incomplete
+				size_t nMsgLen = m_nPartialLen;
+				m_nPartialLen = m_nPartialCapacity = 0;
+				char* pMsg = (char*)m_spPartial.get();
+				nResult = handle_server_directive(std::move(m_spPartial), pMsg, nMsgLen);
+			}
+			while (len > 0)
+			{
+				char* pEnd = (char*)memchr(pData, DS_MESSAGE_SEPERATOR, len);
+				if (pEnd == nullptr)	// incomplete message: keep it till the rest arrives
+				{
+					if (append_partial(pData, len) != 0) return disconnect_on_overflow();
+					break;
+				}
+				size_t nMsgLen = pEnd - pData + 1;
+				len -= nMsgLen;
+				if (len == 0)	// the last message gets the owner itself
+				{
+					nResult = handle_server_directive(std::move(spOwner), pData, nMsgLen);
+					break;
+				}
+				if (bufPoolChunk::addRef(spOwner.get()))	// the message shares the owner with the rest
+					nResult = handle_server_directive(unique_bufptr(spOwner.get()), pData, nMsgLen);
+				else	// cannot be shared (no owner), give the message a copy
+				{
+					char* pCopy = (char*)IO::alloc_send_buffer(nMsgLen + 1);
+					memcpy(pCopy, pData, nMsgLen);
+					nResult = handle_server_directive(unique_bufptr(pCopy), pCopy, nMsgLen);
+				}
+				pData += nMsgLen;
+			}
+			if (m_nBatchedCalls > 0) flush_rpc_batches();	// the batches that are due, now that the read is done
+			return nResult;
+		}
+		// handles one complete message (ends with DS_MESSAGE_SEPERATOR). pMsg points into the memory owned by spOwner.
+		inline int handle_server_directive(unique_bufptr spOwner, char* pMsg, size_t size)
+		{
+			m_timers.schedule(m_heartbeatTimer, HEARTBEAT_TIMEOUT);	// server is alive (O(1) refresh)
+			auto handler = s_stateHandlers.getHandler(pMsg, size);
+			return (this->*handler)(std::forward<unique_bufptr>(spOwner), pMsg, size);
+		}
+	protected:
+		inline int append_partial(const char* pData, size_t len)
+		{
+			if (m_nPartialLen + len > m_nPartialCapacity)
+			{
+				if (m_nPartialLen + len > MAX_MESSAGE_LEN) return -1;
+				size_t nCapacity = std::max(m_nPartialCapacity * 2, std::max((size_t)SENDBUF_SIZE, m_nPartialLen + len));
+				char* pNew = (char*)IO::alloc_send_buffer(nCapacity);
+				if (pNew == nullptr) return -1;
+				if (m_nPartialLen > 0) memcpy(pNew, m_spPartial.get(), m_nPartialLen);
+				m_spPartial.reset(pNew);
+				m_nPartialCapacity = nCapacity;
+			}
+			memcpy((char*)m_spPartial.get() + m_nPartialLen, pData, len);
+			m_nPartialLen += len;
+			return 0;
+		}
+		inline void reset_partial()
+		{
+			m_spPartial.reset();
+			m_nPartialLen = m_nPartialCapacity = 0;
+		}
+		inline int disconnect_on_overflow()
+		{
+			DSLOG_ERROR("Message from server is too large, reconnecting");
+			reset_partial();
+			IO::disconnect();
+			on_connection_lost();
+			return -1;
+		}
+	public:
+
+	//////////////////////////////////////////////////////////
+	// Timers and Connection state (called by the IO handler)
+	//
+	public:
+		inline timer_wheel& timers()
+		{
+			return m_timers;
+		}
+		// fires the expired timers. The IO handler should call this every timers().resolution() ms
+		inline void on_timers_tick(uint64_t nowMs)
+		{
+			m_timers.advance(nowMs);
+			if (m_nBatchedCalls > 0) flush_rpc_batches();	// no more reads came for them
+		}
+		inline void on_connection_established()
+		{
+			reset_partial();
+			m_nReconnectAttempts = 0;
+			m_timers.cancel(m_reconnectTimer);
+			m_timers.schedule(m_heartbeatTimer, HEARTBEAT_TIMEOUT);
+			if (!m_poolTrimTimer.isPending()) m_timers.schedule(m_poolTrimTimer, POOL_TRIM_INTERVAL);	// (runs on through reconnects)
+		}
+		// connection broke (or could not be established). Schedules a reconnect, if enabled.
+		inline void on_connection_lost()
+		{
+			reset_partial();
+			m_bReadyForTransfer = false;	// (before the calls made fail: their callbacks may try again)
+			drop_results();
+			m_timers.cancel(m_heartbeatTimer);
+			if (!m_bAutoReconnect) return;
+			int nShift = std::min(m_nReconnectAttempts++, 16);
+			m_timers.schedule(m_reconnectTimer, std::min((uint64_t)RECONNECT_DELAY_MIN << nShift, (uint64_t)RECONNECT_DELAY_MAX));
+		}
+		// the write queue of the IO handler drained (see notify_writable()): the streamed results go on
+		inline void on_writable()
+		{
+			pump_results();
+		}
+		inline void set_auto_reconnect(bool bAutoReconnect)
+		{
+			m_bAutoReconnect = bAutoReconnect;
+			if (!bAutoReconnect) m_timers.cancel(m_reconnectTimer);
+		}
+	protected:
+		static void on_heartbeat_missed(timer_wheel::entry* pTimer)
+		{
+			_MyType* pThis = (_MyType*)pTimer->data;
+			DSLOG_WARN("No heartbeat from server, reconnecting");
+			pThis->IO::disconnect();	// keeps the reconnect timer (unlike disconnect())
+			pThis->on_connection_lost();
+		}
+		static void on_reconnect_due(timer_wheel::entry* pTimer)
+		{
+			_MyType* pThis = (_MyType*)pTimer->data;
+			if (pThis->IO::reconnect() < 0)
+				pThis->on_connection_lost();	// try again later
+		}
+		// the pools are per thread (the loop's): trimmed from the timers, on the loop thread
+		static void on_pool_trim_due(timer_wheel::entry* pTimer)
+		{
+			_MyType* pThis = (_MyType*)pTimer->data;
+			bufPool::trim(POOL_TRIM_BATCH);
+			pThis->m_timers.schedule(pThis->m_poolTrimTimer, POOL_TRIM_INTERVAL);
+		}
+		// the messages held behind the result on the wire (pongs and acks among them) waited too long, or grew too
+		// many: they cannot go out in the middle of the result, and the result cannot be ended early. Reconnects.
+		static void on_hold_expired(timer_wheel::entry* pTimer)
 		{
-			auto handler = s_stateHandlers.getHandler((char*)spbuf.get(), size);
-			return (this->*handler)(std::forward<unique_bufptr>(spbuf), size);
+			_MyType* pThis = (_MyType*)pTimer->data;
+			DSLOG_WARN("Messages held too long behind an RPC result, reconnecting");
+			pThis->IO::disconnect();
+			pThis->on_connection_lost();
 		}
 
 	protected:
+		// sends a complete message, or holds it till the result on the wire ends (see send_rpc_call_result_stream())
+		inline int send_message(void* buf, size_t len, LPFN_SEND_COMPLETE cb = IO::release_send_buffer, void* owner = nullptr)
+		{
+			if (m_resultStreams.empty() || !m_resultStreams.front()->bStarted)
+				return IO::send(buf, len, cb, owner);
+			_heldSend held = { buf, len, cb, owner };
+			if (m_heldSends.empty()) m_timers.schedule(m_holdTimer, RESULT_MAX_HOLD);
+			m_heldSends.push_back(held);
+			m_nHeldBytes += len;
+			if (m_nHeldBytes > RESULT_MAX_HELD) m_timers.schedule(m_holdTimer, 0);	// (reconnects from the timers, not from within the sender)
+			return 0;
+		}
 		inline int send_auth()
 		{
 			std::string strUsername = CS::getUsername();
@@ -177,92 +445,156 @@ namespace DSCPP
 
 			void* buf = IO::alloc_send_buffer(SENDBUF_SIZE); // request buffer from the IO handler
 			int len = sprintf((char*) buf, "A%cREQ%c{\"username\":\"%s\",\"password\":\"%s\"}%c", DS_MESSAGE_PART_SEPERATOR, DS_MESSAGE_PART_SEPERATOR, strUsername.c_str(), strPassword.c_str(), DS_MESSAGE_SEPERATOR);
-			return IO::send(buf, len); // let the IO handler do the send
+			return send_message(buf, len); // let the IO handler do the send
 		}
 		inline int disconnect()
 		{
 			m_bReadyForTransfer = false;
+			m_timers.cancel(m_heartbeatTimer);
+			m_timers.cancel(m_reconnectTimer);	// deliberate disconnect, no reconnects
+			drop_results();
 			return IO::disconnect();
 		}
 	//////////////////////////////////////////////////////////
 	// State Handlers
 	//
 	protected:
-		int on_connected(unique_bufptr spbuf, size_t size)
+		int on_connected(unique_bufptr spbuf, char* msg, size_t size)
 		{
 			return 0;
 		}
-		int on_server_needs_auth(unique_bufptr spbuf, size_t size)
+		int on_server_needs_auth(unique_bufptr spbuf, char* msg, size_t size)
 		{
 			// server is asking for Auth, let us give one
 			return this->send_auth();
 		}
-		int on_login_invalid(unique_bufptr spbuf, size_t size)
+		int on_login_invalid(unique_bufptr spbuf, char* msg, size_t size)
 		{
 			if (++m_nLoginRetryCount <= getMaxRetries())
 				return this->send_auth();
 			return disconnect();
 		}
-		int on_toomany_auth_attempts(unique_bufptr spbuf, size_t size)
+		int on_toomany_auth_attempts(unique_bufptr spbuf, char* msg, size_t size)
 		{
 			disconnect(); // server doesn't like us trying to so many times and closed the connection
 			return 0;
 		}
-		int on_login_successful(unique_bufptr spbuf, size_t size)
+		int on_login_successful(unique_bufptr spbuf, char* msg, size_t size)
 		{
 			m_nLoginRetryCount = 0; // reset the login retry count
 			m_bReadyForTransfer = true;
 			send_rpc_providers(); // (re)send the rpc providers to server
 			return 0;
 		}
-		int on_provider_acknowledged(unique_bufptr spbuf, size_t size)
+		int on_provider_acknowledged(unique_bufptr spbuf, char* msg, size_t size)
 		{
 			return 0;
 		}
-		int on_ready_to_transfer(unique_bufptr spbuf, size_t size)
+		int on_rpc_request_acknowledged(unique_bufptr spbuf, char* msg, size_t size)
+		{
+			return 0;	// P|A|name|uid+: a provider took the call made
+		}
+		// splits the next part of a message (up to the part separator or the end of the message)
+		static inline int take_part(const char*& pBuf, const char* pBufEnd, const char*& pPart)
+		{
+			pPart = pBuf;
+			while (pBuf < pBufEnd && *pBuf != DS_MESSAGE_PART_SEPERATOR && *pBuf != DS_MESSAGE_SEPERATOR) ++pBuf;
+			int len = (int)(pBuf - pPart);
+			if (pBuf < pBufEnd) ++pBuf;	// past the separator
+			return len;
+		}
+		int on_rpc_response(unique_bufptr spbuf, char* msg, size_t size)
 		{
+			// P|RES|name|uid|data+
+			const char* pBuf = msg + 6;
+			const char *name, *uid, *data;
+			take_part(pBuf, msg + size, name);
+			int uidLen = take_part(pBuf, msg + size, uid);
+			int dataLen = take_part(pBuf, msg + size, data);
+			_rpcRequest* pReq = find_rpc_request(uid, uidLen);
+			if (pReq == nullptr) return 0;	// timed out (or cancelled) meanwhile
+			pReq->data = data;
+			pReq->dataLen = dataLen;
+			complete_rpc_request(*pReq, std::forward<unique_bufptr>(spbuf));
 			return 0;
 		}
-		int on_disconnected(unique_bufptr spbuf, size_t size)
+		int on_rpc_error(unique_bufptr spbuf, char* msg, size_t size)
+		{
+			// P|E|error|name|uid+ (NO_RPC_PROVIDER, RESPONSE_TIMEOUT, or the error sent by the provider)
+			const char* pBuf = msg + 4;
+			const char *error, *name, *uid;
+			int errorLen = take_part(pBuf, msg + size, error);
+			take_part(pBuf, msg + size, name);
+			int uidLen = take_part(pBuf, msg + size, uid);
+			_rpcRequest* pReq = find_rpc_request(uid, uidLen);
+			if (pReq == nullptr) return 0;
+			pReq->error = error;
+			pReq->errorLen = errorLen;
+			complete_rpc_request(*pReq, std::forward<unique_bufptr>(spbuf));
+			return 0;
+		}
+		int on_server_ping(unique_bufptr spbuf, char* msg, size_t size)
+		{
+			// reply in-place: C|PI+ -> C|PO+
+			msg[3] = 'O';
+			return send_message(msg, 5, IO::release_send_buffer, spbuf.release()); // the owner will be released after send is done, automatically
+		}
+		int on_ready_to_transfer(unique_bufptr spbuf, char* msg, size_t size)
+		{
+			return 0;
+		}
+		int on_disconnected(unique_bufptr spbuf, char* msg, size_t size)
 		{
 			disconnect();
 			return 0;
 		}
-		int on_unknown(unique_bufptr spbuf, size_t size)
+		int on_unknown(unique_bufptr spbuf, char* msg, size_t size)
 		{
 			// no clue what server is talking about.
-			fprintf(stderr, "\nUnknown Directive: [%.*s]", size, (char*) spbuf.get());
+			DSLOG_ERROR_RATE("Unknown Directive: [%s]", log_string(msg, size));
 			return -1;
 		}
-		int on_rpc_call_received(unique_bufptr spbuf, size_t bufsize)
+		int on_rpc_call_received(unique_bufptr spbuf, char* buf, size_t bufsize)
 		{
-			const char* buf = (const char*) spbuf.get();
+			const char* pBufEnd = buf + bufsize;	// the message is not NUL terminated (it is followed by the rest of the read)
 
 			const char* pBuf = buf + 6; // methodName starts at 6th char
 
 			const char* methodName = pBuf;
 			int nameLen = 0;
-			while (*pBuf && *pBuf++ != DS_MESSAGE_PART_SEPERATOR && ++nameLen < MAX_METHODNAME_LEN);
+			while (pBuf < pBufEnd && *pBuf++ != DS_MESSAGE_PART_SEPERATOR && ++nameLen < MAX_METHODNAME_LEN);
 
-			if (nameLen >= MAX_METHODNAME_LEN || *pBuf == '\0') 
-				return on_unknown(std::forward<unique_bufptr>(spbuf), bufsize);	// malformed RPC call, we do not respond
+			if (nameLen >= MAX_METHODNAME_LEN || pBuf >= pBufEnd) 
+				return on_unknown(std::forward<unique_bufptr>(spbuf), buf, bufsize);	// malformed RPC call, we do not respond
 
 			const char* uid = pBuf;
 			int uidLen = 0;
-			while (*pBuf && *pBuf++ != DS_MESSAGE_PART_SEPERATOR && ++uidLen < MAX_UID_LEN);
-			if (uidLen >= MAX_UID_LEN || *pBuf == '\0')
-				return on_unknown(std::forward<unique_bufptr>(spbuf), bufsize);	// malformed RPC call, we do not respond
+			while (pBuf < pBufEnd && *pBuf++ != DS_MESSAGE_PART_SEPERATOR && ++uidLen < MAX_UID_LEN);
+			if (uidLen >= MAX_UID_LEN || pBuf >= pBufEnd)
+				return on_unknown(std::forward<unique_bufptr>(spbuf), buf, bufsize);	// malformed RPC call, we do not respond
 
 			// reject if provider does not exist
+			auto methodId = m_rpcRouter.findKey(methodName, nameLen);
 			LPFNRPCMethod rpcHandler = m_rpcRouter.at(methodName, nameLen, nullptr);
 			 if (rpcHandler == nullptr)
-				 return send_rpc_unsupported(std::forward<unique_bufptr>(spbuf), (pBuf - 1) - buf); // pBuf is pointing one past the part-separator, hence -1
+				 return send_rpc_unsupported(std::forward<unique_bufptr>(spbuf), buf, (pBuf - 1) - buf); // pBuf is pointing one past the part-separator, hence -1
+
+			// the caller has given up on a call that waited past its deadline behind the other calls of the read. That is
+			// the only wait seen here: the calls that the providers queue are looked at again when run (reject_if_expired())
+			uint64_t nDeadlineUs = m_rpcLimiter.deadline_us(methodId);
+			if (nDeadlineUs > 0 && m_rpcLimiter.count_if_expired(methodId, rpc_clock_us() - m_nReadAtUs))
+				return send_rpc_error("RPC_DEADLINE_EXCEEDED", methodName, nameLen, uid, uidLen);
+
+			// reject as well if the provider is busy: the server passes the call on to another provider, if any
+			if (!m_rpcLimiter.try_acquire(methodId))
+				return send_rpc_unsupported(std::forward<unique_bufptr>(spbuf), buf, (pBuf - 1) - buf);
 
 			const char* params = pBuf;
 			int paramsLen = bufsize - (params - buf);
 
 			// prepare the RPC data-structure
 			unique_ptr<_rpcCall>  sprpcCall(_NEW1(_rpcCall, std::forward<unique_bufptr>(spbuf)));
+			sprpcCall->message = buf;
 			sprpcCall->methodName = methodName;
 			sprpcCall->nameLen = nameLen;
 			sprpcCall->uid = uid;
@@ -270,6 +602,10 @@ namespace DSCPP
 			sprpcCall->params = params;
 			sprpcCall->paramsLen = paramsLen;
 			sprpcCall->bufLen = bufsize;
+			m_rpcLimiter.link(sprpcCall->inFlight, methodId);	// in flight till the provider releases the call
+			sprpcCall->methodId = methodId;
+			sprpcCall->nReceivedUs = m_nReadAtUs;
+			sprpcCall->nDeadlineUs = (nDeadlineUs > 0) ? m_nReadAtUs + nDeadlineUs : 0;
 
 			// tell server that we are processing the rpc
 			send_rpc_call_acknowledgement(*sprpcCall.get());
@@ -293,36 +629,131 @@ namespace DSCPP
 			auto methodId = m_rpcRouter.findKey(szMethodName, len);
 			if (methodId >= 0) return -1; // already registered !!
 			methodId = m_rpcRouter.insertkv(szMethodName, len, handler);
+			m_rpcLimiter.let_go_of_method(methodId);	// the id may have been of another method
+			m_rpcLimiter.set_method_limit(methodId, 0);
+			m_rpcLimiter.set_method_min_limit(methodId, 0);
+			if ((size_t)methodId < m_rpcBatches.size()) m_rpcBatches[methodId].handler = nullptr;
 			if(is_ready_for_transfer())
 				return send_rpc_provider(szMethodName);
 			return 0;
 		}
+		// Registers a handler that gets the calls of the method in batches: the calls wait till nMaxCalls of
+		// them are in, or till the first of them has waited nMaxDelayUs since its read (0: till the read is
+		// done). The due batches are looked at after every read and on every tick of the timers, so a batch
+		// whose calls stop coming waits up to TIMER_RESOLUTION longer. The calls past their deadline are
+		// answered with an error, and left out of the batch.
+		// The handler gets the calls one after the other in an array, and is free to move them out (to answer
+		// later). send_rpc_call_results() answers them all in one write.
+		inline int register_rpc_batch_provider(const char* szMethodName, LPFNRPCBatchMethod handler, size_t nMaxCalls, uint32_t nMaxDelayUs = 0)
+		{
+			if (handler == nullptr || nMaxCalls == 0) return -1;
+			if (register_rpc_provider(szMethodName, &on_batched_call) != 0) return -1;
+			auto methodId = m_rpcRouter.findKey(szMethodName, strlen(szMethodName));
+			if ((size_t)methodId >= m_rpcBatches.size()) m_rpcBatches.resize(methodId + 1);
+			_rpcBatch& batch = m_rpcBatches[methodId];
+			batch.handler = handler;
+			batch.nMaxCalls = nMaxCalls;
+			batch.nMaxDelayUs = nMaxDelayUs;
+			batch.calls.reserve(nMaxCalls);
+			m_rpcLimiter.set_method_min_limit(methodId, (int)nMaxCalls);	// the calls of a batch are all in flight
+			return 0;
+		}
+		// limits the calls in flight (see _rpcLimiter). The calls beyond the limits are rejected right away.
+		inline void set_rpc_limits(const _rpcLimitOptions& options)
+		{
+			m_rpcLimiter.options = options;
+			for (size_t i = 0; i < m_rpcLimiter.methods.size(); ++i) m_rpcLimiter.reset_method((int)i);
+		}
+		// limits the calls in flight of a registered method (0: the limit of the options)
+		inline int set_rpc_method_limit(const char* szMethodName, int nMaxInFlight)
+		{
+			auto methodId = m_rpcRouter.findKey(szMethodName, strlen(szMethodName));
+			if (methodId < 0) return -1;
+			m_rpcLimiter.set_method_limit(methodId, nMaxInFlight);
+			return 0;
+		}
+		// sets the deadline of the calls of a registered method, counted from the read that brought them (0: the deadline of the options)
+		inline int set_rpc_method_deadline(const char* szMethodName, uint32_t nDeadlineMs)
+		{
+			auto methodId = m_rpcRouter.findKey(szMethodName, strlen(szMethodName));
+			if (methodId < 0) return -1;
+			m_rpcLimiter.set_method_deadline(methodId, nDeadlineMs);
+			return 0;
+		}
+		// for the providers that queue the calls: answers a call that is past its deadline with an error
+		// (and counts it), instead of running it. Returns true if it did so (the call is to be dropped).
+		// The batched calls are looked at when their batch is flushed. The other providers that hold on to the
+		// calls should call this before running them: the dispatch sees only the wait behind the calls of the read.
+		inline bool reject_if_expired(const _rpcCall& c)
+		{
+			uint64_t nowUs = rpc_clock_us();
+			if (!c.is_expired(nowUs) || !m_rpcLimiter.count_if_expired(c.methodId, nowUs - c.nReceivedUs)) return false;
+			send_rpc_call_error(c, "RPC_DEADLINE_EXCEEDED");
+			return true;
+		}
+		// Calls the rpc on the other providers: req.cb gets the response (or the error) once, unless the call
+		// is cancelled first. req stays with the caller till then (it is not copied). Returns -1 (and
+		// req.cb is not called) if the call could not be sent.
+		inline int make_rpc_call(_rpcRequest& req, const char* szMethodName, const char* data, int dataLen, uint32_t nTimeoutMs = RPC_RESPONSE_TIMEOUT)
+		{
+			int nameLen = strlen(szMethodName);
+			if (!is_ready_for_transfer() || req.is_pending() || nameLen >= MAX_METHODNAME_LEN) return -1;
+			char* buf = (char*)IO::alloc_send_buffer(nameLen + dataLen + 32); // request buffer from the IO handler (P|REQ|name|uid|S<data>+ and NUL)
+			req.uid = m_nNextRequestUid++;
+			int len = sprintf(buf, "P%cREQ%c%s%c%llx%cS%.*s%c", DS_MESSAGE_PART_SEPERATOR, DS_MESSAGE_PART_SEPERATOR, szMethodName, DS_MESSAGE_PART_SEPERATOR, (unsigned long long)req.uid, DS_MESSAGE_PART_SEPERATOR, dataLen, data, DS_MESSAGE_SEPERATOR);
+			if (send_message(buf, len) < 0) return -1;
+			req.spbuf.reset();
+			req.data = req.error = nullptr;
+			req.dataLen = req.errorLen = 0;
+			req.pPrev = m_requests.pPrev;
+			req.pNext = &m_requests;
+			m_requests.pPrev->pNext = &req;
+			m_requests.pPrev = &req;
+			req.pOwner = this;
+			m_timers.init(req.timeout, on_rpc_request_timeout, &req);
+			m_timers.schedule(req.timeout, nTimeoutMs);
+			return 0;
+		}
+		// forgets the call made (its response, if any, is ignored). req.cb is not called.
+		inline void cancel_rpc_call(_rpcRequest& req)
+		{
+			if (!req.is_pending()) return;
+			m_timers.cancel(req.timeout);
+			req.pPrev->pNext = req.pNext;
+			req.pNext->pPrev = req.pPrev;
+			req.pPrev = req.pNext = nullptr;
+		}
+		inline const _rpcLimiter& rpc_limiter() const
+		{
+			return m_rpcLimiter;
+		}
 		inline int unregister_rpc_provider(const char* szMethodName)
 		{
 			int len = strlen(szMethodName);
 			if (len >= MAX_METHODNAME_LEN) return -1;
-			auto methodId = m_rpcRouter.findKey(szMethodName, len);
-			if (methodId >= 0) // unregister, only if registered
+			auto batchId = m_rpcRouter.findKey(szMethodName, len);
+			if (batchId >= 0 && (size_t)batchId < m_rpcBatches.size() && m_rpcBatches[batchId].handler != nullptr)
 			{
-				_DELETE(m_rpcRouter[methodId]);
-				m_rpcRouter.updateValue(methodId, nullptr);
-				if(is_ready_for_transfer())
-					return send_rpc_unprovide(szMethodName);
+				flush_rpc_batch(m_rpcBatches[batchId]);	// the calls waiting in it are still to be answered
+				m_rpcBatches[batchId].handler = nullptr;
 			}
+			auto methodId = m_rpcRouter.erase(szMethodName, len);
+			if (methodId >= 0 && is_ready_for_transfer()) // send unprovide, only if it was registered
+				return send_rpc_unprovide(szMethodName);
 			return 0;
 		}
 	protected:
 		inline int send_rpc_unprovide(const char* szMethodName)
 		{
-			char* buf = (char*)IO::alloc_send_buffer(SENDBUF_SIZE); // request buffer from the IO handler
+			char* buf = (char*)IO::alloc_send_buffer(strlen(szMethodName) + 8); // request buffer from the IO handler (P|US|name+ and NUL)
 			int len = sprintf(buf, "P%cUS%c%s%c", DS_MESSAGE_PART_SEPERATOR, DS_MESSAGE_PART_SEPERATOR, szMethodName, DS_MESSAGE_SEPERATOR);
-			return IO::send(buf, len);
+			return send_message(buf, len);
 		}
 		inline int send_rpc_provider(const char* szMethodName)
 		{
-			char* buf = (char*)IO::alloc_send_buffer(SENDBUF_SIZE); // request buffer from the IO handler
+			char* buf = (char*)IO::alloc_send_buffer(strlen(szMethodName) + 8); // request buffer from the IO handler (P|S|name+ and NUL)
 			int len = sprintf(buf, "P%cS%c%s%c", DS_MESSAGE_PART_SEPERATOR, DS_MESSAGE_PART_SEPERATOR, szMethodName, DS_MESSAGE_SEPERATOR);
-			return IO::send(buf, len);
+			return send_message(buf, len);
 		}
 		inline int send_rpc_providers()
 		{
@@ -332,16 +763,16 @@ namespace DSCPP
 			{
 				char methodName[MAX_METHODNAME_LEN];
 				iter->key(methodName, MAX_METHODNAME_LEN); // load the iterator key into the name buffer
-				if(iter->value() != nullptr) send_rpc_provider(methodName);	// values with nullptr are probably the unregistered ones
+				if(iter->value() != nullptr) send_rpc_provider(methodName);
 				++iter;
 			}
 			return 0;
 		}
 		inline int send_rpc_call_acknowledgement(const _rpcCall& c)
 		{
-			char* buf = (char*)IO::alloc_send_buffer(SENDBUF_SIZE); // request buffer from the IO handler
+			char* buf = (char*)IO::alloc_send_buffer(c.nameLen + c.uidLen + 8); // request buffer from the IO handler (P|A|name|uid+ and NUL)
 			int len = sprintf(buf, "P%cA%c%.*s%c%.*s%c", DS_MESSAGE_PART_SEPERATOR, DS_MESSAGE_PART_SEPERATOR, c.nameLen, c.methodName, DS_MESSAGE_PART_SEPERATOR, c.uidLen, c.uid, DS_MESSAGE_SEPERATOR);
-			return IO::send(buf, len); // let the IO handler do the send
+			return send_message(buf, len); // let the IO handler do the send
 		}
 		public:
 		inline int send_rpc_call_result(_rpcCall& c, const char* sResult, int nResultLen)
@@ -351,13 +782,14 @@ namespace DSCPP
 			if (c.paramsLen > (nResultLen+1)) // do we have enough space for in-place replacement of request buffer
 			{
 				// do in-place replacement
-				buf = (char*)c.spbuf.release();
+				buf = c.message;
 				buf[4] = 'S'; // convert REQ -> RES
 				char* result = (char*) c.params;
 				*result++ = 'S'; // string type follows
 				memcpy(result, sResult, nResultLen);
 				result[nResultLen] = DS_MESSAGE_SEPERATOR;
 				bufLen = result + nResultLen - buf + 1;
+				return send_message(buf, bufLen, IO::release_send_buffer, c.spbuf.release()); // the read buffer will be released after send
 			}
 			else
 			{
@@ -365,15 +797,238 @@ namespace DSCPP
 				buf = (char*)IO::alloc_send_buffer(allocSize); // request buffer from the IO handler
 				bufLen = sprintf(buf, "P%cRES%c%.*s%c%.*s%cS%.*s%c", DS_MESSAGE_PART_SEPERATOR, DS_MESSAGE_PART_SEPERATOR, c.nameLen, c.methodName, DS_MESSAGE_PART_SEPERATOR, c.uidLen, c.uid, DS_MESSAGE_PART_SEPERATOR, nResultLen, sResult, DS_MESSAGE_SEPERATOR);
 			}
-			return IO::send(buf, bufLen); // buf will be released after send
+			return send_message(buf, bufLen); // buf will be released after send
+		}
+		// sends the result, and tells completion once it is written out (or dropped)
+		inline int send_rpc_call_result(const _rpcCall& c, const char* sResult, int nResultLen, _sendCompletion& completion)
+		{
+			completion.buf = IO::alloc_send_buffer(c.nameLen + c.uidLen + nResultLen + 16); // request buffer from the IO handler
+			completion.len = sprintf((char*)completion.buf, "P%cRES%c%.*s%c%.*s%cS%.*s%c", DS_MESSAGE_PART_SEPERATOR, DS_MESSAGE_PART_SEPERATOR, c.nameLen, c.methodName, DS_MESSAGE_PART_SEPERATOR, c.uidLen, c.uid, DS_MESSAGE_PART_SEPERATOR, nResultLen, sResult, DS_MESSAGE_SEPERATOR);
+			return send_message(completion.buf, completion.len, on_completion_sent, &completion);
+		}
+		// answers the calls (of a batch) in one write: results[i] (of resultLens[i] bytes) for calls[i].
+		// The calls with a nullptr result are left out (to be answered on their own).
+		inline int send_rpc_call_results(const unique_ptr<_rpcCall>* calls, size_t nCalls, const char* const* results, const int* resultLens)
+		{
+			size_t allocSize = 1;
+			for (size_t i = 0; i < nCalls; ++i)
+				if (results[i] != nullptr) allocSize += calls[i].get()->nameLen + calls[i].get()->uidLen + resultLens[i] + 12; // P|RES|name|uid|S<result>+
+			if (allocSize == 1) return 0;
+			char* buf = (char*)IO::alloc_send_buffer(allocSize); // request buffer from the IO handler
+			int bufLen = 0;
+			for (size_t i = 0; i < nCalls; ++i)
+			{
+				if (results[i] == nullptr) continue;
+				const _rpcCall& c = *calls[i].get();
+				bufLen += sprintf(buf + bufLen, "P%cRES%c%.*s%c%.*s%cS%.*s%c", DS_MESSAGE_PART_SEPERATOR, DS_MESSAGE_PART_SEPERATOR, c.nameLen, c.methodName, DS_MESSAGE_PART_SEPERATOR, c.uidLen, c.uid, DS_MESSAGE_PART_SEPERATOR, resultLens[i], results[i], DS_MESSAGE_SEPERATOR);
+			}
+			return send_message(buf, bufLen); // buf will be released after send
+		}
+		// sends an error for the call (P|E|error|name|uid+), instead of a result
+		inline int send_rpc_call_error(const _rpcCall& c, const char* szError)
+		{
+			return send_rpc_error(szError, c.methodName, c.nameLen, c.uid, c.uidLen);
+		}
+		inline int send_rpc_error(const char* szError, const char* methodName, int nameLen, const char* uid, int uidLen)
+		{
+			char* buf = (char*)IO::alloc_send_buffer(strlen(szError) + nameLen + uidLen + 8); // request buffer from the IO handler (P|E|error|name|uid+ and NUL)
+			int len = sprintf(buf, "P%cE%c%s%c%.*s%c%.*s%c", DS_MESSAGE_PART_SEPERATOR, DS_MESSAGE_PART_SEPERATOR, szError, DS_MESSAGE_PART_SEPERATOR, nameLen, methodName, DS_MESSAGE_PART_SEPERATOR, uidLen, uid, DS_MESSAGE_SEPERATOR);
+			return send_message(buf, len);
+		}
+		// Sends the result of the call in pieces, as the producer makes them (see _rpcResultStream), so that a
+		// large result is never in memory at once. The producer writes every piece straight into a send buffer
+		// (RESULT_CHUNK_SIZE), and is pulled only while the IO handler has less than RESULT_HIGH_WATER queued.
+		// The results go out one after the other, and the other messages (pongs included) wait while one is
+		// on the wire: the producers should keep up. The connection is dropped (and the caller gets an error from
+		// the server) when a result goes out only in part: the producer aborts it midway, or the messages wait
+		// longer than RESULT_MAX_HOLD (or more than RESULT_MAX_HELD bytes). The pieces should not have the message
+		// separators in them.
+		inline int send_rpc_call_result_stream(unique_ptr<_rpcCall> spCall, RPC_RESULT_TYPE type, LPFNRPCProducer producer, void* pState = nullptr)
+		{
+			if (type == RPC_SINGLE_RESULT || producer == nullptr) return -1;
+			_rpcResultStream* pStream = _NEW4(_rpcResultStream, std::forward<unique_ptr<_rpcCall>>(spCall), type, producer, pState);
+			if (pStream == nullptr) return -1;
+			m_resultStreams.push_back(pStream);
+			pump_results();
+			return 0;
+		}
+		// the producer that said RPC_RESULT_WAIT has more to send now (to be called on the thread of the loop)
+		inline void resume_rpc_result(_rpcResultStream& stream)
+		{
+			stream.bWaiting = false;
+			pump_results();
 		}
-		inline int send_rpc_unsupported(unique_bufptr spReqbuf, int nPartSepIndex)
+		inline int send_rpc_unsupported(unique_bufptr spReqbuf, char* rejBuf, int nPartSepIndex)
 		{
-			// we do not support the method the server is asking us to execute, lets reject it
-			char* rejBuf = (char*) spReqbuf.release();	// transfer the ownership 
+			// we do not support the method the server is asking us to execute, lets reject it (in place)
 			rejBuf[4] = 'J';					// convert REQ -> REJ
 			rejBuf[nPartSepIndex] = DS_MESSAGE_SEPERATOR;
-			return IO::send(rejBuf, nPartSepIndex + 1); // rejBuf will be deleted after send is done, automatically
+			return send_message(rejBuf, nPartSepIndex + 1, IO::release_send_buffer, spReqbuf.release()); // the owner will be released after send is done, automatically
+		}
+	protected:
+		static void on_completion_sent(void* owner, size_t len)
+		{
+			_sendCompletion& completion = *(_sendCompletion*)owner;
+			IO::release_send_buffer(completion.buf, completion.len);
+			completion.buf = nullptr;
+			(*completion.cb)(completion);
+		}
+		// the pending calls are few (in flight at once): a walk down the list finds the one answered
+		inline _rpcRequest* find_rpc_request(const char* uid, int uidLen)
+		{
+			uint64_t nUid = 0;
+			for (int i = 0; i < uidLen; ++i)
+			{
+				char ch = uid[i];
+				int nDigit = (ch >= '0' && ch <= '9') ? ch - '0' : (ch >= 'a' && ch <= 'f') ? ch - 'a' + 10 : -1;
+				if (nDigit < 0 || i >= 16) return nullptr;	// not one of ours
+				nUid = (nUid << 4) | nDigit;
+			}
+			for (_rpcRequest* pReq = m_requests.pNext; pReq != &m_requests; pReq = pReq->pNext)
+				if (pReq->uid == nUid) return pReq;
+			return nullptr;
+		}
+		inline void complete_rpc_request(_rpcRequest& req, unique_bufptr spbuf)
+		{
+			cancel_rpc_call(req);
+			req.spbuf = std::move(spbuf);
+			(*req.cb)(req);
+		}
+		inline void fail_rpc_request(_rpcRequest& req, const char* szError)
+		{
+			req.error = szError;
+			req.errorLen = strlen(szError);
+			complete_rpc_request(req, unique_bufptr());
+		}
+		static void on_rpc_request_timeout(timer_wheel::entry* pTimer)
+		{
+			_rpcRequest& req = *(_rpcRequest*)pTimer->data;
+			((_MyType*)req.pOwner)->fail_rpc_request(req, "RESPONSE_TIMEOUT");
+		}
+		// the handler of the batched methods in m_rpcRouter: queues the call in the batch of its method
+		static int on_batched_call(unique_ptr<_rpcCall> spCall, _MyType* pThis)
+		{
+			_rpcBatch& batch = pThis->m_rpcBatches[spCall->methodId];
+			if (batch.calls.empty()) batch.nOpenedUs = spCall->nReceivedUs;
+			batch.calls.push_back(std::forward<unique_ptr<_rpcCall>>(spCall));
+			pThis->m_nBatchedCalls++;
+			if (batch.calls.size() >= batch.nMaxCalls) pThis->flush_rpc_batch(batch);
+			return 0;
+		}
+		// hands the batches that waited long enough over to their handlers
+		inline void flush_rpc_batches()
+		{
+			uint64_t nowUs = rpc_clock_us();
+			for (size_t i = 0; i < m_rpcBatches.size(); ++i)	// (a handler may register another method)
+				if (!m_rpcBatches[i].calls.empty() && nowUs - m_rpcBatches[i].nOpenedUs >= m_rpcBatches[i].nMaxDelayUs)
+					flush_rpc_batch(m_rpcBatches[i]);
+		}
+		inline void flush_rpc_batch(_rpcBatch& batch)
+		{
+			std::vector<unique_ptr<_rpcCall>> calls;	// the handler may get more calls in (and flush again) meanwhile
+			calls.reserve(batch.nMaxCalls);
+			calls.swap(batch.calls);
+			m_nBatchedCalls -= calls.size();
+			size_t nCalls = 0;
+			for (size_t i = 0; i < calls.size(); ++i)	// the expired calls are answered, and left out
+				if (!reject_if_expired(*calls[i].get()) && nCalls++ != i)
+					calls[nCalls - 1] = std::move(calls[i]);
+			if (nCalls > 0) (*batch.handler)(calls.data(), nCalls, this);
+		}
+		// pulls the pieces of the front result while the write queue has room, and moves on to the next result once it ends
+		inline void pump_results()
+		{
+			if (m_bPumping) return;	// a producer resumed a result: the loop below takes care of it
+			m_bPumping = true;
+			size_t nPumped = 0;
+			while (!m_resultStreams.empty() && !m_resultStreams.front()->bWaiting)
+			{
+				// the socket may take everything right away: the reads get their turn after every RESULT_HIGH_WATER bytes
+				if (IO::queued_bytes() >= RESULT_HIGH_WATER || nPumped >= RESULT_HIGH_WATER)
+				{
+					IO::notify_writable(RESULT_LOW_WATER);	// on_writable() pulls the rest
+					break;
+				}
+				_rpcResultStream& stream = *m_resultStreams.front();
+				const _rpcCall& c = *stream.spCall.get();
+				char* buf = (char*)IO::alloc_send_buffer(RESULT_CHUNK_SIZE); // request buffer from the IO handler
+				int nHeaderLen = 0;
+				if (!stream.bStarted)	// P|RES|name|uid|S goes ahead of the first piece
+					nHeaderLen = sprintf(buf, "P%cRES%c%.*s%c%.*s%cS", DS_MESSAGE_PART_SEPERATOR, DS_MESSAGE_PART_SEPERATOR, c.nameLen, c.methodName, DS_MESSAGE_PART_SEPERATOR, c.uidLen, c.uid, DS_MESSAGE_PART_SEPERATOR);
+				int n = (*stream.producer)(stream, buf + nHeaderLen, RESULT_CHUNK_SIZE - nHeaderLen);
+				if (m_resultStreams.empty() || m_resultStreams.front() != &stream)	// dropped from within (the producer disconnected)
+				{
+					IO::release_send_buffer(buf, RESULT_CHUNK_SIZE);
+					break;
+				}
+				if (n <= 0)
+				{
+					IO::release_send_buffer(buf, RESULT_CHUNK_SIZE);
+					if (n == RPC_RESULT_WAIT && stream.type == RPC_PROGRESSIVE_RESULT)
+						stream.bWaiting = true;
+					else
+						end_result(n == RPC_RESULT_END);
+					continue;
+				}
+				assert(n <= RESULT_CHUNK_SIZE - nHeaderLen);
+				bool bFirst = !stream.bStarted;
+				stream.bStarted = true;
+				stream.nBytes += n;
+				nPumped += nHeaderLen + n;
+				if (IO::send_piece(buf, nHeaderLen + n, bFirst, false) < 0)
+					drop_results();	// the connection is gone
+			}
+			m_bPumping = false;
+		}
+		// the front result is complete (or aborted): ends its message, and lets the held messages go
+		inline void end_result(bool bComplete)
+		{
+			_rpcResultStream* pStream = m_resultStreams.front();
+			m_resultStreams.pop_front();
+			const _rpcCall& c = *pStream->spCall.get();
+			if (pStream->bStarted && !bComplete)	// the separator would pass the pieces sent for the whole result
+			{
+				_DELETE(pStream);
+				DSLOG_WARN("RPC result aborted midway, reconnecting");
+				IO::disconnect();
+				on_connection_lost();
+				return;
+			}
+			if (pStream->bStarted)
+			{
+				char* buf = (char*)IO::alloc_send_buffer(1);
+				*buf = DS_MESSAGE_SEPERATOR;
+				IO::send_piece(buf, 1, false, true);
+			}
+			else if (bComplete)	// empty result
+				send_rpc_call_result(*pStream->spCall.get(), "", 0);
+			else
+				send_rpc_call_error(c, "RPC_RESULT_ABORTED");
+			_DELETE(pStream);
+			std::vector<_heldSend> held;
+			held.swap(m_heldSends);
+			m_nHeldBytes = 0;
+			m_timers.cancel(m_holdTimer);
+			for (const _heldSend& h : held) IO::send(h.buf, h.len, h.cb, h.owner);
+		}
+		// the results cannot be sent (connection lost): the producers let go of their state, and the held messages are released
+		inline void drop_results()
+		{
+			while (!m_resultStreams.empty())
+			{
+				_rpcResultStream* pStream = m_resultStreams.front();
+				m_resultStreams.pop_front();
+				(*pStream->producer)(*pStream, nullptr, 0);
+				_DELETE(pStream);
+			}
+			for (const _heldSend& h : m_heldSends) (*h.cb)(h.owner != nullptr ? h.owner : h.buf, h.len);
+			m_heldSends.clear();
+			m_nHeldBytes = 0;
+			m_timers.cancel(m_holdTimer);
+			for (_rpcBatch& batch : m_rpcBatches) batch.calls.clear();	// the calls went with the connection
+			m_nBatchedCalls = 0;
+			while (m_requests.pNext != &m_requests)	// as did the calls made (their callbacks may make new ones)
+				fail_rpc_request(*m_requests.pNext, "CONNECTION_LOST");
 		}
 	};
 	typedef _dsclientBase<> DSClientBase;
@@ -7,6 +7,8 @@
 
 #include "bufPool.h"
 #include "trie_array.h"
+#include "rpcLimiter.h"
+#include "timer_wheel.h"
 
 namespace DSCPP
 {
@@ -20,13 +22,87 @@ namespace DSCPP
 		const char*		params;		// points to the start of parameters in the buf
 		int				paramsLen;
 		unique_bufptr	spbuf;		// the buffer received from server read (should not be modified in the RPC method)
-		size_t			bufLen;
-		inline _rpcCall(unique_bufptr&& buf): spbuf(std::forward<unique_bufptr>(buf)) { }
+		char*			message;	// start of the call message in the spbuf (a read can carry several messages)
+		size_t			bufLen;		// length of the message
+		_rpcInFlight	inFlight;	// counts the call out of the limiter when it is done (released)
+		int				methodId;
+		uint64_t		nReceivedUs;	// when the read that brought the call came in (rpc_clock_us())
+		uint64_t		nDeadlineUs;	// when the caller gives up on it (rpc_clock_us(), 0: never)
+		inline _rpcCall(unique_bufptr&& buf): spbuf(std::forward<unique_bufptr>(buf)), message(nullptr), methodId(-1), nReceivedUs(0), nDeadlineUs(0) { }
+		inline ~_rpcCall()
+		{
+			if (inFlight.pLimiter != nullptr) inFlight.pLimiter->release(inFlight, rpc_clock_us() - nReceivedUs);
+		}
+		inline bool is_expired(uint64_t nowUs = rpc_clock_us()) const
+		{
+			return nDeadlineUs != 0 && nowUs > nDeadlineUs;
+		}
 	};
 
 
 	enum RPC_RESULT_TYPE : short { RPC_SINGLE_RESULT = 0, RPC_PROGRESSIVE_RESULT, RPC_STREAMED_RESULT };
 
+	struct _rpcResultStream;
+	// Producer of a result that is sent in pieces (see _dsclientBase::send_rpc_call_result_stream()).
+	// Writes the next piece into buf (at most len bytes) and returns its length, or one of RPC_PRODUCER_RESULT.
+	// Gets called with a nullptr buf when the result is dropped (connection lost), to let go of stream.pState.
+	typedef int(*LPFNRPCProducer)(_rpcResultStream& stream, char* buf, size_t len);
+	enum RPC_PRODUCER_RESULT
+	{
+		RPC_RESULT_END = 0,		// the result is complete
+		RPC_RESULT_ABORT = -1,	// gives up: the caller gets an error (the connection is dropped, if pieces went out already)
+		RPC_RESULT_WAIT = -2	// nothing to send yet (RPC_PROGRESSIVE_RESULT only): see _dsclientBase::resume_rpc_result()
+	};
+
+	// A result that goes out in pieces, as they are made. Deepstream has no partial results, so on the
+	// wire it is still one RES message, whose pieces are written as the producer makes them.
+	//	RPC_STREAMED_RESULT: the data is at hand (a file, a cursor): the producer is pulled as fast as the socket drains.
+	//	RPC_PROGRESSIVE_RESULT: the data is computed as it goes: the producer may also wait (RPC_RESULT_WAIT).
+	struct _rpcResultStream
+	{
+		unique_ptr<_rpcCall>	spCall;		// the method name and uid of the result point into its buffer
+		RPC_RESULT_TYPE			type;
+		LPFNRPCProducer			producer;
+		void*					pState;		// for the producer
+		uint64_t				nBytes;		// of the result, sent so far
+		bool					bStarted;	// the header of the message is out: the other messages wait till it ends
+		bool					bWaiting;	// the producer said RPC_RESULT_WAIT
+		inline _rpcResultStream(unique_ptr<_rpcCall>&& call, RPC_RESULT_TYPE argType, LPFNRPCProducer argProducer, void* argState) :
+			spCall(std::forward<unique_ptr<_rpcCall>>(call)), type(argType), producer(argProducer), pState(argState), nBytes(0), bStarted(false), bWaiting(false) { }
+	};
+
+	// An rpc call made to the other providers (see _dsclientBase::make_rpc_call()). The caller keeps it
+	// alive till cb is called (once, with the response or the error in), or till it is cancelled.
+	struct _rpcRequest
+	{
+		typedef unique_ptr<void> unique_bufptr;
+		typedef void(*LPFNRPCResponse)(_rpcRequest& req);
+		LPFNRPCResponse		cb = nullptr;
+		void*				pState = nullptr;	// for the cb
+		unique_bufptr		spbuf;				// the buffer that data and error point into (if from the server)
+		const char*			data = nullptr;		// the result, with its type first ('S' for a string)
+		int					dataLen = 0;
+		const char*			error = nullptr;	// or the error (RESPONSE_TIMEOUT, CONNECTION_LOST, or from the server)
+		int					errorLen = 0;
+		uint64_t			uid = 0;
+		void*				pOwner = nullptr;	// the client that made the call
+		_rpcRequest*		pPrev = nullptr;	// links in the pending requests (nullptr when not pending)
+		_rpcRequest*		pNext = nullptr;
+		timer_wheel::entry	timeout;
+		inline bool is_pending() const { return pPrev != nullptr; }
+	};
+
+	// Told once a message is written out, or dropped (see _dsclientBase::send_rpc_call_result()). The
+	// caller keeps it alive till then.
+	struct _sendCompletion
+	{
+		typedef void(*LPFN_SENT)(_sendCompletion&);
+		LPFN_SENT	cb = nullptr;
+		void*		pState = nullptr;	// for the cb
+		void*		buf = nullptr;		// the send buffer (released before cb is called)
+		size_t		len = 0;
+	};
+
 	struct _rpcResult
 	{
 		void* buf;
@@ -0,0 +1,201 @@
+/*
+	Copyright (c) 2016 Cenacle Research India Private Limited
+*/
+
+#ifndef _RPCCOROUTINE_H__Guid__6A1F3E92_C4B7_4D58_9F20_E8B15D7C3A46___
+#define _RPCCOROUTINE_H__Guid__6A1F3E92_C4B7_4D58_9F20_E8B15D7C3A46___
+
+#include "rpc.h"
+
+// C++20 coroutines over the callbacks of _dsclientBase: a provider (or any code on the loop) can make
+// rpc calls, wait for its results to be written out, and wait on the timers without blocking the loop.
+/*	Usage:
+		rpc_task lookup(unique_ptr<_rpcCall> spCall, TClient::TBase* pClient)
+		{
+			_rpcResponse r = co_await rpc_call(*pClient, "db/get", spCall->params + 1, spCall->paramsLen - 2);
+			if (!r) { pClient->send_rpc_call_error(*spCall.get(), "LOOKUP_FAILED"); co_return; }
+			co_await delay(pClient->timers(), 100);
+			co_await rpc_result_sent(*pClient, *spCall.get(), r.data + 1, r.dataLen - 1);	// without the type
+		}
+		client.register_rpc_provider("lookup", [](unique_ptr<_rpcCall> spCall, TClient::TBase* pClient) {
+			lookup(std::move(spCall), pClient);		// runs till the first wait, and returns
+			return 0;
+		});
+
+	Notes:
+		+ The frames come from the pool (POOLED_ALLOC), and the awaitables (with the _rpcRequest, the
+		  _sendCompletion or the timer in them) live in the frames: waiting does not allocate.
+		+ The coroutines resume from the callbacks of the client, so on the thread of its loop. A frame
+		  that could not be allocated does not run at all (and the call it was given is not answered).
+		+ The calls made fail with CONNECTION_LOST when the connection goes (the client resumes them).
+		  A coroutine that waits on a timer when the client goes is never resumed.
+		+ Compiled only with coroutine support (C++20): empty otherwise.
+*/
+#if defined(__cpp_impl_coroutine) && (__cpp_impl_coroutine >= 201902L)
+#include <coroutine>
+#include <exception>
+
+namespace DSCPP
+{
+	// the return type of the coroutines: starts right away, and frees its frame when done (nothing waits on it)
+	struct rpc_task
+	{
+		struct promise_type
+		{
+			// the pooled chunks are aligned to the cache line at least (see bufPoolChunk)
+			static void* operator new(size_t size) noexcept
+			{
+				return POOLED_ALLOC((int)size);
+			}
+			static void operator delete(void* p) noexcept
+			{
+				POOLED_FREE(p);
+			}
+			static rpc_task get_return_object_on_allocation_failure() noexcept { return rpc_task(); }
+			rpc_task get_return_object() noexcept { return rpc_task(); }
+			std::suspend_never initial_suspend() noexcept { return {}; }
+			std::suspend_never final_suspend() noexcept { return {}; }
+			void return_void() noexcept { }
+			void unhandled_exception() noexcept { std::terminate(); }
+		};
+	};
+
+	// the response of an rpc call made (see rpc_call()): false if it failed
+	struct _rpcResponse
+	{
+		unique_ptr<void>	spbuf;		// owns what data and error point into
+		const char*			data;		// the result, with its type first ('S' for a string)
+		int					dataLen;
+		const char*			error;		// or the error
+		int					errorLen;
+		explicit inline operator bool() const { return error == nullptr; }
+	};
+
+	// Waits on a callback that may also come before the coroutine is suspended (within the call that
+	// starts the operation): it then goes on without suspending.
+	struct _callbackAwaiter
+	{
+		std::coroutine_handle<>	handle;
+		bool					bStarting = false;	// the operation is being started (in await_suspend())
+		bool					bDone = false;
+		inline bool await_ready() const noexcept { return false; }
+		inline void done()
+		{
+			bDone = true;
+			if (!bStarting) handle.resume();
+		}
+	};
+
+	template<typename TClient>
+	struct _rpcCallAwaiter : public _callbackAwaiter
+	{
+		TClient&		client;
+		const char*		szMethodName;
+		const char*		data;
+		int				dataLen;
+		uint32_t		nTimeoutMs;
+		_rpcRequest		req;
+		inline _rpcCallAwaiter(TClient& argClient, const char* argMethodName, const char* argData, int argDataLen, uint32_t argTimeoutMs) :
+			client(argClient), szMethodName(argMethodName), data(argData), dataLen(argDataLen), nTimeoutMs(argTimeoutMs) { }
+		inline ~_rpcCallAwaiter()
+		{
+			client.cancel_rpc_call(req);	// the frame went while waiting
+		}
+		inline bool await_suspend(std::coroutine_handle<> h)
+		{
+			handle = h;
+			req.cb = on_response;
+			req.pState = this;
+			bStarting = true;
+			if (client.make_rpc_call(req, szMethodName, data, dataLen, nTimeoutMs) < 0)
+			{
+				req.error = "NOT_SENT";
+				req.errorLen = 8;
+				bDone = true;
+			}
+			bStarting = false;
+			return !bDone;
+		}
+		inline _rpcResponse await_resume()
+		{
+			return _rpcResponse{ std::move(req.spbuf), req.data, req.dataLen, req.error, req.errorLen };
+		}
+		static void on_response(_rpcRequest& req)
+		{
+			((_rpcCallAwaiter*)req.pState)->done();
+		}
+	};
+	// calls the rpc on the other providers (see _dsclientBase::make_rpc_call()), and resumes with its response
+	template<typename TClient>
+	inline _rpcCallAwaiter<TClient> rpc_call(TClient& client, const char* szMethodName, const char* data, int dataLen, uint32_t nTimeoutMs = TClient::RPC_RESPONSE_TIMEOUT)
+	{
+		return _rpcCallAwaiter<TClient>(client, szMethodName, data, dataLen, nTimeoutMs);
+	}
+
+	template<typename TClient>
+	struct _resultSentAwaiter : public _callbackAwaiter
+	{
+		TClient&			client;
+		const _rpcCall&		call;
+		const char*			sResult;
+		int					nResultLen;
+		_sendCompletion		completion;
+		inline _resultSentAwaiter(TClient& argClient, const _rpcCall& argCall, const char* argResult, int argResultLen) :
+			client(argClient), call(argCall), sResult(argResult), nResultLen(argResultLen) { }
+		inline bool await_suspend(std::coroutine_handle<> h)
+		{
+			handle = h;
+			completion.cb = on_sent;
+			completion.pState = this;
+			bStarting = true;
+			client.send_rpc_call_result(call, sResult, nResultLen, completion);	// completes even if it fails
+			bStarting = false;
+			return !bDone;
+		}
+		inline void await_resume() const noexcept { }
+		static void on_sent(_sendCompletion& completion)
+		{
+			((_resultSentAwaiter*)completion.pState)->done();
+		}
+	};
+	// sends the result of the call, and resumes once it is written out (or dropped)
+	template<typename TClient>
+	inline _resultSentAwaiter<TClient> rpc_result_sent(TClient& client, const _rpcCall& call, const char* sResult, int nResultLen)
+	{
+		return _resultSentAwaiter<TClient>(client, call, sResult, nResultLen);
+	}
+
+	struct _delayAwaiter
+	{
+		timer_wheel&			timers;
+		uint64_t				nDelayMs;
+		timer_wheel::entry		timer;
+		std::coroutine_handle<>	handle;
+		inline _delayAwaiter(timer_wheel& argTimers, uint64_t argDelayMs) : timers(argTimers), nDelayMs(argDelayMs) { }
+		inline ~_delayAwaiter()
+		{
+			timers.cancel(timer);
+		}
+		inline bool await_ready() const noexcept { return nDelayMs == 0; }
+		inline void await_suspend(std::coroutine_handle<> h)
+		{
+			handle = h;
+			timers.init(timer, on_due, this);
+			timers.schedule(timer, nDelayMs);
+		}
+		inline void await_resume() const noexcept { }
+		static void on_due(timer_wheel::entry* pTimer)
+		{
+			((_delayAwaiter*)pTimer->data)->handle.resume();
+		}
+	};
+	// resumes after the delay, at the resolution of the timers (the client's timers())
+	inline _delayAwaiter delay(timer_wheel& timers, uint64_t nDelayMs)
+	{
+		return _delayAwaiter(timers, nDelayMs);
+	}
+} // namespace DSCPP
+
+#endif // __cpp_impl_coroutine
+
+#endif // _RPCCOROUTINE_H__Guid__6A1F3E92_C4B7_4D58_9F20_E8B15D7C3A46___
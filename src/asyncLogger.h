@@ -0,0 +1,476 @@
+/*
+	Copyright (c) 2016 Cenacle Research India Private Limited
+*/
+
+#ifndef _ASYNCLOGGER_H__Guid__E4B1C7D2_5A93_4F0E_B8D6_2C71A09F53E8___
+#define _ASYNCLOGGER_H__Guid__E4B1C7D2_5A93_4F0E_B8D6_2C71A09F53E8___
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include <algorithm>
+#include "singleton.h"
+
+// asyncLogger: logging off the hot paths. A log statement only copies its arguments (binary, each with
+// a type tag) into the ring of its thread; a background thread formats them (printf style) and writes
+// them out. Nothing blocks the caller: a record that finds its ring full is dropped (and counted).
+/*	Usage:
+		DSLOG_WARN("No heartbeat from %s:%d, reconnecting", szServer, nPort);
+		DSLOG_ERROR("Unknown Directive: [%s]", DSCPP::log_string(msg, size));	// not NUL terminated
+		DSLOG_ERROR_RATE("Rejected the call %s", szUid);	// at most LOG_RATE_BURST a second from here, the rest counted
+		...
+		DSCPP::asyncLogger::getObject().flush();			// before exit, to see the last records
+
+	Notes:
+		+ DSCPP_LOG_LEVEL (DSLOG_LEVEL_INFO if not defined) takes the statements below it out of the
+		  build. set_level() filters further at run time.
+		+ The format strings must be literals: only their address is recorded. The strings in the
+		  arguments are copied (up to LOG_MAX_STRING_LEN); the numbers and pointers go as they are.
+		+ The conversions are those of printf. The length modifiers (l, ll, z...) are not needed (the
+		  types of the arguments are recorded), but are accepted.
+		+ Every thread gets its ring (LOG_RING_SIZE) with its first record. The ring outlives the thread
+		  till its records are written out.
+*/
+
+#define DSLOG_LEVEL_DEBUG	0
+#define DSLOG_LEVEL_INFO	1
+#define DSLOG_LEVEL_WARN	2
+#define DSLOG_LEVEL_ERROR	3
+#define DSLOG_LEVEL_NONE	4
+
+#ifndef DSCPP_LOG_LEVEL
+#define DSCPP_LOG_LEVEL		DSLOG_LEVEL_INFO
+#endif
+
+#define DSLOG_AT(level, ...)		do { if ((level) >= DSCPP_LOG_LEVEL) DSCPP::asyncLogger::getObject().log((level), 0, __VA_ARGS__); } while (0)
+#define DSLOG_AT_RATE(level, ...)	do { if ((level) >= DSCPP_LOG_LEVEL) { static DSCPP::_logRateLimit _rate; uint32_t _nSuppressed; \
+										if (_rate.allow(_nSuppressed)) DSCPP::asyncLogger::getObject().log((level), _nSuppressed, __VA_ARGS__); } } while (0)
+
+#define DSLOG_DEBUG(...)		DSLOG_AT(DSLOG_LEVEL_DEBUG, __VA_ARGS__)
+#define DSLOG_INFO(...)			DSLOG_AT(DSLOG_LEVEL_INFO, __VA_ARGS__)
+#define DSLOG_WARN(...)			DSLOG_AT(DSLOG_LEVEL_WARN, __VA_ARGS__)
+#define DSLOG_ERROR(...)		DSLOG_AT(DSLOG_LEVEL_ERROR, __VA_ARGS__)
+#define DSLOG_WARN_RATE(...)	DSLOG_AT_RATE(DSLOG_LEVEL_WARN, __VA_ARGS__)
+#define DSLOG_ERROR_RATE(...)	DSLOG_AT_RATE(DSLOG_LEVEL_ERROR, __VA_ARGS__)
+
+namespace DSCPP
+{
+	enum { LOG_RING_SIZE = 64 * 1024, LOG_MAX_STRING_LEN = 256, LOG_RATE_BURST = 10, LOG_LINE_SIZE = 2048 };
+
+	// a string that is not NUL terminated (a part of a message, say), for the %s of a log statement
+	struct _logString
+	{
+		const char*	p;
+		size_t		len;
+	};
+	inline _logString log_string(const char* p, size_t len)
+	{
+		_logString s = { p, len };
+		return s;
+	}
+
+	// lets a log statement through at most LOG_RATE_BURST times a second, and counts the rest
+	struct _logRateLimit
+	{
+		std::atomic<uint64_t>	nSecond;
+		std::atomic<uint32_t>	nCount;
+		std::atomic<uint32_t>	nSuppressed;
+		inline _logRateLimit() : nSecond(0), nCount(0), nSuppressed(0) { }
+		// nSuppressedSince: the records held back since the last one let through
+		inline bool allow(uint32_t& nSuppressedSince)
+		{
+			uint64_t now = (uint64_t)std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+			uint64_t nLast = nSecond.load(std::memory_order_relaxed);
+			if (nLast != now && nSecond.compare_exchange_strong(nLast, now)) nCount.store(0, std::memory_order_relaxed);
+			if (nCount.fetch_add(1, std::memory_order_relaxed) >= LOG_RATE_BURST)
+			{
+				nSuppressed.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			}
+			nSuppressedSince = nSuppressed.exchange(0, std::memory_order_relaxed);
+			return true;
+		}
+	};
+
+	// the header of a record in a ring, followed by its arguments (a tag char and the value each)
+	struct _logRecord
+	{
+		enum { PADDING = 0xFF };	// the level of the filler at the end of the ring
+		uint32_t	size;			// of the record with its arguments, a multiple of 8
+		uint8_t		level;
+		uint8_t		nArgs;
+		uint32_t	nSuppressed;	// records held back by the rate limit before this one
+		uint64_t	timeUs;			// since the epoch
+		const char*	fmt;
+	};
+
+	// the ring of a thread: one writer (the thread), one reader (the background thread)
+	struct _logRing
+	{
+		char					buf[LOG_RING_SIZE];
+		std::atomic<uint64_t>	head;		// written up to (by the thread)
+		std::atomic<uint64_t>	tail;		// read up to (by the background thread)
+		std::atomic<bool>		bOrphaned;	// the thread is gone: freed once empty
+		std::atomic<uint64_t>	nDropped;
+		inline _logRing() : head(0), tail(0), bOrphaned(false), nDropped(0) { }
+
+		// room for a record of the size (a multiple of 8), or nullptr if the ring is full
+		inline char* reserve(uint32_t size)
+		{
+			uint64_t nHead = head.load(std::memory_order_relaxed);
+			size_t nPos = (size_t)(nHead % LOG_RING_SIZE);
+			size_t nFiller = (nPos + size > LOG_RING_SIZE) ? LOG_RING_SIZE - nPos : 0;	// records do not wrap around
+			if (nHead + nFiller + size - tail.load(std::memory_order_acquire) > LOG_RING_SIZE) return nullptr;
+			if (nFiller > 0)
+			{
+				_logRecord* pFiller = (_logRecord*)(buf + nPos);	// (nFiller >= 8: room for size and level)
+				pFiller->size = (uint32_t)nFiller;
+				pFiller->level = _logRecord::PADDING;
+				head.store(nHead + nFiller, std::memory_order_release);
+				nPos = 0;
+			}
+			return buf + nPos;
+		}
+		inline void commit(uint32_t size)
+		{
+			head.store(head.load(std::memory_order_relaxed) + size, std::memory_order_release);
+		}
+	};
+
+	namespace _logArgs
+	{
+		inline size_t string_len(const char* s) { return (s == nullptr) ? 6 : strnlen(s, LOG_MAX_STRING_LEN); }
+		inline size_t size_of(const char* s) { return 1 + sizeof(uint32_t) + string_len(s); }
+		inline size_t size_of(char* s) { return size_of((const char*)s); }
+		inline size_t size_of(const _logString& s) { return 1 + sizeof(uint32_t) + std::min(s.len, (size_t)LOG_MAX_STRING_LEN); }
+		template<typename T> inline size_t size_of(const T&) { return 1 + 8; }
+
+		inline char* put_string(char* p, const char* s, size_t len)
+		{
+			uint32_t n = (uint32_t)len;
+			*p++ = 's';
+			memcpy(p, &n, sizeof(n));
+			memcpy(p + sizeof(n), s, len);
+			return p + sizeof(n) + len;
+		}
+		inline char* put(char* p, const char* s) { return (s == nullptr) ? put_string(p, "(null)", 6) : put_string(p, s, string_len(s)); }
+		inline char* put(char* p, char* s) { return put(p, (const char*)s); }
+		inline char* put(char* p, const _logString& s) { return put_string(p, s.p, std::min(s.len, (size_t)LOG_MAX_STRING_LEN)); }
+		template<typename T> inline char* put(char* p, T* v)
+		{
+			uint64_t u = (uint64_t)(uintptr_t)v;
+			*p++ = 'p';
+			memcpy(p, &u, 8);
+			return p + 8;
+		}
+		template<typename T> inline typename std::enable_if<std::is_floating_point<T>::value, char*>::type put(char* p, const T& v)
+		{
+			double d = (double)v;
+			*p++ = 'f';
+			memcpy(p, &d, 8);
+			return p + 8;
+		}
+		template<typename T> inline typename std::enable_if<!std::is_floating_point<T>::value && !std::is_pointer<T>::value && !std::is_array<T>::value, char*>::type put(char* p, const T& v)
+		{
+			static_assert(std::is_integral<T>::value || std::is_enum<T>::value, "log arguments are numbers, pointers or strings");
+			if (std::is_signed<T>::value) { int64_t i = (int64_t)v; *p++ = 'i'; memcpy(p, &i, 8); }
+			else { uint64_t u = (uint64_t)v; *p++ = 'u'; memcpy(p, &u, 8); }
+			return p + 8;
+		}
+
+		inline size_t total_size() { return 0; }
+		template<typename T, typename... Args> inline size_t total_size(const T& v, const Args&... args) { return size_of(v) + total_size(args...); }
+		inline char* put_all(char* p) { return p; }
+		template<typename T, typename... Args> inline char* put_all(char* p, const T& v, const Args&... args) { return put_all(put(p, v), args...); }
+	} // namespace _logArgs
+
+	class asyncLogger : public _singleton<asyncLogger>
+	{
+		std::mutex				m_lock;			// guards m_rings and the start of the thread
+		std::condition_variable	m_wakeup;
+		std::condition_variable	m_drained;		// a pass over the rings is written out
+		uint64_t				m_nPasses;
+		std::vector<_logRing*>	m_rings;
+		std::thread				m_thread;
+		std::atomic<bool>		m_bStop;
+		std::atomic<int>		m_nLevel;
+		std::atomic<uint64_t>	m_nDropped;		// of the rings freed
+		std::atomic<FILE*>		m_pOut;
+		std::vector<char>		m_out;			// the lines formatted, not yet written (background thread only)
+
+		struct _ringHolder
+		{
+			_logRing*	pRing = nullptr;
+			bool		bGone = false;	// the thread is exiting: its ring is left to the background thread (to free)
+			inline ~_ringHolder()
+			{
+				if (pRing != nullptr) pRing->bOrphaned.store(true, std::memory_order_release);
+				pRing = nullptr;	// (the thread_local destructors that run later may still log)
+				bGone = true;
+			}
+		};
+	public:
+		inline asyncLogger() : m_nPasses(0), m_bStop(false), m_nLevel(DSLOG_LEVEL_DEBUG), m_nDropped(0), m_pOut(stderr)
+		{	}
+		inline ~asyncLogger()
+		{
+			{
+				std::lock_guard<std::mutex> guard(m_lock);
+				m_bStop = true;
+			}
+			m_wakeup.notify_one();
+			if (m_thread.joinable()) m_thread.join();
+			drain();	// what came in after the thread stopped
+			for (_logRing* pRing : m_rings) delete pRing;
+		}
+		inline void set_output(FILE* pOut)
+		{
+			flush();
+			m_pOut = pOut;
+		}
+		// the records below the level are dropped at run time (the build may have dropped more, see DSCPP_LOG_LEVEL)
+		inline void set_level(int nLevel)
+		{
+			m_nLevel = nLevel;
+		}
+		// the records dropped as their rings were full
+		inline uint64_t dropped()
+		{
+			std::lock_guard<std::mutex> guard(m_lock);
+			uint64_t n = m_nDropped;
+			for (_logRing* pRing : m_rings) n += pRing->nDropped;
+			return n;
+		}
+		// waits till the records logged so far are written out
+		inline void flush()
+		{
+			std::unique_lock<std::mutex> guard(m_lock);
+			if (!m_thread.joinable() || m_bStop) return;
+			uint64_t nPass = m_nPasses + 2;		// the one under way may have missed the latest records
+			m_wakeup.notify_one();
+			m_drained.wait(guard, [&] { return m_nPasses >= nPass || m_bStop; });
+		}
+
+		template<typename... Args>
+		inline void log(int nLevel, uint32_t nSuppressed, const char* fmt, const Args&... args)
+		{
+			if (nLevel < m_nLevel.load(std::memory_order_relaxed)) return;
+			_logRing* pRing = ring();
+			if (pRing == nullptr)	// (logged on the way out: of the thread, or of the logger)
+			{
+				m_nDropped.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+			size_t nSize = (sizeof(_logRecord) + _logArgs::total_size(args...) + 7) & ~(size_t)7;
+			char* p = (nSize <= LOG_RING_SIZE / 4) ? pRing->reserve((uint32_t)nSize) : nullptr;
+			if (p == nullptr)
+			{
+				pRing->nDropped.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+			_logRecord* pRecord = (_logRecord*)p;
+			pRecord->size = (uint32_t)nSize;
+			pRecord->level = (uint8_t)nLevel;
+			pRecord->nArgs = (uint8_t)sizeof...(args);
+			pRecord->nSuppressed = nSuppressed;
+			pRecord->timeUs = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+			pRecord->fmt = fmt;
+			_logArgs::put_all(p + sizeof(_logRecord), args...);
+			pRing->commit((uint32_t)nSize);
+		}
+
+		// formats the message of the record (without the time and level) into out, and returns its length
+		static size_t format(const _logRecord& record, char* out, size_t outLen)
+		{
+			const char* f = record.fmt;
+			const char* pArg = (const char*)(&record + 1);
+			int nArgsLeft = record.nArgs;
+			size_t n = 0;
+			while (*f != '\0' && n + 1 < outLen)
+			{
+				if (*f != '%') { out[n++] = *f++; continue; }
+				if (f[1] == '%') { out[n++] = '%'; f += 2; continue; }
+				char spec[32];	// the conversion, rebuilt with the stars resolved and the length for the recorded type
+				size_t s = 0;
+				spec[s++] = *f++;
+				while (*f != '\0' && strchr("-+ #0", *f) != nullptr && s < 8) spec[s++] = *f++;
+				long long nWidth = -1, nPrecision = -1;
+				if (*f == '*') { ++f; nWidth = take_int(pArg, nArgsLeft); }
+				else if (*f >= '0' && *f <= '9') nWidth = strtol(f, (char**)&f, 10);
+				if (*f == '.')
+				{
+					++f;
+					if (*f == '*') { ++f; nPrecision = take_int(pArg, nArgsLeft); }
+					else nPrecision = strtol(f, (char**)&f, 10);
+					if (nPrecision < 0) nPrecision = -1;
+				}
+				while (*f != '\0' && strchr("hlLqjzt", *f) != nullptr) ++f;	// the recorded type says it
+				nWidth = std::min(nWidth, (long long)LOG_LINE_SIZE);	// (no wider than the line: keeps the spec within its buffer)
+				nPrecision = std::min(nPrecision, (long long)LOG_LINE_SIZE);
+				char conv = *f;
+				if (conv == '\0') break;
+				++f;
+				if (nArgsLeft-- <= 0) { n += snprintf(out + n, outLen - n, "%%?"); continue; }	// fewer arguments than conversions
+				if (nWidth >= 0) s += snprintf(spec + s, sizeof(spec) - s, "%lld", nWidth);
+				if (nPrecision >= 0 && *pArg != 's') s += snprintf(spec + s, sizeof(spec) - s, ".%lld", nPrecision);
+				char tag = *pArg++;
+				int nWritten = 0;
+				if (tag == 's')
+				{
+					uint32_t len;
+					memcpy(&len, pArg, sizeof(len));
+					size_t nShown = (nPrecision >= 0) ? std::min((size_t)nPrecision, (size_t)len) : len;
+					memcpy(spec + s, ".*s", 4);
+					nWritten = snprintf(out + n, outLen - n, spec, (int)nShown, pArg + sizeof(len));
+					pArg += sizeof(len) + len;
+				}
+				else
+				{
+					uint64_t u;
+					memcpy(&u, pArg, 8);
+					pArg += 8;
+					if (tag == 'f')
+					{
+						double d;
+						memcpy(&d, &u, 8);
+						bool bFloat = strchr("feEgGaA", conv) != nullptr;
+						memcpy(spec + s, bFloat ? &conv : "lld", bFloat ? 1 : 3);
+						spec[s + (bFloat ? 1 : 3)] = '\0';
+						nWritten = bFloat ? snprintf(out + n, outLen - n, spec, d) : snprintf(out + n, outLen - n, spec, (long long)d);
+					}
+					else if (tag == 'p' || conv == 'p')
+					{
+						memcpy(spec + s, "p", 2);
+						nWritten = snprintf(out + n, outLen - n, spec, (void*)(uintptr_t)u);
+					}
+					else if (conv == 'c')
+					{
+						memcpy(spec + s, "c", 2);
+						nWritten = snprintf(out + n, outLen - n, spec, (int)u);
+					}
+					else if (strchr("feEgGaA", conv) != nullptr)
+					{
+						spec[s] = conv;
+						spec[s + 1] = '\0';
+						nWritten = snprintf(out + n, outLen - n, spec, (tag == 'i') ? (double)(int64_t)u : (double)u);
+					}
+					else
+					{
+						char c = (strchr("diuxXo", conv) != nullptr) ? conv : (tag == 'i' ? 'd' : 'u');
+						spec[s] = 'l'; spec[s + 1] = 'l'; spec[s + 2] = c; spec[s + 3] = '\0';
+						nWritten = (tag == 'i') ? snprintf(out + n, outLen - n, spec, (long long)(int64_t)u) : snprintf(out + n, outLen - n, spec, (unsigned long long)u);
+					}
+				}
+				if (nWritten > 0) n = std::min(n + nWritten, outLen - 1);
+			}
+			out[n] = '\0';
+			return n;
+		}
+	protected:
+		static inline long long take_int(const char*& pArg, int& nArgsLeft)
+		{
+			if (nArgsLeft <= 0 || (*pArg != 'i' && *pArg != 'u')) return -1;
+			uint64_t u;
+			memcpy(&u, pArg + 1, 8);
+			pArg += 9;
+			nArgsLeft--;
+			return (long long)u;
+		}
+		// the ring of the calling thread (registered, and the background thread started, on first use).
+		// nullptr once the thread is exiting, or the logger is stopped
+		inline _logRing* ring()
+		{
+			static thread_local _ringHolder holder;
+			if (holder.pRing != nullptr) return holder.pRing;
+			if (holder.bGone) return nullptr;
+			std::lock_guard<std::mutex> guard(m_lock);
+			if (m_bStop) return nullptr;
+			holder.pRing = new _logRing();
+			m_rings.push_back(holder.pRing);
+			if (!m_thread.joinable()) m_thread = std::thread(&asyncLogger::run, this);
+			return holder.pRing;
+		}
+		void run()
+		{
+			std::unique_lock<std::mutex> guard(m_lock);
+			while (!m_bStop)
+			{
+				guard.unlock();
+				bool bIdle = !drain();
+				guard.lock();
+				if (bIdle) m_wakeup.wait_for(guard, std::chrono::milliseconds(5));	// the writers do not signal: they only copy
+			}
+		}
+		// writes out the records of all the rings, and frees the rings of the threads that are gone. Returns true if it wrote any.
+		bool drain()
+		{
+			std::vector<_logRing*> rings;
+			{
+				std::lock_guard<std::mutex> guard(m_lock);
+				rings = m_rings;
+			}
+			bool bWrote = false;
+			for (_logRing* pRing : rings)
+			{
+				bool bOrphaned = pRing->bOrphaned.load(std::memory_order_acquire);	// (before the last look at head)
+				uint64_t nTail = pRing->tail.load(std::memory_order_relaxed);
+				uint64_t nHead = pRing->head.load(std::memory_order_acquire);
+				while (nTail < nHead)
+				{
+					const _logRecord& record = *(const _logRecord*)(pRing->buf + nTail % LOG_RING_SIZE);
+					if (record.level != _logRecord::PADDING) write(record);
+					nTail += record.size;
+					bWrote = true;
+				}
+				pRing->tail.store(nTail, std::memory_order_release);
+				if (bOrphaned)
+				{
+					std::lock_guard<std::mutex> guard(m_lock);
+					m_rings.erase(std::find(m_rings.begin(), m_rings.end(), pRing));
+					m_nDropped += pRing->nDropped;
+					delete pRing;
+				}
+			}
+			if (!m_out.empty())
+			{
+				FILE* pOut = m_pOut;
+				fwrite(m_out.data(), 1, m_out.size(), pOut);
+				fflush(pOut);
+				m_out.clear();
+			}
+			{
+				std::lock_guard<std::mutex> guard(m_lock);
+				m_nPasses++;
+			}
+			m_drained.notify_all();
+			return bWrote;
+		}
+		void write(const _logRecord& record)
+		{
+			static const char* s_levels[] = { "DEBUG", "INFO ", "WARN ", "ERROR" };
+			char line[LOG_LINE_SIZE];
+			time_t t = (time_t)(record.timeUs / 1000000);
+			std::tm tm;
+#if defined(WIN32) || defined(_WIN32)
+			localtime_s(&tm, &t);
+#else
+			localtime_r(&t, &tm);
+#endif
+			size_t n = snprintf(line, sizeof(line), "[%02d:%02d:%02d.%06d] %s ", tm.tm_hour, tm.tm_min, tm.tm_sec, (int)(record.timeUs % 1000000), s_levels[std::min((int)record.level, 3)]);
+			n += format(record, line + n, sizeof(line) - n - 48);
+			if (record.nSuppressed > 0) n += snprintf(line + n, sizeof(line) - n, " (%u more held back)", record.nSuppressed);
+			line[n++] = '\n';
+			m_out.insert(m_out.end(), line, line + n);
+		}
+	};
+} // namespace DSCPP
+
+#endif // _ASYNCLOGGER_H__Guid__E4B1C7D2_5A93_4F0E_B8D6_2C71A09F53E8___
@@ -9,6 +9,29 @@
 #include <deque>
 #include <algorithm>
 #include <map>
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <mutex>
+#if defined(WIN32) || defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#if defined(__linux__)
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#endif
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
 
 #if defined(DEBUG) || defined(_DEBUG)
 #ifndef BUFPOOL_TRACK_MEMORY
@@ -16,12 +39,70 @@
 #endif
 #endif
 
+// The pools are per-thread: each event loop thread gets its own free lists, so the loops
+// running on different threads neither race nor contend with each other. Release the buffers
+// on the thread that acquired them, and before that thread exits (a buffer released on some 
+// other thread just moves to that thread's pool, but BUFPOOL_TRACK_MEMORY builds assert on it).
+// Define BUFPOOL_THREAD_LOCAL to 0 to have a single process-wide pool (single threaded use only).
+#ifndef BUFPOOL_THREAD_LOCAL
+#define BUFPOOL_THREAD_LOCAL 1
+#endif
+#if BUFPOOL_THREAD_LOCAL
+#define BUFPOOL_STORAGE thread_local
+#else
+#define BUFPOOL_STORAGE
+#endif
+
+// Occupancy of a pool (or of a size class of bufPoolChunk), see the stats() of the pools
+struct bufPoolStats
+{
+	size_t	nInUse = 0;			// handed out, not yet released
+	size_t	nFree = 0;			// kept for reuse
+	size_t	nHighWater = 0;		// the most in use at once
+	size_t	nFromOS = 0;		// no. of allocations from the OS
+	size_t	nTrimmed = 0;		// no. given back to the OS (by trim(), or over the cap of the free ones)
+	size_t	nBytesInUse = 0;
+	size_t	nBytesFree = 0;
+	inline void add(const bufPoolStats& other)
+	{
+		nInUse += other.nInUse;
+		nFree += other.nFree;
+		nHighWater += other.nHighWater;
+		nFromOS += other.nFromOS;
+		nTrimmed += other.nTrimmed;
+		nBytesInUse += other.nBytesInUse;
+		nBytesFree += other.nBytesFree;
+	}
+};
+
+// The bufPoolT pools of a thread register here, so that bufPool::trim() and bufPool::stats()
+// can go over all of them without knowing their types
+struct _bufPoolLink
+{
+	size_t			(*pfnTrim)(size_t nMaxBatch);
+	void			(*pfnStats)(bufPoolStats& total);
+	_bufPoolLink*	pNext;
+};
+template<typename T>
+struct _bufPoolList_singleton { static BUFPOOL_STORAGE _bufPoolLink* s_pHead; };
+template<typename T> BUFPOOL_STORAGE _bufPoolLink* _bufPoolList_singleton<T>::s_pHead = nullptr;
+
+// The pools keep the memory released to them for reuse. Bursts would thus keep their peak for ever:
+// trim() gives back to the OS the free ones that went unused since the previous trim() (the fewest
+// that were free all along), in batches of nMaxBatch. Call it periodically, when idle (see
+// _dsclientBase::POOL_TRIM_INTERVAL). setMaxFree() caps the free ones outright.
 template<typename T>
 struct bufPoolT
 {
 protected:
-	static bufPoolT s_obj;
-	inline bufPoolT() {	}
+	static BUFPOOL_STORAGE bufPoolT s_obj;
+	inline bufPoolT()
+	{
+		m_link.pfnTrim = [](size_t nMaxBatch) { return s_obj.trim(nMaxBatch); };
+		m_link.pfnStats = [](bufPoolStats& total) { total.add(s_obj.stats()); };
+		m_link.pNext = _bufPoolList_singleton<void>::s_pHead;
+		_bufPoolList_singleton<void>::s_pHead = &m_link;
+	}
 	inline ~bufPoolT()
 	{
 #if BUFPOOL_TRACK_MEMORY
@@ -31,6 +112,8 @@ protected:
 		{
 			free(obj);
 		}
+		for (_bufPoolLink** ppLink = &_bufPoolList_singleton<void>::s_pHead; *ppLink != nullptr; ppLink = &(*ppLink)->pNext)
+			if (*ppLink == &m_link) { *ppLink = m_link.pNext; break; }
 	}
 public:
 	static inline bufPoolT& getObject()
@@ -46,12 +129,16 @@ public:
 		{
 			pBuf = freeQ.front();
 			freeQ.pop_front();
+			if (freeQ.size() < m_nLowFree) m_nLowFree = freeQ.size();
 		}
 		else	// no free buffer available - rely on the OS
 		{
 			pBuf = (T*) malloc(sizeof(T));
 			if (pBuf == nullptr) return nullptr;
+			++m_nFromOS;
+			m_nLowFree = 0;
 		}
+		if (++m_nInUse > m_nHighWater) m_nHighWater = m_nInUse;
 #if BUFPOOL_TRACK_MEMORY
 		inuseQ.push_front(pBuf);
 #endif
@@ -64,13 +151,57 @@ public:
 	{
 		if (pBuf == nullptr) return;
 		pBuf->~T();
-		freeQ.push_front(pBuf);
+		if (m_nInUse > 0) --m_nInUse;	// (may have been acquired on another thread)
+		if (freeQ.size() < m_nMaxFree)
+			freeQ.push_front(pBuf);
+		else
+		{
+			free(pBuf);
+			++m_nTrimmed;
+		}
 #if BUFPOOL_TRACK_MEMORY
 		auto foundIter = std::find(inuseQ.cbegin(), inuseQ.cend(), pBuf);
 		assert(foundIter != inuseQ.cend());  // if this fails, it means you are releasing a buffer that we did not allocate !!
 		inuseQ.erase(foundIter);
 #endif
 	}
+	// gives back to the OS (up to nMaxBatch of) the free ones that were not needed since the last trim(). Returns the no. released
+	inline size_t trim(size_t nMaxBatch = (size_t)-1)
+	{
+		size_t nTrim = std::min(std::min(m_nLowFree, freeQ.size()), nMaxBatch);
+		for (size_t i = 0; i < nTrim; ++i)
+		{
+			free(freeQ.back());	// the least recently released
+			freeQ.pop_back();
+		}
+		m_nTrimmed += nTrim;
+		m_nLowFree = (nTrim < nMaxBatch) ? freeQ.size() : m_nLowFree - nTrim;	// the rest of the unused stay candidates
+		return nTrim;
+	}
+	// keeps at most nMaxFree free ones (the rest go back to the OS as they are released)
+	inline void setMaxFree(size_t nMaxFree)
+	{
+		m_nMaxFree = nMaxFree;
+		while (freeQ.size() > m_nMaxFree)
+		{
+			free(freeQ.back());
+			freeQ.pop_back();
+			++m_nTrimmed;
+		}
+		m_nLowFree = std::min(m_nLowFree, freeQ.size());
+	}
+	inline bufPoolStats stats() const
+	{
+		bufPoolStats s;
+		s.nInUse = m_nInUse;
+		s.nFree = freeQ.size();
+		s.nHighWater = m_nHighWater;
+		s.nFromOS = m_nFromOS;
+		s.nTrimmed = m_nTrimmed;
+		s.nBytesInUse = m_nInUse * sizeof(T);
+		s.nBytesFree = freeQ.size() * sizeof(T);
+		return s;
+	}
 #if BUFPOOL_TRACK_MEMORY
 	inline bool isInUse(const T* pBuf) const
 	{
@@ -82,8 +213,15 @@ protected:
 #if BUFPOOL_TRACK_MEMORY
 	std::deque<T*> inuseQ;
 #endif
+	size_t			m_nInUse = 0;
+	size_t			m_nHighWater = 0;
+	size_t			m_nFromOS = 0;
+	size_t			m_nTrimmed = 0;
+	size_t			m_nLowFree = 0;				// the fewest free since the last trim(): as many went unused all along
+	size_t			m_nMaxFree = (size_t)-1;
+	_bufPoolLink	m_link;
 };
-template<typename T> bufPoolT<T> bufPoolT<T>::s_obj;
+template<typename T> BUFPOOL_STORAGE bufPoolT<T> bufPoolT<T>::s_obj;
 
 #define PAGE_ROUND_DOWN(x, PAGE_SIZE)	((x) & (~(PAGE_SIZE-1)))
 #define PAGE_ROUND_UP(x, PAGE_SIZE)		( ((x) + PAGE_SIZE-1)  & (~(PAGE_SIZE-1)) )
@@ -92,33 +230,708 @@ template<typename T> bufPoolT<T> bufPoolT<T>::s_obj;
 #define PAGE_SIZE_2K 0x0800
 #define PAGE_SIZE_4K 0x1000
 
+// bufSlabs: the process-wide regions (slabs) the chunks of bufPoolChunk are cut from. A slab is
+// SLAB_SIZE bytes at an address aligned to SLAB_SIZE, all of it chunks: its header is kept apart, in
+// the table entry of the slab. The header of a chunk is found from its address alone, so the chunks
+// carry none, and start at the alignment of their size class (at least the cache line), as many as
+// the slab holds (8 of 256K, 2048 of 1K). The slabs stay mapped for good; the
+// pages of the chunks trimmed go back to the OS (MADV_DONTNEED), and come back zeroed on first touch.
+// The slabs are registered in a fixed table (MAX_SLABS), to tell them apart from the other buffers
+// (see headerOf()). With HUGE_PAGES_TRANSPARENT the slabs are advised to go on 2 MB pages, with
+// HUGE_PAGES_EXPLICIT they are mapped from the reserved ones (hugetlbfs), falling back to the normal
+// pages when none are left. Linux only: elsewhere the huge pages setting is ignored. A slab can be
+// placed on a NUMA node (preferred, the pages go elsewhere when the node is out of memory).
+// The header also keeps the reference counts of the chunks (see bufPoolChunk::addRef()).
+struct bufSlabs
+{
+	enum { MAX_SLOT_SIZE = 256 * 1024, SLOT_SIZE_STEP = 1024 };	// the size classes cut from slabs (the larger chunks are allocated one by one)
+	enum { SLAB_SHIFT = 21, SLAB_SIZE = 1 << SLAB_SHIFT, MAX_SLABS = 4096, CACHE_LINE = 64 };
+	enum hugePages { HUGE_PAGES_NONE, HUGE_PAGES_TRANSPARENT, HUGE_PAGES_EXPLICIT };
+	struct header	// allocated along with the slab, and kept for good
+	{
+		uint32_t	nSlotSize;		// the size class of the chunks
+		uint32_t	nSlots;
+		std::mutex	lock;			// for the page counts (the chunks of a page may be trimmed on several threads)
+		uint8_t		pageTrims[SLAB_SIZE / PAGE_SIZE_4K] = {};	// per page: its chunks trimmed (see trim())
+		// followed by std::atomic<uint32_t>[nSlots]: per chunk, the owners besides the first (zero as allocated)
+		inline std::atomic<uint32_t>* refs() { return (std::atomic<uint32_t>*)(this + 1); }
+		// the no. of chunks on (or partly on) the page
+		inline uint32_t chunksOnPage(size_t nPage) const
+		{
+			size_t nFirst = nPage * PAGE_SIZE_4K / nSlotSize;
+			size_t nLast = std::min((size_t)nSlots - 1, ((nPage + 1) * PAGE_SIZE_4K - 1) / nSlotSize);
+			return (nFirst <= nLast) ? (uint32_t)(nLast - nFirst + 1) : 0;
+		}
+	};
+protected:
+	struct _range	// chunks back to back, not to be touched (till handed out)
+	{
+		char*	pBegin;
+		char*	pEnd;
+		bool	bZeroed;	// they read as zero
+	};
+	struct _orphans
+	{
+		void*	pFree = nullptr;		// the free chunks, linked through their first bytes (their pages are in use anyway)
+		_range*	pRanges = nullptr;		// the chunks never handed out, and the ones whose pages went back to the OS
+		size_t	nRanges = 0;
+		size_t	nMaxRanges = 0;
+	};
+	struct _table
+	{
+		std::atomic<uintptr_t>	slabs[MAX_SLABS] = {};	// open addressing, never removed (0: empty)
+		header*					headers[MAX_SLABS] = {};	// of the slabs, at their index (set before the slab)
+		std::atomic<int>		nSlabs{ 0 };
+		std::atomic<int>		nHugePages{ HUGE_PAGES_NONE };
+		std::mutex				lock;				// for the inserts, and the orphans
+		_orphans				orphans[MAX_SLOT_SIZE / SLOT_SIZE_STEP] = {};	// per size class: the chunks left by the threads gone
+		std::atomic<int>		nOrphans{ 0 };		// the free ones and the ranges, of all the sizes
+	};
+	template<typename T>
+	struct bufSlabs_singleton { static _table s_obj; };	// (constant initialized: usable from any static constructor)
+	static inline size_t hashOf(uintptr_t base)
+	{
+		return (size_t)(((base >> SLAB_SHIFT) * 2654435761u) % MAX_SLABS);
+	}
+public:
+	// the header of the slab the buffer was cut from, or nullptr if it is not of a slab (without
+	// touching it: any pointer can be asked)
+	static inline header* headerOf(const void* p)
+	{
+		uintptr_t base = (uintptr_t)p & ~(uintptr_t)(SLAB_SIZE - 1);
+		_table& t = bufSlabs_singleton<void>::s_obj;
+		for (size_t i = hashOf(base), n = 0; n < MAX_SLABS; i = (i + 1) % MAX_SLABS, ++n)
+		{
+			uintptr_t slab = t.slabs[i].load(std::memory_order_acquire);
+			if (slab == base) return t.headers[i];
+			if (slab == 0) return nullptr;
+		}
+		return nullptr;
+	}
+	// the reference count of the chunk of the slab
+	static inline std::atomic<uint32_t>& refsOf(const void* p, header* pHeader)
+	{
+		return pHeader->refs()[((uintptr_t)p & (SLAB_SIZE - 1)) / pHeader->nSlotSize];
+	}
+	// the reference count of the chunk (the chunk has to be of a slab)
+	static inline std::atomic<uint32_t>& refsOf(const void* p)
+	{
+		return refsOf(p, headerOf(p));
+	}
+	// tells if the buffer was cut from a slab
+	static inline bool contains(const void* p)
+	{
+		return headerOf(p) != nullptr;
+	}
+	static inline void setHugePages(hugePages mode)
+	{
+		bufSlabs_singleton<void>::s_obj.nHugePages = mode;
+	}
+	static inline size_t count()
+	{
+		return bufSlabs_singleton<void>::s_obj.nSlabs;
+	}
+	// maps a slab for the chunks of the size (a multiple of SLOT_SIZE_STEP), on the NUMA node (if >= 0).
+	// Returns nullptr if out of memory, or of slabs
+	static inline char* allocate(uint32_t nSlotSize, int nNumaNode = -1)
+	{
+		_table& t = bufSlabs_singleton<void>::s_obj;
+		if (t.nSlabs >= MAX_SLABS / 2) return nullptr;	// (the table stays half empty, for short probes)
+		uint32_t nSlots = SLAB_SIZE / nSlotSize;
+		header* pHeader = (header*)malloc(sizeof(header) + nSlots * sizeof(std::atomic<uint32_t>));
+		if (pHeader == nullptr) return nullptr;
+		char* pSlab = map((hugePages)t.nHugePages.load(), nNumaNode);
+		if (pSlab == nullptr) { free(pHeader); return nullptr; }
+		new (pHeader) header();
+		pHeader->nSlotSize = nSlotSize;
+		pHeader->nSlots = nSlots;
+		for (uint32_t i = 0; i < nSlots; ++i) new (&pHeader->refs()[i]) std::atomic<uint32_t>(0);
+		std::lock_guard<std::mutex> guard(t.lock);
+		size_t i = hashOf((uintptr_t)pSlab);
+		while (t.slabs[i].load(std::memory_order_relaxed) != 0) i = (i + 1) % MAX_SLABS;
+		t.headers[i] = pHeader;
+		t.slabs[i].store((uintptr_t)pSlab, std::memory_order_release);
+		t.nSlabs++;
+		return pSlab;
+	}
+	// keeps a free chunk of a pool that goes (with its thread), for the pools of the other threads
+	static inline void orphan(void* pChunk, uint32_t nSlotSize)
+	{
+		_table& t = bufSlabs_singleton<void>::s_obj;
+		std::lock_guard<std::mutex> guard(t.lock);
+		void*& pHead = t.orphans[nSlotSize / SLOT_SIZE_STEP - 1].pFree;
+		*(void**)pChunk = pHead;
+		pHead = pChunk;
+		t.nOrphans++;
+	}
+	// keeps the chunks [pBegin, pEnd) of a pool that goes without touching them (so that their pages stay
+	// with the OS): the ones it never handed out of its slab, or the ones it trimmed. bZeroed: they read as zero
+	static inline void orphan(char* pBegin, char* pEnd, uint32_t nSlotSize, bool bZeroed)
+	{
+		if (pBegin >= pEnd) return;
+		_table& t = bufSlabs_singleton<void>::s_obj;
+		std::lock_guard<std::mutex> guard(t.lock);
+		_orphans& o = t.orphans[nSlotSize / SLOT_SIZE_STEP - 1];
+		if (o.nRanges > 0 && o.pRanges[o.nRanges - 1].pEnd == pBegin && o.pRanges[o.nRanges - 1].bZeroed == bZeroed)
+		{
+			o.pRanges[o.nRanges - 1].pEnd = pEnd;	// (the trimmed ones are mostly back to back)
+			return;
+		}
+		if (o.nRanges == o.nMaxRanges)
+		{
+			size_t nMaxRanges = std::max(o.nMaxRanges * 2, (size_t)16);
+			_range* pRanges = (_range*)realloc(o.pRanges, nMaxRanges * sizeof(_range));
+			if (pRanges == nullptr) return;	// out of memory: the chunks stay unused
+			o.pRanges = pRanges;
+			o.nMaxRanges = nMaxRanges;
+		}
+		o.pRanges[o.nRanges++] = { pBegin, pEnd, bZeroed };
+		t.nOrphans++;
+	}
+	// a chunk of the size left by a thread gone, or nullptr. bZeroed: it is all zeros
+	static inline void* adopt(uint32_t nSlotSize, bool& bZeroed)
+	{
+		_table& t = bufSlabs_singleton<void>::s_obj;
+		if (t.nOrphans.load(std::memory_order_relaxed) == 0) return nullptr;
+		std::lock_guard<std::mutex> guard(t.lock);
+		_orphans& o = t.orphans[nSlotSize / SLOT_SIZE_STEP - 1];
+		if (o.pFree != nullptr)
+		{
+			void* pChunk = o.pFree;
+			o.pFree = *(void**)pChunk;
+			t.nOrphans--;
+			bZeroed = false;
+			return pChunk;
+		}
+		if (o.nRanges == 0) return nullptr;
+		_range& r = o.pRanges[o.nRanges - 1];
+		char* pChunk = r.pBegin;
+		r.pBegin += nSlotSize;
+		bZeroed = r.bZeroed;
+		if (r.pBegin >= r.pEnd)
+		{
+			o.nRanges--;
+			t.nOrphans--;
+		}
+		return pChunk;
+	}
+	// gives the whole pages in the range back to the OS (they read as zero when touched again)
+	static inline void decommit(void* p, size_t len)
+	{
+		uintptr_t begin = PAGE_ROUND_UP((uintptr_t)p, (uintptr_t)PAGE_SIZE_4K);
+		uintptr_t end = PAGE_ROUND_DOWN((uintptr_t)p + len, (uintptr_t)PAGE_SIZE_4K);
+		if (begin >= end) return;
+#if defined(WIN32) || defined(_WIN32)
+		VirtualAlloc((void*)begin, end - begin, MEM_RESET, PAGE_READWRITE);
+#else
+		madvise((void*)begin, end - begin, MADV_DONTNEED);
+#endif
+	}
+	// counts the chunk of the slab as trimmed, and gives back the pages whose chunks all are. The small
+	// chunks share their pages (and the ones of sizes other than whole pages, the pages at their ends):
+	// those go back with the last of their chunks. The chunk is not to be touched till untrim()
+	static inline void trim(header* pHeader, void* pChunk)
+	{
+		char* pSlab = (char*)((uintptr_t)pChunk & ~(uintptr_t)(SLAB_SIZE - 1));
+		size_t nOffset = (char*)pChunk - pSlab;
+		size_t nFirstPage = nOffset / PAGE_SIZE_4K, nLastPage = (nOffset + pHeader->nSlotSize - 1) / PAGE_SIZE_4K;
+		size_t nFrom = nLastPage + 1, nTo = 0;	// the pages to give back (the inner ones of the chunk, and the ends that filled up)
+		std::lock_guard<std::mutex> guard(pHeader->lock);
+		for (size_t nPage = nFirstPage; nPage <= nLastPage; ++nPage)
+			if (++pHeader->pageTrims[nPage] == pHeader->chunksOnPage(nPage))
+			{
+				nFrom = std::min(nFrom, nPage);
+				nTo = nPage + 1;
+			}
+		if (nFrom < nTo) decommit(pSlab + nFrom * PAGE_SIZE_4K, (nTo - nFrom) * PAGE_SIZE_4K);
+	}
+	// counts the trimmed chunk out, before it is used again. Returns true if it reads as zero (all its pages went back)
+	static inline bool untrim(header* pHeader, void* pChunk)
+	{
+		size_t nOffset = (uintptr_t)pChunk & (SLAB_SIZE - 1);
+		size_t nFirstPage = nOffset / PAGE_SIZE_4K, nLastPage = (nOffset + pHeader->nSlotSize - 1) / PAGE_SIZE_4K;
+		bool bZeroed = decommitZeroes();
+		std::lock_guard<std::mutex> guard(pHeader->lock);
+		for (size_t nPage = nFirstPage; nPage <= nLastPage; ++nPage)
+			if (pHeader->pageTrims[nPage]-- != pHeader->chunksOnPage(nPage)) bZeroed = false;
+		return bZeroed;
+	}
+	// tells if the pages of the range were given back by decommit() (and so read as zero)
+	static inline bool decommitZeroes()
+	{
+#if defined(WIN32) || defined(_WIN32)
+		return false;	// MEM_RESET may keep the old contents
+#else
+		return true;
+#endif
+	}
+protected:
+	static inline char* map(hugePages mode, int nNumaNode)
+	{
+#if defined(WIN32) || defined(_WIN32)
+		// reserve twice the size, and commit the aligned half (the rest stays reserved, address space only)
+		char* pRegion = (char*)VirtualAlloc(nullptr, 2 * SLAB_SIZE, MEM_RESERVE, PAGE_NOACCESS);
+		if (pRegion == nullptr) return nullptr;
+		char* pSlab = (char*)PAGE_ROUND_UP((uintptr_t)pRegion, (uintptr_t)SLAB_SIZE);
+		if (nNumaNode >= 0)
+			return (char*)VirtualAllocExNuma(GetCurrentProcess(), pSlab, SLAB_SIZE, MEM_COMMIT, PAGE_READWRITE, (DWORD)nNumaNode);
+		return (char*)VirtualAlloc(pSlab, SLAB_SIZE, MEM_COMMIT, PAGE_READWRITE);
+#else
+#if defined(MAP_HUGETLB)
+		if (mode == HUGE_PAGES_EXPLICIT)
+		{
+			void* p = mmap(nullptr, SLAB_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+			if (p != MAP_FAILED) return bind((char*)p, nNumaNode);	// (huge pages are aligned to their size)
+		}
+#endif
+		// map twice the size, and unmap the parts around the aligned half
+		char* pRegion = (char*)mmap(nullptr, 2 * SLAB_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (pRegion == (char*)MAP_FAILED) return nullptr;
+		char* pSlab = (char*)PAGE_ROUND_UP((uintptr_t)pRegion, (uintptr_t)SLAB_SIZE);
+		if (pSlab > pRegion) munmap(pRegion, pSlab - pRegion);
+		if (pSlab + SLAB_SIZE < pRegion + 2 * SLAB_SIZE) munmap(pSlab + SLAB_SIZE, pRegion + 2 * SLAB_SIZE - (pSlab + SLAB_SIZE));
+#if defined(MADV_HUGEPAGE)
+		if (mode != HUGE_PAGES_NONE) madvise(pSlab, SLAB_SIZE, MADV_HUGEPAGE);
+#endif
+		return bind(pSlab, nNumaNode);
+#endif
+	}
+	// prefers the NUMA node for the pages of the slab (before they are touched). A failure is not an error: the pages go anywhere
+	static inline char* bind(char* pSlab, int nNumaNode)
+	{
+#if defined(__linux__) && defined(SYS_mbind)
+		if (nNumaNode >= 0 && nNumaNode < 64)
+		{
+			unsigned long nodeMask = 1UL << nNumaNode;
+			syscall(SYS_mbind, pSlab, (unsigned long)SLAB_SIZE, MPOL_PREFERRED, &nodeMask, 64UL, 0U);
+		}
+#endif
+		return pSlab;
+	}
+};
+template<typename T> bufSlabs::_table bufSlabs::bufSlabs_singleton<T>::s_obj;
+
+// bufArena is a bump allocator for the short-lived buffers and objects of a message 
+// (the read buffer, the replies, the write requests) or of a loop tick. Acquiring is 
+// a pointer bump in the current block, and releasing just decrements the live count 
+// of the block the buffer came from. Once all allocations of the current block are 
+// released, the whole block gets reset in one step, without touching the individual 
+// allocations. Older blocks (that filled up earlier) are kept aside for reuse once 
+// they drain. Allocations are not cleared to zero (unlike bufPoolChunk).
+// Each allocation is prefixed with a header that looks like a bufPoolChunk size with 
+// a negative value, so arena buffers can be released with POOLED_FREE() and can be 
+// owned by unique_ptr<void> just like the pooled chunks. Not thread-safe: use one 
+// arena per loop (or per connection).
+struct bufArena
+{
+	enum { BLOCK_SIZE = 64 * 1024, ALIGNMENT = 16, MAX_SPARE_BLOCKS = 4 };
+protected:
+	struct _block
+	{
+		bufArena*	pArena;		// owner arena (nullptr, once the arena is destroyed)
+		_block*		pPrev;		// links for the list of retired (or spare) blocks
+		_block*		pNext;
+		size_t		nSize;		// size of the block, including this header
+		int			nLive;		// no. of allocations not yet released
+		char*		pCursor;	// the next free byte
+	};
+	enum 
+	{ 
+		BLOCK_HEADER_SIZE = (sizeof(_block) + ALIGNMENT - 1) & ~(ALIGNMENT - 1),
+		CHUNK_HEADER_SIZE = 2 * sizeof(int)	// [size][-(offset from block)] precede each allocation
+	};
+	_block*	m_pCurrent = nullptr;	// the block being bumped
+	_block*	m_pRetired = nullptr;	// blocks that filled up, but still have live allocations
+	_block*	m_pSpare = nullptr;		// drained blocks kept for reuse
+	int		m_nSpare = 0;
+	void*	m_pLast = nullptr;		// the most recent allocation (can be shrunk in-place)
+public:
+	struct stats
+	{
+		size_t	nAcquired = 0;		// no. of allocations served
+		size_t	nResets = 0;		// no. of times the current block got reset in one step
+		size_t	nBlocksAllocated = 0;	// no. of blocks obtained from the OS
+	} m_stats;
+
+	inline bufArena() { }
+	inline ~bufArena()
+	{
+		// blocks that still have live allocations get released when their last allocation does
+		if (m_pCurrent != nullptr) retire(m_pCurrent);
+		for (_block* pBlock = m_pRetired; pBlock != nullptr; )
+		{
+			_block* pNext = pBlock->pNext;
+			pBlock->pArena = nullptr;
+			if (pBlock->nLive <= 0) free(pBlock);
+			pBlock = pNext;
+		}
+		for (_block* pBlock = m_pSpare; pBlock != nullptr; )
+		{
+			_block* pNext = pBlock->pNext;
+			free(pBlock);
+			pBlock = pNext;
+		}
+	}
+	bufArena(const bufArena&) = delete;
+	bufArena& operator=(const bufArena&) = delete;
+
+	// Returns a buffer of the given size, or nullptr if out of memory
+	inline void* acquire(size_t size)
+	{
+		char* pPayload = (m_pCurrent == nullptr) ? nullptr : payloadAt(m_pCurrent);
+		if (pPayload == nullptr || pPayload + size > blockEnd(m_pCurrent))
+		{
+			if (size > (size_t)BLOCK_SIZE - BLOCK_HEADER_SIZE - CHUNK_HEADER_SIZE - ALIGNMENT)
+				return acquireDedicated(size);
+			if (!nextBlock()) return nullptr;
+			pPayload = payloadAt(m_pCurrent);
+		}
+		return commit(pPayload, size);
+	}
+	// Returns all of the remaining space of the current block (at least nMinSize bytes) as a 
+	// single buffer. Useful for reads, whose size is not known upfront. Use shrink() after the 
+	// read to give back the unused part.
+	inline void* acquireAvailable(size_t nMinSize, size_t& size)
+	{
+		assert(nMinSize <= BLOCK_SIZE / 2);
+		char* pPayload = (m_pCurrent == nullptr) ? nullptr : payloadAt(m_pCurrent);
+		if (pPayload == nullptr || pPayload + nMinSize > blockEnd(m_pCurrent))
+		{
+			if (!nextBlock()) { size = 0; return nullptr; }
+			pPayload = payloadAt(m_pCurrent);
+		}
+		size = blockEnd(m_pCurrent) - pPayload;
+		return commit(pPayload, size);
+	}
+	// Shrinks the most recent allocation to newSize, giving back the rest to the arena.
+	// Returns false (and does nothing) if pBuf is not the most recent allocation.
+	inline bool shrink(void* pBuf, size_t newSize)
+	{
+		if (pBuf == nullptr || pBuf != m_pLast) return false;
+		assert(newSize <= (size_t)((int*)pBuf)[-2]);
+		((int*)pBuf)[-2] = (int)newSize;
+		m_pCurrent->pCursor = (char*)pBuf + newSize;
+		return true;
+	}
+	// Releases a buffer obtained from any arena
+	static inline void release(void* pBuf)
+	{
+		if (pBuf == nullptr) return;
+		_block* pBlock = blockOf(pBuf);
+		assert(pBlock->nLive > 0);	// if this fails, the buffer is being released twice !!
+		if (--pBlock->nLive > 0) return;
+		if (pBlock->pArena == nullptr)	// the arena is gone, the block is on its own
+			free(pBlock);
+		else
+			pBlock->pArena->onBlockDrained(pBlock);
+	}
+	// Adds an owner to an arena buffer, so that several views into it (such as the messages
+	// of one read) can be handed out without copies. Each owner releases the buffer once, and
+	// the memory is reclaimed after the last release. Returns false for non-arena buffers.
+	static inline bool addRef(void* pBuf)
+	{
+		if (pBuf == nullptr || !isArenaChunk(pBuf)) return false;
+		++blockOf(pBuf)->nLive;
+		return true;
+	}
+	// Returns true if the chunk header belongs to an arena allocation (see bufPoolChunk)
+	static inline bool isArenaChunk(const void* pBuf)
+	{
+		return !bufSlabs::contains(pBuf) && ((const int*)pBuf)[-1] < 0;	// (the slab chunks have no header)
+	}
+	static inline size_t allocatedSize(const void* pBuf)
+	{
+		return ((const int*)pBuf)[-2];
+	}
+	static inline bool isInUse(const void* pBuf)
+	{
+		return blockOf(pBuf)->nLive > 0;
+	}
+	// Gives back to the OS the spare blocks, and the current block if nothing in it is live (for the
+	// idle connections). The blocks still in use are kept. The next acquire gets a new block.
+	inline void trim()
+	{
+		while (m_pSpare != nullptr)
+		{
+			_block* pBlock = m_pSpare;
+			unlink(m_pSpare, pBlock);
+			free(pBlock);
+		}
+		m_nSpare = 0;
+		if (m_pCurrent != nullptr && m_pCurrent->nLive <= 0)
+		{
+			free(m_pCurrent);
+			m_pCurrent = nullptr;
+			m_pLast = nullptr;
+		}
+	}
+	// no. of allocations still live in the current block
+	inline int liveCount() const
+	{
+		return m_pCurrent == nullptr ? 0 : m_pCurrent->nLive;
+	}
+protected:
+	static inline _block* blockOf(const void* pBuf)
+	{
+		return (_block*)((const char*)pBuf + ((const int*)pBuf)[-1]);
+	}
+	static inline char* blockEnd(_block* pBlock)
+	{
+		return (char*)pBlock + pBlock->nSize;
+	}
+	static inline char* payloadAt(_block* pBlock)
+	{
+		size_t addr = (size_t)(pBlock->pCursor + CHUNK_HEADER_SIZE);
+		return (char*)((addr + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1));
+	}
+	inline void* commit(char* pPayload, size_t size)
+	{
+		((int*)pPayload)[-1] = -(int)(pPayload - (char*)m_pCurrent);
+		((int*)pPayload)[-2] = (int)size;
+		m_pCurrent->pCursor = pPayload + size;
+		++m_pCurrent->nLive;
+		++m_stats.nAcquired;
+		m_pLast = pPayload;
+		return pPayload;
+	}
+	inline _block* newBlock(size_t nSize)
+	{
+		_block* pBlock = (_block*)malloc(nSize);
+		if (pBlock == nullptr) return nullptr;
+		pBlock->pArena = this;
+		pBlock->pPrev = pBlock->pNext = nullptr;
+		pBlock->nSize = nSize;
+		pBlock->nLive = 0;
+		pBlock->pCursor = (char*)pBlock + BLOCK_HEADER_SIZE;
+		++m_stats.nBlocksAllocated;
+		return pBlock;
+	}
+	// makes a fresh block current, retiring the old one
+	inline bool nextBlock()
+	{
+		_block* pBlock = m_pSpare;
+		if (pBlock != nullptr)
+		{
+			unlink(m_pSpare, pBlock);
+			--m_nSpare;
+		}
+		else if ((pBlock = newBlock(BLOCK_SIZE)) == nullptr)
+			return false;
+		if (m_pCurrent != nullptr) retire(m_pCurrent);
+		m_pCurrent = pBlock;
+		m_pLast = nullptr;
+		return true;
+	}
+	// large allocations get a block of their own, that is released as soon as the allocation is
+	inline void* acquireDedicated(size_t size)
+	{
+		_block* pBlock = newBlock(BLOCK_HEADER_SIZE + CHUNK_HEADER_SIZE + ALIGNMENT + size);
+		if (pBlock == nullptr) return nullptr;
+		char* pPayload = payloadAt(pBlock);
+		((int*)pPayload)[-1] = -(int)(pPayload - (char*)pBlock);
+		((int*)pPayload)[-2] = (int)size;
+		pBlock->nLive = 1;
+		push(m_pRetired, pBlock);
+		++m_stats.nAcquired;
+		return pPayload;
+	}
+	inline void retire(_block* pBlock)
+	{
+		if (pBlock->nLive <= 0)
+			recycle(pBlock);
+		else
+			push(m_pRetired, pBlock);
+	}
+	inline void onBlockDrained(_block* pBlock)
+	{
+		if (pBlock == m_pCurrent)	// reset the whole block in one step
+		{
+			pBlock->pCursor = (char*)pBlock + BLOCK_HEADER_SIZE;
+			m_pLast = nullptr;
+			++m_stats.nResets;
+			return;
+		}
+		unlink(m_pRetired, pBlock);
+		recycle(pBlock);
+	}
+	inline void recycle(_block* pBlock)
+	{
+		if (pBlock->nSize != BLOCK_SIZE || m_nSpare >= MAX_SPARE_BLOCKS)
+		{
+			free(pBlock);
+			return;
+		}
+		pBlock->pCursor = (char*)pBlock + BLOCK_HEADER_SIZE;
+		push(m_pSpare, pBlock);
+		++m_nSpare;
+	}
+	static inline void push(_block*& pHead, _block* pBlock)
+	{
+		pBlock->pPrev = nullptr;
+		pBlock->pNext = pHead;
+		if (pHead != nullptr) pHead->pPrev = pBlock;
+		pHead = pBlock;
+	}
+	static inline void unlink(_block*& pHead, _block* pBlock)
+	{
+		if (pBlock->pPrev != nullptr) pBlock->pPrev->pNext = pBlock->pNext; else pHead = pBlock->pNext;
+		if (pBlock->pNext != nullptr) pBlock->pNext->pPrev = pBlock->pPrev;
+		pBlock->pPrev = pBlock->pNext = nullptr;
+	}
+};
+
 // bufPoolChunk allocates memory of any size. Internally it rounds up sizes
 // to some fixed numbers and maintains separate queues for each size. Unlike
 // bufPoolT, this does not construct any objects on the allocated memory.
-// Each allocated chunk of requested size is prepended with a size variable
-// that indicates which size-queue this chunk belongs to. Caller may not know
-// that more memory is allocated than requested. But repeated calls for similar
-// sizes all will end-up returning the same block (since sizes are rounded up
-// to nearest page size).
+// The chunks of up to bufSlabs::MAX_SLOT_SIZE are cut from slabs, back to back:
+// they carry no header (the slab tells their size), start aligned to their size
+// class (1K multiples) and are contiguous with their neighbours. The larger ones
+// are allocated one by one, prepended with a size variable, and aligned to the
+// cache line. Caller may not know that more memory is allocated than requested.
+// But repeated calls for similar sizes all will end-up returning the same block
+// (since sizes are rounded up to nearest page size). The free chunks are trimmed
+// and capped per size (see bufPoolT): the pages of the slab chunks go back to the
+// OS (see bufSlabs::trim(): the pages the small ones share go with the last of their
+// chunks), the chunks themselves stay for reuse. Every class is capped. A chunk can
+// have several owners (see addRef()): it goes back to the pool with the last.
 struct bufPoolChunk
 {
 protected:
+	typedef std::deque<void*> TQueue; // per-thread (see BUFPOOL_THREAD_LOCAL), so needs no synchronization
+	enum { LARGE_HEADER_SIZE = 3 * sizeof(int) };	// [reference count][offset from the allocation][size] precede the large chunks
+	static constexpr uint32_t REFS_SHARED = 0x80000000u, REFS_COUNT = REFS_SHARED - 1;	// the count is atomic once shared across threads
+	struct _sizeClass
+	{
+		TQueue	freeQ;
+		TQueue	trimmedQ;			// the slab chunks whose pages went back to the OS
+		char*	pNextSlot = nullptr;	// the chunks not yet handed out of the latest slab
+		char*	pSlabEnd = nullptr;
+		size_t	nInUse = 0;
+		size_t	nHighWater = 0;
+		size_t	nFromOS = 0;
+		size_t	nTrimmed = 0;
+		size_t	nLowFree = 0;		// the fewest free since the last trim()
+		size_t	nMaxFree;
+		inline explicit _sizeClass(size_t argMaxFree) : nMaxFree(argMaxFree) { }
+	};
 	inline bufPoolChunk() {	}
 	inline ~bufPoolChunk()
 	{
 #if BUFPOOL_TRACK_MEMORY
-		for(auto sizedQ: inuseQ)
+		for(auto& sizedQ: inuseQ)
 			assert(sizedQ.second.size() <= 0); // this means some blocks are still in-use
 #endif
-		for (auto sizedQ : freeQ)
+		for (auto& sizeClass : m_classes)
+		{
+			_sizeClass& c = sizeClass.second;
+			uint32_t nSize = (uint32_t)sizeClass.first;
+			for (auto pBuf : c.freeQ)
+			{
+				if (bufSlabs::contains(pBuf))
+					bufSlabs::orphan(pBuf, nSize);	// the slabs outlive the pools
+				else
+					free((char*)pBuf - ((int*)pBuf)[-2]);
+			}
+			for (auto pBuf : c.trimmedQ)	// (counted out of their pages: the pools that adopt them know nothing of that)
+			{
+				bool bZeroed = bufSlabs::untrim(bufSlabs::headerOf(pBuf), pBuf);
+				bufSlabs::orphan((char*)pBuf, (char*)pBuf + nSize, nSize, bZeroed);
+			}
+			bufSlabs::orphan(c.pNextSlot, c.pSlabEnd, nSize, true);
+		}
+	}
+	inline size_t roundedSize(size_t size) const
+	{
+		return PAGE_ROUND_UP(std::max(size, (size_t)1), PAGE_SIZE_1K);
+	}
+	inline _sizeClass& classOf(size_t size)	// size: rounded
+	{
+		auto iter = m_classes.find(size);
+		if (iter == m_classes.end()) iter = m_classes.emplace(size, _sizeClass(m_nDefaultMaxFree)).first;
+		return iter->second;
+	}
+	// a new chunk: the next of the slab (or of a new slab), or one allocated on its own. bZeroed: it is all zeros
+	inline char* newChunk(_sizeClass& c, size_t nSize, bool& bZeroed)
+	{
+		bZeroed = false;
+		if (nSize <= bufSlabs::MAX_SLOT_SIZE)
 		{
-			for (auto pChunk : sizedQ.second)
-				free (pChunk);
+			char* pChunk = (m_nNumaNode < 0) ? (char*)bufSlabs::adopt((uint32_t)nSize, bZeroed) : nullptr;	// (the orphans may be on any node)
+			if (pChunk != nullptr) return pChunk;
+			if (c.pNextSlot >= c.pSlabEnd)
+			{
+				char* pSlab = bufSlabs::allocate((uint32_t)nSize, m_nNumaNode);
+				if (pSlab != nullptr)
+				{
+					c.pNextSlot = pSlab;
+					c.pSlabEnd = pSlab + bufSlabs::headerOf(pSlab)->nSlots * nSize;
+				}
+			}
+			if (c.pNextSlot < c.pSlabEnd)
+			{
+				pChunk = c.pNextSlot;
+				c.pNextSlot += nSize;
+				bZeroed = true;		// never touched since mapped
+				return pChunk;
+			}
 		}
+		// large (or out of slabs): allocated on its own, aligned to the cache line
+		char* pAlloc = (char*)malloc(nSize + LARGE_HEADER_SIZE + bufSlabs::CACHE_LINE);
+		if (pAlloc == nullptr) return nullptr;
+		char* pChunk = (char*)PAGE_ROUND_UP((uintptr_t)pAlloc + LARGE_HEADER_SIZE, (uintptr_t)bufSlabs::CACHE_LINE);
+		new (pChunk - LARGE_HEADER_SIZE) std::atomic<uint32_t>(0);
+		((int*)pChunk)[-2] = (int)(pChunk - pAlloc);
+		((int*)pChunk)[-1] = (int)nSize;
+		return pChunk;
 	}
-	inline size_t roundedSize(size_t size)
+	// the reference count of a chunk (of the slab, or a large one if pSlab is nullptr)
+	static inline std::atomic<uint32_t>& refsOf(void* pBuf, bufSlabs::header* pSlab)
 	{
-		return PAGE_ROUND_UP(size, PAGE_SIZE_1K);
+		return pSlab ? bufSlabs::refsOf(pBuf, pSlab) : *(std::atomic<uint32_t>*)((char*)pBuf - LARGE_HEADER_SIZE);
+	}
+	// drops an owner of the chunk. Returns true for the last one (the chunk is free to go back)
+	static inline bool dropRef(void* pBuf, bufSlabs::header* pSlab)
+	{
+		std::atomic<uint32_t>& refs = refsOf(pBuf, pSlab);
+		uint32_t nRefs = refs.load(std::memory_order_relaxed);
+		if (nRefs & REFS_SHARED)
+		{
+			nRefs = refs.fetch_sub(1, std::memory_order_acq_rel);
+			if ((nRefs & REFS_COUNT) != 0) return false;
+			refs.store(0, std::memory_order_relaxed);	// (the last owner: no one else looks)
+			return true;
+		}
+		if (nRefs == 0) return true;
+		refs.store(nRefs - 1, std::memory_order_relaxed);
+		return false;
+	}
+	// gives the chunk back to the OS: the pages of a slab chunk (the chunk is kept), or the whole of a large one
+	static inline void giveBack(_sizeClass& c, void* pBuf, size_t nSize)
+	{
+		bufSlabs::header* pSlab = bufSlabs::headerOf(pBuf);
+		if (pSlab != nullptr)
+		{
+			bufSlabs::trim(pSlab, pBuf);	// (the pages it shares go back with the last of their chunks)
+			c.trimmedQ.push_back(pBuf);
+		}
+		else
+			free((char*)pBuf - ((int*)pBuf)[-2]);
+		++c.nTrimmed;
+	}
+	static inline void giveBackOldest(_sizeClass& c, size_t nSize, size_t nCount)
+	{
+		for (size_t i = 0; i < nCount; ++i)
+		{
+			void* pBuf = c.freeQ.back();	// the least recently released
+			c.freeQ.pop_back();
+			giveBack(c, pBuf, nSize);
+		}
+	}
+	// the size class of a chunk (not of an arena buffer)
+	static inline size_t sizeOf(const void* pBuf)
+	{
+		bufSlabs::header* pSlab = bufSlabs::headerOf(pBuf);
+		return pSlab ? pSlab->nSlotSize : ((const int*)pBuf)[-1];
 	}
 	// we use this bufPoolChunk_singleton template class for two reasons:
 	// 1. function based static initialized singletons are costly in C++14 (TLS based syncs)
@@ -126,7 +939,7 @@ protected:
 	//    No point in maintaining a whole CPP file just for a static variable. Static vars
 	//    in a template-class can be defined directly in the header. So, we take that shortcut.
 	template<typename T>
-	struct bufPoolChunk_singleton { static bufPoolChunk s_obj; };
+	struct bufPoolChunk_singleton { static BUFPOOL_STORAGE bufPoolChunk s_obj; };
 public:
 	static inline bufPoolChunk& getObject()
 	{
@@ -134,66 +947,172 @@ public:
 	}
 	inline void* acquire(int size)
 	{
-		size = roundedSize(size) + sizeof(int);	// round to a size so that we can group multiple nearby sizes into single queue
-		void* pChunk = nullptr;
-		TQueue& queue = freeQ[size];
+		size_t nSize = roundedSize(size);	// round to a size so that we can group multiple nearby sizes into single queue
+		char* pBuf = nullptr;
+		bool bZeroed = false;
+		_sizeClass& c = classOf(nSize);
+		TQueue& queue = c.freeQ;
 		if (!queue.empty())
 		{
-			pChunk = queue.front();
+			pBuf = (char*)queue.front();
 			queue.pop_front();
+			if (queue.size() < c.nLowFree) c.nLowFree = queue.size();
+		}
+		else if (!c.trimmedQ.empty())	// the pages come back as they are touched
+		{
+			pBuf = (char*)c.trimmedQ.front();
+			c.trimmedQ.pop_front();
+			bZeroed = bufSlabs::untrim(bufSlabs::headerOf(pBuf), pBuf);
 		}
 		else	// no free buffer available - rely on the OS
 		{
-			pChunk = malloc(size);
-			if (pChunk == nullptr) return nullptr;
-			*((int*)pChunk) = size;
+			pBuf = newChunk(c, nSize, bZeroed);
+			if (pBuf == nullptr) return nullptr;
+			++c.nFromOS;
+			c.nLowFree = 0;
 		}
+		if (++c.nInUse > c.nHighWater) c.nHighWater = c.nInUse;
 #if BUFPOOL_TRACK_MEMORY
-		inuseQ[size].push_front(pChunk);
+		inuseQ[nSize].push_front(pBuf);
 #endif
 		// clear the buffer to zero before handing over to client
-		void *pBuf = (char*)pChunk + sizeof(int);
-		memset(pBuf, 0, size - sizeof(int));
+		if (!bZeroed) memset(pBuf, 0, nSize);
 		return pBuf;
 	}
 	inline void release(void* pBuf)
 	{
 		if (pBuf == nullptr) return;
-		void* pChunk = ((char*)pBuf - sizeof(int));
-		int size = *((int*)pChunk);
-		freeQ[size].push_front(pChunk);
+		bufSlabs::header* pSlab = bufSlabs::headerOf(pBuf);
+		if (!pSlab && ((int*)pBuf)[-1] < 0) { bufArena::release(pBuf); return; }
+		if (!dropRef(pBuf, pSlab)) return;	// the other owners still hold it
+		size_t nSize = pSlab ? pSlab->nSlotSize : ((int*)pBuf)[-1];
+		_sizeClass& c = classOf(nSize);	// (may be new here: released on a thread other than its own)
+		if (c.nInUse > 0) --c.nInUse;
+		if (c.freeQ.size() < c.nMaxFree)
+			c.freeQ.push_front(pBuf);
+		else
+			giveBack(c, pBuf, nSize);
 #if BUFPOOL_TRACK_MEMORY
-		TQueue& inuseQueue = inuseQ[size];
-		auto foundIter = std::find(inuseQueue.cbegin(), inuseQueue.cend(), pChunk);
+		TQueue& inuseQueue = inuseQ[nSize];
+		auto foundIter = std::find(inuseQueue.cbegin(), inuseQueue.cend(), pBuf);
 		assert(foundIter != inuseQueue.cend()); // if this fails, it means you are releasing a buffer that we did not allocate !!
 		inuseQueue.erase(foundIter);
 #endif
 	}
+	// Adds an owner to a buffer (a chunk, or an arena buffer, see bufArena::addRef()), so that several
+	// views into it (the messages of a read, or a message forwarded on several connections) can be
+	// handed out without copies. Each owner releases it once, and the chunk goes back to the pool with
+	// the last. The count is plain, for the owners on one loop, till bAcrossThreads makes it atomic for
+	// good: ask for it before an owner goes to another thread. The arena buffers stay on their loop
+	// (false for them, then). Returns false for nullptr.
+	static inline bool addRef(void* pBuf, bool bAcrossThreads = false)
+	{
+		if (pBuf == nullptr) return false;
+		bufSlabs::header* pSlab = bufSlabs::headerOf(pBuf);
+		if (!pSlab && ((int*)pBuf)[-1] < 0) return !bAcrossThreads && bufArena::addRef(pBuf);
+		std::atomic<uint32_t>& refs = refsOf(pBuf, pSlab);
+		uint32_t nRefs = refs.load(std::memory_order_relaxed);
+		if (nRefs & REFS_SHARED)
+			refs.fetch_add(1, std::memory_order_relaxed);
+		else	// (all the owners are on this thread yet)
+			refs.store((nRefs + 1) | (bAcrossThreads ? REFS_SHARED : 0u), std::memory_order_relaxed);
+		return true;
+	}
+	// the slabs mapped from now on prefer the memory of the NUMA node (-1: any). The loop threads
+	// pinned to a node set it (see place_loop_thread()), as the pool is theirs
+	inline void setNumaNode(int nNumaNode)
+	{
+		m_nNumaNode = nNumaNode;
+	}
+	inline int numaNode() const
+	{
+		return m_nNumaNode;
+	}
+	// the usable size of the buffer (its size class)
 	inline size_t allocatedSize(void* pBuf)
 	{
-		void* pChunk = ((char*)pBuf - sizeof(int));
-		return *((int*)pChunk);
+		if (bufArena::isArenaChunk(pBuf)) return bufArena::allocatedSize(pBuf);
+		return sizeOf(pBuf);
+	}
+	// gives back to the OS (up to nMaxBatch of) the free chunks that were not needed since the last
+	// trim(), of all the sizes. Returns the no. released
+	inline size_t trim(size_t nMaxBatch = (size_t)-1)
+	{
+		size_t nTrimmed = 0;
+		bool bFreed = false;	// (the large chunks go to the heap)
+		for (auto& sizeClass : m_classes)
+		{
+			_sizeClass& c = sizeClass.second;
+			size_t nTrim = std::min(std::min(c.nLowFree, c.freeQ.size()), nMaxBatch - nTrimmed);
+			giveBackOldest(c, sizeClass.first, nTrim);
+			nTrimmed += nTrim;
+			bFreed |= (nTrim > 0 && sizeClass.first > bufSlabs::MAX_SLOT_SIZE);
+			if (nTrimmed >= nMaxBatch)	// the rest of the unused stay candidates for the next trim()
+			{
+				c.nLowFree -= nTrim;
+				break;
+			}
+			c.nLowFree = c.freeQ.size();
+		}
+#if defined(__GLIBC__)
+		if (bFreed) malloc_trim(0);	// the heap keeps the freed pages otherwise
+#endif
+		return nTrimmed;
+	}
+	// keeps at most nMaxFree free chunks of the size (the rest go back to the OS as they are released)
+	inline void setMaxFree(int size, size_t nMaxFree)
+	{
+		size_t nSize = roundedSize(size);
+		_sizeClass& c = classOf(nSize);
+		c.nMaxFree = nMaxFree;
+		if (c.freeQ.size() > nMaxFree) giveBackOldest(c, nSize, c.freeQ.size() - nMaxFree);
+		c.nLowFree = std::min(c.nLowFree, c.freeQ.size());
+	}
+	// the cap of the free chunks of the sizes that have none set (see setMaxFree()), including those already in use
+	inline void setDefaultMaxFree(size_t nMaxFree)
+	{
+		m_nDefaultMaxFree = nMaxFree;
+		for (auto& sizeClass : m_classes)
+			setMaxFree((int)sizeClass.first, nMaxFree);
+	}
+	// occupancy of the chunks of the size (as given to acquire()), or of all of them (size < 0)
+	inline bufPoolStats stats(int size = -1) const
+	{
+		bufPoolStats s;
+		for (auto& sizeClass : m_classes)
+		{
+			if (size >= 0 && sizeClass.first != roundedSize(size)) continue;
+			const _sizeClass& c = sizeClass.second;
+			s.nInUse += c.nInUse;
+			s.nFree += c.freeQ.size();
+			s.nHighWater += c.nHighWater;
+			s.nFromOS += c.nFromOS;
+			s.nTrimmed += c.nTrimmed;
+			s.nBytesInUse += c.nInUse * sizeClass.first;
+			s.nBytesFree += c.freeQ.size() * sizeClass.first;
+		}
+		return s;
 	}
 #if BUFPOOL_TRACK_MEMORY
 	inline bool isInUse(const void* pBuf) const
 	{
 		if (pBuf == nullptr) return false;
-		void* pChunk = ((char*)pBuf - sizeof(int));
-		int size = *((int*)pChunk);
-		auto inUserIter = inuseQ.find(size);
+		if (bufArena::isArenaChunk(pBuf)) return bufArena::isInUse(pBuf);
+		auto inUserIter = inuseQ.find(sizeOf(pBuf));
 		if (inUserIter == inuseQ.cend()) return false;
 		const TQueue& inuseQueue = inUserIter->second;
-		return inuseQueue.cend() != std::find(inuseQueue.cbegin(), inuseQueue.cend(), pChunk);
+		return inuseQueue.cend() != std::find(inuseQueue.cbegin(), inuseQueue.cend(), pBuf);
 	}
 #endif
 protected:
-	typedef std::deque<void*> TQueue; //TODO: std::dequeue may not be thread-safe. Checkout any high-performance fast-inert/remove containers that are thread-safe.
-	std::map<size_t, TQueue> freeQ;
+	std::map<size_t, _sizeClass> m_classes;	// by the rounded size
+	size_t	m_nDefaultMaxFree = (size_t)-1;
+	int		m_nNumaNode = -1;
 #if BUFPOOL_TRACK_MEMORY
 	std::map<size_t, TQueue> inuseQ;
 #endif
 };
-template<typename T> bufPoolChunk bufPoolChunk::bufPoolChunk_singleton<T>::s_obj;
+template<typename T> BUFPOOL_STORAGE bufPoolChunk bufPoolChunk::bufPoolChunk_singleton<T>::s_obj;
 
 struct bufPool
 {
@@ -207,6 +1126,22 @@ struct bufPool
 	{
 		bufPoolT<T>::getObject().release(buf);
 	}
+	// trims the chunks and all the bufPoolT pools of the thread (nMaxBatch each). Returns the no. released
+	inline static size_t trim(size_t nMaxBatch = (size_t)-1)
+	{
+		size_t nTrimmed = bufPoolChunk::getObject().trim(nMaxBatch);
+		for (_bufPoolLink* pLink = _bufPoolList_singleton<void>::s_pHead; pLink != nullptr; pLink = pLink->pNext)
+			nTrimmed += (*pLink->pfnTrim)(nMaxBatch);
+		return nTrimmed;
+	}
+	// occupancy of the chunks and all the bufPoolT pools of the thread, together
+	inline static bufPoolStats stats()
+	{
+		bufPoolStats total = bufPoolChunk::getObject().stats();
+		for (_bufPoolLink* pLink = _bufPoolList_singleton<void>::s_pHead; pLink != nullptr; pLink = pLink->pNext)
+			(*pLink->pfnStats)(total);
+		return total;
+	}
 };
 
 #define _NEW(type)								bufPoolT<type>::getObject().acquire()
@@ -265,6 +1200,8 @@ public:
 		inline static bool isInUse(void* ptr) { return bufPoolChunk::getObject().isInUse(ptr); }
 	};
 #endif
+	inline unique_ptr()	// owns nothing (yet)
+	{ }
 	inline explicit unique_ptr(pointer ptr) : pChunk(ptr)
 	{
 #if BUFPOOL_TRACK_MEMORY 
@@ -284,4 +1221,83 @@ public:
 	_Myt& operator=(const _Myt&) = delete;
 };
 
+// buf_slice is a view into a pooled buffer (a chunk, or an arena buffer) that shares the ownership
+// of it: the copies and the slices of a view are owners too, and the buffer goes back to the pool
+// when the last of them is gone (see bufPoolChunk::addRef()). Useful to fan out one inbound message
+// to several listeners, or to forward it on several connections, without copies. A view is sent as
+//		client.send(slice.data(), slice.size(), release_send_buffer, slice.release());
+// The views counted on one loop are cheap (no atomics): use share_across_threads() for the one that
+// goes to another thread, after which the buffer is counted atomically (by all its views).
+struct buf_slice
+{
+	inline buf_slice()	// views nothing
+	{ }
+	// takes over the ownership of the buffer, and views len bytes at pData (which point into it)
+	inline buf_slice(unique_ptr<void> spOwner, char* pData, size_t len) : pOwner(spOwner.release()), pData(pData), nLen(len)
+	{ }
+	inline buf_slice(const buf_slice& other) : pOwner(other.pOwner), pData(other.pData), nLen(other.nLen)
+	{
+		bufPoolChunk::addRef(pOwner);
+	}
+	inline buf_slice(buf_slice&& other) : pOwner(other.pOwner), pData(other.pData), nLen(other.nLen)
+	{
+		other.pOwner = nullptr; other.pData = nullptr; other.nLen = 0;
+	}
+	inline ~buf_slice()
+	{
+		reset();
+	}
+	inline buf_slice& operator=(const buf_slice& other)
+	{
+		if (this != &other) { bufPoolChunk::addRef(other.pOwner); reset(); pOwner = other.pOwner; pData = other.pData; nLen = other.nLen; }
+		return *this;
+	}
+	inline buf_slice& operator=(buf_slice&& other)
+	{
+		if (this != &other) { reset(); std::swap(pOwner, other.pOwner); std::swap(pData, other.pData); std::swap(nLen, other.nLen); }
+		return *this;
+	}
+	inline explicit operator bool() const { return pOwner != nullptr; }
+	inline char* data() const { return pData; }
+	inline size_t size() const { return nLen; }
+	inline bool empty() const { return nLen == 0; }
+	inline void* owner() const { return pOwner; }
+	// a view of nLength bytes from nOffset of this one (up to its end), sharing the buffer
+	inline buf_slice slice(size_t nOffset, size_t nLength = (size_t)-1) const
+	{
+		buf_slice part(*this);
+		nOffset = std::min(nOffset, nLen);
+		part.pData += nOffset;
+		part.nLen = std::min(nLength, nLen - nOffset);
+		return part;
+	}
+	// a view that can be handed to another thread. The arena buffers do not leave their loop, so
+	// the view of one gets a chunk of its own (empty, if out of memory)
+	inline buf_slice share_across_threads() const
+	{
+		if (pOwner == nullptr) return buf_slice();
+		if (bufPoolChunk::addRef(pOwner, true)) return buf_slice(unique_ptr<void>(pOwner), pData, nLen);
+		char* pCopy = (char*)POOLED_ALLOC((int)nLen);
+		if (pCopy == nullptr) return buf_slice();
+		memcpy(pCopy, pData, nLen);
+		return buf_slice(unique_ptr<void>(pCopy), pCopy, nLen);
+	}
+	// yields the ownership (the view stays as it is, for the send), to be released with POOLED_FREE()
+	inline void* release()
+	{
+		void* p = pOwner;
+		pOwner = nullptr;
+		return p;
+	}
+	inline void reset()
+	{
+		if (pOwner != nullptr) POOLED_FREE(pOwner);
+		pOwner = nullptr; pData = nullptr; nLen = 0;
+	}
+protected:
+	void*	pOwner = nullptr;	// the buffer, one reference of it
+	char*	pData = nullptr;
+	size_t	nLen = 0;
+};
+
 #endif // !_BUFPOOL_H__CBA8E586_437B_491E_B3BC_2C039526D9FD__
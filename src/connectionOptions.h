@@ -0,0 +1,200 @@
+/*
+	Copyright (c) 2016 Cenacle Research India Private Limited
+*/
+
+#ifndef _CONNECTIONOPTIONS_H__Guid__A4F1D6C2_8B37_4E0A_9C5D_2E7B10F84A93___
+#define _CONNECTIONOPTIONS_H__Guid__A4F1D6C2_8B37_4E0A_9C5D_2E7B10F84A93___
+
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include "uv.h"
+#include "bufPool.h"
+#if !defined(_WIN32)
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <unistd.h>
+#endif
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#endif
+
+namespace DSCPP
+{
+	// The socket and loop options of the client connections. The IO handlers apply them to every
+	// socket they open (the reconnects included), before connecting (see set_options() of the handlers).
+	// 0 (or -1 for nCpu) leaves the system default.
+	struct _connectionOptions
+	{
+		bool	bNoDelay = false;		// TCP_NODELAY: the small messages (acks, rpc replies) go out without the Nagle delay
+		int		nSendBufSize = 0;		// SO_SNDBUF in bytes
+		int		nRecvBufSize = 0;		// SO_RCVBUF in bytes (the receive window scales with it)
+		bool	bQuickAck = false;		// TCP_QUICKACK (Linux): acks without delay. The kernel drops it, so it is set again after every read
+		int		nNotSentLowat = 0;		// TCP_NOTSENT_LOWAT (Linux, macOS): limits the unsent bytes queued in the kernel
+		size_t	nReadBufferSize = 0;	// space offered to a read (0: the handler's default)
+		int		nCpu = -1;				// pins the thread that runs the loop to this core
+		int		nNumaNode = -1;			// pins the thread that runs the loop to the cores of this NUMA node (unless nCpu),
+										// and backs its buffer pool with the node's memory (the node of nCpu, if only that is set)
+	};
+
+	inline bool set_quickack(uv_os_sock_t fd)
+	{
+#ifdef TCP_QUICKACK
+		int nOn = 1;
+		return setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, (const char*)&nOn, sizeof(nOn)) == 0;
+#else
+		return false;
+#endif
+	}
+
+	// sets the socket level options on fd. Returns the number of options that could not be set.
+	inline int apply_socket_options(uv_os_sock_t fd, const _connectionOptions& options)
+	{
+		int nFailed = 0;
+		int nOn = 1;
+		if (options.bNoDelay && setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (const char*)&nOn, sizeof(nOn)) != 0) nFailed++;
+		if (options.nSendBufSize > 0 && setsockopt(fd, SOL_SOCKET, SO_SNDBUF, (const char*)&options.nSendBufSize, sizeof(int)) != 0) nFailed++;
+		if (options.nRecvBufSize > 0 && setsockopt(fd, SOL_SOCKET, SO_RCVBUF, (const char*)&options.nRecvBufSize, sizeof(int)) != 0) nFailed++;
+		if (options.bQuickAck && !set_quickack(fd)) nFailed++;
+		if (options.nNotSentLowat > 0)
+		{
+#ifdef TCP_NOTSENT_LOWAT
+			if (setsockopt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, (const char*)&options.nNotSentLowat, sizeof(int)) != 0) nFailed++;
+#else
+			nFailed++;
+#endif
+		}
+		return nFailed;
+	}
+
+	// pins the calling thread to the given core. Returns false if that is not supported (or fails).
+	inline bool pin_thread_to_cpu(int nCpu)
+	{
+#if defined(_WIN32)
+		return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << nCpu) != 0;
+#elif defined(__linux__)
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(nCpu, &cpus);
+		return pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0;
+#else
+		return false;
+#endif
+	}
+
+	// NUMA placement (no libnuma needed: sysfs and the syscalls on Linux). The nodes are numbered from 0; -1 is unknown.
+	enum { MAX_NUMA_NODES = 64 };
+
+	// no. of NUMA nodes (1 on the machines without NUMA)
+	inline int numa_node_count()
+	{
+#if defined(_WIN32)
+		ULONG nHighest = 0;
+		return GetNumaHighestNodeNumber(&nHighest) ? (int)nHighest + 1 : 1;
+#elif defined(__linux__)
+		char szPath[64];
+		int nNodes = 0;
+		for (; nNodes < MAX_NUMA_NODES; ++nNodes)
+		{
+			snprintf(szPath, sizeof(szPath), "/sys/devices/system/node/node%d", nNodes);
+			if (access(szPath, F_OK) != 0) break;
+		}
+		return nNodes > 0 ? nNodes : 1;
+#else
+		return 1;
+#endif
+	}
+	// the NUMA node of the core
+	inline int numa_node_of_cpu(int nCpu)
+	{
+#if defined(_WIN32)
+		PROCESSOR_NUMBER proc = { (WORD)(nCpu / 64), (BYTE)(nCpu % 64), 0 };
+		USHORT nNode = 0;
+		return GetNumaProcessorNodeEx(&proc, &nNode) ? (int)nNode : -1;
+#elif defined(__linux__)
+		char szPath[80];
+		for (int nNode = 0; nNode < MAX_NUMA_NODES; ++nNode)
+		{
+			snprintf(szPath, sizeof(szPath), "/sys/devices/system/cpu/cpu%d/node%d", nCpu, nNode);
+			if (access(szPath, F_OK) == 0) return nNode;
+		}
+		return numa_node_count() == 1 ? 0 : -1;
+#else
+		return 0;
+#endif
+	}
+	// the NUMA node the calling thread runs on (now: it may move, unless pinned)
+	inline int numa_current_node()
+	{
+#if defined(_WIN32)
+		PROCESSOR_NUMBER proc;
+		GetCurrentProcessorNumberEx(&proc);
+		USHORT nNode = 0;
+		return GetNumaProcessorNodeEx(&proc, &nNode) ? (int)nNode : -1;
+#elif defined(__linux__) && defined(SYS_getcpu)
+		unsigned nCpu = 0, nNode = 0;
+		return syscall(SYS_getcpu, &nCpu, &nNode, nullptr) == 0 ? (int)nNode : -1;
+#else
+		return 0;
+#endif
+	}
+	// the NUMA node of the memory page at the address (which must have been touched), -1 if not known
+	inline int numa_node_of_address(const void* p)
+	{
+#if defined(__linux__) && defined(SYS_get_mempolicy)
+		int nNode = -1;
+		return syscall(SYS_get_mempolicy, &nNode, nullptr, 0, p, MPOL_F_NODE | MPOL_F_ADDR) == 0 ? nNode : -1;
+#else
+		(void)p;
+		return -1;
+#endif
+	}
+	// pins the calling thread to the cores of the NUMA node. Returns false if that is not supported (or fails).
+	inline bool pin_thread_to_numa_node(int nNode)
+	{
+#if defined(_WIN32)
+		GROUP_AFFINITY affinity = {};
+		return GetNumaNodeProcessorMaskEx((USHORT)nNode, &affinity) && SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr);
+#elif defined(__linux__)
+		char szPath[64], szList[1024];
+		snprintf(szPath, sizeof(szPath), "/sys/devices/system/node/node%d/cpulist", nNode);
+		FILE* pFile = fopen(szPath, "r");
+		if (pFile == nullptr) return false;
+		bool bRead = fgets(szList, sizeof(szList), pFile) != nullptr;
+		fclose(pFile);
+		if (!bRead) return false;
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		for (char* p = szList; *p >= '0' && *p <= '9'; )	// "0-3,8-11"
+		{
+			int nFirst = (int)strtol(p, &p, 10), nLast = nFirst;
+			if (*p == '-') nLast = (int)strtol(p + 1, &p, 10);
+			for (int nCpu = nFirst; nCpu <= nLast && nCpu < CPU_SETSIZE; ++nCpu) CPU_SET(nCpu, &cpus);
+			if (*p == ',') ++p;
+		}
+		return CPU_COUNT(&cpus) > 0 && pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0;
+#else
+		return false;
+#endif
+	}
+	// places the calling thread (the loop's) as the options say: pins it, and gives its buffer pool the
+	// memory of its node. Returns the node (-1 if not known). Called by the IO handlers as their loop starts.
+	inline int place_loop_thread(const _connectionOptions& options)
+	{
+		int nNode = options.nNumaNode;
+		if (options.nCpu >= 0)
+		{
+			pin_thread_to_cpu(options.nCpu);
+			if (nNode < 0) nNode = numa_node_of_cpu(options.nCpu);
+		}
+		else if (nNode >= 0)
+			pin_thread_to_numa_node(nNode);
+		if (nNode >= 0) bufPoolChunk::getObject().setNumaNode(nNode);
+		return (nNode >= 0) ? nNode : numa_current_node();
+	}
+} // namespace DSCPP
+
+#endif // _CONNECTIONOPTIONS_H__Guid__A4F1D6C2_8B37_4E0A_9C5D_2E7B10F84A93___
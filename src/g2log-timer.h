@@ -24,6 +24,17 @@ namespace g2 {
 		return tm_snapshot;
 	}
 
+	tm gmtime(const std::time_t& time)
+	{
+		std::tm tm_snapshot;
+#if (defined(WIN32) || defined(_WIN32) || defined(__WIN32__))
+		gmtime_s(&tm_snapshot, &time);
+#else
+		gmtime_r(&time, &tm_snapshot); // POSIX  
+#endif
+		return tm_snapshot;
+	}
+
 
 	// To simplify things the return value is just a string. I.e. by design!  
 	std::string put_time(const std::tm* date_time, const char* c_time_format)
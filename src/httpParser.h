@@ -0,0 +1,176 @@
+/*
+	Copyright (c) 2016 Cenacle Research India Private Limited
+*/
+
+#ifndef _HTTPPARSER_H__Guid__3D8A6F21_C47B_4E19_9B52_7E0D14A6C8B3___
+#define _HTTPPARSER_H__Guid__3D8A6F21_C47B_4E19_9B52_7E0D14A6C8B3___
+
+#include <cstring>
+#include <algorithm>
+#include "trie_array.h"
+
+struct _knownStrings
+{
+	enum { MAX_HTTPVERB_STRLEN = 16 };
+	enum VERBS { VERB_CONNECT=0, VERB_DELETE, VERB_GET, VERB_HEAD, VERB_OPTIONS, VERB_POST, VERB_PUT, VERB_TRACE };
+	trie_prefixed_hash http_verbs;
+
+	inline _knownStrings()
+	{
+		//Note: SPACE is important after the verb (for prefix matching correctly). This list should match the enum VERBS above
+		const char* verbs[] = { "CONNECT ", "DELETE ", "GET ", "HEAD ", "OPTIONS ", "POST ", "PUT ", "TRACE " };
+		http_verbs.hash(verbs, sizeof(verbs) / sizeof(verbs[0]));
+	}
+};
+
+// case-insensitive comparison of ASCII header names
+inline bool header_name_equals(const char* pName, size_t nameLen, const char* szKnown, size_t knownLen)
+{
+	if (nameLen != knownLen) return false;
+	for (size_t i = 0; i < nameLen; ++i)
+		if ((pName[i] | 0x20) != (szKnown[i] | 0x20)) return false;
+	return true;
+}
+
+// A parsed request. All pointers point into the receive buffer of the connection, and are valid
+// only during the route handler call.
+struct _httpRequest
+{
+	int			verb;			// one of _knownStrings::VERBS
+	const char*	uri;
+	size_t		uriLen;
+	const char*	body;
+	size_t		bodyLen;
+	bool		bKeepAlive;		// HTTP/1.1 default, unless "Connection: close" (HTTP/1.0: only on "Connection: keep-alive")
+};
+
+struct _httpStaticResponse
+{
+	const char*	szStatus;
+	const char*	szContentType;
+	const char*	pBody;
+	size_t		bodyLen;
+};
+
+// The responses that do not change across requests (other than their Date). Each server loop
+// serializes them once into its _httpResponseCache, and the handlers refer to them by id.
+struct _httpStaticResponses
+{
+	enum { MAX_RESPONSES = 32 };
+	enum IDS { RESP_NONE = -1, RESP_OK = 0, RESP_HELLO, RESP_BAD_REQUEST, RESP_NOT_FOUND, RESP_METHOD_NOT_ALLOWED, RESP_LENGTH_REQUIRED,
+		RESP_PAYLOAD_TOO_LARGE, RESP_URI_TOO_LONG, RESP_HEADERS_TOO_LARGE, RESP_INTERNAL_ERROR, RESP_VERSION_NOT_SUPPORTED };
+	_httpStaticResponse	responses[MAX_RESPONSES];
+	int					nResponses = 0;
+
+	inline _httpStaticResponses()
+	{
+		//Note: This list should match the enum IDS above
+		add("200 OK", "text/plain", "OK", 2);
+		add("200 OK", "text/html", "Hello World!!  ", 15);
+		add("400 Bad Request", "text/plain", "", 0);
+		add("404 Not Found", "text/plain", "Not Found", 9);
+		add("405 Method Not Allowed", "text/plain", "", 0);
+		add("411 Length Required", "text/plain", "", 0);
+		add("413 Payload Too Large", "text/plain", "", 0);
+		add("414 URI Too Long", "text/plain", "", 0);
+		add("431 Request Header Fields Too Large", "text/plain", "", 0);
+		add("500 Internal Server Error", "text/plain", "", 0);
+		add("505 HTTP Version Not Supported", "text/plain", "", 0);
+	}
+	// registers a response. Should be called before the servers start. Returns the id, or -1 if full
+	inline int add(const char* szStatus, const char* szContentType, const char* pBody, size_t bodyLen)
+	{
+		if (nResponses >= MAX_RESPONSES) return RESP_NONE;
+		_httpStaticResponse& r = responses[nResponses];
+		r.szStatus = szStatus;
+		r.szContentType = szContentType;
+		r.pBody = pBody;
+		r.bodyLen = bodyLen;
+		return nResponses++;
+	}
+};
+
+// _httpParser: the request parsing of the server connections, over their receive buffers in place.
+//	The requests can arrive split across reads and pipelined back to back: findHeadersEnd() resumes
+//	the search from where the earlier one stopped, and parse() tells a request apart from the next
+//	by its Content-Length. Chunked request bodies are not supported.
+struct _httpParser
+{
+	enum { MAX_HEADER_COUNT = 24 };
+	const _knownStrings&	strings;
+	size_t					nMaxURLLen;
+	size_t					nMaxRequestLen;		// headers and body (the receive buffer size)
+
+	// Returns the end of the headers (past the blank line) of the request in pReq[0, nAvail), or
+	// nullptr if they are not complete yet. nScanned is the no. of bytes of pReq searched already
+	// (by the earlier calls on the same request): it is updated for the next call on failure.
+	static inline const char* findHeadersEnd(const char* pReq, size_t nAvail, size_t& nScanned)
+	{
+		size_t nFrom = (nScanned > 3) ? (nScanned - 3) : 0;	// (the blank line can straddle the reads)
+		for (const char* p = pReq + nFrom; p + 4 <= pReq + nAvail; ++p)
+		{
+			p = (const char*)memchr(p, '\r', pReq + nAvail - p);
+			if (p == nullptr || p + 4 > pReq + nAvail) break;
+			if (p[1] == '\n' && p[2] == '\r' && p[3] == '\n') return p + 4;
+		}
+		nScanned = nAvail;
+		return nullptr;
+	}
+	// parses the request line and headers. Returns the static error response on failure (RESP_NONE on success).
+	// Sets nRequestLen to the full length (headers + body), or 0 if the body is not complete.
+	inline int parse(const char* pReq, const char* pHeadersEnd, size_t nAvail, _httpRequest& req, size_t& nRequestLen) const
+	{
+		size_t keyLen = std::min((size_t)_knownStrings::MAX_HTTPVERB_STRLEN, (size_t)(pHeadersEnd - pReq));
+		req.verb = strings.http_verbs.prefixMatch(pReq, keyLen);
+		if (req.verb < 0) return _httpStaticResponses::RESP_METHOD_NOT_ALLOWED;
+
+		req.uri = pReq + keyLen;
+		const char* pLineEnd = (const char*)memchr(req.uri, '\r', pHeadersEnd - req.uri);
+		const char* pSpace = (const char*)memchr(req.uri, ' ', std::min((size_t)(pLineEnd - req.uri), nMaxURLLen + 1));
+		if (pSpace == nullptr)	// (too long only if the search stopped short of the line end)
+			return ((size_t)(pLineEnd - req.uri) > nMaxURLLen) ? _httpStaticResponses::RESP_URI_TOO_LONG : _httpStaticResponses::RESP_BAD_REQUEST;
+		req.uriLen = pSpace - req.uri;
+
+		const char* pVersion = pSpace + 1;
+		if (pLineEnd - pVersion != 8 || memcmp(pVersion, "HTTP/1.", 7) != 0) return _httpStaticResponses::RESP_VERSION_NOT_SUPPORTED;
+		req.bKeepAlive = (pVersion[7] == '1');
+
+		size_t nContentLength = 0;
+		int nHeaders = 0;
+		for (const char* pLine = pLineEnd + 2; pLine < pHeadersEnd - 2; pLine = pLineEnd + 2)
+		{
+			pLineEnd = (const char*)memchr(pLine, '\r', pHeadersEnd - pLine);
+			if (++nHeaders > MAX_HEADER_COUNT) return _httpStaticResponses::RESP_HEADERS_TOO_LARGE;
+			const char* pColon = (const char*)memchr(pLine, ':', pLineEnd - pLine);
+			if (pColon == nullptr) return _httpStaticResponses::RESP_BAD_REQUEST;
+			const char* pValue = pColon + 1;
+			while (pValue < pLineEnd && *pValue == ' ') ++pValue;
+			size_t valueLen = pLineEnd - pValue;
+			if (header_name_equals(pLine, pColon - pLine, "Connection", 10))
+			{
+				if (header_name_equals(pValue, valueLen, "close", 5)) req.bKeepAlive = false;
+				else if (header_name_equals(pValue, valueLen, "keep-alive", 10)) req.bKeepAlive = true;
+			}
+			else if (header_name_equals(pLine, pColon - pLine, "Content-Length", 14))
+			{
+				nContentLength = 0;
+				for (const char* p = pValue; p < pLineEnd; ++p)
+				{
+					if (*p < '0' || *p > '9') return _httpStaticResponses::RESP_BAD_REQUEST;
+					nContentLength = nContentLength * 10 + (*p - '0');
+					if (nContentLength > nMaxRequestLen) return _httpStaticResponses::RESP_PAYLOAD_TOO_LARGE;
+				}
+			}
+			else if (header_name_equals(pLine, pColon - pLine, "Transfer-Encoding", 17))
+				return _httpStaticResponses::RESP_LENGTH_REQUIRED;	// chunked request bodies are not supported
+		}
+		size_t nHeadersLen = pHeadersEnd - pReq;
+		if (nHeadersLen + nContentLength > nMaxRequestLen) return _httpStaticResponses::RESP_PAYLOAD_TOO_LARGE;
+		req.body = pHeadersEnd;
+		req.bodyLen = nContentLength;
+		nRequestLen = (nHeadersLen + nContentLength <= nAvail) ? nHeadersLen + nContentLength : 0;
+		return _httpStaticResponses::RESP_NONE;
+	}
+};
+
+#endif // _HTTPPARSER_H__Guid__3D8A6F21_C47B_4E19_9B52_7E0D14A6C8B3___
@@ -3,11 +3,41 @@
 */
 
 #include "dsclientbase.h"
+#include "connectionOptions.h"
 #include "trie_array.h"
+#include "httpParser.h"
+#include "timer_wheel.h"
 #include "g2log-timer.h"
 
 #if defined(WIN32) || defined(_WIN32)
 #define close(a) closesocket(a)
+#define SOCKET_WOULDBLOCK()	(WSAGetLastError() == WSAEWOULDBLOCK)
+typedef WSABUF IOVEC;
+inline char* iov_base(const IOVEC& v) { return v.buf; }
+inline size_t iov_len(const IOVEC& v) { return v.len; }
+inline void iov_set(IOVEC& v, const char* p, size_t len) { v.buf = (char*)p; v.len = (ULONG)len; }
+// gathered send. Returns the no. of bytes sent, or -1 on failure
+inline int send_iov(SOCKET s, IOVEC* pIov, int nIov)
+{
+	DWORD nSent = 0;
+	return (WSASend(s, pIov, nIov, &nSent, 0, NULL, NULL) == 0) ? (int)nSent : -1;
+}
+#else
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/uio.h>
+typedef int SOCKET;
+#define INVALID_SOCKET		(-1)
+#define SOCKET_WOULDBLOCK()	(errno == EWOULDBLOCK || errno == EAGAIN)
+typedef struct iovec IOVEC;
+inline char* iov_base(const IOVEC& v) { return (char*)v.iov_base; }
+inline size_t iov_len(const IOVEC& v) { return v.iov_len; }
+inline void iov_set(IOVEC& v, const char* p, size_t len) { v.iov_base = (void*)p; v.iov_len = len; }
+// gathered send. Returns the no. of bytes sent, or -1 on failure
+inline int send_iov(SOCKET s, IOVEC* pIov, int nIov)
+{
+	return (int)writev(s, pIov, nIov);
+}
 #endif
 
 inline std::string getTimestamp()
@@ -19,21 +49,27 @@ inline std::string getTimestamp()
 #include <map>
 #include <algorithm>
 #include <vector>
+#include <thread>
 
 
 
-enum Constants { RECV_BUF_SIZE = 8192, HTTP_MAX_HEADER_COUNT = 24  };
+enum Constants { HTTP_MAX_SEND_SEGMENTS = 64 };
 
 struct _Config
 {
 	bool nSocketNonBlocking = true;      // O_NONBLOCK option
 	bool nSocketReuse = true;            // SO_REUSEADDR option
+	bool nSocketReusePort = true;        // SO_REUSEPORT option (each server thread gets its own listener, kernel spreads the connections)
 	int nListenBacklog = 16;            // backlog for the listen socket
+	int nServerThreads = 0;				// no. of server threads, each with its own loop (0: one per hardware thread)
+	int nAcceptBatch = 64;				// max. connections accepted per readiness event (the rest are taken on the next loop iteration)
+	bool bNumaPlacement = false;		// spreads the server threads over the NUMA nodes: each runs on the cores of its node, with its buffers in the node's memory
 
-	int nClientTimeout = 15000;			// client timeout in milliseconds
+	int nClientTimeout = 15000;			// client timeout in milliseconds (idle time, refreshed on every activity)
+	int nTimerResolution = 100;			// granularity of the connection timeouts in milliseconds
 
 	int nRecvBufSize = 8192;			// socket receive buffer size 8kb (should be large enough to hold URL + Headers including cookies etc. all)
-	int nSendBufSize = 8192;			// socket send buffer size
+	int nSendBufSize = 8192;			// socket send buffer size (responses of pipelined requests are collected here, before sending)
 
 	int nMaxURLLen = 256;				// maximum URI Path in the HTTP Header
 } gConfigOptions;
@@ -55,6 +91,26 @@ inline void set_addrreuse(SOCKET sockfd, bool option = gConfigOptions.nSocketReu
 	setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, (char*)&val, sizeof(val));
 }
 
+// returns true if the listeners can share the port (SO_REUSEPORT is not available on Windows)
+inline bool set_portreuse(SOCKET sockfd, bool option = gConfigOptions.nSocketReusePort)
+{
+#ifdef SO_REUSEPORT
+	int val = option;
+	return setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, (char*)&val, sizeof(val)) == 0 && option;
+#else
+	return false;
+#endif
+}
+
+inline bool is_portreuse_supported()
+{
+#ifdef SO_REUSEPORT
+	return gConfigOptions.nSocketReusePort;
+#else
+	return false;
+#endif
+}
+
 SOCKET server_listen(const char* szHost, int port)
 {
 	SOCKET result = INVALID_SOCKET;
@@ -76,48 +132,295 @@ SOCKET server_listen(const char* szHost, int port)
 		set_nonblocking(listenFd);
 		// set SO_REUSEADDR so that it can be bound without waiting for any previously bound sockets to be closed
 		set_addrreuse(listenFd);
+		// set SO_REUSEPORT so that each server thread can bind its own listener to the same port
+		set_portreuse(listenFd);
 		// Bind and Listen for Servers
 		if (!bind(listenFd, pAddrInfo->ai_addr, pAddrInfo->ai_addrlen) && !listen(listenFd, gConfigOptions.nListenBacklog))
 		{
 			result = listenFd;
 		}
+		else if (listenFd != INVALID_SOCKET)
+			close(listenFd);
 	}
 	if (pAddrInfo) freeaddrinfo(pAddrInfo);
 	return result;
 }
 
-struct _knownStrings
+_knownStrings gKnownStrings;
+
+// The response of a route handler: either one of the static responses (see _httpStaticResponses),
+// which goes out pre-serialized from the response cache of the loop, or a dynamic response that
+// is collected into the send buffer of the connection (no allocations per request).
+struct _httpResponse
+{
+	enum { DATE_LINE_LEN = 37 };	// "Date: Sun, 06 Nov 1994 08:49:37 GMT\r\n"
+	char*		pBuf;
+	size_t		nCapacity;
+	size_t		nLen;
+	bool		bKeepAlive;
+	const char*	pDateLine;		// Date header of the loop (refreshed once a second)
+	int			nStaticId;		// static response to send (-1 for the dynamic response in pBuf)
+	bool		bHeadersOnly;	// response to a HEAD request: the headers (with the Content-Length of the body), no body
+
+	inline bool append(const char* pData, size_t len)
+	{
+		if (nLen + len > nCapacity) return false;
+		memcpy(pBuf + nLen, pData, len);
+		nLen += len;
+		return true;
+	}
+	inline bool append(const char* sz) { return append(sz, strlen(sz)); }
+	inline bool append(size_t n)
+	{
+		char digits[24]; int i = sizeof(digits);
+		do { digits[--i] = '0' + (n % 10); n /= 10; } while (n > 0);
+		return append(digits + i, sizeof(digits) - i);
+	}
+	// writes a complete response (the headers only, for HEAD). Returns false if the send buffer has no room for it
+	inline bool write(const char* szStatus, const char* szContentType, const char* pBody, size_t bodyLen)
+	{
+		size_t nOldLen = nLen;
+		bool bOK = append("HTTP/1.1 ") && append(szStatus)
+			&& append("\r\nServer: dscppclient\r\n") && append(pDateLine, DATE_LINE_LEN)
+			&& append("Content-Type: ") && append(szContentType)
+			&& append("\r\nContent-Length: ") && append(bodyLen)
+			&& append(bKeepAlive ? "\r\nConnection: keep-alive\r\n\r\n" : "\r\nConnection: close\r\n\r\n")
+			&& (bHeadersOnly || append(pBody, bodyLen));
+		if (!bOK) nLen = nOldLen;
+		return bOK;
+	}
+	// responds with a static response (by its id in gStaticResponses)
+	inline void writeStatic(int id)
+	{
+		nStaticId = id;
+	}
+};
+
+_httpStaticResponses gStaticResponses;
+
+// _httpResponseCache: the static responses of a server loop, serialized once in both the
+// keep-alive and close variants. The Date header is patched in place by refreshDate() (once a
+// second, from a loop timer), so the responses go out as they are, without any formatting.
+struct _httpResponseCache
+{
+	enum { DATE_VALUE_OFFSET = 6, DATE_VALUE_LEN = 29 };	// "Date: " + IMF-fixdate
+	struct _entry
+	{
+		size_t	offset;			// of the response in m_memory
+		size_t	len;
+		size_t	headersLen;		// of the response without its body (for HEAD)
+		size_t	dateOffset;		// of the Date value in m_memory
+	};
+protected:
+	std::vector<char>	m_memory;
+	_entry				m_entries[_httpStaticResponses::MAX_RESPONSES][2];	// [id][bKeepAlive]
+	int					m_nEntries = 0;
+	char				m_dateLine[_httpResponse::DATE_LINE_LEN + 1];
+	time_t				m_lastDate = 0;
+
+public:
+	inline _httpResponseCache()
+	{
+		memcpy(m_dateLine, "Date: Thu, 01 Jan 1970 00:00:00 GMT\r\n", sizeof(m_dateLine));
+	}
+	inline const char* dateLine() const { return m_dateLine; }
+
+	// serializes the static responses. Should be called before the loop starts.
+	inline void build(const _httpStaticResponses& statics, time_t now)
+	{
+		refreshDate(now);
+		m_memory.clear();
+		std::vector<char> buf;
+		for (m_nEntries = 0; m_nEntries < statics.nResponses; ++m_nEntries)
+		{
+			const _httpStaticResponse& r = statics.responses[m_nEntries];
+			for (int bKeepAlive = 0; bKeepAlive < 2; ++bKeepAlive)
+			{
+				buf.resize(256 + strlen(r.szStatus) + strlen(r.szContentType) + r.bodyLen);
+				_httpResponse resp = { buf.data(), buf.size(), 0, bKeepAlive != 0, m_dateLine, _httpStaticResponses::RESP_NONE, false };
+				resp.write(r.szStatus, r.szContentType, r.pBody, r.bodyLen);
+				const char* pDate = std::search(buf.data(), buf.data() + resp.nLen, m_dateLine, m_dateLine + DATE_VALUE_OFFSET);
+				_entry& e = m_entries[m_nEntries][bKeepAlive];
+				e.offset = m_memory.size();
+				e.len = resp.nLen;
+				e.headersLen = resp.nLen - r.bodyLen;
+				e.dateOffset = e.offset + (pDate - buf.data()) + DATE_VALUE_OFFSET;
+				m_memory.insert(m_memory.end(), buf.data(), buf.data() + resp.nLen);
+			}
+		}
+	}
+	// the serialized response (without its body, for HEAD). Valid till the next refreshDate() (copy it to hold it longer).
+	inline bool get(int id, bool bKeepAlive, bool bHeadersOnly, const char*& pResponse, size_t& len) const
+	{
+		if (id < 0 || id >= m_nEntries) return false;
+		const _entry& e = m_entries[id][bKeepAlive ? 1 : 0];
+		pResponse = m_memory.data() + e.offset;
+		len = bHeadersOnly ? e.headersLen : e.len;
+		return true;
+	}
+	// updates the Date of all the responses, if the second has changed
+	inline void refreshDate(time_t now)
+	{
+		if (now == m_lastDate) return;
+		m_lastDate = now;
+		static const char* days[] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+		static const char* months[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+		std::tm t = g2::gmtime(now);
+		char szDate[64];
+		snprintf(szDate, sizeof(szDate), "%s, %02d %s %04d %02d:%02d:%02d GMT", days[t.tm_wday], t.tm_mday, months[t.tm_mon], t.tm_year + 1900, t.tm_hour, t.tm_min, t.tm_sec);
+		memcpy(m_dateLine + DATE_VALUE_OFFSET, szDate, DATE_VALUE_LEN);
+		for (int i = 0; i < m_nEntries; ++i)
+			for (int j = 0; j < 2; ++j)
+				memcpy(&m_memory[m_entries[i][j].dateOffset], szDate, DATE_VALUE_LEN);
+	}
+};
+
+// Route handlers fill the response for the request. They are called on the loop thread.
+typedef void(*LPFN_HTTP_HANDLER)(const _httpRequest& req, _httpResponse& resp);
+
+// Routes are matched by the longest registered prefix of the URI ("/" catches everything else)
+struct _httpRoutes
 {
-	enum { MAX_HTTPVERB_STRLEN = 16 };
-	enum VERBS { VERB_CONNECT=0, VERB_DELETE, VERB_GET, VERB_HEAD, VERB_OPTIONS, VERB_POST, VERB_PUT, VERB_TRACE };
-	trie_prefixed_hash http_verbs;
+	enum { MAX_ROUTES = 32, MAX_ROUTE_DEPTH = 16 };
+	typedef trie_prefixed_array<LPFN_HTTP_HANDLER, static_array<LPFN_HTTP_HANDLER, MAX_ROUTES>> TRIE_ARRAY;
+	TRIE_ARRAY routes;
 
-	inline _knownStrings()
+	static void on_not_found(const _httpRequest& req, _httpResponse& resp)
+	{
+		resp.writeStatic(_httpStaticResponses::RESP_NOT_FOUND);
+	}
+	static void on_health(const _httpRequest& req, _httpResponse& resp)
+	{
+		resp.writeStatic(_httpStaticResponses::RESP_OK);
+	}
+	static void on_root(const _httpRequest& req, _httpResponse& resp)
 	{
-		//Note: SPACE is important after the verb (for prefix matching correctly). This list should match the enum VERBS above
-		const char* verbs[] = { "CONNECT ", "DELETE ", "GET ", "HEAD ", "OPTIONS ", "POST ", "PUT ", "TRACE " }; 
-		http_verbs.hash(verbs, sizeof(verbs) / sizeof(verbs[0]));
+		resp.writeStatic(_httpStaticResponses::RESP_HELLO);
 	}
-} gKnownStrings;
+	inline _httpRoutes()
+	{
+		add("/health", on_health);
+		add("/", on_root);
+	}
+	inline void add(const char* szPath, LPFN_HTTP_HANDLER handler)
+	{
+		routes.insertkv(szPath, strlen(szPath), handler);
+	}
+	inline LPFN_HTTP_HANDLER find(const char* uri, size_t uriLen) const
+	{
+		TRIE_ARRAY::TRIE::result_pair_type results[MAX_ROUTE_DEPTH];
+		return routes.prefixMatch(uri, uriLen, results, MAX_ROUTE_DEPTH, &on_not_found);
+	}
+} gHttpRoutes;
+
+struct _client;
 
+// _serverLoop: an event loop and the state shared by its connections. The loop timers run
+// only while there are connections, so that an idle loop does not wake up.
+struct _serverLoop
+{
+	uv_loop_t uvLoop;
+	_client* pClients = nullptr;       // the open connections
+	timer_wheel timers{ 0, (uint32_t)gConfigOptions.nTimerResolution };	// idle timeouts of all the connections
+	uv_timer_t timersTick;             // drives the wheel
+	_httpResponseCache responses;      // the static responses, serialized for this loop
+	uv_timer_t dateTick;               // refreshes the Date of the responses at every second
+
+	inline void init()
+	{
+		uv_loop_init(&uvLoop);
+		uv_timer_init(&uvLoop, &timersTick);
+		timersTick.data = (void*)this;
+		uv_timer_init(&uvLoop, &dateTick);
+		dateTick.data = (void*)this;
+		responses.build(gStaticResponses, time(NULL));
+	}
+	inline void closeTimers()
+	{
+		uv_timer_stop(&timersTick);
+		uv_close((uv_handle_t *)&timersTick, nullptr);
+		uv_timer_stop(&dateTick);
+		uv_close((uv_handle_t *)&dateTick, nullptr);
+	}
+	// starts the timers (if not already) for a new connection
+	inline void armTimers()
+	{
+		if (!uv_is_active((uv_handle_t *)&timersTick))
+		{
+			timers.advance(uv_now(&uvLoop));	// the wheel is empty, just catches up
+			uv_timer_start(&timersTick, onTimersTick, timers.resolution(), timers.resolution());
+		}
+		if (!uv_is_active((uv_handle_t *)&dateTick))
+			refreshDate();	// could be stale after an idle period
+	}
+	static void onTimersTick(uv_timer_t* pTimer)
+	{
+		_serverLoop* pLoop = (_serverLoop*)pTimer->data;
+		pLoop->timers.advance(uv_now(&pLoop->uvLoop));
+		if (pLoop->timers.empty()) uv_timer_stop(pTimer);	// no connections, no wake-ups
+	}
+	static void onDateTick(uv_timer_t* pTimer)
+	{
+		_serverLoop* pLoop = (_serverLoop*)pTimer->data;
+		if (pLoop->pClients != nullptr) pLoop->refreshDate();	// no connections, no wake-ups
+	}
+	// updates the Date of the responses, and arms the tick for the next second
+	inline void refreshDate()
+	{
+		// the second and the delay to the next one come from the same reading (time() can lag the wall clock)
+		int64_t nowMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+		responses.refreshDate((time_t)(nowMs / 1000));
+		uv_timer_start(&dateTick, onDateTick, 1000 - (uint64_t)(nowMs % 1000), 0);	// aligned to the wall clock, not the loop clock
+	}
+};
+
+// _client: a keep-alive HTTP/1.1 connection.
+//	+ Requests are parsed incrementally: the header terminator search resumes where the last read left off
+//	+ Pipelined requests are processed in order, and their responses are sent together with one writev
+//	+ Static responses are sent straight from the response cache of the loop (no copies). Dynamic
+//	  responses are collected into the send buffer, which is acquired once per connection.
+//	+ When the peer does not read fast enough, reading stops till the pending responses are sent
 struct _client
 {
 	SOCKET		clientFd;
 	uv_poll_t*	clientPoll;
-	uv_timer_t* timer;
-
-	inline _client(SOCKET clientFd, uv_loop_t* serverLoop)
+	_serverLoop* pLoop;
+	timer_wheel::entry idleTimer;
+
+	char*		pRecvBuf;
+	size_t		nRecvLen = 0;		// bytes in the receive buffer
+	size_t		nScanned = 0;		// bytes already searched for the end of headers
+	char*		pSendBuf;
+	size_t		nSendLen = 0;		// bytes of the send buffer taken by the queued dynamic responses
+	IOVEC		sendQueue[HTTP_MAX_SEND_SEGMENTS];	// the responses pending to be sent
+	int			nSegments = 0;
+	size_t		nQueuedBytes = 0;
+	char*		pPinned = nullptr;	// copy of the pending responses, made when the socket blocks
+	size_t		nPinnedSize = 0;
+	bool		bCloseAfterSend = false;
+	int			nPollEvents = 0;
+
+	_client*	pPrev = nullptr;	// links in the open connections of the loop (closed when the loop stops)
+	_client*	pNext = nullptr;
+
+	inline _client(SOCKET clientFd, _serverLoop* pLoop)
 	{
 		this->clientFd = clientFd;
+		this->pLoop = pLoop;
+		pNext = pLoop->pClients;
+		if (pNext != nullptr) pNext->pPrev = this;
+		pLoop->pClients = this;
+
+		this->pRecvBuf = (char*)POOLED_ALLOC(gConfigOptions.nRecvBufSize);
+		this->pSendBuf = (char*)POOLED_ALLOC(gConfigOptions.nSendBufSize);
+
 		this->clientPoll = _NEW(uv_poll_t);
-		uv_poll_init_socket(serverLoop, clientPoll, clientFd);
-		uv_poll_start(clientPoll, UV_READABLE, onReadable);
+		uv_poll_init_socket(&pLoop->uvLoop, clientPoll, clientFd);
 		clientPoll->data = (void*) this;
+		setPollEvents(UV_READABLE);
 
-		timer = _NEW(uv_timer_t);
-		uv_timer_init(serverLoop, timer);
-		uv_timer_start(timer, onTimeout, gConfigOptions.nClientTimeout, 0);
-		timer->data = (void*) this;
+		pLoop->timers.init(idleTimer, onTimeout, this);
+		pLoop->timers.schedule(idleTimer, gConfigOptions.nClientTimeout);
 	}
 	inline ~_client()
 	{
@@ -126,139 +429,330 @@ struct _client
 			_DELETE((uv_poll_t *)handle);
 		});
 
-		uv_timer_stop(timer);
-		uv_close((uv_handle_t *)timer, [](uv_handle_t *handle) {
-			_DELETE((uv_timer_t *)handle);
-		});
+		pLoop->timers.cancel(idleTimer);
 
 		close(this->clientFd);
+		POOLED_FREE(pRecvBuf);
+		POOLED_FREE(pSendBuf);
+		if (pPinned != nullptr) POOLED_FREE(pPinned);
+
+		if (pPrev != nullptr) pPrev->pNext = pNext; else pLoop->pClients = pNext;
+		if (pNext != nullptr) pNext->pPrev = pPrev;
+	}
+	inline void setPollEvents(int events)
+	{
+		if (events == nPollEvents) return;
+		nPollEvents = events;
+		uv_poll_start(clientPoll, events, onPollEvent);
 	}
-	static void onTimeout(uv_timer_t* pTimer)
+	static void onTimeout(timer_wheel::entry* pTimer)
 	{
 		_client* pClient = (_client*)pTimer->data;
 		_DELETE(pClient);
 	}
-	static void onReadable(uv_poll_t* clientPoll, int status, int events)
+	static void onPollEvent(uv_poll_t* clientPoll, int status, int events)
 	{
 		_client* pClient = (_client*)clientPoll->data;
-		if (status < 0) { _DELETE(pClient); return; }
-
-		char data[Constants::RECV_BUF_SIZE];
-		int size = recv(pClient->clientFd, data, Constants::RECV_BUF_SIZE, 0);
-		if (size <= 0) 
+		if (status < 0 || !pClient->onEvents(events))
+			_DELETE(pClient);
+	}
+	// returns false when the connection should be closed
+	inline bool onEvents(int events)
+	{
+		pLoop->timers.schedule(idleTimer, gConfigOptions.nClientTimeout);	// connection is active, push the idle timeout (O(1))
+		if (events & UV_WRITABLE)
+			return pump();	// resumes the requests held back for want of send buffer space
+		for (;;)
 		{
-			if (size == 0 || errno != EWOULDBLOCK)  /* Handle disconnect */
+			if (nRecvLen >= (size_t)gConfigOptions.nRecvBufSize)
 			{
-				_DELETE(pClient);
-				return;
+				sendError(_httpStaticResponses::RESP_HEADERS_TOO_LARGE);
+				return flush();
 			}
-			else // no more data
-				return;
+			int size = recv(clientFd, pRecvBuf + nRecvLen, gConfigOptions.nRecvBufSize - nRecvLen, 0);
+			if (size == 0) return false;	/* Handle disconnect */
+			if (size < 0) return SOCKET_WOULDBLOCK();	// no more data
+			nRecvLen += size;
+			if (!pump()) return false;
+			if (nSegments > 0) return true;	// peer is not reading, stop reading till it catches up
 		}
-
-		size_t keyLen = _knownStrings::MAX_HTTPVERB_STRLEN;
-		if(gKnownStrings.http_verbs.prefixMatch(data, keyLen) < 0) 
+	}
+	// responds to the buffered requests till they are exhausted or the socket cannot take more.
+	// Returns false when the connection should be closed.
+	inline bool pump()
+	{
+		for (;;)
 		{
-			char error[] = "HTTP/1.1 405 Method Not Allowed\r\n\r\n";
-			send(pClient->clientFd, error, strlen(error), 0);
-			_DELETE(pClient);
-			return;
+			size_t nPending = nRecvLen;
+			processRequests();
+			if (!flush()) return false;
+			if (nSegments > 0 || nRecvLen == nPending) return true;	// blocked on send, or no complete request left
 		}
-
-		char* pURI = data + keyLen;
-		char* pSpace = (char*)std::memchr(pURI, ' ', gConfigOptions.nMaxURLLen + 8);
-		if (pSpace == nullptr)
+	}
+	// parses and responds to all the complete requests in the receive buffer
+	inline void processRequests()
+	{
+		_httpParser parser = { gKnownStrings, (size_t)gConfigOptions.nMaxURLLen, (size_t)gConfigOptions.nRecvBufSize };
+		size_t nConsumed = 0;
+		while (!bCloseAfterSend && nConsumed < nRecvLen && nSegments < HTTP_MAX_SEND_SEGMENTS - 1)	// a segment is kept for the errors
 		{
-			char error[] = "HTTP/1.1 414 URI Too Long\r\n\r\n";
-			send(pClient->clientFd, error, strlen(error), 0);
-			_DELETE(pClient);
-			return;
-		}		
-
-		data[size] = 0;
-		printf("\n %s ", data);
-
-		char http_response[] =
-			"HTTP/1.1 200 OK\n"
-			"Date: Thu, 19 Feb 2009 12:27:04 GMT\n"
-			"Server: Apache/2.2.3\n"
-			"Last-Modified: Wed, 18 Jun 2003 16:05:58 GMT\n"
-			"ETag: \"56d-9989200-1132c580\"\n"
-			"Content-Type: text/html\n"
-			"Content-Length: 15\n"
-			"Accept-Ranges: bytes\n"
-			"Connection: close\n"
-			"\n"
-			"Hello World!!  ";
-
-		send(pClient->clientFd, http_response, strlen(http_response), 0);
-
+			char* pReq = pRecvBuf + nConsumed;
+			size_t nAvail = nRecvLen - nConsumed;
+
+			// find the end of headers, resuming from where the earlier search stopped
+			size_t nReqScanned = (nScanned > nConsumed) ? (nScanned - nConsumed) : 0;
+			const char* pHeadersEnd = _httpParser::findHeadersEnd(pReq, nAvail, nReqScanned);
+			if (pHeadersEnd == nullptr) { nScanned = nConsumed + nReqScanned; break; }	// incomplete headers, wait for more data
+
+			_httpRequest req;
+			size_t nRequestLen = 0;
+			int nError = parser.parse(pReq, pHeadersEnd, nAvail, req, nRequestLen);
+			if (nError != _httpStaticResponses::RESP_NONE) { sendError(nError); break; }
+			if (nRequestLen == 0) break;	// body is not complete yet
+
+			_httpResponse resp = { pSendBuf + nSendLen, gConfigOptions.nSendBufSize - nSendLen, 0, req.bKeepAlive, pLoop->responses.dateLine(), _httpStaticResponses::RESP_NONE,
+				req.verb == _knownStrings::VERB_HEAD };	// (RFC 9110 9.3.2: HEAD gets the headers of GET, without the body)
+			(*gHttpRoutes.find(req.uri, req.uriLen))(req, resp);
+			if (!queueResponse(resp))	// no room for the response (or the handler wrote nothing)
+			{
+				if (nSegments > 0) break;	// retry once the pending responses are sent
+				sendError(_httpStaticResponses::RESP_INTERNAL_ERROR);
+				break;
+			}
+			if (!req.bKeepAlive) bCloseAfterSend = true;
+			nConsumed += nRequestLen;
+			nScanned = nConsumed;
+		}
+		if (nConsumed > 0)	// move the left over partial request (if any) to the front
+		{
+			memmove(pRecvBuf, pRecvBuf + nConsumed, nRecvLen - nConsumed);
+			nRecvLen -= nConsumed;
+			nScanned = (nScanned > nConsumed) ? nScanned - nConsumed : 0;
+		}
 	}
-};
-
-
-struct _server
-{
-	uv_loop_t* uvLoop = nullptr;       // the main default loop
-	SOCKET listenFd = INVALID_SOCKET;  // the listening socket that accepts clients
-	uv_poll_t* listenPoll = nullptr;   // the poll handler for listening 
-
-	inline ~_server()
+	// adds the data to the send queue (merged with the last segment when contiguous)
+	inline void queue(const char* pData, size_t len)
 	{
-		stop();
+		IOVEC* pLast = (nSegments > 0) ? &sendQueue[nSegments - 1] : nullptr;
+		if (pLast != nullptr && iov_base(*pLast) + iov_len(*pLast) == pData)
+			iov_set(*pLast, iov_base(*pLast), iov_len(*pLast) + len);
+		else
+			iov_set(sendQueue[nSegments++], pData, len);
+		nQueuedBytes += len;
 	}
-	inline void stop()
+	// queues the response of a handler. Returns false if there is no room for it now
+	inline bool queueResponse(const _httpResponse& resp)
 	{
-		if (listenPoll)
-		{
-			uv_poll_stop(listenPoll);
-			uv_close((uv_handle_t *)listenPoll, [](uv_handle_t *handle) { });
-		}
-		if (listenFd != INVALID_SOCKET)
+		const char* pData = resp.pBuf;
+		size_t len = resp.nLen;
+		if (resp.nStaticId != _httpStaticResponses::RESP_NONE && !pLoop->responses.get(resp.nStaticId, resp.bKeepAlive, resp.bHeadersOnly, pData, len))
+			return false;
+		if (len == 0 || (nQueuedBytes > 0 && nQueuedBytes + len > (size_t)gConfigOptions.nSendBufSize)) return false;
+		queue(pData, len);
+		if (pData == resp.pBuf) nSendLen += len;
+		return true;
+	}
+	// queues an error response and closes the connection after sending it
+	inline void sendError(int nStaticId)
+	{
+		const char* pData;
+		size_t len;
+		if (pLoop->responses.get(nStaticId, false, false, pData, len))
+			queue(pData, len);	// always has a segment (see processRequests())
+		bCloseAfterSend = true;
+	}
+	// sends the pending responses. Returns false when the connection should be closed.
+	inline bool flush()
+	{
+		while (nSegments > 0)
 		{
-			close(listenFd);
-			listenFd = INVALID_SOCKET;
+			int size = send_iov(clientFd, sendQueue, nSegments);
+			if (size < 0)
+			{
+				if (!SOCKET_WOULDBLOCK()) return false;
+				pin();	// the cached responses can change (Date) before the socket takes the rest
+				setPollEvents(UV_WRITABLE);	// wait till the socket can take more
+				return true;
+			}
+			consume(size);
 		}
-		if (uvLoop) 
+		nSendLen = nQueuedBytes = 0;
+		if (pPinned != nullptr)
 		{
-			uv_loop_close(uvLoop); uvLoop = nullptr;
+			POOLED_FREE(pPinned);
+			pPinned = nullptr;
 		}
-		if (listenPoll)
+		if (bCloseAfterSend) return false;
+		setPollEvents(UV_READABLE);
+		return true;
+	}
+	// removes the sent bytes from the send queue
+	inline void consume(size_t nSent)
+	{
+		nQueuedBytes -= nSent;
+		int nDone = 0;
+		for (; nDone < nSegments && nSent >= iov_len(sendQueue[nDone]); ++nDone)
+			nSent -= iov_len(sendQueue[nDone]);
+		if (nDone < nSegments && nSent > 0)
+			iov_set(sendQueue[nDone], iov_base(sendQueue[nDone]) + nSent, iov_len(sendQueue[nDone]) - nSent);
+		nSegments -= nDone;
+		memmove(sendQueue, sendQueue + nDone, nSegments * sizeof(IOVEC));
+	}
+	// copies the pending responses into a buffer of their own, so that they do not depend on the
+	// response cache (or the send buffer) while the socket is blocked. Only the blocked sockets pay this.
+	inline void pin()
+	{
+		if (nSegments == 1 && iov_base(sendQueue[0]) >= pPinned && iov_base(sendQueue[0]) < pPinned + nPinnedSize) return;	// already pinned
+		char* pNew = (char*)POOLED_ALLOC(nQueuedBytes);
+		size_t nCopied = 0;
+		for (int i = 0; i < nSegments; ++i)
 		{
-			_DELETE((uv_poll_t *)listenPoll);
-			listenPoll = nullptr;
+			memcpy(pNew + nCopied, iov_base(sendQueue[i]), iov_len(sendQueue[i]));
+			nCopied += iov_len(sendQueue[i]);
 		}
+		if (pPinned != nullptr) POOLED_FREE(pPinned);
+		pPinned = pNew;
+		nPinnedSize = nQueuedBytes;
+		nSegments = 1;
+		iov_set(sendQueue[0], pPinned, nQueuedBytes);
+		nSendLen = 0;	// nothing in the send buffer is referenced anymore
 	}
-} gServer;
+};
 
-uv_poll_t* start_accepting(SOCKET listenFd, uv_loop_t* uvLoop, uv_poll_cb acceptHandler)
-{
-	auto listenPoll = _NEW(uv_poll_t);
-	uv_poll_init_socket(uvLoop, listenPoll, listenFd);
-	uv_poll_start(listenPoll, UV_READABLE, acceptHandler);
-	return listenPoll;
-}
 
-void acceptHandler(uv_poll_t *listenPoll, int status, int events)
+// _server: one event loop with its own listener, run on its own thread.
+//	With SO_REUSEPORT, each server binds a listener to the same port and the kernel spreads
+//	the incoming connections across them. A connection stays on the loop that accepted it,
+//	so the loops share nothing (the buffer pools are per-thread too).
+struct _server : public _serverLoop
 {
-	if (status < 0) return;
-	
-	_server* pServer = (_server*)listenPoll->data;
-	SOCKET clientFd = accept(pServer->listenFd, NULL, NULL);
-	if (clientFd == INVALID_SOCKET) return;
+	SOCKET listenFd = INVALID_SOCKET;  // the listening socket that accepts clients
+	uv_poll_t listenPoll;              // the poll handler for listening
+	uv_async_t stopSignal;             // wakes up the loop to stop it (from any thread)
+	std::thread thread;
+	bool bStarted = false;
+	int nNumaNode = -1;                // the node the loop is placed on (-1: anywhere)
+
+	// opens the listener and prepares the loop. Returns 0 on success.
+	inline int start(const char* szHost, int port)
+	{
+		listenFd = server_listen(szHost, port);
+		if (listenFd == INVALID_SOCKET) return -1;
+		init();
+		uv_poll_init_socket(&uvLoop, &listenPoll, listenFd);
+		listenPoll.data = (void*)this;
+		uv_poll_start(&listenPoll, UV_READABLE, acceptHandler);
+		uv_async_init(&uvLoop, &stopSignal, onStop);
+		stopSignal.data = (void*)this;
+		bStarted = true;
+		return 0;
+	}
+	// runs the loop till it is stopped
+	inline void run()
+	{
+		if (nNumaNode >= 0)	// (the connections accepted here stay here, so do their buffers)
+		{
+			DSCPP::_connectionOptions options;
+			options.nNumaNode = nNumaNode;
+			DSCPP::place_loop_thread(options);
+		}
+		uv_run(&uvLoop, UV_RUN_DEFAULT);
+		uv_loop_close(&uvLoop);
+	}
+	// can be called from any thread (and from signal handlers)
+	inline void stop()
+	{
+		if (bStarted) uv_async_send(&stopSignal);
+	}
+	static void onStop(uv_async_t* pSignal)
+	{
+		_server* pServer = (_server*)pSignal->data;
+		uv_poll_stop(&pServer->listenPoll);
+		uv_close((uv_handle_t *)&pServer->listenPoll, nullptr);
+		close(pServer->listenFd);
+		pServer->listenFd = INVALID_SOCKET;
+		while (pServer->pClients != nullptr)
+			_DELETE(pServer->pClients);	// unlinks itself from the list
+		pServer->closeTimers();
+		uv_close((uv_handle_t *)&pServer->stopSignal, nullptr);	// loop exits once all the handles are closed
+	}
+	static void acceptHandler(uv_poll_t *listenPoll, int status, int events)
+	{
+		if (status < 0) return;
 
+		_server* pServer = (_server*)listenPoll->data;
+		// drain the backlog, but within a limit so that the other connections of the loop are not starved
+		for (int i = 0; i < gConfigOptions.nAcceptBatch; ++i)
+		{
+#if defined(__linux__)
+			SOCKET clientFd = accept4(pServer->listenFd, NULL, NULL, SOCK_NONBLOCK);	// saves the fcntl calls
+			if (clientFd == INVALID_SOCKET) return;	// backlog is empty
+#else
+			SOCKET clientFd = accept(pServer->listenFd, NULL, NULL);
+			if (clientFd == INVALID_SOCKET) return;	// backlog is empty
+			set_nonblocking(clientFd);	// reads are drained till EWOULDBLOCK
+#endif
 #ifdef __APPLE__
-	int noSigpipe = 1;
-	setsockopt(clientFd, SOL_SOCKET, SO_NOSIGPIPE, &noSigpipe, sizeof(int));
+			int noSigpipe = 1;
+			setsockopt(clientFd, SOL_SOCKET, SO_NOSIGPIPE, &noSigpipe, sizeof(int));
 #endif
-	// create a new client object that takes care of itself. 
-	_NEW2(_client, clientFd, pServer->uvLoop);	// this memory is self deleted by the class
-}
+			// create a new client object that takes care of itself.
+			pServer->armTimers();
+			_NEW2(_client, clientFd, pServer);	// this memory is self deleted by the class
+		}
+	}
+};
+
+// the server threads
+struct _serverGroup
+{
+	_server*	pServers = nullptr;
+	int			nServers = 0;
+
+	inline ~_serverGroup()
+	{
+		stop();
+		wait();
+	}
+	// starts nThreads servers on the port (0: one per hardware thread). Returns the no. of servers started.
+	inline int start(const char* szHost, int port, int nThreads = gConfigOptions.nServerThreads)
+	{
+		if (nThreads <= 0) nThreads = std::max(1, (int)std::thread::hardware_concurrency());
+		if (!is_portreuse_supported()) nThreads = 1;	// listeners cannot share the port
+		pServers = new _server[nThreads];
+		int nNodes = gConfigOptions.bNumaPlacement ? DSCPP::numa_node_count() : 1;
+		for (nServers = 0; nServers < nThreads; ++nServers)
+		{
+			if (nNodes > 1) pServers[nServers].nNumaNode = nServers % nNodes;
+			if (pServers[nServers].start(szHost, port) != 0) break;
+		}
+		// the first server runs on the calling thread (see wait())
+		for (int i = 1; i < nServers; ++i)
+			pServers[i].thread = std::thread([](_server* pServer) { pServer->run(); }, &pServers[i]);
+		return nServers;
+	}
+	// runs the first server on the calling thread, and waits for all of them to stop
+	inline void wait()
+	{
+		if (pServers == nullptr) return;
+		if (nServers > 0) pServers[0].run();
+		for (int i = 1; i < nServers; ++i)
+			if (pServers[i].thread.joinable()) pServers[i].thread.join();
+		delete[] pServers;
+		pServers = nullptr;
+		nServers = 0;
+	}
+	// can be called from any thread (and from signal handlers)
+	inline void stop()
+	{
+		for (int i = 0; i < nServers; ++i)
+			pServers[i].stop();
+	}
+} gServers;
 
 void interrupt_handler(int sig)
 {
-	std::cerr << "\n[" << getTimestamp() << "] Received Interrupt. Stopping the server loop";
-	gServer.stop();
+	gServers.stop();
 }
 void setup_signal_handlers(void)
 {
@@ -277,12 +771,10 @@ void serverMain()
 {
 	setup_signal_handlers();
 
-	gServer.uvLoop = uv_default_loop();
-	gServer.listenFd = server_listen(NULL, 8080);
-	gServer.listenPoll = start_accepting(gServer.listenFd, gServer.uvLoop, acceptHandler);
-	gServer.listenPoll->data = (void*)&gServer;
+	int nServers = gServers.start(NULL, 8080);
+	std::cerr << "\n[" << getTimestamp() << "] Started " << nServers << " server loop(s)";
 
-	uv_run(gServer.uvLoop, UV_RUN_DEFAULT);
+	gServers.wait();
 
-	std::cerr << "\n[" << getTimestamp() << "] Server loop stopped";
-}
\ No newline at end of file
+	std::cerr << "\n[" << getTimestamp() << "] Server loops stopped";
+}
@@ -0,0 +1,263 @@
+/*
+	Copyright (c) 2016 Cenacle Research India Private Limited
+*/
+
+#ifndef _RCU_TRIE_ARRAY_H__Guid__9B1F2E64_7A3C_4D85_B0E6_3C58A17D2F40___
+#define _RCU_TRIE_ARRAY_H__Guid__9B1F2E64_7A3C_4D85_B0E6_3C58A17D2F40___
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+#include "trie_array.h"
+
+// Epoch based reclamation for read-mostly data structures.
+//	+ Each reader thread owns a slot (cache-line sized, to avoid false sharing between readers).
+//	+ A reader publishes the global epoch in its slot when it enters a read-side section,
+//	  and clears it when it leaves. Readers take no locks and write only to their own slot.
+//	+ Writers retire the old versions with the epoch at which they were replaced. A retired
+//	  version is released once no active reader holds an epoch at or before that epoch.
+struct _epochDomain
+{
+	enum { MAX_READERS = 128, CACHE_LINE_SIZE = 64 };
+	struct alignas(CACHE_LINE_SIZE) _slot
+	{
+		std::atomic<uint64_t>	epoch;	// 0 when the reader is not inside a read-side section
+		std::atomic<bool>		inUse;	// slot is registered to a reader
+	};
+protected:
+	std::atomic<uint64_t>	m_globalEpoch;
+	_slot					m_slots[MAX_READERS];
+public:
+	inline _epochDomain(): m_globalEpoch(1)
+	{
+		for (int i = 0; i < MAX_READERS; ++i)
+		{
+			m_slots[i].epoch.store(0, std::memory_order_relaxed);
+			m_slots[i].inUse.store(false, std::memory_order_relaxed);
+		}
+	}
+	// Returns a free slot for the reader, or -1 if all slots are taken
+	inline int registerReader()
+	{
+		for (int i = 0; i < MAX_READERS; ++i)
+		{
+			bool expected = false;
+			if (m_slots[i].inUse.compare_exchange_strong(expected, true))
+				return i;
+		}
+		return -1;
+	}
+	inline void unregisterReader(int nSlot)
+	{
+		m_slots[nSlot].epoch.store(0, std::memory_order_release);
+		m_slots[nSlot].inUse.store(false, std::memory_order_release);
+	}
+	inline void enter(int nSlot)
+	{
+		// seq_cst store: should be visible before the reader loads the shared pointer
+		m_slots[nSlot].epoch.store(m_globalEpoch.load(std::memory_order_acquire));
+	}
+	inline void leave(int nSlot)
+	{
+		m_slots[nSlot].epoch.store(0, std::memory_order_release);
+	}
+	// advances the global epoch and returns the epoch before the advance
+	inline uint64_t advance()
+	{
+		return m_globalEpoch.fetch_add(1);
+	}
+	// returns true if no reader is inside a section that started at or before the given epoch
+	inline bool isQuiescent(uint64_t epoch) const
+	{
+		for (int i = 0; i < MAX_READERS; ++i)
+		{
+			uint64_t e = m_slots[i].epoch.load();
+			if (e != 0 && e <= epoch) return false;
+		}
+		return true;
+	}
+};
+
+// rcu_trie_array: trie_array for concurrent, lock-free lookups with background updates.
+//	Readers query an immutable snapshot of the keys and values. Writers apply their changes
+//	to a private master trie_array (serialized by a mutex), and publish a new snapshot with a
+//	single atomic pointer swap. The old snapshots are released through epoch based reclamation.
+/*	Usage:
+		rcu_trie_array<int> rta;
+		rta.insertkv("echo", 4, 1);						// writer (any thread)
+		rta.update([](trie_array<int>& ta) { ... });		// batch of changes, published once
+
+		rcu_trie_array<int>::reader r(rta);				// one per reader thread
+		int value = r.at("echo", 4, -1);				// lock-free lookup
+
+	Notes:
+		+ Each publish builds the trie of the snapshot afresh from the keys of the master (cedar keeps
+		  the suffixes of the keys apart from its double array, so the array alone is no copy), and
+		  copies the values. Batch the writes with update() when registering many keys.
+		+ Readers get the values by copy. Do not hold pointers into a snapshot outside read().
+		+ Each reader object occupies one of the _epochDomain::MAX_READERS slots. Create one per
+		  thread and keep it for the lifetime of the thread. The readers beyond that many still
+		  work, but take the writers' lock for each read (see reader::isValid()).
+*/
+template<typename Tvalue = void*>
+struct rcu_trie_array
+{
+	typedef trie_array<Tvalue> TMaster;
+	typedef TMaster TSnapshotArray;
+	typedef typename TMaster::KEY KEY;
+
+	// immutable copy of the master, queried by the readers
+	struct _snapshot
+	{
+		TSnapshotArray	ta;
+		uint64_t		retiredEpoch = 0;
+
+		inline explicit _snapshot(TMaster& master)
+		{
+			ta.assign(master);
+		}
+		_snapshot(const _snapshot&) = delete;
+		_snapshot& operator=(const _snapshot&) = delete;
+	};
+
+	// Read handle for a thread. Lookups through it take no locks.
+	struct reader
+	{
+	protected:
+		rcu_trie_array&	m_owner;
+		int				m_nSlot;
+	public:
+		inline explicit reader(rcu_trie_array& owner): m_owner(owner), m_nSlot(owner.m_epochs.registerReader())
+		{
+		}
+		inline ~reader()
+		{
+			if (m_nSlot >= 0) m_owner.m_epochs.unregisterReader(m_nSlot);
+		}
+		reader(const reader&) = delete;
+		reader& operator=(const reader&) = delete;
+
+		// false when all the _epochDomain::MAX_READERS slots were taken: the reads then take the
+		// writers' lock (correct, but not lock-free)
+		inline bool isValid() const { return m_nSlot >= 0; }
+
+		// Invokes fn(const TSnapshotArray&) inside a read-side section and returns its result.
+		// The snapshot is guaranteed to stay alive only till fn returns.
+		template<typename Fn>
+		inline auto read(Fn fn) -> decltype(fn(std::declval<const TSnapshotArray&>()))
+		{
+			if (!isValid())	// no slot to hold off the reclamation: the writers (who reclaim) wait instead
+			{
+				std::lock_guard<std::mutex> lock(m_owner.m_writeLock);
+				return fn(m_owner.m_pCurrent.load()->ta);
+			}
+			struct _section
+			{
+				_epochDomain& d; int n;
+				inline _section(_epochDomain& argD, int argN): d(argD), n(argN) { d.enter(n); }
+				inline ~_section() { d.leave(n); }
+			} section(m_owner.m_epochs, m_nSlot);
+			const _snapshot* pSnapshot = m_owner.m_pCurrent.load();
+			return fn(pSnapshot->ta);
+		}
+		// Returns the KEY index if exists. Else returns -1
+		inline KEY findKey(const char* szKey, size_t keyLen)
+		{
+			return read([szKey, keyLen](const TSnapshotArray& ta) { return ta.findKey(szKey, keyLen); });
+		}
+		// Returns (a copy of) the value for the given key, or errVal if the key does not exist
+		inline Tvalue at(const char* szKey, size_t keyLen, const Tvalue& errVal)
+		{
+			return read([szKey, keyLen, &errVal](const TSnapshotArray& ta) -> Tvalue { return ta.at(szKey, keyLen, errVal); });
+		}
+		// Returns (a copy of) the value for the given hash, or errVal if out of range
+		inline Tvalue at(KEY hash, const Tvalue& errVal)
+		{
+			return read([hash, &errVal](const TSnapshotArray& ta) -> Tvalue {
+				return (hash < 0 || hash >= ta.m_array.reserved()) ? errVal : ta[hash];
+			});
+		}
+	};
+
+protected:
+	_epochDomain				m_epochs;
+	std::atomic<_snapshot*>		m_pCurrent;
+	std::mutex					m_writeLock;	// serializes the writers
+	TMaster						m_master;		// writer's copy, the source of the snapshots
+	std::vector<_snapshot*>		m_retired;		// replaced snapshots, waiting for the readers to move on
+
+public:
+	inline rcu_trie_array(): m_pCurrent(nullptr)
+	{
+		m_master.reserve(1);	// so that the snapshots always have a valid values array
+		m_pCurrent.store(new _snapshot(m_master));
+	}
+	inline ~rcu_trie_array()
+	{
+		// no readers should be active at this point
+		delete m_pCurrent.load();
+		for (_snapshot* p : m_retired) delete p;
+	}
+	rcu_trie_array(const rcu_trie_array&) = delete;
+	rcu_trie_array& operator=(const rcu_trie_array&) = delete;
+
+	// Applies a batch of changes fn(TMaster&) to the master and publishes them as one version.
+	template<typename Fn>
+	inline void update(Fn fn)
+	{
+		std::lock_guard<std::mutex> lock(m_writeLock);
+		fn(m_master);
+		publish();
+	}
+	inline KEY insertkv(const char* szKey, size_t keyLen, const Tvalue& value)
+	{
+		KEY key = -1;
+		update([&](TMaster& ta) { key = ta.insertkv(szKey, keyLen, value); });
+		return key;
+	}
+	inline void insertkv(const char* szKeys[], const size_t keyLen[], const Tvalue values[], size_t arrayLen, KEY hashOut[] = nullptr)
+	{
+		update([&](TMaster& ta) { ta.insertkv(szKeys, keyLen, values, arrayLen, hashOut); });
+	}
+	inline void updateValue(const KEY hash, const Tvalue& value)
+	{
+		update([&](TMaster& ta) { ta.updateValue(hash, value); });
+	}
+	inline KEY erase(const char* szKey, size_t keyLen)
+	{
+		KEY key = -1;
+		update([&](TMaster& ta) { key = ta.erase(szKey, keyLen); });
+		return key;
+	}
+	// Releases the retired snapshots that no reader can be using anymore.
+	// Gets called automatically on each publish. Returns the no. of snapshots still pending.
+	inline size_t reclaim()
+	{
+		std::lock_guard<std::mutex> lock(m_writeLock);
+		return reclaimRetired();
+	}
+
+protected:
+	// should be called with the m_writeLock held
+	inline void publish()
+	{
+		_snapshot* pNew = new _snapshot(m_master);
+		_snapshot* pOld = m_pCurrent.exchange(pNew);
+		pOld->retiredEpoch = m_epochs.advance();	// readers that entered at or before this epoch may still see pOld
+		m_retired.push_back(pOld);
+		reclaimRetired();
+	}
+	inline size_t reclaimRetired()
+	{
+		auto iterEnd = std::remove_if(m_retired.begin(), m_retired.end(), [this](_snapshot* p) {
+			if (!m_epochs.isQuiescent(p->retiredEpoch)) return false;
+			delete p;
+			return true;
+		});
+		m_retired.erase(iterEnd, m_retired.end());
+		return m_retired.size();
+	}
+};
+
+#endif // _RCU_TRIE_ARRAY_H__Guid__9B1F2E64_7A3C_4D85_B0E6_3C58A17D2F40___
@@ -0,0 +1,257 @@
+/*
+	Copyright (c) 2016 Cenacle Research India Private Limited
+*/
+
+#ifndef _RPCLIMITER_H__Guid__9B2E47C1_D6A8_4F35_8E10_C3A5F7190B64___
+#define _RPCLIMITER_H__Guid__9B2E47C1_D6A8_4F35_8E10_C3A5F7190B64___
+
+#include <cstdint>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+
+namespace DSCPP
+{
+	inline uint64_t rpc_clock_us()
+	{
+		return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	// Concurrency limits of the rpc calls (see _dsclientBase::set_rpc_limits()). 0 is no limit.
+	struct _rpcLimitOptions
+	{
+		int		nMaxInFlight = 0;			// calls of all the methods together
+		int		nMaxInFlightPerMethod = 0;	// calls of a method (the adaptive limits stay below it, or below ADAPTIVE_MAX_LIMIT)
+		bool	bAdaptive = false;			// the limit of every method follows its latency
+		int		nMinLimit = 1;				// the adaptive limits do not go below this
+		double	fLatencyTolerance = 2.0;	// latency this many times the lowest seen is taken as queueing
+		uint32_t nDeadlineMs = 0;			// calls that waited longer than this since they were read are not run
+	};
+
+	struct _rpcLimiter;
+	// A call counted in by _rpcLimiter::try_acquire(methodId, call). It stays linked in the limiter till it is
+	// released, so that the limiter can let go of the calls that outlive it, or the method they counted against.
+	struct _rpcInFlight
+	{
+		_rpcLimiter*	pLimiter = nullptr;	// nullptr: not counted in (or let go by the limiter)
+		int				methodId = -1;		// -1: counts against the global limit only
+		_rpcInFlight*	pPrev = nullptr;
+		_rpcInFlight*	pNext = nullptr;
+	};
+
+	// _rpcLimiter: keeps the rpc calls in flight within the limits, in all and per method. The calls
+	// beyond get rejected right away (the server passes them on to another provider), instead of
+	// queueing here behind the busy ones.
+	//	With bAdaptive, the limit of every method follows its latency (AIMD): every window of completed
+	//	calls (as many as the limit) that averages fLatencyTolerance times the lowest latency seen
+	//	cuts the limit by BACKOFF, and every window that hit the limit without doing so raises it by one.
+	//	The lowest latency drifts up towards the recent ones, so that a method that got slower for good
+	//	(larger data, say) is not held down for ever.
+	//	The calls that waited past the deadline of their method (behind the slow ones of the same read, or
+	//	in the queue of a provider) are not run: the caller has given up on them by then. The time they
+	//	would have taken (at the average latency of the method) is counted as saved. The wait is counted
+	//	from the read that brought the call: the time it spent on the wire and in the server is not known.
+	/*	Usage:
+			if (limiter.count_if_expired(methodId, nWaitedUs)) reject();
+			if (!limiter.try_acquire(methodId)) reject();		// the method id is its key in the rpc router
+			...
+			limiter.release(methodId, nLatencyUs);			// once the call is done
+		The calls that may outlive the limiter (or the method of their id) are counted in with an _rpcInFlight,
+		and released with it: try_acquire(methodId, call) ... release(call, nLatencyUs).
+	*/
+	struct _rpcLimiter
+	{
+		enum { ADAPTIVE_INITIAL_LIMIT = 16, ADAPTIVE_MAX_LIMIT = 1024, MIN_DRIFT_SHIFT = 6 };
+		static constexpr double BACKOFF = 0.9;
+
+		struct _methodLoad
+		{
+			int			nInFlight = 0;
+			int			nMaxInFlight = 0;		// set for the method (0: the nMaxInFlightPerMethod of the options)
+			int			nMinLimit = 0;			// set for the method (a batch, for the batched ones), above the nMinLimit of the options
+			uint32_t	nDeadlineMs = 0;		// set for the method (0: the nDeadlineMs of the options)
+			uint64_t	nAvgLatencyUs = 0;		// moving average (1/8 weight to the latest)
+			double		fLimit = 0;				// the adaptive limit (0: not started yet)
+			uint64_t	nMinLatencyUs = 0;		// the lowest window average (0: none yet)
+			uint64_t	nWindowLatencyUs = 0;	// sum of the latencies in the window
+			int			nWindowCalls = 0;
+			bool		bSaturated = false;		// the limit was hit in the window
+			uint64_t	nCalls = 0;
+			uint64_t	nRejected = 0;
+			uint64_t	nExpired = 0;			// calls not run, as their deadline had passed
+			uint64_t	nSavedUs = 0;			// the time those would have taken
+		};
+
+		_rpcLimitOptions			options;
+		int							nInFlight = 0;
+		uint64_t					nRejected = 0;	// by the global limit
+		uint64_t					nExpired = 0;	// of all the methods
+		uint64_t					nSavedUs = 0;
+		std::vector<_methodLoad>	methods;		// indexed by the method id
+		_rpcInFlight				calls;			// sentinel of the (circular) list of the calls counted in with an _rpcInFlight
+
+		inline _rpcLimiter()
+		{
+			calls.pPrev = calls.pNext = &calls;
+		}
+		// the calls still in flight are let go: they are released later with no limiter to count out of
+		inline ~_rpcLimiter()
+		{
+			while (calls.pNext != &calls) unlink(*calls.pNext);
+		}
+		_rpcLimiter(const _rpcLimiter&) = delete;
+		_rpcLimiter& operator=(const _rpcLimiter&) = delete;
+
+		inline _methodLoad& method(int methodId)
+		{
+			if ((size_t)methodId >= methods.size()) methods.resize(methodId + 1);
+			return methods[methodId];
+		}
+		// the upper bound of the method (0: none)
+		inline int cap(const _methodLoad& m) const
+		{
+			int nCap = (m.nMaxInFlight > 0) ? m.nMaxInFlight : options.nMaxInFlightPerMethod;
+			return (options.bAdaptive && nCap <= 0) ? (int)ADAPTIVE_MAX_LIMIT : nCap;
+		}
+		// the limit in force for the method (0: none)
+		inline int limit(_methodLoad& m)
+		{
+			if (!options.bAdaptive) return cap(m);
+			int nMinLimit = std::max(std::max(options.nMinLimit, m.nMinLimit), 1);
+			if (m.fLimit == 0) m.fLimit = std::min(std::max((int)ADAPTIVE_INITIAL_LIMIT, nMinLimit), cap(m));
+			return std::max((int)m.fLimit, nMinLimit);
+		}
+		// the deadline of the method in microseconds (0: none)
+		inline uint64_t deadline_us(int methodId)
+		{
+			_methodLoad& m = method(methodId);
+			return (uint64_t)((m.nDeadlineMs > 0) ? m.nDeadlineMs : options.nDeadlineMs) * 1000;
+		}
+		// tells if a call that waited this long is past the deadline of its method, and counts it if so
+		inline bool count_if_expired(int methodId, uint64_t nWaitedUs)
+		{
+			uint64_t nDeadlineUs = deadline_us(methodId);
+			if (nDeadlineUs == 0 || nWaitedUs <= nDeadlineUs) return false;
+			_methodLoad& m = method(methodId);
+			m.nExpired++;
+			m.nSavedUs += m.nAvgLatencyUs;
+			nExpired++;
+			nSavedUs += m.nAvgLatencyUs;
+			return true;
+		}
+		// counts a call in, unless that would cross a limit
+		inline bool try_acquire(int methodId)
+		{
+			_methodLoad& m = method(methodId);
+			int nLimit = limit(m);
+			if (options.nMaxInFlight > 0 && nInFlight >= options.nMaxInFlight)
+			{
+				nRejected++;
+				m.nRejected++;
+				return false;
+			}
+			if (nLimit > 0 && m.nInFlight >= nLimit)
+			{
+				m.bSaturated = true;
+				m.nRejected++;
+				return false;
+			}
+			nInFlight++;
+			m.nCalls++;
+			if (++m.nInFlight >= nLimit) m.bSaturated = true;
+			return true;
+		}
+		// counts the call in (and links it), unless that would cross a limit
+		inline bool try_acquire(int methodId, _rpcInFlight& call)
+		{
+			if (!try_acquire(methodId)) return false;
+			link(call, methodId);
+			return true;
+		}
+		// links the call counted in with try_acquire(methodId) (once it is made, after the limits were checked)
+		inline void link(_rpcInFlight& call, int methodId)
+		{
+			call.pLimiter = this;
+			call.methodId = methodId;
+			call.pPrev = calls.pPrev;
+			call.pNext = &calls;
+			calls.pPrev->pNext = &call;
+			calls.pPrev = &call;
+		}
+		// counts the call out, if it is still counted in this limiter
+		inline void release(_rpcInFlight& call, uint64_t nLatencyUs)
+		{
+			if (call.pLimiter != this) return;
+			int methodId = call.methodId;
+			unlink(call);
+			if (methodId >= 0) release(methodId, nLatencyUs); else nInFlight--;
+		}
+		// the method id goes to another method: the calls of the old one in flight count against the global limit only
+		inline void let_go_of_method(int methodId)
+		{
+			for (_rpcInFlight* p = calls.pNext; p != &calls; p = p->pNext)
+				if (p->methodId == methodId)
+				{
+					p->methodId = -1;
+					method(methodId).nInFlight--;
+				}
+		}
+		inline void unlink(_rpcInFlight& call)
+		{
+			call.pPrev->pNext = call.pNext;
+			call.pNext->pPrev = call.pPrev;
+			call.pPrev = call.pNext = nullptr;
+			call.pLimiter = nullptr;
+		}
+		// counts a call out, and adapts the limit of its method
+		inline void release(int methodId, uint64_t nLatencyUs)
+		{
+			_methodLoad& m = method(methodId);
+			nInFlight--;
+			m.nInFlight--;
+			m.nAvgLatencyUs = (m.nAvgLatencyUs == 0) ? nLatencyUs : m.nAvgLatencyUs + ((int64_t)(nLatencyUs - m.nAvgLatencyUs) >> 3);
+			if (!options.bAdaptive) return;
+			m.nWindowLatencyUs += nLatencyUs;
+			if (++m.nWindowCalls < limit(m)) return;
+			uint64_t nAverageUs = m.nWindowLatencyUs / m.nWindowCalls;
+			uint64_t nDrifted = m.nMinLatencyUs + (m.nMinLatencyUs >> MIN_DRIFT_SHIFT) + 1;
+			m.nMinLatencyUs = (m.nMinLatencyUs == 0) ? nAverageUs : std::min(nAverageUs, nDrifted);
+			if (nAverageUs > m.nMinLatencyUs * options.fLatencyTolerance)
+				m.fLimit = std::max((double)std::max(options.nMinLimit, m.nMinLimit), m.fLimit * BACKOFF);
+			else if (m.bSaturated)
+				m.fLimit = std::min((double)cap(m), m.fLimit + 1);
+			m.nWindowLatencyUs = 0;
+			m.nWindowCalls = 0;
+			m.bSaturated = false;
+		}
+		// sets the deadline of a method (0: the default of the options)
+		inline void set_method_deadline(int methodId, uint32_t nDeadlineMs)
+		{
+			method(methodId).nDeadlineMs = nDeadlineMs;
+		}
+		// sets the upper bound of a method (0: the default of the options), and starts its adaptive limit over
+		inline void set_method_limit(int methodId, int nMaxInFlight)
+		{
+			_methodLoad& m = method(methodId);
+			m.nMaxInFlight = nMaxInFlight;
+			reset_method(methodId);
+		}
+		// sets the lowest adaptive limit of a method (0: the nMinLimit of the options), and starts its adaptive limit over
+		inline void set_method_min_limit(int methodId, int nMinLimit)
+		{
+			method(methodId).nMinLimit = nMinLimit;
+			reset_method(methodId);
+		}
+		// forgets the latencies of the method (its id went to another method), but not its calls in flight
+		inline void reset_method(int methodId)
+		{
+			_methodLoad& m = method(methodId);
+			m.fLimit = 0;
+			m.nMinLatencyUs = m.nWindowLatencyUs = m.nAvgLatencyUs = 0;
+			m.nWindowCalls = 0;
+			m.bSaturated = false;
+		}
+	};
+} // namespace DSCPP
+
+#endif // _RPCLIMITER_H__Guid__9B2E47C1_D6A8_4F35_8E10_C3A5F7190B64___
@@ -0,0 +1,187 @@
+/*
+	Copyright (c) 2016 Cenacle Research India Private Limited
+*/
+
+#ifndef _TIMER_WHEEL_H__Guid__4C7E19A3_8B52_4F0D_9E6A_71D3B58C2E04___
+#define _TIMER_WHEEL_H__Guid__4C7E19A3_8B52_4F0D_9E6A_71D3B58C2E04___
+
+#include <cstdint>
+#include <cstddef>
+
+// timer_wheel: hierarchical timing wheel for large numbers of coarse timers (idle timeouts,
+// heartbeats, retries). Scheduling, refreshing and cancelling a timer are O(1) list operations,
+// independent of the no. of pending timers. A single loop timer (firing at the resolution of the
+// wheel) drives all of them through advance().
+/*	Usage:
+		timer_wheel wheel(uv_now(loop), 100);		// 100ms resolution
+		timer_wheel::entry idle;					// usually embedded in the connection object
+		wheel.init(idle, on_idle, pConnection);
+		wheel.schedule(idle, 15000);				// (re)schedule on every activity
+		...
+		wheel.advance(uv_now(loop));				// from the loop timer, fires the expired ones
+
+	Notes:
+		+ Timers fire at tick granularity, within one resolution of the due time (the clock of
+		  the wheel moves only on advance(), and delays are counted from its last tick).
+		+ LEVELS x SLOT_BITS bits of ticks are covered directly (~19 days at 100ms). Longer
+		  timers are parked at the top level and re-placed as the wheel turns.
+		+ Entries are intrusive (no allocations). An entry must be cancelled (or have fired)
+		  before its memory is released. Not thread-safe: use one wheel per loop.
+*/
+struct timer_wheel
+{
+	enum { LEVELS = 4, SLOT_BITS = 6, SLOTS = 1 << SLOT_BITS, SLOT_MASK = SLOTS - 1 };
+
+	struct entry;
+	typedef void(*LPFN_TIMER_EXPIRED)(entry*);
+
+	struct entry
+	{
+		entry*				pPrev = nullptr;	// links in the slot list (nullptr when not scheduled)
+		entry*				pNext = nullptr;
+		uint64_t			expiry = 0;			// the tick at which the timer fires
+		LPFN_TIMER_EXPIRED	cb = nullptr;
+		void*				data = nullptr;		// owner of the timer (free for the callback to use)
+
+		inline bool isPending() const { return pPrev != nullptr; }
+	};
+
+protected:
+	entry		m_slots[LEVELS][SLOTS];	// sentinels of the circular slot lists
+	uint64_t	m_nCurrentTick;			// all the ticks up to (and including) this have been processed
+	uint32_t	m_nResolution;			// milliseconds per tick
+	size_t		m_nPending = 0;			// no. of scheduled timers
+
+public:
+	inline explicit timer_wheel(uint64_t nowMs = 0, uint32_t nResolutionMs = 100): m_nResolution(nResolutionMs > 0 ? nResolutionMs : 1)
+	{
+		m_nCurrentTick = nowMs / m_nResolution;
+		for (int l = 0; l < LEVELS; ++l)
+			for (int s = 0; s < SLOTS; ++s)
+				m_slots[l][s].pPrev = m_slots[l][s].pNext = &m_slots[l][s];
+	}
+	timer_wheel(const timer_wheel&) = delete;
+	timer_wheel& operator=(const timer_wheel&) = delete;
+
+	inline uint32_t resolution() const { return m_nResolution; }
+	inline size_t size() const { return m_nPending; }
+	inline bool empty() const { return m_nPending == 0; }
+
+	// sets the callback of the timer. Does not schedule it.
+	inline void init(entry& e, LPFN_TIMER_EXPIRED cb, void* data)
+	{
+		e.cb = cb;
+		e.data = data;
+	}
+	// (re)schedules the timer to fire after delayMs from the current time of the wheel.
+	// Rescheduling a pending timer just moves it (use this to refresh idle timeouts on activity).
+	inline void schedule(entry& e, uint64_t delayMs)
+	{
+		if (e.isPending()) unlink(e); else ++m_nPending;
+		uint64_t nTicks = (delayMs + m_nResolution - 1) / m_nResolution;
+		e.expiry = m_nCurrentTick + (nTicks > 0 ? nTicks : 1);
+		place(e);
+	}
+	// removes the timer, if it is pending. Safe to call on timers that are not scheduled.
+	inline void cancel(entry& e)
+	{
+		if (!e.isPending()) return;
+		unlink(e);
+		--m_nPending;
+	}
+	// milliseconds till the timer fires (0 if it is due, or not scheduled)
+	inline uint64_t remaining(const entry& e) const
+	{
+		return (e.isPending() && e.expiry > m_nCurrentTick) ? (e.expiry - m_nCurrentTick) * m_nResolution : 0;
+	}
+	// processes the ticks up to nowMs, firing the timers that have expired.
+	// The callbacks are free to schedule or cancel any timers (including the one firing).
+	// Returns the no. of timers fired.
+	inline size_t advance(uint64_t nowMs)
+	{
+		uint64_t nTargetTick = nowMs / m_nResolution;
+		size_t nFired = 0;
+		if (m_nPending == 0 && nTargetTick > m_nCurrentTick)	// nothing to fire, just catch up
+			m_nCurrentTick = nTargetTick;
+		while (m_nCurrentTick < nTargetTick)
+		{
+			++m_nCurrentTick;
+			cascade();
+			// fire all the timers of this tick
+			entry expired;
+			splice(m_slots[0][m_nCurrentTick & SLOT_MASK], expired);
+			while (expired.pNext != &expired)
+			{
+				entry* pEntry = expired.pNext;
+				unlink(*pEntry);
+				--m_nPending;
+				++nFired;
+				(*pEntry->cb)(pEntry);
+			}
+			if (m_nPending == 0 && nTargetTick > m_nCurrentTick)
+				m_nCurrentTick = nTargetTick;
+		}
+		return nFired;
+	}
+
+protected:
+	// the slot lists are circular with a sentinel, so that entries can unlink without knowing their slot
+	static inline void unlink(entry& e)
+	{
+		e.pPrev->pNext = e.pNext;
+		e.pNext->pPrev = e.pPrev;
+		e.pPrev = e.pNext = nullptr;
+	}
+	static inline void link(entry& head, entry& e)
+	{
+		e.pNext = &head;
+		e.pPrev = head.pPrev;
+		head.pPrev->pNext = &e;
+		head.pPrev = &e;
+	}
+	// moves all the entries of the list 'from' to the (empty) list 'to'
+	static inline void splice(entry& from, entry& to)
+	{
+		if (from.pNext == &from)
+		{
+			to.pPrev = to.pNext = &to;
+			return;
+		}
+		to.pNext = from.pNext;
+		to.pPrev = from.pPrev;
+		to.pNext->pPrev = &to;
+		to.pPrev->pNext = &to;
+		from.pPrev = from.pNext = &from;
+	}
+	// places the entry at the lowest level whose range covers its remaining ticks
+	inline void place(entry& e)
+	{
+		// A level covers the deltas that its slots cannot alias with the current tick. Delta is 0 only
+		// for the entries cascaded down on their own tick (those are fired right after the cascade).
+		uint64_t expiry = e.expiry;
+		uint64_t delta = (expiry > m_nCurrentTick) ? expiry - m_nCurrentTick : 0;
+		int level = 0;
+		while (level < LEVELS - 1 && delta >= ((uint64_t)1 << (SLOT_BITS * (level + 1)))) ++level;
+		if (delta >= ((uint64_t)1 << (SLOT_BITS * LEVELS)))	// beyond the wheel: park at the farthest slot, re-placed on cascade
+			expiry = m_nCurrentTick + ((uint64_t)1 << (SLOT_BITS * LEVELS)) - 1;
+		link(m_slots[level][(expiry >> (SLOT_BITS * level)) & SLOT_MASK], e);
+	}
+	// when a level completes a revolution, the next slot of the level above is spread down
+	inline void cascade()
+	{
+		for (int level = 1; level < LEVELS; ++level)
+		{
+			if ((m_nCurrentTick & (((uint64_t)1 << (SLOT_BITS * level)) - 1)) != 0) return;
+			entry pending;
+			splice(m_slots[level][(m_nCurrentTick >> (SLOT_BITS * level)) & SLOT_MASK], pending);
+			while (pending.pNext != &pending)
+			{
+				entry* pEntry = pending.pNext;
+				unlink(*pEntry);
+				place(*pEntry);
+			}
+		}
+	}
+};
+
+#endif // _TIMER_WHEEL_H__Guid__4C7E19A3_8B52_4F0D_9E6A_71D3B58C2E04___
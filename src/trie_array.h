@@ -8,6 +8,7 @@
 #pragma warning( disable : 4800) // ignore performance warning: forcing value to bool 'true' or 'false'
 
 #include <vector>
+#include <string>
 #include <algorithm>
 #include <map>
 #include "cedarpp.h"
@@ -49,6 +50,46 @@ struct trie_hash
 	typedef cedar::da<HASH, -1, -2, false> TRIE;
 protected:
 	TRIE m_trie;
+	HASH m_nKeyCount = 0;	// no. of keys in the trie (cedar's num_keys() walks the whole double array, so we track it ourselves)
+	HASH m_nNextHash = 0;	// the next sequential hash to be given out (when there are no erased hashes to reuse)
+	std::vector<HASH> m_freeHashes;	// hashes of the erased keys, reused for new keys
+	HASH m_nErasedCount = 0;	// no. of keys erased since the last compaction
+	float m_fCompactThreshold = 0.5f;	// compact once the erased keys exceed this fraction of (live + erased) keys
+	enum { MIN_ERASED_FOR_COMPACTION = 64 };
+	inline HASH newHash()
+	{
+		if (m_freeHashes.empty()) return m_nNextHash++;
+		HASH result = m_freeHashes.back();
+		m_freeHashes.pop_back();
+		return result;
+	}
+	// the live keys and their hashes
+	inline void collect(std::vector<std::string>& keys, std::vector<HASH>& hashes)
+	{
+		keys.reserve(m_nKeyCount);
+		hashes.reserve(m_nKeyCount);
+		for (iterator iter = begin(), iterEnd = end(); iter != iterEnd; ++iter)
+		{
+			std::string key(iter->keylen() + 1, '\0');
+			iter->key(&key[0], key.length());
+			key.resize(iter->keylen());
+			keys.push_back(std::move(key));
+			hashes.push_back(iter->hash());
+		}
+	}
+	// a new double array with just the keys, inserted in their sorted order
+	inline void rebuild(const std::vector<std::string>& keys, const std::vector<HASH>& hashes)
+	{
+		std::vector<size_t> order(keys.size());
+		for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+		std::sort(order.begin(), order.end(), [&keys](size_t a, size_t b) { return keys[a] < keys[b]; });
+
+		m_trie.clear();	// releases the old double array
+		for (size_t i : order)
+			m_trie.update(keys[i].c_str(), keys[i].length()) = hashes[i];
+		m_nKeyCount = (HASH)keys.size();
+		m_nErasedCount = 0;
+	}
 public:
 	/// <summary>
 	/// Returns the hash for a given string.
@@ -61,7 +102,8 @@ public:
 	/// @return the hash value for the given string. If a hash value has been already
 	///	 set earlier, it will be returned. If no hash was specified earlier for the given
 	///	 string, a new hash value will be calculated and returned. By default, it will be the 
-	///	 number of strings hashed till now +1. However, caller can override this default
+	///	 number of strings hashed till now +1 (or the hash of an erased string, if any, which
+	///	 gets reused). However, caller can override this default
 	///	 behavior and specify their own hash to be used for the new string, by supplying a
 	///	 positive integer value in defaultHash (Collisions may happen and will not be resolved).
 	///	 The defaultHash value supplied is used only for new strings whose hash not yet been 
@@ -74,8 +116,9 @@ public:
 		HASH result = getHash(szKey, keyLen);
 		if (result < 0)
 		{
-			result = (defaultHash == -1 ? (m_trie.num_keys()) : defaultHash);
+			result = (defaultHash == -1 ? newHash() : defaultHash);
 			m_trie.update(szKey, keyLen) = result;
+			++m_nKeyCount;
 		}
 		return result;
 	}
@@ -89,6 +132,61 @@ public:
 		for (int i = 0; i < arrayLen; ++i)
 			hash(keys[i], keylen[i]);
 	}
+	/// <summary>
+	/// Bulk version of hash(). Hashes a batch of keys in one pass.
+	///	 + New keys get sequential hashes in the order they appear in the input (same as
+	///	   calling hash() on each of them), so hashOut[i] always belongs to keys[i].
+	///	   Hashes of erased keys (if any) are reused first.
+	///	 + Keys that already exist (or repeat within the batch) keep their earlier hash.
+	///	 + The keys are inserted into the double array in sorted order (sorted here, if the
+	///	   input is not already sorted), which keeps the sibling relocations to a minimum.
+	/// @param keys the strings to be hashed
+	/// @param keylen the lengths of the strings. Can be nullptr for null-terminated strings.
+	/// @param arrayLen the no. of strings in the keys array
+	/// @param hashOut optional array (of arrayLen size) that receives the hash of each key
+	/// </summary>
+	inline void build(const char* keys[], const size_t keylen[], size_t arrayLen, HASH hashOut[] = nullptr)
+	{
+		std::vector<size_t> lens(keylen == nullptr ? arrayLen : 0);
+		for (size_t i = 0; i < lens.size(); ++i) lens[i] = std::strlen(keys[i]);
+		const size_t* pLen = (keylen == nullptr ? lens.data() : keylen);
+
+		std::vector<HASH> hashes(hashOut == nullptr ? arrayLen : 0);
+		HASH* pHash = (hashOut == nullptr ? hashes.data() : hashOut);
+
+		// sort the key indices (stable, so that the first occurrence of a repeated key comes first)
+		std::vector<size_t> order(arrayLen);
+		for (size_t i = 0; i < arrayLen; ++i) order[i] = i;
+		auto keyLess = [keys, pLen](size_t a, size_t b) {
+			int cmp = std::memcmp(keys[a], keys[b], std::min(pLen[a], pLen[b]));
+			return cmp < 0 || (cmp == 0 && pLen[a] < pLen[b]);
+		};
+		if (!std::is_sorted(order.begin(), order.end(), keyLess))
+			std::stable_sort(order.begin(), order.end(), keyLess);
+
+		// repeated keys point to their first occurrence, others to themselves
+		std::vector<size_t> first(arrayLen);
+		for (size_t i = 0; i < arrayLen; ++i)
+			first[order[i]] = (i > 0 && !keyLess(order[i - 1], order[i])) ? first[order[i - 1]] : order[i];
+
+		// assign the hashes in the input order, then insert the new keys in the sorted order
+		std::vector<bool> isNew(arrayLen);
+		for (size_t i = 0; i < arrayLen; ++i)
+		{
+			if (first[i] != i) { pHash[i] = pHash[first[i]]; continue; }
+			pHash[i] = getHash(keys[i], pLen[i]);
+			if (pHash[i] < 0) { pHash[i] = newHash(); ++m_nKeyCount; isNew[i] = true; }
+		}
+		for (size_t i = 0; i < arrayLen; ++i)
+		{
+			size_t k = order[i];
+			if (isNew[k]) m_trie.update(keys[k], pLen[k]) = pHash[k];
+		}
+	}
+	inline void build(const char* keys[], size_t arrayLen, HASH hashOut[] = nullptr)
+	{
+		build(keys, nullptr, arrayLen, hashOut);
+	}
 	/// <summary>Returns the hash for a string if it exists in the Trie. Else returns -1</summary>
 	inline HASH getHash(const char* szKey) const
 	{
@@ -102,17 +200,134 @@ public:
 	inline void setHash(const char* keys[], const HASH hash[], int arrayLen)
 	{
 		for (int i = 0; i < arrayLen; ++i)
-			m_trie.update(keys[i]) = hash[i];
+			setHash(keys[i], std::strlen(keys[i]), hash[i]);
 	}
 	inline void setHash(const char* keys[], size_t keylen[], const HASH hash[], int arrayLen)
 	{
 		for (int i = 0; i < arrayLen; ++i)
-			m_trie.update(keys[i], keylen[i]) = hash[i];
+			setHash(keys[i], keylen[i], hash[i]);
+	}
+	inline void setHash(const char* szKey, size_t keyLen, const HASH hash)
+	{
+		if (getHash(szKey, keyLen) < 0) { ++m_nKeyCount; ++m_nNextHash; }
+		m_trie.update(szKey, keyLen) = hash;
+	}
+	/// <summary>Returns the no. of keys present in the trie</summary>
+	inline size_t size() const
+	{
+		return m_nKeyCount;
+	}
+	/// <summary>
+	/// Removes the key from the trie and returns its hash (-1 if the key does not exist).
+	/// The hash is reused for the next new key (unless bRecycleHash is false, which is needed
+	/// when the hash is shared by other keys). The trie gets compacted automatically once the 
+	/// erased keys pass the compaction threshold (see setCompactionThreshold()).
+	/// </summary>
+	inline HASH erase(const char* szKey, size_t keyLen, bool bRecycleHash = true)
+	{
+		HASH result = getHash(szKey, keyLen);
+		if (result < 0 || m_trie.erase(szKey, keyLen) != 0) return -1;
+		--m_nKeyCount;
+		if (bRecycleHash) m_freeHashes.push_back(result);
+		if (++m_nErasedCount >= MIN_ERASED_FOR_COMPACTION && m_nErasedCount > m_fCompactThreshold * (m_nKeyCount + m_nErasedCount))
+			compact();
+		return result;
+	}
+	/// <summary>
+	/// Sets the fraction of erased keys (out of live + erased keys since the last compaction) 
+	/// beyond which erase() compacts the trie. Use a value >= 1 to disable auto compaction.
+	/// </summary>
+	inline void setCompactionThreshold(float fThreshold)
+	{
+		m_fCompactThreshold = fThreshold;
+	}
+	/// <summary>
+	/// Rebuilds the double array with only the live keys, releasing the space left behind 
+	/// by the erased keys. The hashes of the keys do not change. Trailing free hashes are 
+	/// given back, so that nextHash() (and the value arrays sized by it) can shrink.
+	/// </summary>
+	inline void compact()
+	{
+		std::vector<std::string> keys;
+		std::vector<HASH> hashes;
+		collect(keys, hashes);
+		rebuild(keys, hashes);
+
+		std::sort(m_freeHashes.begin(), m_freeHashes.end());
+		while (!m_freeHashes.empty() && m_freeHashes.back() == m_nNextHash - 1)
+		{
+			m_freeHashes.pop_back();
+			--m_nNextHash;
+		}
+		std::reverse(m_freeHashes.begin(), m_freeHashes.end());	// reuse the lowest hashes first
+		m_freeHashes.shrink_to_fit();
+	}
+	/// <summary>Returns the hash that the next new key would get (1 + the largest sequential hash in use)</summary>
+	inline HASH nextHash() const
+	{
+		return m_nNextHash;
 	}
 	/// <summary>clears all keys and values (without releasing the memory)</summary>
 	inline void clear()
 	{
 		m_trie.reset();
+		m_nKeyCount = 0;
+		m_nNextHash = 0;
+		m_nErasedCount = 0;
+		m_freeHashes.clear();
+	}
+	/// <summary>
+	/// The trie as a flat image, the way cedar saves it: the tail (the suffixes of the keys,
+	/// led by its own size in bytes as an int) followed by the double array. imageSize() is
+	/// the whole of it, imageTailSize() the tail. saveImage() appends the image to the file.
+	/// </summary>
+	inline size_t imageSize() const { return m_trie.total_size(); }
+	inline size_t imageTailSize() const { return m_trie.total_size() - m_trie.size() * m_trie.unit_size(); }
+	inline size_t unitSize() const { return m_trie.unit_size(); }
+	inline int saveImage(const char* szFile) const
+	{
+		return m_trie.save(szFile, "ab");
+	}
+	/// <summary>
+	/// Makes the trie use an externally owned image (for example, a memory-mapped one written
+	/// earlier with saveImage()) for lookups, without copying it. The memory is not released 
+	/// by the trie. Only the lookups (getHash(), prefixMatch() etc.) are supported on an attached 
+	/// image: no new keys can be added, and iteration is not possible (cedar keeps the sibling 
+	/// links needed for that outside of the image).
+	/// </summary>
+	inline void attach(const void* pImage, size_t nImageSize, HASH nKeyCount)
+	{
+		assert(nImageSize >= imageTailSizeOf(pImage));
+		m_trie.set_array(const_cast<void*>(pImage), nImageSize / unitSize());	// (cedar rounds the double array up to whole units)
+		m_nKeyCount = m_nNextHash = nKeyCount;
+		m_freeHashes.clear();
+	}
+	/// <summary>The size of the tail of an image (see imageSize())</summary>
+	static inline size_t imageTailSizeOf(const void* pImage)
+	{
+		int nTailSize = 0;
+		std::memcpy(&nTailSize, pImage, sizeof(nTailSize));
+		return (size_t)nTailSize;
+	}
+	/// <summary>
+	/// Makes the trie a copy of the other one: the same keys with the same hashes (and the same
+	/// hashes to reuse), in a double array built afresh in the sorted order of the keys.
+	/// </summary>
+	inline void assign(trie_hash& other)
+	{
+		std::vector<std::string> keys;
+		std::vector<HASH> hashes;
+		other.collect(keys, hashes);
+		rebuild(keys, hashes);
+		m_nNextHash = other.m_nNextHash;
+		m_freeHashes = other.m_freeHashes;
+	}
+	/// <summary>Detaches the external array (if any) and resets the trie to empty</summary>
+	inline void detach()
+	{
+		m_trie.clear();
+		m_nKeyCount = m_nNextHash = 0;
+		m_freeHashes.clear();
 	}
 
 	/// <summary>iterator support for trie_hash</summary>
@@ -253,9 +468,15 @@ public:
 	{
 		return m_nReserved;
 	}
+	inline const Tobject* data() const
+	{
+		return m_pBase;
+	}
+	// grows the array (geometrically) if nIndex is not already in range
 	inline bool ensureValid(int nIndex)
 	{
-		return reserve(nIndex + 1);
+		if (nIndex < m_nReserved) return true;
+		return reserve(std::max(nIndex + 1, std::max(m_nReserved * 2, 8)));
 	}
 	// reserves space for nCount no. of objects
 	inline bool reserve(int nCount)
@@ -264,7 +485,28 @@ public:
 		assert(nCount > 0);
 		if (m_nReserved < nCount)
 		{
-			Tobject* tmp = (Tobject*)_REALLOC(m_pBase, sizeof(Tobject) * (nCount += 8)); // reserve 8 more than asked
+			Tobject* tmp = (Tobject*)_REALLOC(m_pBase, sizeof(Tobject) * nCount);
+			if (tmp == nullptr) return false;
+			m_pBase = tmp;
+			m_nReserved = nCount;
+		}
+		return true;
+	}
+	// makes the array a copy of the other (of as many objects)
+	inline bool assign(const dyn_array& other)
+	{
+		if (other.m_nReserved <= 0) { cleanup(); return true; }
+		if (!reserve(other.m_nReserved) || !shrink(other.m_nReserved)) return false;
+		memcpy(m_pBase, other.m_pBase, sizeof(Tobject) * other.m_nReserved);
+		return true;
+	}
+	// releases the space beyond nCount no. of objects
+	inline bool shrink(int nCount)
+	{
+		assert(nCount > 0);
+		if (nCount < m_nReserved)
+		{
+			Tobject* tmp = (Tobject*)_REALLOC(m_pBase, sizeof(Tobject) * nCount);
 			if (tmp == nullptr) return false;
 			m_pBase = tmp;
 			m_nReserved = nCount;
@@ -313,11 +555,20 @@ public:
 	{
 		return TSize;
 	}
+	inline const Tobject* data() const
+	{
+		return m_Base;
+	}
 	inline bool ensureValid(int nIndex) const
 	{
 		assert(nIndex >= 0 && nIndex < reserved());
 		return true;
 	}
+	inline bool reserve(int nCount) const
+	{
+		assert(nCount <= reserved());
+		return nCount <= reserved();
+	}
 	inline const_TobjRef operator[](int nIndex) const
 	{
 		return m_Base[nIndex];
@@ -337,11 +588,62 @@ public:
 	}
 };
 
+// Read-only view over an externally owned array (for example, the values section of a 
+// memory-mapped trie image). The memory is neither allocated nor released by this array.
+template<typename Tobject>
+struct mapped_array
+{
+	const Tobject* m_pBase = nullptr;	// the start of array
+	int m_nReserved = 0;	// no. of objects in the array
+	typedef typename std::conditional<std::is_scalar<Tobject>::value, const Tobject, const Tobject&>::type const_TobjRef;
+public:
+	inline int reserved() const
+	{
+		return m_nReserved;
+	}
+	inline const Tobject* data() const
+	{
+		return m_pBase;
+	}
+	inline void attach(const void* pBase, int nCount)
+	{
+		m_pBase = (const Tobject*)pBase;
+		m_nReserved = nCount;
+	}
+	inline void detach()
+	{
+		m_pBase = nullptr;
+		m_nReserved = 0;
+	}
+	inline const_TobjRef operator[](int nIndex) const
+	{
+		assert(m_pBase != nullptr && nIndex >= 0 && nIndex < m_nReserved);
+		return *(m_pBase + nIndex);
+	}
+};
+
+// Describes the memory of a trie_array: the image of the trie (see trie_hash::imageSize()) and
+// the values array. Used to save a trie_array as a flat image and to attach the image back for lookups.
+struct trie_layout
+{
+	const void*	pTrie;		// the image of the trie: nullptr for a trie in use (cedar keeps its tail apart, see saveTrie())
+	size_t		nTrieSize;	// size of the image in bytes: the tail, then the double array
+	size_t		nTailSize;	// size of the tail in bytes
+	size_t		unitSize;	// size of each unit of the double array
+	int			nKeys;		// no. of keys in the trie
+	const void*	pValues;	// the values array
+	int			nValues;	// no. of values in the array
+	size_t		valueSize;	// size of each value
+};
+
 struct instanced_triehash : protected trie_hash
 {
 	typedef trie_hash::HASH HASH;
 };
 
+// shared_triehash: all the instances share the same (function-static) trie_hash.
+//	No synchronization is done. Load the keys upfront (before any other thread uses them),
+//	or use rcu_trie_array (rcu_trie_array.h) when keys get added while other threads read.
 struct shared_triehash
 {
 	typedef trie_hash::HASH HASH;
@@ -372,6 +674,10 @@ protected:
 	{
 		getInstance().setHash(keys, keylen, hash, arrayLen);
 	}
+	static inline void build(const char* keys[], const size_t keylen[], size_t arrayLen, HASH hashOut[] = nullptr)
+	{
+		getInstance().build(keys, keylen, arrayLen, hashOut);
+	}
 	static inline iterator begin()
 	{
 		return getInstance().begin();
@@ -466,10 +772,26 @@ public:
 	// pre-load the keys and values. The Hash values may not be known in this
 	// case, so further access to the array will always be throug strings only,
 	// such as through operator [](const char*).
-	inline void insertkv(const char* szKeys[], Tvalue values[], int arrayLen)
+	inline void insertkv(const char* szKeys[], const Tvalue values[], int arrayLen)
 	{
-		for (int i = 0; i < arrayLen; ++i)
-			insertkv(szKeys[i], values[i]);
+		insertkv(szKeys, nullptr, values, arrayLen);
+	}
+	// bulk version of insertkv(). The keys are hashed in one pass (see trie_hash::build())
+	// and the array is grown only once for the whole batch. The hash of each key can 
+	// optionally be collected in hashOut (should be arrayLen in size).
+	inline void insertkv(const char* szKeys[], const size_t keyLen[], const Tvalue values[], size_t arrayLen, KEY hashOut[] = nullptr)
+	{
+		if (arrayLen <= 0) return;
+		std::vector<KEY> hashes(hashOut == nullptr ? arrayLen : 0);
+		KEY* pHash = (hashOut == nullptr ? hashes.data() : hashOut);
+		Trie_Hash_Impl::build(szKeys, keyLen, arrayLen, pHash);
+		setupKeyRange(pHash, arrayLen);
+		updateValues(pHash, values, arrayLen);
+	}
+	// hint to pre-allocate the array for the given no. of keys (useful before a series of single insertkv())
+	inline bool reserve(int nCount)
+	{
+		return m_array.reserve(nCount);
 	}
 	// set value associated with a string, manually choosing a hash key.
 	// The value can later be updated directly using the same hash key,
@@ -484,7 +806,7 @@ public:
 	// pre-load the keys and values with manually chosen hashes. Later
 	// these same hashes can be used to update the values in bulk, using
 	// updateValues() or updateValue().
-	inline void insertkhv(const char* szKeys[], const KEY hash[], Tvalue values[], int arrayLen)
+	inline void insertkhv(const char* szKeys[], const KEY hash[], const Tvalue values[], int arrayLen)
 	{
 		loadKeys(szKeys, hash, arrayLen);
 		updateValues(hash, values, arrayLen);
@@ -498,14 +820,14 @@ public:
 	}
 	// Once keys has been pre-loaded with loadKeys(), the values can be
 	// updated easily just by directly using the hash (instead of the string key).
-	inline void updateValues(const KEY hash[], Tvalue values[], int arrayLen)
+	inline void updateValues(const KEY hash[], const Tvalue values[], int arrayLen)
 	{
 		for (int i = 0; i < arrayLen; ++i)
 			updateValue(hash[i], values[i]);
 	}
 	// updates the values for sequential hashes in the range [first, last). 
 	// The keys for these hashes should have been pre-loaded with loadKeys or insert() earlier.
-	inline void updateValues(KEY hashFirst, KEY hashLast, Tvalue values[])
+	inline void updateValues(KEY hashFirst, KEY hashLast, const Tvalue values[])
 	{
 		assert(hashFirst < hashLast && hashFirst >= 0 && hashLast < m_array.reserved());
 		memcpy(m_array.m_pBase + hashFirst, values, sizeof(Tvalue)*(hashLast - hashFirst));
@@ -530,6 +852,58 @@ public:
 		KEY maxIndex = *std::max_element(hash, hash + arrayLen);
 		m_array.ensureValid(maxIndex); // we are not loading the values here, but ensure enough space
 	}
+	// Removes the key and resets its value to zero/null. The array slot (and the hash) of 
+	// the key is reused by the next new key. Returns the hash of the erased key, or -1 if 
+	// the key does not exist. 
+	inline KEY erase(const char* szKey, size_t keyLen)
+	{
+		KEY hash = Trie_Hash_Impl::erase(szKey, keyLen);
+		if (hash >= 0 && hash < m_array.reserved()) updateValue(hash, Tvalue());
+		return hash;
+	}
+	inline KEY erase(const char* szKey)
+	{
+		return erase(szKey, strlen(szKey));
+	}
+	// Rebuilds the trie without the erased keys and shrinks the array to the hashes in use.
+	// erase() compacts the trie (but not the array) automatically beyond a threshold.
+	inline void compact()
+	{
+		Trie_Hash_Impl::compact();
+		m_array.shrink(std::max(Trie_Hash_Impl::nextHash(), (KEY)1));
+	}
+	// Returns the memory layout of the keys and values, for saving them as an image (see trie_image.h).
+	inline trie_layout layout() const
+	{
+		trie_layout l = { nullptr, Trie_Hash_Impl::imageSize(), Trie_Hash_Impl::imageTailSize(), Trie_Hash_Impl::unitSize(), (int)Trie_Hash_Impl::size(),
+						  m_array.data(), m_array.reserved(), sizeof(Tvalue) };
+		return l;
+	}
+	// Appends the image of the trie (layout().nTrieSize bytes) to the file. Returns 0 on success, -1 on failure.
+	inline int saveTrie(const char* szFile) const
+	{
+		return Trie_Hash_Impl::saveImage(szFile);
+	}
+	// Attaches to the keys and values of a layout saved earlier (usually a memory-mapped
+	// image) without copying. The array should be a mapped_array. See trie_image.h
+	inline void attach(const trie_layout& l)
+	{
+		assert(l.valueSize == sizeof(Tvalue) && l.unitSize == Trie_Hash_Impl::unitSize() && l.pTrie != nullptr);
+		Trie_Hash_Impl::attach(l.pTrie, l.nTrieSize, l.nKeys);
+		m_array.attach(l.pValues, l.nValues);
+	}
+	// Makes this a copy of the other: its keys with their hashes (in a trie built afresh, see
+	// trie_hash::assign()) and its values.
+	inline void assign(_Myt& other)
+	{
+		Trie_Hash_Impl::assign(other);
+		m_array.assign(other.m_array);
+	}
+	inline void detach()
+	{
+		Trie_Hash_Impl::detach();
+		m_array.detach();
+	}
 	// clear only the values and retain the keys. All values will be set to zero/null.
 	inline void clearValues() 
 	{
@@ -602,7 +976,8 @@ struct trie_prefixed_array : public trie_array <Tvalue, trie_prefixed_hash, Tarr
 	}
 	inline const_TValRef prefixMatch(const char* szKey, size_t keyLen, TRIE::result_pair_type* resultArray, size_t resultArrayLen, const_TValRef errVal) const
 	{
-		size_t nResults = Trie_Hash_Impl::prefixMatch(szKey, keyLen, resultArray, resultArrayLen);
+		// cedar reports the total no. of matches, which could be more than the resultArrayLen
+		size_t nResults = std::min(Trie_Hash_Impl::prefixMatch(szKey, keyLen, resultArray, resultArrayLen), resultArrayLen);
 		if (nResults <= 0) return errVal;
 		return operator[](resultArray[nResults - 1].value);
 	}
@@ -642,6 +1017,12 @@ typedef trie_hash TrieHash;
 	  + trie_hash::hash() can be avoided by specifying manual Hashes (with loadKeys(), insert()).
 	  + Cache and supply the string lengths manually wherever possible. They are faster.
 	  + Use bulk insertions and bulk updates(). They are faster. Single insert() is very costly.
+	  + Bulk insertkv() (and trie_hash::build()) insert the keys in sorted order and grow the
+		value array only once. Prefer it for loading hundreds or thousands of keys.
+	  + When keys have to be added one-by-one, use reserve() upfront to size the value array.
+	  + erase() frees the key and its array slot for reuse. The trie gets rebuilt once the erased
+		keys pass a threshold, and compact() can be used to also shrink the value array.
+	  + Do not erase keys whose hashes are cached elsewhere: the hash gets reused for a new key.
 	
 	Example Code
 	----------------
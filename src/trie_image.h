@@ -0,0 +1,226 @@
+/*
+	Copyright (c) 2016 Cenacle Research India Private Limited
+*/
+
+#ifndef _TRIE_IMAGE_H__Guid__5E0B7A52_3C1D_4F67_9A8B_2D6E41C09F13___
+#define _TRIE_IMAGE_H__Guid__5E0B7A52_3C1D_4F67_9A8B_2D6E41C09F13___
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include "trie_array.h"
+
+#if defined(WIN32) || defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// trie_image: flat binary image of a trie_array (the cedar trie + the values array).
+//	The image is laid out such that it can be memory-mapped read-only and queried in place,
+//	without any parsing or copying. Processes mapping the same image share the pages.
+/*	Image Layout:
+		+ _trieImageHeader
+		+ the trie, at trieOffset, as cedar saves it: the tail (the suffixes of the keys, led by
+		  its size) and then the double array units (cedar nodes)
+		+ values array, at valuesOffset
+	The double array and the values are aligned to IMAGE_ALIGNMENT, so that they stay aligned when mapped.
+
+	Notes:
+		+ Images are not portable across architectures (endianness and sizes are checked, not converted).
+		+ Only the lookups are supported on a mapped image. No new keys or values can be added, and
+		  the keys cannot be iterated (see trie_hash::attach()).
+		+ The values are saved as raw bytes. Pointers (such as handler addresses) are not valid
+		  across processes. Save indices (into a handler table etc.) as values instead.
+*/
+struct _trieImageHeader
+{
+	enum { IMAGE_VERSION = 2, IMAGE_ALIGNMENT = 64 };
+	char		magic[8];		// "DSTRIE" followed by two NULs
+	uint32_t	version;
+	uint32_t	headerSize;		// sizeof(_trieImageHeader)
+	uint32_t	endianCheck;	// 0x01020304 when written
+	uint32_t	unitSize;		// size of each unit of the double array
+	uint32_t	valueSize;		// sizeof(Tvalue)
+	int32_t		nKeys;			// no. of keys in the trie
+	uint64_t	trieOffset;		// offset of the trie (its tail) from the start of image
+	uint64_t	nTrieSize;		// size of the trie in bytes (the tail and the double array)
+	uint64_t	nTailSize;		// size of the tail in bytes
+	uint64_t	valuesOffset;	// offset of the values array from the start of image
+	uint64_t	nValues;		// no. of values in the values array
+
+	static inline const char* signature() { return "DSTRIE\0"; }
+	static inline uint64_t aligned(uint64_t offset) { return (offset + IMAGE_ALIGNMENT - 1) & ~(uint64_t)(IMAGE_ALIGNMENT - 1); }
+};
+
+// Read-only memory mapping of a complete file
+struct mapped_file
+{
+	const void*	m_pData = nullptr;
+	size_t		m_nSize = 0;
+#if defined(WIN32) || defined(_WIN32)
+	HANDLE		m_hFile = INVALID_HANDLE_VALUE;
+	HANDLE		m_hMapping = NULL;
+#endif
+public:
+	inline ~mapped_file()
+	{
+		close();
+	}
+	// maps the file read-only. Returns 0 on success, -1 on failure
+	inline int open(const char* szFile)
+	{
+		close();
+#if defined(WIN32) || defined(_WIN32)
+		m_hFile = CreateFileA(szFile, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (m_hFile == INVALID_HANDLE_VALUE) return -1;
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(m_hFile, &size) || size.QuadPart <= 0) { close(); return -1; }
+		m_hMapping = CreateFileMappingA(m_hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (m_hMapping == NULL) { close(); return -1; }
+		m_pData = MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0);
+		if (m_pData == nullptr) { close(); return -1; }
+		m_nSize = (size_t)size.QuadPart;
+#else
+		int fd = ::open(szFile, O_RDONLY);
+		if (fd < 0) return -1;
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size <= 0) { ::close(fd); return -1; }
+		void* pData = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		::close(fd);	// the mapping stays valid after the descriptor is closed
+		if (pData == MAP_FAILED) return -1;
+		m_pData = pData;
+		m_nSize = (size_t)st.st_size;
+#endif
+		return 0;
+	}
+	inline void close()
+	{
+#if defined(WIN32) || defined(_WIN32)
+		if (m_pData != nullptr) UnmapViewOfFile(m_pData);
+		if (m_hMapping != NULL) CloseHandle(m_hMapping);
+		if (m_hFile != INVALID_HANDLE_VALUE) CloseHandle(m_hFile);
+		m_hMapping = NULL;
+		m_hFile = INVALID_HANDLE_VALUE;
+#else
+		if (m_pData != nullptr) munmap(const_cast<void*>(m_pData), m_nSize);
+#endif
+		m_pData = nullptr;
+		m_nSize = 0;
+	}
+	inline const void* data() const { return m_pData; }
+	inline size_t size() const { return m_nSize; }
+};
+
+struct trie_image
+{
+	// Writes the trie_array as a flat image file. Returns 0 on success, -1 on failure.
+	template<typename TArray>
+	static inline int save(const char* szFile, const TArray& ta)
+	{
+		trie_layout l = ta.layout();
+		_trieImageHeader hdr;
+		memset(&hdr, 0, sizeof(hdr));
+		memcpy(hdr.magic, _trieImageHeader::signature(), sizeof(hdr.magic));
+		hdr.version = _trieImageHeader::IMAGE_VERSION;
+		hdr.headerSize = sizeof(hdr);
+		hdr.endianCheck = 0x01020304;
+		hdr.unitSize = (uint32_t)l.unitSize;
+		hdr.valueSize = (uint32_t)l.valueSize;
+		hdr.nKeys = l.nKeys;
+		hdr.nTrieSize = l.nTrieSize;
+		hdr.nTailSize = l.nTailSize;
+		hdr.nValues = l.nValues;
+		hdr.trieOffset = _trieImageHeader::aligned(sizeof(hdr) + hdr.nTailSize) - hdr.nTailSize;	// (the double array aligned)
+		hdr.valuesOffset = _trieImageHeader::aligned(hdr.trieOffset + hdr.nTrieSize);
+
+		// cedar writes the trie (it keeps the tail to itself), appended between the header and the values
+		FILE* fp = fopen(szFile, "wb");
+		if (fp == nullptr) return -1;
+		bool bOK = fwrite(&hdr, sizeof(hdr), 1, fp) == 1 && pad(fp, hdr.trieOffset);
+		bOK = (fclose(fp) == 0) && bOK && ta.saveTrie(szFile) == 0;
+		if (!bOK || (fp = fopen(szFile, "ab")) == nullptr) return -1;
+		bOK = fseek(fp, 0, SEEK_END) == 0 && ftell(fp) == (long)(hdr.trieOffset + hdr.nTrieSize)
+			&& pad(fp, hdr.valuesOffset)
+			&& (hdr.nValues == 0 || fwrite(l.pValues, hdr.valueSize, (size_t)hdr.nValues, fp) == hdr.nValues);
+		bOK = (fclose(fp) == 0) && bOK;
+		return bOK ? 0 : -1;
+	}
+	// Validates the image and extracts its layout. The layout points into the image memory.
+	// Returns 0 on success, -1 if the image is malformed or does not match the expected sizes.
+	static inline int parse(const void* pImage, size_t nImageSize, size_t unitSize, size_t valueSize, trie_layout& l)
+	{
+		if (pImage == nullptr || nImageSize < sizeof(_trieImageHeader)) return -1;
+		const _trieImageHeader& hdr = *(const _trieImageHeader*)pImage;
+		if (memcmp(hdr.magic, _trieImageHeader::signature(), sizeof(hdr.magic)) != 0 ||
+			hdr.version != _trieImageHeader::IMAGE_VERSION || hdr.headerSize != sizeof(hdr) || hdr.endianCheck != 0x01020304 ||
+			hdr.unitSize != unitSize || hdr.valueSize != valueSize || hdr.nKeys < 0)
+			return -1;
+		// the sections should lie completely within the image
+		if (hdr.trieOffset > nImageSize || hdr.nTrieSize > nImageSize - hdr.trieOffset || hdr.nTailSize < sizeof(int) || hdr.nTailSize > hdr.nTrieSize ||
+			hdr.valuesOffset > nImageSize || hdr.nValues > (nImageSize - hdr.valuesOffset) / valueSize || hdr.nValues > INT32_MAX)
+			return -1;
+		l.pTrie = (const char*)pImage + hdr.trieOffset;
+		if (trie_hash::imageTailSizeOf(l.pTrie) != hdr.nTailSize) return -1;	// (cedar finds the double array by the size in the tail)
+		l.nTrieSize = (size_t)hdr.nTrieSize;
+		l.nTailSize = (size_t)hdr.nTailSize;
+		l.unitSize = unitSize;
+		l.nKeys = hdr.nKeys;
+		l.pValues = (const char*)pImage + hdr.valuesOffset;
+		l.nValues = (int)hdr.nValues;
+		l.valueSize = valueSize;
+		return 0;
+	}
+protected:
+	static inline bool pad(FILE* fp, uint64_t offset)
+	{
+		long pos = ftell(fp);
+		if (pos < 0 || (uint64_t)pos > offset) return false;
+		for (; (uint64_t)pos < offset; ++pos)
+			if (fputc(0, fp) == EOF) return false;
+		return true;
+	}
+};
+
+// trie_array_image: a trie_array that is queried in place from a memory-mapped image.
+//	Create the image once with trie_image::save(szFile, ta) from a regular trie_array,
+//	and open() it at startup. Opening is just a mapping: the pages are loaded on first access.
+template<typename Tvalue = int, typename Ttrie_hash_impl = instanced_triehash>
+struct trie_array_image : public trie_array<Tvalue, Ttrie_hash_impl, mapped_array<Tvalue>>
+{
+	typedef trie_array<Tvalue, Ttrie_hash_impl, mapped_array<Tvalue>> _Base;
+protected:
+	mapped_file m_file;
+public:
+	inline ~trie_array_image()
+	{
+		close();
+	}
+	// maps the image file and attaches to it. Returns 0 on success, -1 on failure.
+	inline int open(const char* szFile)
+	{
+		close();
+		trie_layout l;
+		if (m_file.open(szFile) != 0) return -1;
+		if (trie_image::parse(m_file.data(), m_file.size(), _Base::layout().unitSize, sizeof(Tvalue), l) != 0)
+		{
+			m_file.close();
+			return -1;
+		}
+		_Base::attach(l);
+		return 0;
+	}
+	inline void close()
+	{
+		_Base::detach();
+		m_file.close();
+	}
+};
+
+#endif // _TRIE_IMAGE_H__Guid__5E0B7A52_3C1D_4F67_9A8B_2D6E41C09F13___
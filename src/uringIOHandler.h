@@ -0,0 +1,587 @@
+/*
+	Copyright (c) 2016 Cenacle Research India Private Limited
+*/
+
+#ifndef _URINGIOHANDLER_H__Guid__6E0B94D7_2A8C_4B1F_8D53_F41C7A0E9B26___
+#define _URINGIOHANDLER_H__Guid__6E0B94D7_2A8C_4B1F_8D53_F41C7A0E9B26___
+
+// Linux only (io_uring, 6.1 or later for the multishot receive into a provided buffer ring)
+#include <linux/io_uring.h>
+#undef BLOCK_SIZE	// of <linux/fs.h>: clashes with bufArena::BLOCK_SIZE
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <ctime>
+#include <atomic>
+#include <string>
+#include <vector>
+#include "dsclientbase.h"
+#include "connectionOptions.h"
+
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup		425
+#define __NR_io_uring_enter		426
+#define __NR_io_uring_register	427
+#endif
+
+namespace DSCPP
+{
+	// uringIOHandler: TCP transport over io_uring for _dsclientBase (no libuv, no readiness polling).
+	//	- Reads: one multishot receive stays armed on the socket. The kernel picks a buffer for every read
+	//	  from a ring of provided buffers (pooled chunks), and the filled chunk is handed to the client as
+	//	  is (zero-copy, the client owns it from there); its slot in the ring gets a fresh chunk from the pool.
+	//	- Sends: the sends of a loop iteration are queued, and go out as one gathered sendmsg, submitted
+	//	  together with everything else in the single io_uring_enter that also waits for the completions.
+	//	- No buffers are registered (IORING_REGISTER_BUFFERS): the provided ring takes their place for the reads,
+	//	  and the sends go from wherever they were built. A fixed buffer is one per op, so the sends of an
+	//	  iteration could not go gathered in one sendmsg, and they are arena buffers or read buffers replied in
+	//	  place, that come and go faster than a table of registered ones could follow. SEND_ZC pays off only
+	//	  for large sends, at a second completion per send: the messages here are small.
+	//	- Timers: a timeout op ticks the timers of the client every timers().resolution() ms.
+	//	TClient gets the same events as with uvIOHandler. The loop is run by run(), and stopped by stop().
+	/*	Usage:
+			class myClient : public _dsclientBase<uringIOHandler<myClient>> { ... };
+			myClient client;
+			client.open("127.0.0.1", 6021);
+			client.run();		// till client.stop()
+			client.close();
+	*/
+	template<typename TClient>
+	struct uringIOHandler
+	{
+		enum
+		{
+			RING_ENTRIES = 256,
+			READ_BUFFERS = 64,			// provided buffers (power of 2)
+			READ_BUFFER_SIZE = 4096,	// unless set by the nReadBufferSize of the options
+			MAX_SEND_IOVECS = 64,		// buffers gathered into one sendmsg
+			BUFFER_GROUP = 0
+		};
+		enum OP { OP_CONNECT = 1, OP_RECV, OP_SEND, OP_TIMERS_TICK };	// the low byte of the user_data
+		typedef unique_ptr<void> unique_bufptr;
+
+		struct _stats
+		{
+			uint64_t	nEnterCalls = 0;	// syscalls to submit and wait
+			uint64_t	nSendCalls = 0;		// sendmsg ops (each carries the sends of an iteration)
+			uint64_t	nSends = 0;			// send() calls
+			uint64_t	nReads = 0;			// completions of the multishot receive (with data)
+		} m_stats;
+
+	protected:
+		struct _PendingSend
+		{
+			void*	buf;
+			size_t	len;
+			LPFN_SEND_COMPLETE cb;
+			void*	owner;		// the buffer to release on completion (buf may point into it)
+		};
+		// the ring
+		int				m_ringFd = -1;
+		void*			m_pRingMem = MAP_FAILED;	// the submission and completion rings (single mmap)
+		size_t			m_nRingMemSize = 0;
+		io_uring_sqe*	m_sqes = (io_uring_sqe*)MAP_FAILED;
+		size_t			m_nSqesSize = 0;
+		unsigned*		m_sqHead = nullptr;
+		unsigned*		m_sqTail = nullptr;
+		unsigned*		m_sqArray = nullptr;
+		unsigned		m_sqMask = 0;
+		unsigned		m_sqEntries = 0;
+		unsigned		m_nToSubmit = 0;
+		unsigned*		m_cqHead = nullptr;
+		unsigned*		m_cqTail = nullptr;
+		io_uring_cqe*	m_cqes = nullptr;
+		unsigned		m_cqMask = 0;
+		// the provided buffers of the receive
+		io_uring_buf_ring*	m_pBufRing = (io_uring_buf_ring*)MAP_FAILED;
+		size_t			m_nBufRingSize = 0;
+		unsigned short	m_nBufTail = 0;
+		char*			m_readBuffers[READ_BUFFERS];
+		// the socket
+		int				m_fd = -1;
+		unsigned		m_nGeneration = 0;		// tells the completions of the old sockets apart
+		bool			m_bConnecting = false;
+		bool			m_bRecvArmed = false;
+		bool			m_bSendInFlight = false;
+		bool			m_bClosing = false;		// shut down, closed once the ops in flight complete
+		struct sockaddr_in m_dest;
+		std::string		m_strHost;
+		int				m_nPort = 0;
+		int				m_nKeepAliveDelay = 60;
+		// the sends
+		std::vector<_PendingSend> m_sendQueue;	// [m_nSendHead, m_nSendHead + m_nSendsInFlight) are in flight
+		size_t			m_nSendHead = 0;
+		size_t			m_nSendsInFlight = 0;
+		size_t			m_nFrontSent = 0;		// bytes of the front send that are already out
+		size_t			m_nQueuedBytes = 0;		// of the sends not yet completed
+		bool			m_bNotifyWritable = false;	// on_writable() is due once m_nQueuedBytes drains to m_nWritableLowWater
+		size_t			m_nWritableLowWater = 0;
+		struct iovec	m_iov[MAX_SEND_IOVECS];
+		struct msghdr	m_msg;
+		// the loop
+		struct __kernel_timespec m_tickInterval;
+		bool			m_bTicking = false;
+		std::atomic<bool> m_bRunning;
+		bufArena		m_arena;				// send buffers
+		_connectionOptions m_options;
+		int				m_nNumaNode = -1;		// where the loop runs (see place_loop_thread())
+		size_t			m_nReadBufferSize = READ_BUFFER_SIZE;
+
+		inline TClient* client()
+		{
+			return static_cast<TClient*>(this);
+		}
+
+	public:
+		inline uringIOHandler() : m_bRunning(false)
+		{
+			memset(m_readBuffers, 0, sizeof(m_readBuffers));
+		}
+		inline ~uringIOHandler()
+		{
+			close();
+		}
+		///@param buf the data that need to be sent. memory is owned and managed by caller
+		///@param len the size of buf to be sent
+		///@param cb the callback on completion. Called with buf (or owner, if given) and len as parameters
+		///@param owner the allocation that buf points into (for the replies written in place into a read buffer)
+		int send(void* buf, size_t len, LPFN_SEND_COMPLETE cb = release_send_buffer, void* owner = nullptr)
+		{
+			if (m_fd < 0 || m_bClosing) { (*cb)(owner != nullptr ? owner : buf, len); return -1; }
+			_PendingSend pending = { buf, len, cb, owner };
+			m_sendQueue.push_back(pending);	// goes out with the others of this iteration (see flush_sends())
+			m_nQueuedBytes += len;
+			m_stats.nSends++;
+			return 0;
+		}
+		// sends a piece of a message that goes out in several. On a byte stream, that is a plain send
+		int send_piece(void* buf, size_t len, bool bFirst, bool bLast, LPFN_SEND_COMPLETE cb = release_send_buffer, void* owner = nullptr)
+		{
+			return send(buf, len, cb, owner);
+		}
+		// the bytes sent and not yet written to the socket
+		inline size_t queued_bytes() const
+		{
+			return m_nQueuedBytes;
+		}
+		// TClient::on_writable() gets called (once) when the queued sends have drained to nLowWater bytes
+		inline void notify_writable(size_t nLowWater)
+		{
+			m_bNotifyWritable = true;
+			m_nWritableLowWater = nLowWater;
+		}
+		// allocates a buffer that has to be owned and managed by the caller
+		inline void* alloc_send_buffer(size_t size)
+		{
+			return m_arena.acquire(size);
+		}
+		static inline void release_send_buffer(void* buf, size_t s = 0)
+		{
+			POOLED_FREE(buf);	// buf should have been allocated with alloc_send_buffer() (or be a read buffer, for in-place replies)
+		}
+		// sets the socket options (applied to every socket from the next connect) and the loop options of run().
+		// The read buffer size applies from the next open() that sets up the ring.
+		inline void set_options(const _connectionOptions& options)
+		{
+			m_options = options;
+			if (m_ringFd < 0 && options.nReadBufferSize > 0) m_nReadBufferSize = options.nReadBufferSize;
+		}
+		// the NUMA node the loop runs on, once it runs (-1: not known). The threads that work for the
+		// connection (the rpc providers that hand off, say) are best pinned to it too (see pin_thread_to_numa_node())
+		inline int numa_node() const
+		{
+			return m_nNumaNode;
+		}
+		// sets up the ring (on the first call) and starts connecting to the server.
+		// TClient::on_connection_established() gets called on success.
+		int open(const char* szHost, int nPort, int nKeepAliveDelay = 60)
+		{
+			memset(&m_dest, 0, sizeof(m_dest));
+			m_dest.sin_family = AF_INET;
+			m_dest.sin_port = htons(nPort);
+			if (inet_pton(AF_INET, szHost, &m_dest.sin_addr) != 1) return -1;
+			m_strHost = szHost;
+			m_nPort = nPort;
+			m_nKeepAliveDelay = nKeepAliveDelay;
+			if (m_ringFd < 0)
+			{
+				if (init_ring() < 0)
+				{
+					close();
+					return -1;
+				}
+				client()->on_timers_tick(now_ms());	// brings the clock of the wheel up to the loop time
+				uint64_t nResolution = client()->timers().resolution();
+				m_tickInterval.tv_sec = nResolution / 1000;
+				m_tickInterval.tv_nsec = (nResolution % 1000) * 1000000;
+				arm_timers_tick();
+			}
+			return connect();
+		}
+		int reconnect()
+		{
+			if (m_ringFd < 0 || m_fd >= 0) return -1;	// never connected, or the old socket is still closing
+			return connect();
+		}
+		// shuts the socket down. It gets closed once the ops in flight on it complete.
+		// The client decides about the reconnects (see _dsclientBase::disconnect()).
+		int disconnect()
+		{
+			if (m_fd < 0 || m_bClosing) return 0;
+			m_bClosing = true;
+			::shutdown(m_fd, SHUT_RDWR);	// completes the receive, and aborts a connect in progress
+			try_close_socket();
+			return 0;
+		}
+		// runs the loop till stop()
+		int run()
+		{
+			m_bRunning = true;
+			m_nNumaNode = place_loop_thread(m_options);
+			while (m_bRunning && m_ringFd >= 0)
+				if (run_once() < 0) return -1;
+			return 0;
+		}
+		// submits the queued ops, waits for (at least one) completion and handles the completions
+		int run_once()
+		{
+			flush_sends();
+			m_stats.nEnterCalls++;
+			int r = (int)syscall(__NR_io_uring_enter, m_ringFd, m_nToSubmit, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+			if (r < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) return -1;
+			if (r > 0) m_nToSubmit -= std::min((unsigned)r, m_nToSubmit);
+			process_completions();
+			return 0;
+		}
+		// makes run() return. Can be called from a signal handler.
+		void stop()
+		{
+			m_bRunning = false;
+		}
+		// closes the socket (waiting for its ops in flight) and the ring
+		void close()
+		{
+			if (m_ringFd >= 0)
+			{
+				disconnect();
+				for (int i = 0; i < 100 && m_fd >= 0; ++i)	// the shutdown completes the ops right away
+					if (run_once() < 0) break;
+				if (m_fd >= 0) { ::close(m_fd); m_fd = -1; }
+				::close(m_ringFd);	// cancels whatever is left (the timers tick)
+				m_ringFd = -1;
+			}
+			fail_queued_sends();
+			if (m_pRingMem != MAP_FAILED) munmap(m_pRingMem, m_nRingMemSize);
+			if (m_sqes != (io_uring_sqe*)MAP_FAILED) munmap(m_sqes, m_nSqesSize);
+			if (m_pBufRing != (io_uring_buf_ring*)MAP_FAILED) munmap(m_pBufRing, m_nBufRingSize);
+			m_pRingMem = MAP_FAILED;
+			m_sqes = (io_uring_sqe*)MAP_FAILED;
+			m_pBufRing = (io_uring_buf_ring*)MAP_FAILED;
+			for (int i = 0; i < READ_BUFFERS; ++i)
+				if (m_readBuffers[i] != nullptr) { POOLED_FREE(m_readBuffers[i]); m_readBuffers[i] = nullptr; }
+			m_bTicking = false;
+		}
+		inline bool is_connected() const
+		{
+			return m_fd >= 0 && !m_bConnecting && !m_bClosing;
+		}
+
+	protected:
+		static inline uint64_t now_ms()
+		{
+			struct timespec ts;
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+			return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+		}
+		int init_ring()
+		{
+			struct io_uring_params params;
+			memset(&params, 0, sizeof(params));
+			params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;	// completions are run only when we wait for them
+			m_ringFd = (int)syscall(__NR_io_uring_setup, RING_ENTRIES, &params);
+			if (m_ringFd < 0 && errno == EINVAL)	// older kernel
+			{
+				memset(&params, 0, sizeof(params));
+				m_ringFd = (int)syscall(__NR_io_uring_setup, RING_ENTRIES, &params);
+			}
+			if (m_ringFd < 0 || !(params.features & IORING_FEAT_SINGLE_MMAP)) return -1;
+
+			size_t nSqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+			size_t nCqSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+			m_nRingMemSize = std::max(nSqSize, nCqSize);
+			m_pRingMem = mmap(nullptr, m_nRingMemSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_SQ_RING);
+			m_nSqesSize = params.sq_entries * sizeof(io_uring_sqe);
+			m_sqes = (io_uring_sqe*)mmap(nullptr, m_nSqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_SQES);
+			if (m_pRingMem == MAP_FAILED || m_sqes == (io_uring_sqe*)MAP_FAILED) return -1;
+			char* pRing = (char*)m_pRingMem;
+			m_sqHead = (unsigned*)(pRing + params.sq_off.head);
+			m_sqTail = (unsigned*)(pRing + params.sq_off.tail);
+			m_sqArray = (unsigned*)(pRing + params.sq_off.array);
+			m_sqMask = *(unsigned*)(pRing + params.sq_off.ring_mask);
+			m_sqEntries = params.sq_entries;
+			m_cqHead = (unsigned*)(pRing + params.cq_off.head);
+			m_cqTail = (unsigned*)(pRing + params.cq_off.tail);
+			m_cqes = (io_uring_cqe*)(pRing + params.cq_off.cqes);
+			m_cqMask = *(unsigned*)(pRing + params.cq_off.ring_mask);
+
+			// the ring of provided buffers, filled with pooled chunks (in place of registered buffers: see the notes above)
+			m_nBufRingSize = READ_BUFFERS * sizeof(io_uring_buf);
+			m_pBufRing = (io_uring_buf_ring*)mmap(nullptr, m_nBufRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (m_pBufRing == (io_uring_buf_ring*)MAP_FAILED) return -1;
+			struct io_uring_buf_reg reg;
+			memset(&reg, 0, sizeof(reg));
+			reg.ring_addr = (uint64_t)m_pBufRing;
+			reg.ring_entries = READ_BUFFERS;
+			reg.bgid = BUFFER_GROUP;
+			if (syscall(__NR_io_uring_register, m_ringFd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) return -1;
+			m_nBufTail = 0;
+			for (unsigned short bid = 0; bid < READ_BUFFERS; ++bid)
+			{
+				m_readBuffers[bid] = (char*)POOLED_ALLOC(m_nReadBufferSize);
+				provide_buffer(bid);
+			}
+			return 0;
+		}
+		// puts the buffer back in the ring (the kernel sees it with the tail)
+		inline void provide_buffer(unsigned short bid)
+		{
+			// the entries start at the ring (not at bufs: its flexible array is off by the empty struct in C++)
+			io_uring_buf* pBuf = reinterpret_cast<io_uring_buf*>(m_pBufRing) + (m_nBufTail & (READ_BUFFERS - 1));
+			pBuf->addr = (uint64_t)m_readBuffers[bid];
+			pBuf->len = (unsigned)m_nReadBufferSize;
+			pBuf->bid = bid;
+			__atomic_store_n(&m_pBufRing->tail, ++m_nBufTail, __ATOMIC_RELEASE);
+		}
+		// next free submission entry (cleared), or nullptr if the ring is full even after a submit
+		io_uring_sqe* get_sqe()
+		{
+			unsigned tail = *m_sqTail;
+			if (tail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE) >= m_sqEntries)
+			{
+				int r = (int)syscall(__NR_io_uring_enter, m_ringFd, m_nToSubmit, 0, 0, nullptr, 0);
+				if (r > 0) m_nToSubmit -= std::min((unsigned)r, m_nToSubmit);
+				if (tail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE) >= m_sqEntries) return nullptr;
+			}
+			io_uring_sqe* sqe = &m_sqes[tail & m_sqMask];
+			memset(sqe, 0, sizeof(*sqe));
+			m_sqArray[tail & m_sqMask] = tail & m_sqMask;
+			__atomic_store_n(m_sqTail, tail + 1, __ATOMIC_RELEASE);
+			m_nToSubmit++;
+			return sqe;
+		}
+		inline uint64_t user_data(OP op) const
+		{
+			return ((uint64_t)m_nGeneration << 8) | op;
+		}
+		int connect()
+		{
+			m_fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+			if (m_fd < 0) return -1;
+			int nOn = 1;
+			setsockopt(m_fd, SOL_SOCKET, SO_KEEPALIVE, &nOn, sizeof(nOn));
+			setsockopt(m_fd, IPPROTO_TCP, TCP_KEEPIDLE, &m_nKeepAliveDelay, sizeof(m_nKeepAliveDelay));
+			apply_socket_options(m_fd, m_options);	// best effort: the connection works without them
+			++m_nGeneration;
+			m_bClosing = false;
+			io_uring_sqe* sqe = get_sqe();
+			if (sqe == nullptr) { ::close(m_fd); m_fd = -1; return -1; }
+			sqe->opcode = IORING_OP_CONNECT;
+			sqe->fd = m_fd;
+			sqe->addr = (uint64_t)&m_dest;
+			sqe->off = sizeof(m_dest);
+			sqe->user_data = user_data(OP_CONNECT);
+			m_bConnecting = true;
+			return 0;
+		}
+		void arm_recv()
+		{
+			io_uring_sqe* sqe = get_sqe();
+			if (sqe == nullptr) return;
+			sqe->opcode = IORING_OP_RECV;
+			sqe->fd = m_fd;
+			sqe->ioprio = IORING_RECV_MULTISHOT;
+			sqe->flags = IOSQE_BUFFER_SELECT;
+			sqe->buf_group = BUFFER_GROUP;
+			sqe->user_data = user_data(OP_RECV);
+			m_bRecvArmed = true;
+		}
+		void arm_timers_tick()
+		{
+			io_uring_sqe* sqe = get_sqe();
+			if (sqe == nullptr) return;
+			sqe->opcode = IORING_OP_TIMEOUT;
+			sqe->addr = (uint64_t)&m_tickInterval;
+			sqe->len = 1;
+			sqe->user_data = OP_TIMERS_TICK;
+			m_bTicking = true;
+		}
+		// gathers the queued sends into one sendmsg (one op in flight at a time keeps them in order)
+		void flush_sends()
+		{
+			if (m_bSendInFlight || m_fd < 0 || m_bConnecting || m_bClosing || m_nSendHead == m_sendQueue.size()) return;
+			size_t nIov = 0;
+			for (size_t i = m_nSendHead; i < m_sendQueue.size() && nIov < MAX_SEND_IOVECS; ++i, ++nIov)
+			{
+				size_t nSkip = (i == m_nSendHead) ? m_nFrontSent : 0;
+				m_iov[nIov].iov_base = (char*)m_sendQueue[i].buf + nSkip;
+				m_iov[nIov].iov_len = m_sendQueue[i].len - nSkip;
+			}
+			memset(&m_msg, 0, sizeof(m_msg));
+			m_msg.msg_iov = m_iov;
+			m_msg.msg_iovlen = nIov;
+			io_uring_sqe* sqe = get_sqe();
+			if (sqe == nullptr) return;
+			sqe->opcode = IORING_OP_SENDMSG;
+			sqe->fd = m_fd;
+			sqe->addr = (uint64_t)&m_msg;
+			sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+			sqe->user_data = user_data(OP_SEND);
+			m_nSendsInFlight = nIov;
+			m_bSendInFlight = true;
+			m_stats.nSendCalls++;
+		}
+		// completes the sends that went out fully
+		void on_sent(size_t nSent)
+		{
+			nSent += m_nFrontSent;
+			m_nFrontSent = 0;
+			for (; m_nSendsInFlight > 0; --m_nSendsInFlight)
+			{
+				_PendingSend& pending = m_sendQueue[m_nSendHead];
+				if (nSent < pending.len) { m_nFrontSent = nSent; break; }	// partly sent: the rest goes with the next flush
+				nSent -= pending.len;
+				m_nQueuedBytes -= pending.len;
+				++m_nSendHead;
+				(*pending.cb)(pending.owner != nullptr ? pending.owner : pending.buf, pending.len);	// may queue more sends
+			}
+			m_nSendsInFlight = 0;
+			if (m_nSendHead == m_sendQueue.size()) { m_sendQueue.clear(); m_nSendHead = 0; }
+			else if (m_nSendHead >= MAX_SEND_IOVECS && m_nSendHead * 2 >= m_sendQueue.size())	// (a queue that never drains: its sent front goes)
+			{
+				m_sendQueue.erase(m_sendQueue.begin(), m_sendQueue.begin() + m_nSendHead);
+				m_nSendHead = 0;
+			}
+			if (m_bNotifyWritable && m_nQueuedBytes <= m_nWritableLowWater)
+			{
+				m_bNotifyWritable = false;
+				client()->on_writable();
+			}
+		}
+		void fail_queued_sends()
+		{
+			while (m_nSendHead < m_sendQueue.size())
+			{
+				_PendingSend pending = m_sendQueue[m_nSendHead++];
+				(*pending.cb)(pending.owner != nullptr ? pending.owner : pending.buf, pending.len);
+			}
+			m_sendQueue.clear();
+			m_nSendHead = m_nSendsInFlight = m_nFrontSent = m_nQueuedBytes = 0;
+		}
+		// closes the socket once nothing is in flight on it
+		void try_close_socket()
+		{
+			if (!m_bClosing || m_bConnecting || m_bRecvArmed || m_bSendInFlight) return;
+			::close(m_fd);
+			m_fd = -1;
+			m_bClosing = false;
+			fail_queued_sends();
+		}
+		// the connection broke (not by disconnect())
+		void on_socket_error()
+		{
+			if (m_bClosing) return;
+			disconnect();
+			client()->on_connection_lost();	// schedules a reconnect
+		}
+		void process_completions()
+		{
+			unsigned head = *m_cqHead;
+			while (head != __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE))
+			{
+				io_uring_cqe cqe = m_cqes[head & m_cqMask];
+				__atomic_store_n(m_cqHead, ++head, __ATOMIC_RELEASE);	// the handlers below may submit more
+				on_completion(cqe);
+				head = *m_cqHead;
+			}
+		}
+		void on_completion(const io_uring_cqe& cqe)
+		{
+			OP op = (OP)(cqe.user_data & 0xFF);
+			if (op == OP_TIMERS_TICK)
+			{
+				m_bTicking = false;
+				if (m_ringFd >= 0) arm_timers_tick();
+				client()->on_timers_tick(now_ms());
+				return;
+			}
+			if ((cqe.user_data >> 8) != m_nGeneration)	// of a socket that is closed by now
+			{
+				if (op == OP_RECV && (cqe.flags & IORING_CQE_F_BUFFER)) provide_buffer(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+				return;
+			}
+			switch (op)
+			{
+			case OP_CONNECT:
+				m_bConnecting = false;
+				if (cqe.res < 0 || m_bClosing)
+				{
+					bool bAborted = m_bClosing;
+					m_bClosing = true;
+					try_close_socket();
+					if (!bAborted) client()->on_connection_lost();	// the client retries later
+					return;
+				}
+				arm_recv();
+				client()->on_connection_established();
+				return;
+			case OP_RECV:
+				if (!(cqe.flags & IORING_CQE_F_MORE)) m_bRecvArmed = false;
+				if (cqe.res > 0 && (cqe.flags & IORING_CQE_F_BUFFER))
+				{
+					unsigned short bid = (unsigned short)(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+					char* pData = m_readBuffers[bid];
+					m_readBuffers[bid] = (char*)POOLED_ALLOC(m_nReadBufferSize);	// the client keeps the filled one
+					provide_buffer(bid);
+					m_stats.nReads++;
+					if (m_options.bQuickAck) set_quickack(m_fd);	// the kernel turns it off on its own
+					if (m_bClosing)
+						POOLED_FREE(pData);
+					else	// the read buffer is owned by the client from here (messages are dispatched in place)
+						client()->handle_server_data(unique_bufptr(pData), pData, cqe.res);
+					if (!m_bRecvArmed && !m_bClosing) arm_recv();
+				}
+				else if (cqe.res == -ENOBUFS)	// every buffer was taken when the data came: they are back by now
+				{
+					if (!m_bRecvArmed && !m_bClosing) arm_recv();
+				}
+				else if (!m_bClosing)
+				{
+					DSLOG_WARN("Socket Read Failure: connection lost with server");
+					on_socket_error();
+				}
+				try_close_socket();
+				return;
+			case OP_SEND:
+				m_bSendInFlight = false;
+				if (cqe.res >= 0)
+					on_sent(cqe.res);
+				else
+					on_socket_error();
+				try_close_socket();
+				return;
+			default:
+				return;
+			}
+		}
+	};
+} // namespace DSCPP
+
+#endif // _URINGIOHANDLER_H__Guid__6E0B94D7_2A8C_4B1F_8D53_F41C7A0E9B26___
@@ -0,0 +1,413 @@
+/*
+	Copyright (c) 2016 Cenacle Research India Private Limited
+*/
+
+#ifndef _UVIOHANDLER_H__Guid__3D8A5C21_6F4B_4E97_A1D2_9C07E64B58F3___
+#define _UVIOHANDLER_H__Guid__3D8A5C21_6F4B_4E97_A1D2_9C07E64B58F3___
+
+#include <string>
+#include "dsclientbase.h"
+#include "connectionOptions.h"
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define UV_SPIN_PAUSE() _mm_pause()
+#else
+#define UV_SPIN_PAUSE()
+#endif
+
+namespace DSCPP
+{
+	// Spin-then-park policy of uvIOHandler::run_loop(), for the latency critical deployments (a single
+	// connection on a dedicated core): after every read the loop keeps polling without blocking
+	// (UV_RUN_NOWAIT) for nSpinUs, and only then parks in the kernel (UV_RUN_ONCE) till the next event.
+	// The wake-up from epoll is then paid only after the quiet periods, not on every message of a burst.
+	struct uvSpinPolicy
+	{
+		uint32_t	nSpinUs = 0;		// 0: park right away (plain UV_RUN_DEFAULT). UINT32_MAX: never park
+		int			nBusyPollUs = 50;	// SO_BUSY_POLL on the socket when spinning (Linux): reads poll the device queue
+	};
+
+	// uvIOHandler: TCP transport over libuv for _dsclientBase.
+	//	TClient is the class deriving from this handler (through _dsclientBase), and gets the events:
+	//		on_connection_established(), on_connection_lost(),
+	//		handle_server_data(spOwner, pData, len), on_timers_tick(nowMs) and on_writable()
+	//	The reads, the send buffers and the write requests all come from a per-connection arena.
+	//	The reads are sized by the recent read sizes: the small ones (acks, pings) land in a reusable slab
+	//	and are copied out to the arena at their size, the large ones are read into the arena directly.
+	//	An idle connection gives back its slab and arena blocks (see IDLE_TRIM_MS).
+	//	The handler reconnects to the same server on reconnect() (see _dsclientBase::on_connection_lost()).
+	/*	Usage:
+			class myClient : public _dsclientBase<uvIOHandler<myClient>> { ... };
+			myClient client;
+			client.open(uv_default_loop(), "127.0.0.1", 6021);
+			client.run_loop();	// or uv_run(uv_default_loop(), UV_RUN_DEFAULT)
+	*/
+	template<typename TClient>
+	struct uvIOHandler
+	{
+		enum
+		{
+			READ_SLAB_SIZE = 2048,						// reads expected to be at most this small go to the slab
+			MAX_READ_SIZE = bufArena::BLOCK_SIZE / 2,	// the read size estimate doubles up to this on full reads
+			READ_SHRINK_AFTER = 8,						// reads below half of the estimate in a row, before it halves
+			IDLE_TRIM_MS = 5000							// no reads or writes for this long: the memory is given back
+		};
+		typedef unique_ptr<void> unique_bufptr;
+
+		uv_connect_t	m_connection;
+		uv_tcp_t		m_socket;
+		uv_timer_t		m_timersTick;	// drives the timers of the client (heartbeat, reconnects)
+		bufArena		m_arena;		// per-connection arena for the read buffers, send buffers and write requests
+		uv_loop_t*		m_uvLoop = nullptr;
+		struct sockaddr_in m_dest;		// server address (for the reconnects)
+		std::string		m_strHost;
+		int				m_nPort = 0;
+		int				m_nKeepAliveDelay = 60;
+		bool			m_bSocketOpen = false;	// m_socket is initialized and not yet closed
+		_connectionOptions m_options;
+		int				m_nNumaNode = -1;		// where the loop runs (see place_loop_thread())
+		uvSpinPolicy	m_spinPolicy;
+		uint64_t		m_nReads = 0;			// tells run_loop() that the loop was not idle
+		uint64_t		m_nWrites = 0;
+		size_t			m_nReadEstimate = READ_SLAB_SIZE;	// expected size of the next read (power of 2)
+		int				m_nSmallReads = 0;		// reads below half of the estimate, in a row
+		char*			m_pReadSlab = nullptr;	// READ_SLAB_SIZE bytes, reused by the small reads
+		uint64_t		m_nActivityAtTick = 0;	// m_nReads + m_nWrites at the last timers tick with activity
+		uint64_t		m_nIdleSinceMs = 0;
+		bool			m_bNotifyWritable = false;	// on_writable() is due once the write queue drains to m_nWritableLowWater
+		size_t			m_nWritableLowWater = 0;
+
+	protected:
+		enum { MAX_FRAME_HEADER_LEN = 16 };
+		struct _Writer
+		{
+			void*	buf;
+			size_t	len;
+			LPFN_SEND_COMPLETE cb;
+			void*	owner;		// the buffer to release on completion (buf may point into it)
+			char	header[MAX_FRAME_HEADER_LEN];	// sent ahead of buf (framing by the derived handlers)
+			uv_write_t write_req;
+			inline _Writer(void* argbuf, size_t arglen, LPFN_SEND_COMPLETE argcb, void* argowner): buf(argbuf), len(arglen), cb(argcb), owner(argowner)
+			{
+				this->write_req.data = this;
+			}
+		};
+		inline TClient* client()
+		{
+			return static_cast<TClient*>(this);
+		}
+
+	public:
+		inline ~uvIOHandler()
+		{
+			if (m_pReadSlab != nullptr) POOLED_FREE(m_pReadSlab);
+		}
+		///@param buf the data that need to be sent. memory is owned and managed by caller
+		///@param len the size of buf to be sent
+		///@param cb the callback on completion. Called with buf (or owner, if given) and len as parameters
+		///@param owner the allocation that buf points into (for the replies written in place into a read buffer)
+		int send(void* buf, size_t len, LPFN_SEND_COMPLETE cb = release_send_buffer, void* owner = nullptr)
+		{
+			return write(nullptr, 0, buf, len, cb, owner);
+		}
+		// sends a piece of a message that goes out in several. On a byte stream, that is a plain send
+		int send_piece(void* buf, size_t len, bool bFirst, bool bLast, LPFN_SEND_COMPLETE cb = release_send_buffer, void* owner = nullptr)
+		{
+			return send(buf, len, cb, owner);
+		}
+		// the bytes sent and not yet written to the socket
+		inline size_t queued_bytes() const
+		{
+			return m_bSocketOpen ? m_socket.write_queue_size : 0;
+		}
+		// TClient::on_writable() gets called (once) when the write queue has drained to nLowWater bytes
+		inline void notify_writable(size_t nLowWater)
+		{
+			m_bNotifyWritable = true;
+			m_nWritableLowWater = nLowWater;
+		}
+		// allocates a buffer that has to be owned and managed by the caller
+		inline void* alloc_send_buffer(size_t size)
+		{
+			return m_arena.acquire(size);
+		}
+		static inline void release_send_buffer(void* buf, size_t s = 0)
+		{
+			POOLED_FREE(buf);	// buf should have been allocated with alloc_send_buffer() (or be a read buffer, for in-place replies)
+		}
+		// starts connecting to the server. TClient::on_connection_established() gets called on success.
+		int open(uv_loop_t* uvLoop, const char* szHost, int nPort, int nKeepAliveDelay = 60)
+		{
+			if (uv_ip4_addr(szHost, nPort, &m_dest) < 0) return -1;
+			m_strHost = szHost;
+			m_nPort = nPort;
+			m_nKeepAliveDelay = nKeepAliveDelay;
+			if (m_uvLoop == nullptr)
+			{
+				m_uvLoop = uvLoop;
+				client()->on_timers_tick(uv_now(m_uvLoop));	// brings the clock of the wheel up to the loop time
+				uv_timer_init(m_uvLoop, &m_timersTick);
+				m_timersTick.data = this;
+				uint64_t nResolution = client()->timers().resolution();
+				uv_timer_start(&m_timersTick, on_timers_tick_due, nResolution, nResolution);
+			}
+			return connect();
+		}
+		int reconnect()
+		{
+			if (m_uvLoop == nullptr || m_bSocketOpen) return -1;	// never connected, or the old socket is still closing
+			return connect();
+		}
+		// closes the socket. The client decides about the reconnects (see _dsclientBase::disconnect()).
+		int disconnect()
+		{
+			if (!m_bSocketOpen) return 0;
+			uv_read_stop((uv_stream_t*)&m_socket);
+			if (!uv_is_closing((uv_handle_t*)&m_socket))
+				uv_close((uv_handle_t*)&m_socket, on_close);
+			return 0;
+		}
+		// sets the socket options (applied to every socket from the next connect) and the loop options of run_loop()
+		inline void set_options(const _connectionOptions& options)
+		{
+			m_options = options;
+		}
+		// the NUMA node the loop runs on, once it runs (-1: not known). The threads that work for the
+		// connection (the rpc providers that hand off, say) are best pinned to it too (see pin_thread_to_numa_node())
+		inline int numa_node() const
+		{
+			return m_nNumaNode;
+		}
+		// sets how run_loop() waits for the events (the socket options apply from the next connect)
+		inline void set_spin_policy(const uvSpinPolicy& policy)
+		{
+			m_spinPolicy = policy;
+		}
+		// runs the loop of open() till it has nothing left to do (see shutdown()), spinning as set by set_spin_policy()
+		int run_loop()
+		{
+			uv_loop_t* uvLoop = m_uvLoop;
+			if (uvLoop == nullptr) return -1;
+			m_nNumaNode = place_loop_thread(m_options);
+			if (m_spinPolicy.nSpinUs == 0) return uv_run(uvLoop, UV_RUN_DEFAULT);
+			uint64_t nSpinNs = (m_spinPolicy.nSpinUs == UINT32_MAX) ? UINT64_MAX : (uint64_t)m_spinPolicy.nSpinUs * 1000;	// (never parks)
+			uint64_t nReads = m_nReads;
+			uint64_t nLastActive = uv_hrtime();
+			for (;;)
+			{
+				if (uv_run(uvLoop, UV_RUN_NOWAIT) == 0) return 0;
+				if (m_nReads != nReads)
+				{
+					nReads = m_nReads;
+					nLastActive = uv_hrtime();
+				}
+				else if (uv_hrtime() - nLastActive < nSpinNs)
+					UV_SPIN_PAUSE();
+				else	// quiet for long enough: park till the next event
+				{
+					if (uv_run(uvLoop, UV_RUN_ONCE) == 0) return 0;
+					nReads = m_nReads;
+					nLastActive = uv_hrtime();
+				}
+			}
+		}
+		// closes the socket and the timers, so that the loop can exit
+		void shutdown()
+		{
+			disconnect();
+			if (m_uvLoop != nullptr)
+			{
+				uv_timer_stop(&m_timersTick);
+				uv_close((uv_handle_t*)&m_timersTick, nullptr);
+				m_uvLoop = nullptr;
+			}
+		}
+
+	protected:
+		int connect()
+		{
+			if (uv_tcp_init_ex(m_uvLoop, &m_socket, AF_INET) < 0) return -1;	// creates the socket now, for the options
+			m_socket.data = this;
+			m_connection.data = this;
+			m_bSocketOpen = true;
+			apply_socket_options(socket_fd(), m_options);	// best effort: the connection works without them
+			if (uv_tcp_keepalive(&m_socket, 1, m_nKeepAliveDelay) < 0 ||
+				uv_tcp_connect(&m_connection, &m_socket, (const struct sockaddr*)&m_dest, on_connect) < 0)
+			{
+				disconnect();
+				return -1;
+			}
+			return 0;
+		}
+		// sends the header (if any) followed by buf, with one write
+		int write(const char* pHeader, size_t nHeaderLen, void* buf, size_t len, LPFN_SEND_COMPLETE cb, void* owner)
+		{
+			assert(nHeaderLen <= MAX_FRAME_HEADER_LEN);
+			void* pWriterMem = m_bSocketOpen ? m_arena.acquire(sizeof(_Writer)) : nullptr;
+			if (pWriterMem == nullptr) { (*cb)(owner != nullptr ? owner : buf, len); return -1; }
+			_Writer* writer = new (pWriterMem) _Writer(buf, len, cb, owner);	// gets released in on_send_done()
+			m_nWrites++;
+			uv_buf_t bufs[2];
+			int nBufs = 0;
+			if (nHeaderLen > 0)
+			{
+				memcpy(writer->header, pHeader, nHeaderLen);
+				bufs[nBufs++] = uv_buf_init(writer->header, (unsigned int)nHeaderLen);
+			}
+			bufs[nBufs++] = uv_buf_init((char*)buf, (unsigned int)len);
+			int r = uv_write(&writer->write_req, (uv_stream_t*)&m_socket, bufs, nBufs, on_send_done);
+			if (r < 0)	// on_send_done() will not be called
+			{
+				(*cb)(owner != nullptr ? owner : buf, len);
+				writer->~_Writer();
+				bufArena::release(writer);
+			}
+			return r;
+		}
+		static void on_send_done(uv_write_t* write_req, int status)
+		{
+			_Writer* writer = (_Writer*)write_req->data;
+			uvIOHandler* pThis = (uvIOHandler*)write_req->handle->data;
+			// call the completion callback
+			(*writer->cb)(writer->owner != nullptr ? writer->owner : writer->buf, writer->len);
+			// free the memory acquired in the write()
+			writer->~_Writer();
+			bufArena::release(writer);
+			if (status == 0 && pThis->m_bNotifyWritable && pThis->queued_bytes() <= pThis->m_nWritableLowWater)
+			{
+				pThis->m_bNotifyWritable = false;
+				pThis->client()->on_writable();
+			}
+		}
+		inline uv_os_sock_t socket_fd()
+		{
+			uv_os_fd_t fd;
+			return (uv_fileno((uv_handle_t*)&m_socket, &fd) == 0) ? (uv_os_sock_t)fd : (uv_os_sock_t)-1;
+		}
+		// for the spinning loop: no Nagle delay on the replies, and busy polling of the device queue on the reads
+		void set_low_latency_options()
+		{
+			uv_tcp_nodelay(&m_socket, 1);
+#ifdef SO_BUSY_POLL
+			if (m_spinPolicy.nBusyPollUs > 0)	// needs CAP_NET_ADMIN above net.core.busy_read
+				setsockopt(socket_fd(), SOL_SOCKET, SO_BUSY_POLL, (char*)&m_spinPolicy.nBusyPollUs, sizeof(m_spinPolicy.nBusyPollUs));
+#endif
+		}
+		// follows the recent read sizes: doubles the estimate on a full read, and halves it
+		// after READ_SHRINK_AFTER reads in a row that needed less than half of it
+		inline void adapt_read_size(size_t nRead, size_t nOffered)
+		{
+			if (nRead >= nOffered)
+			{
+				m_nSmallReads = 0;
+				if (m_nReadEstimate < MAX_READ_SIZE) m_nReadEstimate *= 2;
+			}
+			else if (nRead < m_nReadEstimate / 2 && m_nReadEstimate > READ_SLAB_SIZE)
+			{
+				if (++m_nSmallReads < READ_SHRINK_AFTER) return;
+				m_nSmallReads = 0;
+				m_nReadEstimate /= 2;
+			}
+			else
+				m_nSmallReads = 0;
+		}
+		// gives back the read slab and the arena blocks, if the connection has been idle for IDLE_TRIM_MS
+		inline void trim_if_idle(uint64_t nowMs)
+		{
+			if (m_nReads + m_nWrites != m_nActivityAtTick || m_nIdleSinceMs == 0)
+			{
+				m_nActivityAtTick = m_nReads + m_nWrites;
+				m_nIdleSinceMs = nowMs;
+				return;
+			}
+			if (nowMs - m_nIdleSinceMs < IDLE_TRIM_MS) return;
+			if (m_pReadSlab != nullptr) POOLED_FREE(m_pReadSlab);
+			m_pReadSlab = nullptr;
+			m_arena.trim();	// the blocks still in use stay
+			m_nIdleSinceMs = nowMs;
+		}
+		static void on_timers_tick_due(uv_timer_t* pTimer)
+		{
+			uvIOHandler* pThis = (uvIOHandler*)pTimer->data;
+			uint64_t nowMs = uv_now(pTimer->loop);
+			pThis->trim_if_idle(nowMs);
+			pThis->client()->on_timers_tick(nowMs);
+		}
+		static void on_connect(uv_connect_t* connection, int status)
+		{
+			uvIOHandler* pThis = (uvIOHandler*)connection->data;
+			if (status < 0)
+			{
+				pThis->disconnect();	// closes the socket, and the client retries later
+				pThis->client()->on_connection_lost();
+				return;
+			}
+			uv_stream_set_blocking((uv_stream_t*)&pThis->m_socket, false);
+			if (pThis->m_spinPolicy.nSpinUs > 0) pThis->set_low_latency_options();
+			pThis->client()->on_connection_established();
+			uv_read_start((uv_stream_t*)&pThis->m_socket, on_alloc, on_read);
+		}
+		// hands out the slab, or the estimated size from the arena, for the next read (libuv's suggested_size
+		// is ignored), up to the nReadBufferSize of the options. See on_read for the copy, or the shrink.
+		static void on_alloc(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf)
+		{
+			uvIOHandler* pThis = (uvIOHandler*)handle->data;
+			size_t nMax = pThis->m_options.nReadBufferSize;
+			size_t nWanted = (nMax > 0 && nMax < pThis->m_nReadEstimate) ? nMax : pThis->m_nReadEstimate;
+			if (pThis->m_nReadEstimate <= READ_SLAB_SIZE)
+			{
+				if (pThis->m_pReadSlab == nullptr) pThis->m_pReadSlab = (char*)POOLED_ALLOC(READ_SLAB_SIZE);
+				*buf = uv_buf_init(pThis->m_pReadSlab, pThis->m_pReadSlab == nullptr ? 0 : (unsigned int)nWanted);
+				return;
+			}
+			size_t size = 0;
+			char* base = (char*)pThis->m_arena.acquireAvailable(nWanted, size);
+			if (base != nullptr && size > nWanted && pThis->m_arena.shrink(base, nWanted)) size = nWanted;
+			*buf = uv_buf_init(base, base == nullptr ? 0 : (unsigned int)size);
+		}
+		static void on_read(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf)
+		{
+			uvIOHandler* pThis = (uvIOHandler*)stream->data;
+			bool bSlab = (buf->base != nullptr && buf->base == pThis->m_pReadSlab);
+			if (nread > 0)
+			{
+				pThis->m_nReads++;
+				if (pThis->m_options.bQuickAck) set_quickack(pThis->socket_fd());	// the kernel turns it off on its own
+				pThis->adapt_read_size(nread, buf->len);
+				char* pData = buf->base;
+				if (bSlab)	// copied out at its size, so that the slab can take the next read
+				{
+					pData = (char*)pThis->m_arena.acquire(nread);
+					if (pData != nullptr) memcpy(pData, buf->base, nread);
+				}
+				else
+					pThis->m_arena.shrink(pData, nread); // give back the unused space to the arena
+				if (pData != nullptr)	// the read buffer is owned by the client from here (messages are dispatched in place)
+					pThis->client()->handle_server_data(unique_bufptr(pData), pData, nread);
+				else
+					on_read_failure(pThis);
+			}
+			else
+			{
+				if (buf->base != nullptr && !bSlab) POOLED_FREE(buf->base);
+				if (nread < 0) on_read_failure(pThis);	// 0 is EAGAIN: nothing read
+			}
+		}
+		static void on_read_failure(uvIOHandler* pThis)
+		{
+			DSLOG_WARN("Socket Read Failure: connection lost with server");
+			pThis->disconnect();
+			pThis->client()->on_connection_lost();	// schedules a reconnect
+		}
+		static void on_close(uv_handle_t* handle)
+		{
+			// nothing to delete here because the socket (==handle) is a member (m_socket)
+			uvIOHandler* pThis = (uvIOHandler*)handle->data;
+			pThis->m_bSocketOpen = false;	// can be reconnected now
+			if (pThis->m_pReadSlab != nullptr) POOLED_FREE(pThis->m_pReadSlab);	// not needed till the next connection
+			pThis->m_pReadSlab = nullptr;
+		}
+	};
+} // namespace DSCPP
+
+#endif // _UVIOHANDLER_H__Guid__3D8A5C21_6F4B_4E97_A1D2_9C07E64B58F3___
@@ -0,0 +1,221 @@
+/*
+	Copyright (c) 2016 Cenacle Research India Private Limited
+*/
+
+#ifndef _WSDEFLATE_H__Guid__B52E7A90_3C1D_4F68_9E04_A7D3C61F25E8___
+#define _WSDEFLATE_H__Guid__B52E7A90_3C1D_4F68_9E04_A7D3C61F25E8___
+
+#include <cstring>
+#include <cctype>
+#include "bufPool.h"
+#ifdef DSCPP_WITH_ZLIB
+#include <zlib.h>
+#endif
+
+namespace DSCPP
+{
+	// The permessage-deflate parameters agreed with the server (RFC 7692, 7.1)
+	struct _wsDeflateParams
+	{
+		bool	bServerNoContextTakeover = false;	// server resets its compressor after every message
+		bool	bClientNoContextTakeover = false;	// we have to reset ours after every message
+		int		nServerMaxWindowBits = 15;
+		int		nClientMaxWindowBits = 15;
+
+		// parses the Sec-WebSocket-Extensions value of the handshake response (up to the end of the line).
+		// Returns false if it is not permessage-deflate or has parameters that were not offered.
+		inline bool parse(const char* szExtensions)
+		{
+			const char* p = szExtensions;
+			const char* pName = nullptr;
+			if (token(p, pName) != 18 || strncmp(pName, "permessage-deflate", 18) != 0) return false;
+			for (skip_spaces(p); *p == ';'; skip_spaces(p))
+			{
+				++p;
+				size_t nName = token(p, pName);
+				int nValue = -1;
+				skip_spaces(p);
+				if (*p == '=')	// the window bits (may be quoted)
+				{
+					++p;
+					skip_spaces(p);
+					bool bQuoted = (*p == '"');
+					if (bQuoted) ++p;
+					for (nValue = 0; isdigit((unsigned char)*p); ++p) nValue = nValue * 10 + (*p - '0');
+					if (bQuoted && *p++ != '"') return false;
+				}
+				bool bWindowBits = (nValue >= 8 && nValue <= 15);
+				if (is(pName, nName, "server_no_context_takeover") && nValue < 0) bServerNoContextTakeover = true;
+				else if (is(pName, nName, "client_no_context_takeover") && nValue < 0) bClientNoContextTakeover = true;
+				else if (is(pName, nName, "server_max_window_bits") && bWindowBits) nServerMaxWindowBits = nValue;
+				else if (is(pName, nName, "client_max_window_bits") && bWindowBits) nClientMaxWindowBits = nValue;
+				else return false;
+			}
+			return *p == '\0' || *p == '\r' || *p == '\n';	// one extension only (that is all we offer)
+		}
+	protected:
+		static inline void skip_spaces(const char*& p)
+		{
+			while (*p == ' ' || *p == '\t') ++p;
+		}
+		static inline size_t token(const char*& p, const char*& pStart)
+		{
+			skip_spaces(p);
+			for (pStart = p; *p != '\0' && strchr(" \t;,=\"\r\n", *p) == nullptr; ++p);
+			return p - pStart;
+		}
+		static inline bool is(const char* pName, size_t nName, const char* szParam)
+		{
+			return strlen(szParam) == nName && strncmp(pName, szParam, nName) == 0;
+		}
+	};
+
+#ifdef DSCPP_WITH_ZLIB
+	// wsDeflate: the permessage-deflate compressor and decompressor of a connection.
+	//	The zlib streams live as long as the connection, so that (unless the server asks otherwise) the
+	//	window carries over from message to message: the repetitive JSON of the records and events then
+	//	compresses to a fraction of what each message would on its own. The buffers are pooled chunks.
+	//	Messages smaller than the threshold (acks, pings) are not worth the CPU and go uncompressed.
+	struct wsDeflate
+	{
+		enum { DEFAULT_THRESHOLD = 64, INFLATE_CHUNK_SIZE = 16 * 1024 };	// acks and pings are below the threshold
+
+		z_stream			m_deflater;
+		z_stream			m_inflater;
+		bool				m_bDeflaterReady = false;
+		bool				m_bInflaterReady = false;
+		_wsDeflateParams	m_params;
+		size_t				m_nThreshold = DEFAULT_THRESHOLD;
+		int					m_nLevel = Z_DEFAULT_COMPRESSION;
+		char*				m_pOut = nullptr;	// the chunk being filled by the decompression
+		size_t				m_nOutLen = 0;
+
+		inline ~wsDeflate()
+		{
+			end();
+		}
+		// nThreshold: smallest message that gets compressed. nLevel: zlib compression level (1 fastest, 9 smallest)
+		inline void set_options(size_t nThreshold, int nLevel)
+		{
+			m_nThreshold = nThreshold;
+			m_nLevel = nLevel;
+		}
+		// starts the streams for a connection with the negotiated parameters
+		inline int init(const _wsDeflateParams& params)
+		{
+			end();
+			m_params = params;
+			memset(&m_inflater, 0, sizeof(m_inflater));
+			if (inflateInit2(&m_inflater, -15) != Z_OK) return -1;	// raw deflate; 15 bits can read any window size
+			m_bInflaterReady = true;
+			if (params.nClientMaxWindowBits >= 9)	// zlib cannot write 8-bit windows: then we only send uncompressed
+			{
+				memset(&m_deflater, 0, sizeof(m_deflater));
+				if (deflateInit2(&m_deflater, m_nLevel, Z_DEFLATED, -params.nClientMaxWindowBits, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+				{
+					end();
+					return -1;
+				}
+				m_bDeflaterReady = true;
+			}
+			return 0;
+		}
+		inline void end()
+		{
+			if (m_bDeflaterReady) deflateEnd(&m_deflater);
+			if (m_bInflaterReady) inflateEnd(&m_inflater);
+			m_bDeflaterReady = m_bInflaterReady = false;
+			if (m_pOut != nullptr) POOLED_FREE(m_pOut);
+			m_pOut = nullptr;
+			m_nOutLen = 0;
+		}
+		inline bool is_active() const
+		{
+			return m_bInflaterReady;
+		}
+		inline bool should_compress(size_t len) const
+		{
+			return m_bDeflaterReady && len >= m_nThreshold;
+		}
+		// compresses a message into a pooled buffer (owned by the caller), leaving out the 00 00 FF FF tail
+		// of the flush (RFC 7692, 7.2.1). Returns nullptr on failure.
+		inline char* compress(const char* p, size_t len, size_t& nOutLen)
+		{
+			size_t nCapacity = deflateBound(&m_deflater, (uLong)len) + 16;
+			char* pOut = (char*)POOLED_ALLOC(nCapacity);
+			size_t nOut = 0;
+			m_deflater.next_in = (Bytef*)p;
+			m_deflater.avail_in = (uInt)len;
+			for (;;)
+			{
+				m_deflater.next_out = (Bytef*)pOut + nOut;
+				m_deflater.avail_out = (uInt)(nCapacity - nOut);
+				if (deflate(&m_deflater, Z_SYNC_FLUSH) == Z_STREAM_ERROR) { POOLED_FREE(pOut); return nullptr; }
+				nOut = nCapacity - m_deflater.avail_out;
+				if (m_deflater.avail_out > 0) break;	// all of the message is in, and flushed
+				char* pLarger = (char*)POOLED_ALLOC(nCapacity * 2);
+				memcpy(pLarger, pOut, nOut);
+				POOLED_FREE(pOut);
+				pOut = pLarger;
+				nCapacity *= 2;
+			}
+			if (m_params.bClientNoContextTakeover) deflateReset(&m_deflater);
+			if (nOut < 4)	// nothing to flush (empty message): an empty block stands for it (RFC 7692, 7.2.3.6)
+			{
+				pOut[0] = 0;
+				nOut = 5;
+			}
+			nOutLen = nOut - 4;
+			return pOut;
+		}
+		// decompresses a piece of a compressed message. The output is handed to out(char* pChunk, size_t len)
+		// in pooled chunks (out owns them); the last one comes with the message end. Returns -1 on bad data.
+		template<typename TOutput>
+		inline int decompress(const char* p, size_t len, bool bMessageEnd, TOutput&& out)
+		{
+			if (len > 0 && inflate_piece(p, len, out) < 0) return -1;
+			if (!bMessageEnd) return 0;
+			static const char s_tail[4] = { 0, 0, (char)0xFF, (char)0xFF };
+			if (inflate_piece(s_tail, 4, out) < 0) return -1;
+			if (m_nOutLen > 0) out(m_pOut, m_nOutLen);
+			else if (m_pOut != nullptr) POOLED_FREE(m_pOut);
+			m_pOut = nullptr;
+			m_nOutLen = 0;
+			if (m_params.bServerNoContextTakeover) inflateReset(&m_inflater);
+			return 0;
+		}
+	protected:
+		template<typename TOutput>
+		inline int inflate_piece(const char* p, size_t len, TOutput& out)
+		{
+			m_inflater.next_in = (Bytef*)p;
+			m_inflater.avail_in = (uInt)len;
+			for (;;)
+			{
+				if (m_pOut == nullptr)
+				{
+					m_pOut = (char*)POOLED_ALLOC(INFLATE_CHUNK_SIZE);
+					m_nOutLen = 0;
+				}
+				m_inflater.next_out = (Bytef*)m_pOut + m_nOutLen;
+				m_inflater.avail_out = (uInt)(INFLATE_CHUNK_SIZE - m_nOutLen);
+				int r = inflate(&m_inflater, Z_SYNC_FLUSH);
+				if (r != Z_OK && r != Z_BUF_ERROR && r != Z_STREAM_END) return -1;
+				if (r == Z_STREAM_END) inflateReset(&m_inflater);	// the server ended the stream (BFINAL): a new one follows
+				m_nOutLen = INFLATE_CHUNK_SIZE - m_inflater.avail_out;
+				if (m_nOutLen == INFLATE_CHUNK_SIZE)	// full: hand it over, there may be more
+				{
+					out(m_pOut, m_nOutLen);
+					m_pOut = nullptr;
+					m_nOutLen = 0;
+					continue;
+				}
+				if (m_inflater.avail_in == 0) return 0;
+				if (r == Z_BUF_ERROR) return -1;	// input left, room left, and no progress
+			}
+		}
+	};
+#endif // DSCPP_WITH_ZLIB
+} // namespace DSCPP
+
+#endif // _WSDEFLATE_H__Guid__B52E7A90_3C1D_4F68_9E04_A7D3C61F25E8___
@@ -0,0 +1,534 @@
+/*
+	Copyright (c) 2016 Cenacle Research India Private Limited
+*/
+
+#ifndef _WSIOHANDLER_H__Guid__8F1C2B64_E03A_4D59_B7C6_51A9E4D2F08B___
+#define _WSIOHANDLER_H__Guid__8F1C2B64_E03A_4D59_B7C6_51A9E4D2F08B___
+
+#include <string>
+#include <random>
+#include <cctype>
+#include "uvIOHandler.h"
+#include "wsDeflate.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define WS_MASK_SSE2
+#endif
+
+namespace DSCPP
+{
+	enum { WS_KEY_LEN = 24, WS_ACCEPT_LEN = 28 };	// base64 lengths of the 16-byte handshake nonce and the 20-byte SHA-1
+
+	// XORs n bytes at p with the 4-byte masking key (RFC 6455, 5.3). offset is the position of p
+	// in the payload, so a payload can be masked in pieces. Masks 16 bytes at a time with SSE2.
+	inline void ws_mask(char* p, size_t n, const unsigned char key[4], size_t offset = 0)
+	{
+		unsigned char k[16];	// the key, rotated to the offset and repeated
+		for (int i = 0; i < 16; ++i) k[i] = key[(i + offset) & 3];
+		size_t i = 0;
+#ifdef WS_MASK_SSE2
+		__m128i vKey = _mm_loadu_si128((const __m128i*)k);
+		for (; i + 16 <= n; i += 16)
+			_mm_storeu_si128((__m128i*)(p + i), _mm_xor_si128(_mm_loadu_si128((const __m128i*)(p + i)), vKey));
+#endif
+		uint64_t nKey8;
+		memcpy(&nKey8, k, 8);
+		for (; i + 8 <= n; i += 8)
+		{
+			uint64_t v;
+			memcpy(&v, p + i, 8);
+			v ^= nKey8;
+			memcpy(p + i, &v, 8);
+		}
+		for (; i < n; ++i) p[i] ^= k[i & 3];	// i is a multiple of 4 here, so k stays in phase
+	}
+
+	// SHA-1 of the data (only used for the handshake keys, hence no streaming)
+	inline void ws_sha1(const void* pData, size_t len, unsigned char digest[20])
+	{
+		uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+		const unsigned char* pBytes = (const unsigned char*)pData;
+		uint64_t nBits = (uint64_t)len * 8;
+		size_t nBlocks = (len + 8) / 64 + 1;	// data, 0x80 and the 64-bit length
+		auto rol = [](uint32_t x, int n) { return (x << n) | (x >> (32 - n)); };
+		for (size_t b = 0; b < nBlocks; ++b)
+		{
+			unsigned char block[64];
+			for (size_t i = 0; i < 64; ++i)
+			{
+				size_t pos = b * 64 + i;
+				block[i] = pos < len ? pBytes[pos] : (pos == len ? 0x80 : 0);
+			}
+			if (b == nBlocks - 1)
+				for (int i = 0; i < 8; ++i) block[56 + i] = (unsigned char)(nBits >> (56 - 8 * i));
+			uint32_t w[80];
+			for (int i = 0; i < 16; ++i)
+				w[i] = ((uint32_t)block[4 * i] << 24) | ((uint32_t)block[4 * i + 1] << 16) | ((uint32_t)block[4 * i + 2] << 8) | block[4 * i + 3];
+			for (int i = 16; i < 80; ++i)
+				w[i] = rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+			uint32_t a = h[0], bb = h[1], c = h[2], d = h[3], e = h[4];
+			for (int i = 0; i < 80; ++i)
+			{
+				uint32_t f, k;
+				if (i < 20)			{ f = (bb & c) | (~bb & d);				k = 0x5A827999; }
+				else if (i < 40)	{ f = bb ^ c ^ d;						k = 0x6ED9EBA1; }
+				else if (i < 60)	{ f = (bb & c) | (bb & d) | (c & d);	k = 0x8F1BBCDC; }
+				else				{ f = bb ^ c ^ d;						k = 0xCA62C1D6; }
+				uint32_t temp = rol(a, 5) + f + e + k + w[i];
+				e = d; d = c; c = rol(bb, 30); bb = a; a = temp;
+			}
+			h[0] += a; h[1] += bb; h[2] += c; h[3] += d; h[4] += e;
+		}
+		for (int i = 0; i < 20; ++i) digest[i] = (unsigned char)(h[i / 4] >> (24 - 8 * (i % 4)));
+	}
+
+	// base64 of the data into szOut (needs 4 * ((len + 2) / 3) + 1 chars). Returns the length written.
+	inline size_t ws_base64(const unsigned char* pData, size_t len, char* szOut)
+	{
+		static const char s_alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+		size_t n = 0;
+		for (size_t i = 0; i < len; i += 3)
+		{
+			uint32_t v = (uint32_t)pData[i] << 16;
+			if (i + 1 < len) v |= (uint32_t)pData[i + 1] << 8;
+			if (i + 2 < len) v |= pData[i + 2];
+			szOut[n++] = s_alphabet[(v >> 18) & 63];
+			szOut[n++] = s_alphabet[(v >> 12) & 63];
+			szOut[n++] = (i + 1 < len) ? s_alphabet[(v >> 6) & 63] : '=';
+			szOut[n++] = (i + 2 < len) ? s_alphabet[v & 63] : '=';
+		}
+		szOut[n] = '\0';
+		return n;
+	}
+
+	// Sec-WebSocket-Accept for the given Sec-WebSocket-Key (RFC 6455, 4.2.2)
+	inline void ws_accept_key(const char* szKey, char szAccept[WS_ACCEPT_LEN + 1])
+	{
+		std::string str = szKey;
+		str += "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+		unsigned char digest[20];
+		ws_sha1(str.c_str(), str.length(), digest);
+		ws_base64(digest, sizeof(digest), szAccept);
+	}
+
+	// Incremental parser for the frames sent by a server (RFC 6455, 5.2). Takes the data in pieces
+	// of any size, and hands the payloads to the sink in place (no copies), as they arrive:
+	//		int TSink::on_ws_data(char* p, size_t n, bool bMessageEnd)		- a piece of a text/binary message
+	//		int TSink::on_ws_control(int nOpcode, char* p, size_t n)		- a complete close/ping/pong frame
+	// The sink returns < 0 to stop the parsing (e.g. when it closed the connection). is_compressed()
+	// tells if the current message is compressed (RSV1, allowed once permessage-deflate is negotiated).
+	template<typename TSink>
+	struct _wsFrameParser
+	{
+		enum { MAX_HEADER_LEN = 14, MAX_CONTROL_PAYLOAD = 125 };
+		enum WS_OPCODE { WS_CONTINUATION = 0x0, WS_TEXT = 0x1, WS_BINARY = 0x2, WS_CLOSE = 0x8, WS_PING = 0x9, WS_PONG = 0xA };
+
+		unsigned char	m_header[MAX_HEADER_LEN];	// the header of the current frame, assembled
+		size_t			m_nHeaderLen;
+		uint64_t		m_nPayloadLeft;		// bytes of the current frame payload yet to come
+		int				m_nOpcode;			// of the current frame
+		bool			m_bFin;
+		bool			m_bInPayload;
+		bool			m_bInMessage;		// a fragmented message is in progress (continuation frames expected)
+		bool			m_bCompressed;		// the current message is compressed
+		bool			m_bAllowCompressed = false;	// RSV1 is allowed (permessage-deflate got negotiated)
+		char			m_control[MAX_CONTROL_PAYLOAD];	// control frames are delivered whole, even if split across reads
+		size_t			m_nControlLen;
+
+		inline _wsFrameParser()
+		{
+			reset();
+		}
+		inline void reset()
+		{
+			m_nHeaderLen = 0;
+			m_nPayloadLeft = 0;
+			m_nOpcode = WS_CONTINUATION;
+			m_bFin = m_bInPayload = m_bInMessage = m_bCompressed = false;
+			m_nControlLen = 0;
+		}
+		inline void allow_compressed(bool bAllow)
+		{
+			m_bAllowCompressed = bAllow;
+		}
+		inline bool is_compressed() const
+		{
+			return m_bCompressed;
+		}
+		// returns 0 on success, -1 on protocol errors or when the sink stops the parsing
+		inline int parse(TSink* pSink, char* pData, size_t len)
+		{
+			while (len > 0)
+			{
+				if (!m_bInPayload)
+				{
+					size_t nTaken = std::min(header_size() - m_nHeaderLen, len);
+					memcpy(m_header + m_nHeaderLen, pData, nTaken);
+					m_nHeaderLen += nTaken;
+					pData += nTaken;
+					len -= nTaken;
+					if (m_nHeaderLen < header_size()) continue;	// the length or the mask bytes are yet to come
+					if (begin_frame() < 0) return -1;
+					if (m_nPayloadLeft == 0)	// empty frame
+					{
+						if (m_nOpcode < WS_CLOSE && m_bFin && pSink->on_ws_data(pData, 0, true) < 0) return -1;
+						if (end_frame(pSink) < 0) return -1;
+					}
+					continue;
+				}
+				size_t nTaken = (size_t)std::min(m_nPayloadLeft, (uint64_t)len);
+				m_nPayloadLeft -= nTaken;
+				if (m_nOpcode >= WS_CLOSE)
+				{
+					memcpy(m_control + m_nControlLen, pData, nTaken);
+					m_nControlLen += nTaken;
+				}
+				else if (pSink->on_ws_data(pData, nTaken, m_bFin && m_nPayloadLeft == 0) < 0)
+					return -1;
+				pData += nTaken;
+				len -= nTaken;
+				if (m_nPayloadLeft == 0 && end_frame(pSink) < 0) return -1;
+			}
+			return 0;
+		}
+	protected:
+		inline size_t header_size() const
+		{
+			if (m_nHeaderLen < 2) return 2;
+			size_t nLenCode = m_header[1] & 0x7F;
+			return 2 + (nLenCode == 126 ? 2 : (nLenCode == 127 ? 8 : 0)) + ((m_header[1] & 0x80) ? 4 : 0);
+		}
+		inline int begin_frame()
+		{
+			m_bFin = (m_header[0] & 0x80) != 0;
+			m_nOpcode = m_header[0] & 0x0F;
+			bool bRsv1 = (m_header[0] & 0x40) != 0;
+			if ((m_header[0] & 0x30) != 0 || (bRsv1 && !m_bAllowCompressed)) return -1;	// RSV bits of the extensions not negotiated
+			if ((m_header[1] & 0x80) != 0) return -1;	// servers must not mask their frames
+			uint64_t nLen = m_header[1] & 0x7F;
+			if (nLen == 126)
+				nLen = ((uint64_t)m_header[2] << 8) | m_header[3];
+			else if (nLen == 127)
+			{
+				nLen = 0;
+				for (int i = 2; i < 10; ++i) nLen = (nLen << 8) | m_header[i];
+				if (nLen >> 63) return -1;	// the most significant bit must be 0
+			}
+			if (m_nOpcode >= WS_CLOSE)	// control frames: not fragmented, small, and may come in between the fragments
+			{
+				if (m_nOpcode > WS_PONG || !m_bFin || nLen > MAX_CONTROL_PAYLOAD || bRsv1) return -1;
+				m_nControlLen = 0;
+			}
+			else
+			{
+				if (m_nOpcode == WS_CONTINUATION ? (!m_bInMessage || bRsv1) : (m_bInMessage || m_nOpcode > WS_BINARY)) return -1;
+				if (m_nOpcode != WS_CONTINUATION) m_bCompressed = bRsv1;	// RSV1 is set on the first frame of the message only
+				m_bInMessage = !m_bFin;
+			}
+			m_nPayloadLeft = nLen;
+			m_nHeaderLen = 0;
+			m_bInPayload = true;
+			return 0;
+		}
+		inline int end_frame(TSink* pSink)
+		{
+			m_bInPayload = false;
+			if (m_nOpcode >= WS_CLOSE)
+				return pSink->on_ws_control(m_nOpcode, m_control, m_nControlLen);
+			return 0;
+		}
+	};
+
+	// wsIOHandler: WebSocket transport over libuv for _dsclientBase (deepstream serves the clients on ws://host:6020/deepstream).
+	//	Upgrades the TCP connection of uvIOHandler with the opening handshake, and then
+	//		- sends every message as one masked text frame. The masking is done in place (the send buffer is
+	//		  given up to the handler anyway), and the frame header goes out with the payload in one write.
+	//		- unframes the server data in place: the payload pieces are handed to the client as views of the
+	//		  read buffer (sharing it, see bufPoolChunk::addRef()), never copied. The client does the message framing.
+	//		- answers the pings, and echoes the close (the server then closes the connection).
+	//		- optionally compresses the messages with permessage-deflate (see enable_compression()).
+	//	TClient gets the same events as with uvIOHandler, with on_connection_established() after the handshake.
+	/*	Usage:
+			class myClient : public _dsclientBase<wsIOHandler<myClient>> { ... };
+			myClient client;
+			client.open(uv_default_loop(), "127.0.0.1", 6020);
+			uv_run(uv_default_loop(), UV_RUN_DEFAULT);
+	*/
+	template<typename TClient>
+	struct wsIOHandler : public uvIOHandler<wsIOHandler<TClient>>
+	{
+		typedef uvIOHandler<wsIOHandler<TClient>> _Base;
+		typedef typename _Base::unique_bufptr unique_bufptr;
+		typedef _wsFrameParser<wsIOHandler> TParser;
+		enum WS_STATE { WS_CLOSED, WS_HANDSHAKE, WS_OPEN, WS_CLOSING };
+		enum { MAX_HANDSHAKE_LEN = 1024 };	// the handshake response of the server should fit in this
+
+	protected:
+		TParser			m_parser;
+		WS_STATE		m_state = WS_CLOSED;
+		std::string		m_strPath = "/deepstream";
+		std::mt19937	m_rng;				// the masking keys and the handshake nonces
+		void*			m_pReadOwner = nullptr;	// owner of the read being parsed (shared with the payload pieces)
+#ifdef DSCPP_WITH_ZLIB
+		wsDeflate		m_deflate;
+		bool			m_bOfferDeflate = false;
+#endif
+		size_t			m_nHandshakeLen = 0;
+		char			m_szAccept[WS_ACCEPT_LEN + 1];	// the Sec-WebSocket-Accept expected from the server
+		char			m_handshake[MAX_HANDSHAKE_LEN];	// the handshake response, assembled
+
+		inline TClient* dsclient()
+		{
+			return static_cast<TClient*>(this);
+		}
+
+	public:
+		inline wsIOHandler() : m_rng(std::random_device()())
+		{ }
+		// starts connecting to the server at ws://szHost:nPort/szPath
+		int open(uv_loop_t* uvLoop, const char* szHost, int nPort, int nKeepAliveDelay = 60, const char* szPath = "/deepstream")
+		{
+			m_strPath = szPath;
+			return _Base::open(uvLoop, szHost, nPort, nKeepAliveDelay);
+		}
+		///@param buf the message to be sent. Gets masked in place, hence should not be reused by the caller
+		///@param len the size of buf to be sent
+		///@param cb the callback on completion. Called with buf (or owner, if given) and len as parameters
+		///@param owner the allocation that buf points into (for the replies written in place into a read buffer)
+		int send(void* buf, size_t len, LPFN_SEND_COMPLETE cb = _Base::release_send_buffer, void* owner = nullptr)
+		{
+			if (m_state != WS_OPEN) { (*cb)(owner != nullptr ? owner : buf, len); return -1; }
+#ifdef DSCPP_WITH_ZLIB
+			size_t nCompressedLen = 0;
+			char* pCompressed = m_deflate.should_compress(len) ? m_deflate.compress((const char*)buf, len, nCompressedLen) : nullptr;
+			if (pCompressed != nullptr)
+			{
+				(*cb)(owner != nullptr ? owner : buf, len);	// done with the original
+				return send_frame(TParser::WS_TEXT, pCompressed, nCompressedLen, _Base::release_send_buffer, nullptr, WS_RSV1);
+			}
+#endif
+			return send_frame(TParser::WS_TEXT, buf, len, cb, owner);
+		}
+		// sends a piece of a message that goes out in several, as a frame of a fragmented message.
+		// Such messages are not compressed (RSV1 would have to be known with the first piece).
+		int send_piece(void* buf, size_t len, bool bFirst, bool bLast, LPFN_SEND_COMPLETE cb = _Base::release_send_buffer, void* owner = nullptr)
+		{
+			if (m_state != WS_OPEN) { (*cb)(owner != nullptr ? owner : buf, len); return -1; }
+			return send_frame(bFirst ? TParser::WS_TEXT : TParser::WS_CONTINUATION, buf, len, cb, owner, 0, bLast);
+		}
+		int disconnect()
+		{
+			m_state = WS_CLOSED;
+			return _Base::disconnect();
+		}
+#ifdef DSCPP_WITH_ZLIB
+		// offers permessage-deflate in the handshakes that follow. The messages of at least nThreshold
+		// bytes get compressed (with the zlib nLevel), if the server agrees.
+		void enable_compression(size_t nThreshold = wsDeflate::DEFAULT_THRESHOLD, int nLevel = Z_DEFAULT_COMPRESSION)
+		{
+			m_bOfferDeflate = true;
+			m_deflate.set_options(nThreshold, nLevel);
+		}
+#endif
+
+	//////////////////////////////////////////////////////////
+	// Events from uvIOHandler (forwarded to the client once the connection is upgraded)
+	//
+	public:
+		inline timer_wheel& timers()
+		{
+			return dsclient()->timers();
+		}
+		inline void on_timers_tick(uint64_t nowMs)
+		{
+			dsclient()->on_timers_tick(nowMs);
+		}
+		inline void on_writable()
+		{
+			dsclient()->on_writable();
+		}
+		// TCP connection is up: send the opening handshake
+		void on_connection_established()
+		{
+			m_parser.reset();
+			m_nHandshakeLen = 0;
+			m_state = WS_HANDSHAKE;
+			unsigned char nonce[16];
+			for (int i = 0; i < 16; i += 4)
+			{
+				uint32_t r = m_rng();
+				memcpy(nonce + i, &r, 4);
+			}
+			char szKey[WS_KEY_LEN + 1];
+			ws_base64(nonce, sizeof(nonce), szKey);
+			ws_accept_key(szKey, m_szAccept);
+			const char* szExtensions = "";
+#ifdef DSCPP_WITH_ZLIB
+			m_deflate.end();
+			if (m_bOfferDeflate) szExtensions = "Sec-WebSocket-Extensions: permessage-deflate; client_max_window_bits\r\n";
+#endif
+			char* buf = (char*)this->alloc_send_buffer(m_strPath.length() + this->m_strHost.length() + 320);
+			int len = sprintf(buf, "GET %s HTTP/1.1\r\nHost: %s:%d\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+				"Sec-WebSocket-Key: %s\r\nSec-WebSocket-Version: 13\r\n%s\r\n", m_strPath.c_str(), this->m_strHost.c_str(), this->m_nPort, szKey, szExtensions);
+			this->write(nullptr, 0, buf, len, _Base::release_send_buffer, nullptr);
+		}
+		void on_connection_lost()
+		{
+			m_state = WS_CLOSED;
+			dsclient()->on_connection_lost();
+		}
+		int handle_server_data(unique_bufptr spOwner, char* pData, size_t len)
+		{
+			if (m_state == WS_HANDSHAKE)
+			{
+				size_t nConsumed = 0;
+				int r = on_handshake_data(pData, len, nConsumed);
+				if (r <= 0) return r;	// incomplete, or failed
+				pData += nConsumed;		// the frames that came along with the response
+				len -= nConsumed;
+			}
+			if (m_state != WS_OPEN || len == 0) return 0;
+			m_pReadOwner = spOwner.get();
+			int r = m_parser.parse(this, pData, len);
+			m_pReadOwner = nullptr;
+			if (r < 0 && m_state == WS_OPEN)	// protocol error (and not a stop by the handlers)
+				return fail("WebSocket protocol error from server");
+			return r;
+		}
+
+	//////////////////////////////////////////////////////////
+	// Frame parser sink
+	//
+	public:
+		int on_ws_data(char* p, size_t n, bool bMessageEnd)
+		{
+#ifdef DSCPP_WITH_ZLIB
+			if (m_parser.is_compressed())	// inflated into pooled chunks, which the client gets to own
+			{
+				int r = m_deflate.decompress(p, n, bMessageEnd, [this](char* pChunk, size_t nLen) {
+					if (m_state == WS_OPEN) dsclient()->handle_server_data(unique_bufptr(pChunk), pChunk, nLen);
+					else POOLED_FREE(pChunk);
+				});
+				if (r < 0) return fail("WebSocket message from server could not be decompressed");
+				return m_state == WS_OPEN ? 0 : -1;
+			}
+#endif
+			if (n == 0) return 0;
+			if (bufPoolChunk::addRef(m_pReadOwner))	// the piece shares the read buffer
+				dsclient()->handle_server_data(unique_bufptr(m_pReadOwner), p, n);
+			else	// no owner to share, give the piece a copy
+			{
+				char* pCopy = (char*)this->alloc_send_buffer(n);
+				memcpy(pCopy, p, n);
+				dsclient()->handle_server_data(unique_bufptr(pCopy), pCopy, n);
+			}
+			return m_state == WS_OPEN ? 0 : -1;	// the client may have disconnected
+		}
+		int on_ws_control(int nOpcode, char* p, size_t n)
+		{
+			if (nOpcode == TParser::WS_PONG) return 0;	// we do not ping
+			char* buf = (char*)this->alloc_send_buffer(n + 1);
+			memcpy(buf, p, n);
+			if (nOpcode == TParser::WS_PING)
+			{
+				send_frame(TParser::WS_PONG, buf, n, _Base::release_send_buffer, nullptr);	// with the same application data
+				return m_state == WS_OPEN ? 0 : -1;
+			}
+			// close: echo the status code, and let the server close the connection (the client learns it from the read)
+			send_frame(TParser::WS_CLOSE, buf, std::min(n, (size_t)2), _Base::release_send_buffer, nullptr);
+			m_state = WS_CLOSING;
+			return -1;
+		}
+
+	protected:
+		enum { WS_RSV1 = 0x40 };	// the frame carries a compressed message
+		int send_frame(int nOpcode, void* buf, size_t len, LPFN_SEND_COMPLETE cb, void* owner, int nFlags = 0, bool bFin = true)
+		{
+			unsigned char header[_Base::MAX_FRAME_HEADER_LEN];
+			size_t n = 0;
+			header[n++] = (unsigned char)((bFin ? 0x80 : 0) | nFlags | nOpcode);	// FIN: the last frame of the message
+			if (len < 126)
+				header[n++] = (unsigned char)(0x80 | len);
+			else if (len <= 0xFFFF)
+			{
+				header[n++] = 0x80 | 126;
+				header[n++] = (unsigned char)(len >> 8);
+				header[n++] = (unsigned char)len;
+			}
+			else
+			{
+				header[n++] = 0x80 | 127;
+				for (int i = 7; i >= 0; --i) header[n++] = (unsigned char)((uint64_t)len >> (8 * i));
+			}
+			uint32_t nKey = m_rng();
+			memcpy(header + n, &nKey, 4);
+			ws_mask((char*)buf, len, header + n);
+			n += 4;
+			return this->write((const char*)header, n, buf, len, cb, owner);
+		}
+		// assembles the handshake response. Returns 1 when the connection got upgraded (nConsumed bytes of
+		// pData were the response), 0 when more of the response is due, and -1 on failure.
+		int on_handshake_data(const char* pData, size_t len, size_t& nConsumed)
+		{
+			size_t nPrevLen = m_nHandshakeLen;
+			size_t nTaken = std::min(len, (size_t)MAX_HANDSHAKE_LEN - 1 - m_nHandshakeLen);
+			memcpy(m_handshake + m_nHandshakeLen, pData, nTaken);
+			m_nHandshakeLen += nTaken;
+			m_handshake[m_nHandshakeLen] = '\0';
+			const char* pEnd = strstr(m_handshake, "\r\n\r\n");
+			if (pEnd == nullptr)
+				return (m_nHandshakeLen < MAX_HANDSHAKE_LEN - 1) ? 0 : fail("WebSocket handshake response is too large");
+			size_t nResponseLen = pEnd + 4 - m_handshake;
+			nConsumed = nResponseLen - nPrevLen;
+			m_handshake[nResponseLen] = '\0';
+			if (strncmp(m_handshake, "HTTP/1.1 101", 12) != 0)
+				return fail("WebSocket upgrade rejected by server");
+			const char* pAccept = find_header(m_handshake, "Sec-WebSocket-Accept");
+			if (pAccept == nullptr || strncmp(pAccept, m_szAccept, WS_ACCEPT_LEN) != 0 || (pAccept[WS_ACCEPT_LEN] != '\r' && pAccept[WS_ACCEPT_LEN] != ' '))
+				return fail("WebSocket handshake failed: unexpected Sec-WebSocket-Accept");
+			const char* pExtensions = find_header(m_handshake, "Sec-WebSocket-Extensions");
+			m_parser.allow_compressed(false);
+			if (pExtensions != nullptr)	// only what we offered can be accepted
+			{
+#ifdef DSCPP_WITH_ZLIB
+				_wsDeflateParams params;
+				if (!m_bOfferDeflate || !params.parse(pExtensions) || m_deflate.init(params) < 0)
+					return fail("WebSocket handshake failed: unexpected Sec-WebSocket-Extensions");
+				m_parser.allow_compressed(true);
+#else
+				return fail("WebSocket handshake failed: unexpected Sec-WebSocket-Extensions");
+#endif
+			}
+			m_state = WS_OPEN;
+			dsclient()->on_connection_established();
+			return m_state == WS_OPEN ? 1 : -1;
+		}
+		// value of the header (names are case-insensitive), or nullptr
+		static const char* find_header(const char* szResponse, const char* szName)
+		{
+			size_t nNameLen = strlen(szName);
+			for (const char* p = strstr(szResponse, "\r\n"); p != nullptr; p = strstr(p, "\r\n"))
+			{
+				p += 2;
+				size_t i = 0;
+				while (i < nNameLen && tolower((unsigned char)p[i]) == tolower((unsigned char)szName[i])) ++i;
+				if (i == nNameLen && p[i] == ':')
+				{
+					for (p += i + 1; *p == ' ' || *p == '\t'; ++p);
+					return p;
+				}
+			}
+			return nullptr;
+		}
+		int fail(const char* szReason)
+		{
+			DSLOG_WARN("%s", szReason);
+			disconnect();
+			dsclient()->on_connection_lost();	// the client retries later
+			return -1;
+		}
+	};
+} // namespace DSCPP
+
+#endif // _WSIOHANDLER_H__Guid__8F1C2B64_E03A_4D59_B7C6_51A9E4D2F08B___
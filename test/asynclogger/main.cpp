@@ -0,0 +1,156 @@
+/*
+	Copyright (c) 2016 Cenacle Research India Private Limited
+*/
+
+#define CATCH_CONFIG_MAIN  // This tells Catch to provide a main()
+#include "catch.hpp"
+#define DSCPP_LOG_LEVEL	DSLOG_LEVEL_INFO
+#include "asyncLogger.h"
+#include <string>
+#include <vector>
+#include <thread>
+
+using namespace DSCPP;
+
+// records the arguments the way log() does, and formats them back
+template<typename... Args>
+std::string format(const char* fmt, const Args&... args)
+{
+	alignas(8) char buf[1024];
+	_logRecord& record = *(_logRecord*)buf;
+	record.nArgs = (uint8_t)sizeof...(args);
+	record.fmt = fmt;
+	_logArgs::put_all(buf + sizeof(_logRecord), args...);
+	char out[512];
+	size_t n = asyncLogger::format(record, out, sizeof(out));
+	return std::string(out, n);
+}
+
+// the lines written to the file so far
+std::vector<std::string> read_lines(FILE* pFile)
+{
+	std::vector<std::string> lines;
+	char line[2048];
+	rewind(pFile);
+	while (fgets(line, sizeof(line), pFile) != nullptr) lines.push_back(line);
+	return lines;
+}
+
+TEST_CASE("Formatting", "[asynclogger]")
+{
+	REQUIRE(format("plain") == "plain");
+	REQUIRE(format("%d %u %x %5.2f %%", -7, 7u, 255, 3.14159) == "-7 7 ff  3.14 %");
+	REQUIRE(format("%ld %lld %zu", -1L, 1LL << 40, (size_t)12) == "-1 1099511627776 12");
+	REQUIRE(format("[%s] [%-4s] [%.2s]", "abc", "ab", "abc") == "[abc] [ab  ] [ab]");
+	REQUIRE(format("[%*d] [%.*s]", 4, 7, 1, "xyz") == "[   7] [x]");
+	REQUIRE(format("[%s]", log_string("abcdef", 3)) == "[abc]");
+	REQUIRE(format("%s", (const char*)nullptr) == "(null)");
+	char name[] = "mutable";
+	REQUIRE(format("%s %c", name, 'A') == "mutable A");
+	REQUIRE(format("%d %d", 1) == "1 %?");	// fewer arguments
+	std::string longString(1000, 'x');
+	REQUIRE(format("%s", longString.c_str()).size() == LOG_MAX_STRING_LEN);
+	// huge widths and precisions (from the arguments) are cut to the line, and the output to the buffer
+	REQUIRE(format("%+#0*.*f", 0x7FFFFFFFFFFFFFFFLL, 0x7FFFFFFFFFFFFFFFLL, 1.5).size() == 511);
+	REQUIRE(format("%-#0 +*.*d|", 999999999999LL, 999999999999LL, 7).size() == 511);
+	REQUIRE(format("%.*s|", 0x7FFFFFFFFFFFFFFFLL, "abc") == "abc|");
+}
+
+TEST_CASE("Rate Limit", "[asynclogger]")
+{
+	_logRateLimit rate;
+	uint32_t nSuppressed = 0;
+	int nAllowed = 0;
+	for (int i = 0; i < 100; ++i)
+		if (rate.allow(nSuppressed)) nAllowed++;
+	// a second may have turned within the loop
+	REQUIRE(nAllowed >= LOG_RATE_BURST);
+	REQUIRE(nAllowed <= 2 * LOG_RATE_BURST);
+}
+
+TEST_CASE("Ring", "[asynclogger]")
+{
+	_logRing* pRing = new _logRing();
+	size_t nRecords = 0;
+	while (pRing->reserve(48) != nullptr) { pRing->commit(48); nRecords++; }
+	REQUIRE(nRecords == LOG_RING_SIZE / 48);
+	pRing->tail = 48 * 3;		// read three
+	char* p = pRing->reserve(48);	// does not fit before the end: wraps, after a filler
+	REQUIRE(p == pRing->buf);
+	REQUIRE(((_logRecord*)(pRing->buf + nRecords * 48))->level == (uint8_t)_logRecord::PADDING);
+	pRing->commit(48);
+	REQUIRE(pRing->reserve(104) == nullptr);
+	REQUIRE(pRing->reserve(96) != nullptr);
+	delete pRing;
+}
+
+TEST_CASE("Logging", "[asynclogger]")
+{
+	asyncLogger& logger = asyncLogger::getObject();
+	FILE* pFile = tmpfile();
+	REQUIRE(pFile != nullptr);
+	logger.set_output(pFile);
+
+	SECTION("Levels")
+	{
+		DSLOG_DEBUG("not built: %d", 1);
+		DSLOG_INFO("info %d", 2);
+		logger.set_level(DSLOG_LEVEL_ERROR);
+		DSLOG_WARN("filtered %d", 3);
+		DSLOG_ERROR("error %s", "4");
+		logger.set_level(DSLOG_LEVEL_DEBUG);
+		logger.flush();
+		std::vector<std::string> lines = read_lines(pFile);
+		REQUIRE(lines.size() == 2);
+		REQUIRE(lines[0].find("] INFO  info 2\n") != std::string::npos);
+		REQUIRE(lines[1].find("] ERROR error 4\n") != std::string::npos);
+	}
+	SECTION("Rate Limited")
+	{
+		for (int i = 0; i < 100; ++i) DSLOG_WARN_RATE("again %d", i);
+		logger.flush();
+		std::vector<std::string> lines = read_lines(pFile);
+		REQUIRE(lines.size() >= LOG_RATE_BURST);
+		REQUIRE(lines.size() <= 2 * LOG_RATE_BURST);
+		REQUIRE(lines[0].find("again 0\n") != std::string::npos);
+	}
+	SECTION("Threads")
+	{
+		enum { THREADS = 4, RECORDS = 1000 };
+		std::vector<std::thread> threads;
+		for (int t = 0; t < THREADS; ++t)
+			threads.push_back(std::thread([t]() {
+				for (int i = 0; i < RECORDS; ++i) DSLOG_INFO("thread %d record %d of %s", t, i, "a string to copy");
+			}));
+		for (auto& th : threads) th.join();	// their rings are left to the background thread
+		uint64_t nDropped = logger.dropped();
+		logger.flush();
+		std::vector<std::string> lines = read_lines(pFile);
+		REQUIRE(lines.size() + nDropped == THREADS * RECORDS);
+		std::vector<int> nextOf(THREADS, 0);	// in order within a thread
+		for (auto& line : lines)
+		{
+			int t, i;
+			REQUIRE(sscanf(line.c_str() + line.find("thread"), "thread %d record %d", &t, &i) == 2);
+			REQUIRE(i >= nextOf[t]);
+			nextOf[t] = i + 1;
+		}
+	}
+	SECTION("On the way out of a thread")
+	{
+		struct _lateLogger { inline ~_lateLogger() { DSLOG_INFO("late %d", 1); } };	// destroyed after the ring holder
+		uint64_t nDropped = logger.dropped();
+		std::thread([]() {
+			static thread_local _lateLogger late;
+			(void)late;
+			DSLOG_INFO("early %d", 0);
+		}).join();
+		logger.flush();
+		REQUIRE(logger.dropped() == nDropped + 1);
+		std::vector<std::string> lines = read_lines(pFile);
+		REQUIRE(lines.size() == 1);
+		REQUIRE(lines[0].find("early 0\n") != std::string::npos);
+	}
+	logger.set_output(stderr);
+	fclose(pFile);
+}
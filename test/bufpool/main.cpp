@@ -0,0 +1,417 @@
+/*
+	Copyright (c) 2016 Cenacle Research India Private Limited
+*/
+
+#define CATCH_CONFIG_MAIN  // This tells Catch to provide a main()
+#include "catch.hpp"
+#include "bufPool.h"
+#include <cstring>
+#include <vector>
+#include <set>
+#include <thread>
+
+TEST_CASE("Buffer Arena", "[bufArena]")
+{
+	bufArena arena;
+
+	SECTION("Reset on Retire")
+	{
+		// a request/response cycle: read buffer, reply buffer, write request
+		for (int i = 0; i < 1000; ++i)
+		{
+			size_t readSize = 0;
+			char* pRead = (char*)arena.acquireAvailable(4096, readSize);
+			REQUIRE(pRead != nullptr);
+			REQUIRE(readSize >= 4096);
+			REQUIRE(arena.shrink(pRead, 100));
+			char* pReply = (char*)arena.acquire(200);
+			void* pWriter = arena.acquire(64);
+			REQUIRE(pReply != nullptr);
+			REQUIRE(pWriter != nullptr);
+			REQUIRE(((size_t)pReply % bufArena::ALIGNMENT) == 0);
+			REQUIRE(arena.liveCount() == 3);
+			REQUIRE(POOLED_ALLOCATED_SIZE(pRead) == 100);
+			REQUIRE(POOLED_ALLOCATED_SIZE(pReply) == 200);
+
+			POOLED_FREE(pRead);		// arena buffers can be released like any pooled chunk
+			POOLED_FREE(pWriter);
+			REQUIRE(arena.liveCount() == 1);
+			POOLED_FREE(pReply);
+			REQUIRE(arena.liveCount() == 0);
+		}
+		REQUIRE(arena.m_stats.nBlocksAllocated == 1);	// the block got reset each time, never grew
+		REQUIRE(arena.m_stats.nResets == 1000);
+	}
+	SECTION("Shrink only the last")
+	{
+		void* p1 = arena.acquire(100);
+		void* p2 = arena.acquire(100);
+		REQUIRE(!arena.shrink(p1, 10));
+		REQUIRE(arena.shrink(p2, 10));
+		POOLED_FREE(p1);
+		POOLED_FREE(p2);
+	}
+	SECTION("Outstanding buffers keep their block")
+	{
+		std::vector<char*> held;
+		for (int i = 0; i < 100; ++i)	// spans multiple blocks
+		{
+			char* p = (char*)arena.acquire(4000);
+			memset(p, i, 4000);
+			held.push_back(p);
+		}
+		REQUIRE(arena.m_stats.nBlocksAllocated > 1);
+		for (int i = 0; i < 100; ++i)
+			REQUIRE(held[i][3999] == (char)i);	// no block got reused while its buffers are live
+		for (char* p : held) POOLED_FREE(p);
+
+		void* pLarge = arena.acquire(1024 * 1024);	// larger than a block
+		REQUIRE(pLarge != nullptr);
+		REQUIRE(POOLED_ALLOCATED_SIZE(pLarge) == 1024 * 1024);
+		POOLED_FREE(pLarge);
+	}
+	SECTION("Shared owners")
+	{
+		char* pRead = (char*)arena.acquire(300);
+		int nLive = arena.liveCount();
+		size_t nResets = arena.m_stats.nResets;
+		REQUIRE(bufArena::addRef(pRead));
+		REQUIRE(bufArena::addRef(pRead));
+		unique_ptr<void> spFirst(pRead), spSecond(pRead);	// views of two messages of the read
+		POOLED_FREE(pRead);
+		spFirst.reset();
+		REQUIRE(arena.liveCount() == nLive);	// one owner is still holding it
+		REQUIRE(arena.m_stats.nResets == nResets);
+		spSecond.reset();
+		REQUIRE(arena.m_stats.nResets == nResets + 1);	// the last owner gave back the block
+
+		void* pChunk = POOLED_ALLOC(100);
+		REQUIRE(!bufArena::addRef(pChunk));	// only the arena buffers can be shared
+		POOLED_FREE(pChunk);
+	}
+	SECTION("Trim")
+	{
+		std::vector<void*> held;
+		for (int i = 0; i < 40; ++i) held.push_back(arena.acquire(4000));	// spans blocks
+		void* pLive = arena.acquire(100);
+		for (void* p : held) POOLED_FREE(p);	// the older blocks drain to the spares
+		size_t nBlocks = arena.m_stats.nBlocksAllocated;
+		arena.trim();	// frees the spares, keeps the current block (pLive is in it)
+		REQUIRE(arena.liveCount() == 1);
+		void* p = arena.acquire(100);
+		REQUIRE(arena.m_stats.nBlocksAllocated == nBlocks);	// still bumping the current block
+		POOLED_FREE(p);
+		POOLED_FREE(pLive);
+		arena.trim();	// now the current block goes too
+		REQUIRE(arena.liveCount() == 0);
+		p = arena.acquire(100);
+		REQUIRE(arena.m_stats.nBlocksAllocated == nBlocks + 1);
+		POOLED_FREE(p);
+	}
+	SECTION("Buffers outliving the arena")
+	{
+		bufArena* pArena = new bufArena();
+		void* p = pArena->acquire(100);
+		delete pArena;
+		unique_ptr<void> sp(p);	// gets released after the arena is gone
+	}
+}
+
+TEST_CASE("Per-thread Pools", "[bufPool]")
+{
+	// a released chunk goes back to the free list of its thread
+	void* p1 = POOLED_ALLOC(100);
+	POOLED_FREE(p1);
+	REQUIRE(POOLED_ALLOC(100) == p1);
+
+	void* pOther = nullptr;
+	bufPoolChunk* pOtherPool = nullptr;
+	std::thread t([&]() {
+		pOtherPool = &bufPoolChunk::getObject();
+		pOther = POOLED_ALLOC(100);	// cannot be p1: that one is taken, and is not in this thread's pool anyway
+		memset(pOther, 1, 100);
+		POOLED_FREE(pOther);
+	});
+	t.join();
+	REQUIRE(pOtherPool != &bufPoolChunk::getObject());
+	REQUIRE(pOther != p1);
+	POOLED_FREE(p1);
+}
+
+struct _pooledObject
+{
+	char	data[40];
+};
+
+TEST_CASE("Trimming", "[bufPool]")
+{
+	enum { SIZE = 12 * 1024 };	// (a class the other tests leave alone)
+	bufPoolChunk& pool = bufPoolChunk::getObject();
+
+	SECTION("Idle chunks")
+	{
+		pool.trim();
+		pool.trim();	// what the other tests left
+		REQUIRE(pool.stats().nFree == 0);	// (of every class)
+		std::vector<void*> burst;
+		for (int i = 0; i < 100; ++i) burst.push_back(POOLED_ALLOC(SIZE));
+		REQUIRE(pool.stats(SIZE).nInUse == 100);
+		REQUIRE(pool.stats(SIZE).nHighWater >= 100);
+		for (void* p : burst) POOLED_FREE(p);
+		REQUIRE(pool.stats(SIZE).nFree >= 100);
+
+		pool.trim();	// all of them were needed since the last trim
+		size_t nFree = pool.stats(SIZE).nFree;
+		REQUIRE(nFree >= 100);
+		for (int i = 0; i < 10; ++i) POOLED_FREE(POOLED_ALLOC(SIZE));	// a quiet period, 1 at a time
+		REQUIRE(pool.trim(20) == 20);	// in batches
+		REQUIRE(pool.stats(SIZE).nFree == nFree - 20);
+		size_t nTrimmed = pool.trim();
+		REQUIRE(pool.stats(SIZE).nFree == 1);	// the one in use in the period
+		REQUIRE(nTrimmed >= nFree - 21);
+		REQUIRE(pool.stats(SIZE).nTrimmed >= nFree - 1);
+	}
+	SECTION("Capped")
+	{
+		pool.setMaxFree(SIZE, 10);
+		std::vector<void*> burst;
+		for (int i = 0; i < 50; ++i) burst.push_back(POOLED_ALLOC(SIZE));
+		for (void* p : burst) POOLED_FREE(p);
+		REQUIRE(pool.stats(SIZE).nFree == 10);
+		pool.setMaxFree(SIZE, (size_t)-1);
+	}
+	SECTION("Capped chunks that share pages")
+	{
+		enum { SMALL = 1000, MAX_FREE = 8, BURST = 64 };	// (4 to a page)
+		pool.setMaxFree(SMALL, MAX_FREE);
+		size_t nTrimmed = pool.stats(SMALL).nTrimmed;
+		std::vector<char*> burst;
+		for (int i = 0; i < BURST; ++i)
+		{
+			burst.push_back((char*)POOLED_ALLOC(SMALL));
+			memset(burst.back(), 0xAB, SMALL);
+		}
+		for (char* p : burst) POOLED_FREE(p);
+		REQUIRE(pool.stats(SMALL).nFree <= MAX_FREE);
+		REQUIRE(pool.stats(SMALL).nTrimmed >= nTrimmed + BURST - MAX_FREE);
+#if defined(__linux__)
+		// the pages whose chunks all went over the cap are back with the OS
+		std::set<char*> chunks(burst.begin(), burst.end());
+		std::set<char*> pages;
+		for (char* p : burst) pages.insert((char*)PAGE_ROUND_DOWN((uintptr_t)p, (uintptr_t)PAGE_SIZE_4K));
+		size_t nWhole = 0, nGone = 0;
+		for (char* pPage : pages)
+		{
+			bool bWhole = true;
+			for (int i = 0; i < PAGE_SIZE_4K / 1024; ++i) bWhole = bWhole && chunks.count(pPage + i * 1024) > 0;
+			if (!bWhole) continue;
+			nWhole++;
+			unsigned char resident = 0;
+			REQUIRE(mincore(pPage, PAGE_SIZE_4K, &resident) == 0);
+			nGone += ((resident & 1) == 0);
+		}
+		REQUIRE(nWhole > MAX_FREE);
+		REQUIRE(nGone >= nWhole - MAX_FREE);	// (the free ones hold a page each, at most)
+#endif
+		char* p = (char*)POOLED_ALLOC(SMALL);	// reused (from the free ones, or the trimmed)
+		REQUIRE(p[0] == 0);
+		REQUIRE(p[SMALL - 1] == 0);
+		POOLED_FREE(p);
+		pool.setMaxFree(SMALL, (size_t)-1);
+	}
+	SECTION("Trimmed chunks that share pages")
+	{
+		enum { SMALL = 3000 };
+		size_t nTrimmed = pool.stats(SMALL).nTrimmed;
+		std::vector<void*> burst;
+		for (int i = 0; i < 30; ++i) burst.push_back(POOLED_ALLOC(SMALL));
+		for (void* p : burst) POOLED_FREE(p);
+		REQUIRE(pool.stats(SMALL).nFree >= 30);
+		pool.trim();
+		pool.trim();	// idle through a whole period
+		REQUIRE(pool.stats(SMALL).nFree == 0);
+		REQUIRE(pool.stats(SMALL).nTrimmed >= nTrimmed + 30);
+	}
+	SECTION("Objects")
+	{
+		std::vector<_pooledObject*> burst;
+		for (int i = 0; i < 30; ++i) burst.push_back(_NEW(_pooledObject));
+		for (auto p : burst) _DELETE(p);
+		REQUIRE(bufPoolT<_pooledObject>::getObject().stats().nFree >= 30);
+		bufPool::trim();
+		bufPool::trim();	// through the pools of the thread
+		REQUIRE(bufPoolT<_pooledObject>::getObject().stats().nFree == 0);
+		REQUIRE(bufPool::stats().nBytesFree == 0);
+	}
+	SECTION("Objects released on another thread")
+	{
+		bufPoolT<_pooledObject>& objects = bufPoolT<_pooledObject>::getObject();
+		_pooledObject* p = nullptr;
+		std::thread([&p]() { p = _NEW(_pooledObject); }).join();
+		size_t nInUse = objects.stats().nInUse;
+		_DELETE(p);	// into the pool of this thread, which did not count it in
+		REQUIRE(objects.stats().nInUse <= nInUse);
+		REQUIRE(objects.stats().nBytesInUse <= nInUse * sizeof(_pooledObject));
+	}
+}
+
+TEST_CASE("Slabs", "[bufPool]")
+{
+	SECTION("Aligned, without headers")
+	{
+		char* p1 = (char*)POOLED_ALLOC(2000);
+		char* p2 = (char*)POOLED_ALLOC(2000);
+		REQUIRE(bufSlabs::contains(p1));
+		REQUIRE(((size_t)p1 % 2048) == 0);	// at the alignment of the size class
+		REQUIRE(POOLED_ALLOCATED_SIZE(p1) == 2048);
+		REQUIRE(p2 == p1 + 2048);			// back to back, in the same slab
+		REQUIRE(!bufArena::addRef(p2));		// (its first bytes are not a header)
+		REQUIRE(p1[2047] == 0);
+		POOLED_FREE(p1);
+		POOLED_FREE(p2);
+
+		char* pLarge = (char*)POOLED_ALLOC(bufSlabs::MAX_SLOT_SIZE + 1);	// allocated on its own
+		REQUIRE(!bufSlabs::contains(pLarge));
+		REQUIRE(((size_t)pLarge % bufSlabs::CACHE_LINE) == 0);
+		REQUIRE(POOLED_ALLOCATED_SIZE(pLarge) == bufSlabs::MAX_SLOT_SIZE + 1024);
+		POOLED_FREE(pLarge);
+		REQUIRE(!bufSlabs::contains(&pLarge));
+	}
+	SECTION("All of the slab")
+	{
+		size_t nSlabs = bufSlabs::count();
+		std::vector<char*> chunks;
+		for (int i = 0; i < bufSlabs::SLAB_SIZE / bufSlabs::MAX_SLOT_SIZE; ++i) chunks.push_back((char*)POOLED_ALLOC(bufSlabs::MAX_SLOT_SIZE));
+		REQUIRE(bufSlabs::count() == nSlabs + 1);	// (the header is kept apart)
+		for (size_t i = 0; i < chunks.size(); ++i) REQUIRE(chunks[i] == chunks[0] + i * bufSlabs::MAX_SLOT_SIZE);
+		REQUIRE(bufSlabs::headerOf(chunks[0])->nSlots == chunks.size());
+		for (char* p : chunks) POOLED_FREE(p);
+	}
+	SECTION("Trimmed pages")
+	{
+		enum { SIZE = 8 * 1024 };
+		bufPoolChunk& pool = bufPoolChunk::getObject();
+		pool.setMaxFree(SIZE, 0);	// every release gives the pages back
+		char* p = (char*)POOLED_ALLOC(SIZE);
+		memset(p, 0xAB, SIZE);
+		POOLED_FREE(p);
+		REQUIRE(pool.stats(SIZE).nFree == 0);
+		char* pAgain = (char*)POOLED_ALLOC(SIZE);	// the same chunk, zeroed
+		REQUIRE(pAgain == p);
+		REQUIRE(pAgain[0] == 0);
+		REQUIRE(pAgain[SIZE - 1] == 0);
+		POOLED_FREE(pAgain);
+		pool.setMaxFree(SIZE, (size_t)-1);
+	}
+	SECTION("Left by threads gone")
+	{
+		enum { SIZE = 7 * 1024 };
+		std::thread([]() { POOLED_FREE(POOLED_ALLOC(SIZE)); }).join();
+		size_t nSlabs = bufSlabs::count();
+		void* p = POOLED_ALLOC(SIZE);	// from the slab of that thread
+		REQUIRE(bufSlabs::contains(p));
+		REQUIRE(bufSlabs::count() == nSlabs);
+		POOLED_FREE(p);
+	}
+	SECTION("Left untouched by threads gone")
+	{
+		enum { SIZE = 20 * 1024 };
+		char* pTrimmed = nullptr;
+		std::thread([&pTrimmed]() {
+			bufPoolChunk::getObject().setMaxFree(SIZE, 0);
+			pTrimmed = (char*)POOLED_ALLOC(SIZE);
+			memset(pTrimmed, 0xAB, SIZE);
+			POOLED_FREE(pTrimmed);	// its pages go back to the OS
+		}).join();
+#if defined(__linux__)
+		unsigned char resident[2 * SIZE / PAGE_SIZE_4K] = {};
+		REQUIRE(mincore(pTrimmed, 2 * SIZE, resident) == 0);	// the trimmed one, and the next, never handed out
+		for (unsigned char r : resident) REQUIRE((r & 1) == 0);
+#endif
+		std::vector<char*> adopted;
+		for (int i = 0; i < 4; ++i)
+		{
+			adopted.push_back((char*)POOLED_ALLOC(SIZE));
+			REQUIRE(bufSlabs::contains(adopted.back()));
+			REQUIRE(adopted.back()[0] == 0);
+			REQUIRE(adopted.back()[SIZE - 1] == 0);
+		}
+		REQUIRE(std::find(adopted.begin(), adopted.end(), pTrimmed + SIZE) != adopted.end());
+		for (char* p : adopted) POOLED_FREE(p);
+	}
+}
+
+TEST_CASE("Shared Slices", "[bufPool]")
+{
+	SECTION("Views of one read")
+	{
+		char* pRead = (char*)POOLED_ALLOC(3000);
+		memcpy(pRead, "one\x1etwo\x1ethree\x1e", 14);
+		size_t nFree = bufPoolChunk::getObject().stats(3000).nFree;
+		buf_slice whole(unique_ptr<void>(pRead), pRead, 14);
+		buf_slice first = whole.slice(0, 4), second = whole.slice(4, 4), third = whole.slice(8);
+		REQUIRE(third.size() == 6);
+		REQUIRE(memcmp(second.data(), "two", 3) == 0);
+		REQUIRE(whole.slice(20).empty());
+		whole.reset();
+		first.reset();
+		buf_slice copy(second);
+		second = std::move(third);
+		REQUIRE(!third);
+		second.reset();
+		REQUIRE(bufPoolChunk::getObject().stats(3000).nFree == nFree);	// the copy still holds it
+		REQUIRE(memcmp(copy.data(), "two", 3) == 0);
+		copy.reset();
+		REQUIRE(bufPoolChunk::getObject().stats(3000).nFree == nFree + 1);	// back with the last owner
+		REQUIRE(POOLED_ALLOC(3000) == pRead);	// (and reused as a single owner one)
+		POOLED_FREE(pRead);
+		REQUIRE(bufPoolChunk::getObject().stats(3000).nFree == nFree + 1);
+	}
+	SECTION("Sent, like the owners of the replies")
+	{
+		char* pLarge = (char*)POOLED_ALLOC(bufSlabs::MAX_SLOT_SIZE + 1);	// (counted in its own header)
+		buf_slice msg(unique_ptr<void>(pLarge), pLarge, 100);
+		std::vector<void*> sends;	// as if queued on several connections
+		for (int i = 0; i < 3; ++i) { buf_slice view(msg); sends.push_back(view.release()); }
+		msg.reset();
+		for (void* pOwner : sends)
+		{
+			REQUIRE(pOwner == pLarge);
+			POOLED_FREE(pOwner);	// (as release_send_buffer does)
+		}
+		void* pAgain = POOLED_ALLOC(bufSlabs::MAX_SLOT_SIZE + 1);
+		REQUIRE(pAgain == pLarge);	// released once, with the last send
+		POOLED_FREE(pAgain);
+	}
+	SECTION("Across threads")
+	{
+		enum { THREADS = 4, VIEWS = 1000 };
+		char* pMsg = (char*)POOLED_ALLOC(100);
+		strcpy(pMsg, "fan out");
+		buf_slice msg(unique_ptr<void>(pMsg), pMsg, 7);
+		std::vector<std::vector<buf_slice>> views(THREADS);
+		for (auto& threadViews : views)
+			threadViews.push_back(msg.share_across_threads());
+		msg.reset();
+		std::atomic<int> nMatched{ 0 };
+		std::vector<std::thread> threads;
+		for (auto& threadViews : views)
+			threads.emplace_back([&threadViews, &nMatched]() {
+				for (int i = 0; i < VIEWS; ++i) threadViews.push_back(threadViews.front().slice(4));	// (atomic from here)
+				for (auto& view : threadViews) nMatched += (memcmp(view.data(), "out", 3) == 0);
+				threadViews.clear();
+			});
+		for (auto& t : threads) t.join();
+		REQUIRE(nMatched == THREADS * VIEWS);
+		REQUIRE(bufSlabs::refsOf(pMsg).load() == 0);	// the last owner cleared the count, and gave it back
+
+		bufArena arena;
+		char* pRead = (char*)arena.acquire(100);
+		strcpy(pRead, "arena");
+		buf_slice local(unique_ptr<void>(pRead), pRead, 5);
+		buf_slice away = local.share_across_threads();	// an arena buffer stays on its loop: copied
+		REQUIRE(away.owner() != pRead);
+		REQUIRE(memcmp(away.data(), "arena", 5) == 0);
+		REQUIRE(arena.liveCount() == 1);
+	}
+}
@@ -0,0 +1,156 @@
+/*
+	Copyright (c) 2016 Cenacle Research India Private Limited
+*/
+
+#define CATCH_CONFIG_MAIN  // This tells Catch to provide a main()
+#include "catch.hpp"
+#include "rpcCoroutine.h"
+#include <string>
+#include <vector>
+#include <algorithm>
+
+using namespace DSCPP;
+
+#if defined(__cpp_impl_coroutine) && (__cpp_impl_coroutine >= 201902L)
+
+// stands in for _dsclientBase: keeps the calls made and the results sent, for the test to complete them
+struct _mockClient
+{
+	enum { RPC_RESPONSE_TIMEOUT = 1000 };
+	timer_wheel						wheel;
+	std::vector<_rpcRequest*>		requests;
+	std::vector<std::string>		methods;
+	std::vector<_sendCompletion*>	sends;
+	std::vector<std::string>		results;
+	bool							bConnected = true;
+	bool							bSendsComplete = false;	// right away, within the send
+
+	_mockClient() : wheel(0, 10) { }
+	int make_rpc_call(_rpcRequest& req, const char* szMethodName, const char* data, int dataLen, uint32_t nTimeoutMs)
+	{
+		if (!bConnected) return -1;
+		req.pPrev = req.pNext = &req;	// pending
+		requests.push_back(&req);
+		methods.push_back(std::string(szMethodName) + ":" + std::string(data, dataLen));
+		return 0;
+	}
+	void cancel_rpc_call(_rpcRequest& req)
+	{
+		requests.erase(std::remove(requests.begin(), requests.end(), &req), requests.end());
+		req.pPrev = req.pNext = nullptr;
+	}
+	void respond(size_t i, const char* data, const char* error = nullptr)
+	{
+		_rpcRequest& req = *requests[i];
+		cancel_rpc_call(req);
+		req.data = data;
+		req.dataLen = (data != nullptr) ? (int)strlen(data) : 0;
+		req.error = error;
+		req.errorLen = (error != nullptr) ? (int)strlen(error) : 0;
+		(*req.cb)(req);
+	}
+	int send_rpc_call_result(const _rpcCall& c, const char* sResult, int nResultLen, _sendCompletion& completion)
+	{
+		results.push_back(std::string(sResult, nResultLen));
+		sends.push_back(&completion);
+		if (bSendsComplete) complete_send(sends.size() - 1);
+		return 0;
+	}
+	void complete_send(size_t i)
+	{
+		_sendCompletion* pCompletion = sends[i];
+		sends.erase(sends.begin() + i);
+		(*pCompletion->cb)(*pCompletion);
+	}
+};
+
+// the frame of the coroutine that awaits it
+struct _frameOf
+{
+	void*& pFrame;
+	bool await_ready() const noexcept { return false; }
+	bool await_suspend(std::coroutine_handle<> h) { pFrame = h.address(); return false; }
+	void await_resume() const noexcept { }
+};
+
+// a provider: calls two rpcs one after the other, waits a bit, and answers with both
+rpc_task provide(_mockClient& client, _rpcCall& call, std::string& log, void*& pFrame)
+{
+	co_await _frameOf{ pFrame };
+	_rpcResponse first = co_await rpc_call(client, "first", "a", 1);
+	if (!first) { log += "first failed;"; co_return; }
+	log += std::string(first.data, first.dataLen) + ";";
+	_rpcResponse second = co_await rpc_call(client, "second", "b", 1);
+	if (!second) { log += std::string(second.error, second.errorLen) + ";"; co_return; }
+	log += std::string(second.data, second.dataLen) + ";";
+	co_await delay(client.wheel, 50);
+	log += "delayed;";
+	co_await rpc_result_sent(client, call, "done", 4);
+	log += "sent;";
+}
+
+TEST_CASE("Coroutines", "[coroutine]")
+{
+	_mockClient client;
+	_rpcCall call((unique_ptr<void>()));
+	std::string log;
+	void* pFrame = nullptr;
+
+	SECTION("Calls")
+	{
+		provide(client, call, log, pFrame);
+		REQUIRE(((size_t)pFrame % __STDCPP_DEFAULT_NEW_ALIGNMENT__) == 0);	// the pooled chunks are aligned
+		REQUIRE(client.requests.size() == 1);
+		REQUIRE(client.methods[0] == "first:a");
+		client.respond(0, "S1");
+		REQUIRE(log == "S1;");
+		REQUIRE(client.requests.size() == 1);
+		REQUIRE(client.methods[1] == "second:b");
+		client.respond(0, "S2");
+		REQUIRE(log == "S1;S2;");
+
+		client.wheel.advance(40);
+		REQUIRE(log == "S1;S2;");
+		client.wheel.advance(60);
+		REQUIRE(log == "S1;S2;delayed;");
+		REQUIRE(client.results.size() == 1);
+		REQUIRE(client.results[0] == "done");
+		REQUIRE(client.sends.size() == 1);
+		client.complete_send(0);
+		REQUIRE(log == "S1;S2;delayed;sent;");
+	}
+	SECTION("Errors")
+	{
+		provide(client, call, log, pFrame);
+		client.respond(0, "S1");
+		client.respond(0, nullptr, "NO_RPC_PROVIDER");
+		REQUIRE(log == "S1;NO_RPC_PROVIDER;");
+		REQUIRE(client.requests.empty());
+		REQUIRE(client.wheel.empty());
+	}
+	SECTION("Not Sent")
+	{
+		client.bConnected = false;	// resumes right away
+		provide(client, call, log, pFrame);
+		REQUIRE(log == "first failed;");
+	}
+	SECTION("Sent Right Away")
+	{
+		client.bSendsComplete = true;	// completes within the send: goes on without suspending
+		provide(client, call, log, pFrame);
+		client.respond(0, "S1");
+		client.respond(0, "S2");
+		client.wheel.advance(100);
+		REQUIRE(log == "S1;S2;delayed;sent;");
+		REQUIRE(client.sends.empty());
+	}
+}
+
+#else
+
+TEST_CASE("Coroutines", "[coroutine]")
+{
+	WARN("built without coroutine support (C++20): skipped");
+}
+
+#endif
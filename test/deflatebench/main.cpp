@@ -0,0 +1,158 @@
+/*
+	Copyright (c) 2016 Cenacle Research India Private Limited
+*/
+
+// Benchmark: CPU time versus bytes on the wire for permessage-deflate (wsDeflate), on recorded traffic.
+// usage: deflateBench [capture_file]
+//	capture_file holds the messages of a session, as sent on the wire (terminated by the record separator, 30).
+//	Without it, a session of typical record/event/rpc traffic (with its acks) is generated.
+
+#include "wsDeflate.h"
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace DSCPP;
+
+std::vector<std::string> load_capture(const char* szFile)
+{
+	std::ifstream file(szFile, std::ios::binary);
+	std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	std::vector<std::string> messages;
+	size_t nStart = 0;
+	for (size_t i = 0; i < data.length(); ++i)
+		if (data[i] == 30)
+		{
+			messages.push_back(data.substr(nStart, i + 1 - nStart));
+			nStart = i + 1;
+		}
+	return messages;
+}
+
+std::vector<std::string> generate_session(size_t nMessages)
+{
+	static const char* s_names[] = { "Aarav", "Kavya", "Vivaan", "Diya", "Arjun", "Ishaan", "Meera", "Rohan" };
+	static const char* s_status[] = { "online", "away", "busy", "offline" };
+	std::mt19937 rng(42);
+	std::vector<std::string> messages;
+	char msg[1024];
+	while (messages.size() < nMessages)
+	{
+		int nUser = rng() % 500, nVersion = rng() % 1000;
+		const char* szName = s_names[rng() % 8];
+		switch (rng() % 6)
+		{
+		case 0:	// full record update, and its ack
+			sprintf(msg, "R\x1fU\x1fusers/%d\x1f%d\x1f{\"name\":\"%s\",\"status\":\"%s\",\"score\":%u,\"lastSeen\":%u,\"tags\":[\"team-%d\",\"region-%d\"],\"settings\":{\"notifications\":true,\"theme\":\"dark\"}}\x1e",
+				nUser, nVersion, szName, s_status[rng() % 4], (unsigned)(rng() % 100000), (unsigned)(1480000000 + rng() % 1000000), nUser % 12, nUser % 5);
+			messages.push_back(msg);
+			sprintf(msg, "R\x1f" "A\x1fS\x1fusers/%d\x1e", nUser);
+			break;
+		case 1:	// record patch
+			sprintf(msg, "R\x1fP\x1fusers/%d\x1f%d\x1fstatus\x1fS%s\x1e", nUser, nVersion, s_status[rng() % 4]);
+			break;
+		case 2:	// event
+			sprintf(msg, "E\x1f" "EVT\x1f" "chat/room-%d\x1fO{\"from\":\"%s\",\"text\":\"message number %u in the room\",\"sentAt\":%u,\"attachments\":[]}\x1e",
+				nUser % 20, szName, (unsigned)(rng() % 10000), (unsigned)(1480000000 + rng() % 1000000));
+			break;
+		case 3:	// rpc call and its acks
+			sprintf(msg, "P\x1fREQ\x1f" "add-scores\x1f" "u%u\x1fO{\"user\":\"users/%d\",\"points\":%u}\x1e", (unsigned)rng(), nUser, (unsigned)(rng() % 50));
+			messages.push_back(msg);
+			sprintf(msg, "P\x1f" "A\x1f" "add-scores\x1f" "u%u\x1e", (unsigned)rng());
+			break;
+		case 4:	// list snapshot
+		{
+			int n = sprintf(msg, "R\x1fU\x1fleaderboard\x1f%d\x1f[", nVersion);
+			for (int i = 0; i < 20; ++i)
+				n += sprintf(msg + n, "%s\"users/%d\"", i ? "," : "", (nUser + i * 37) % 500);
+			sprintf(msg + n, "]\x1e");
+			break;
+		}
+		default:	// heartbeat
+			sprintf(msg, "C\x1fPI\x1e");
+		}
+		messages.push_back(msg);
+	}
+	return messages;
+}
+
+struct _benchConfig
+{
+	const char*	szName;
+	bool		bCompress;
+	int			nLevel;
+	size_t		nThreshold;
+	bool		bContextTakeover;
+};
+
+inline size_t ws_header_len(size_t len)	// client frame: 2 bytes, the extended length, and the masking key
+{
+	return 2 + (len < 126 ? 0 : (len <= 0xFFFF ? 2 : 8)) + 4;
+}
+
+int main(int argc, char* argv[])
+{
+	std::vector<std::string> messages = (argc > 1) ? load_capture(argv[1]) : generate_session(100000);
+	if (messages.empty()) { fprintf(stderr, "no messages in %s\n", argv[1]); return -1; }
+
+	_benchConfig configs[] =
+	{
+		{ "uncompressed",				false,	0,	0,		true },
+		{ "level 1, >= 256 B",			true,	1,	256,	true },
+		{ "level 6, >= 256 B",			true,	6,	256,	true },
+		{ "level 9, >= 256 B",			true,	9,	256,	true },
+		{ "level 6, >= 64 B (default)",	true,	6,	64,		true },
+		{ "level 6, all",				true,	6,	0,		true },
+		{ "level 6, >= 256 B, no ctx",	true,	6,	256,	false },
+	};
+	size_t nPayload = 0;
+	for (const std::string& msg : messages) nPayload += msg.length();
+	printf("%zu messages, %zu bytes of payload (%s)\n\n", messages.size(), nPayload, argc > 1 ? argv[1] : "generated session");
+	printf("%-28s %12s %8s %12s %12s %10s %10s\n", "", "wire bytes", "ratio", "compressed", "deflate ms", "inflate ms", "ns/byte");
+
+	for (const _benchConfig& config : configs)
+	{
+		_wsDeflateParams params;
+		params.bClientNoContextTakeover = params.bServerNoContextTakeover = !config.bContextTakeover;
+		wsDeflate client, server;	// the sender and the receiver of the messages
+		client.set_options(config.nThreshold, config.nLevel);
+		if (config.bCompress && (client.init(params) < 0 || server.init(params) < 0)) return -1;
+
+		size_t nWire = 0, nCompressed = 0, nMismatches = 0;
+		std::chrono::steady_clock::duration deflateTime(0), inflateTime(0);
+		std::string inflated;
+		for (const std::string& msg : messages)
+		{
+			if (!client.should_compress(msg.length()))
+			{
+				nWire += ws_header_len(msg.length()) + msg.length();
+				continue;
+			}
+			size_t nLen = 0;
+			auto t0 = std::chrono::steady_clock::now();
+			char* pCompressed = client.compress(msg.data(), msg.length(), nLen);
+			auto t1 = std::chrono::steady_clock::now();
+			inflated.clear();
+			server.decompress(pCompressed, nLen, true, [&inflated](char* pChunk, size_t n) {
+				inflated.append(pChunk, n);
+				POOLED_FREE(pChunk);
+			});
+			auto t2 = std::chrono::steady_clock::now();
+			POOLED_FREE(pCompressed);
+			deflateTime += t1 - t0;
+			inflateTime += t2 - t1;
+			nWire += ws_header_len(nLen) + nLen;
+			nCompressed++;
+			if (inflated != msg) nMismatches++;
+		}
+		double fDeflateMs = std::chrono::duration<double, std::milli>(deflateTime).count();
+		double fInflateMs = std::chrono::duration<double, std::milli>(inflateTime).count();
+		printf("%-28s %12zu %7.1f%% %12zu %12.1f %10.1f %10.1f%s\n", config.szName, nWire, 100.0 * nWire / nPayload, nCompressed,
+			fDeflateMs, fInflateMs, (fDeflateMs + fInflateMs) * 1e6 / nPayload, nMismatches ? "  ROUNDTRIP FAILED" : "");
+	}
+	return 0;
+}
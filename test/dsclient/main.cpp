@@ -2,169 +2,69 @@
 	Copyright (c) 2016 Cenacle Research India Private Limited
 */
 
-#include "dsclientbase.h"
-
-void alloc_cb(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf) {
-	*buf = uv_buf_init((char*)POOLED_ALLOC(suggested_size), suggested_size);
-}
-
-void on_connect(uv_connect_t* connection, int status);
-void on_stream_read(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf);
-void on_stream_close(uv_handle_t* handle);
-
+#include "wsIOHandler.h"
+#ifdef __linux__
+#include "uringIOHandler.h"
+#endif
 
-struct uvIOHandler
+// Sample client over libuv: connects with the given transport (TIOHandler is
+// DSCPP::wsIOHandler or DSCPP::uvIOHandler), logs in and provides the "echo", "count" (streamed) and "length" (batched) RPCs.
+template<template<typename> class TIOHandler>
+class _dsclientUVDriver : public DSCPP::_dsclientBase<TIOHandler<_dsclientUVDriver<TIOHandler>>, DSCPP::simpleCredentialsSupplier>
 {
-	uv_connect_t	m_connection;
-	uv_tcp_t		m_socket;
-
-	struct _Writer
-	{
-		void*	buf;
-		size_t	len;
-		DSCPP::LPFN_SEND_COMPLETE cb;
-		inline _Writer(void* argbuf, size_t arglen, DSCPP::LPFN_SEND_COMPLETE argcb): cb(argcb), buf(argbuf), len(arglen)
-		{ 
-			this->write_req.data = this;
-		}
-		uv_write_t write_req;
-	};
-
-	///@param buf the data that need to be sent. memory is owned and managed by caller
-	///@param len the size of buf to be sent
-	///@param cb the callback on completion. Called with buf and len as parameters
-	int send(void* buf, size_t len, DSCPP::LPFN_SEND_COMPLETE cb = release_send_buffer)
-	{
-		uv_stream_t* stream = m_connection.handle;		// same as m_socket
-		_Writer* writer = _NEW3(_Writer, buf, len, cb);	// gets deleted in on_send_done()
-		uv_buf_t bufs[] = { uv_buf_init((char*)buf, len) };
-		return uv_write(&writer->write_req, stream, bufs, 1, on_send_done);
-	}
-	static void on_send_done(uv_write_t* write_req, int status)
-	{
-		_Writer* writer = (_Writer*)write_req->data;
-		// call the completion callback
-		(*writer->cb)(writer->buf, writer->len);
-		// free the memory allocated in the send()
-		_DELETE(writer);
-		// Notes: write_req->handle == m_socket / stream. 
-		// You can use uv_close(write_req->handle,[](){}) here to close the socket and end the uv_run() loop.
-	}
-	// allocates a buffer that has to be owned and managed by the caller
-	static inline void* alloc_send_buffer(size_t size)
+public:
+	~_dsclientUVDriver()
 	{
-		return POOLED_ALLOC(size);
+		stop();
 	}
-	static inline void release_send_buffer(void* buf, size_t s = 0)
+	int connect(const char* szServer, int nPort, const char* szUsername = "userA", const char* szPassword = "password", int nKeepAliveDelay = 60)
 	{
-		POOLED_FREE(buf);	// buf should have been allocated with alloc_send_buffer()
+		this->strUsername = szUsername;
+		this->strPassword = szPassword;
+		return this->open(uv_default_loop(), szServer, nPort, nKeepAliveDelay);
 	}
-	int recv(char* buf, size_t buflen)
+	int run()
 	{
-		return fgets(buf, buflen, stdin) != nullptr ? 0 : -1;
+		return this->run_loop();	// spins if set_spin_policy() asked for it
 	}
-	int disconnect()
+	void stop()
 	{
-		uv_read_stop(m_connection.handle); // m_connection.handle is same as m_socket
-		if (!uv_is_closing((uv_handle_t*)m_connection.handle))
-			uv_close((uv_handle_t*)m_connection.handle, on_stream_close);
-		return 0;
+		this->disconnect();	// no reconnects
+		this->shutdown();	// loop exits once the socket and the timers are closed
 	}
 };
 
-class _dsclientUVDriver : public DSCPP::_dsclientBase<uvIOHandler, DSCPP::simpleCredentialsSupplier>
+#ifdef __linux__
+// Sample client over io_uring (TCP): same as above, with the loop run by the IO handler
+class _dsclientUringDriver : public DSCPP::_dsclientBase<DSCPP::uringIOHandler<_dsclientUringDriver>, DSCPP::simpleCredentialsSupplier>
 {
-protected:
-	uv_loop_t*		m_uvLoop = nullptr;
-
 public:
-	~_dsclientUVDriver()
+	int connect(const char* szServer, int nPort, const char* szUsername = "userA", const char* szPassword = "password", int nKeepAliveDelay = 60)
 	{
-		stop();
-	}
-	int connect(const char* szServer = "127.0.0.1", int nPort = 6021, const char* szUsername = "userA", const char* szPassword = "password", int nTimeoutDelay = 60)
-	{
-		strUsername = szUsername;
-		strPassword = szPassword;
-
-		m_uvLoop = uv_default_loop();
-
-		m_connection.data = this;
-
-		struct sockaddr_in dest;
-		if (uv_ip4_addr(szServer, nPort, &dest) < 0 ||
-			uv_tcp_init(m_uvLoop, &m_socket) < 0 ||
-			uv_tcp_keepalive(&m_socket, 1, nTimeoutDelay) < 0 ||
-			uv_tcp_connect(&m_connection, &m_socket, (const struct sockaddr*)&dest, on_connect) < 0)
-			return -1;
-
-		return 0;
+		this->strUsername = szUsername;
+		this->strPassword = szPassword;
+		return this->open(szServer, nPort, nKeepAliveDelay);
 	}
-
 	int run()
 	{
-		return uv_run(m_uvLoop, UV_RUN_DEFAULT);
+		int r = IO::run();
+		this->disconnect();	// no reconnects
+		IO::close();
+		return r;
 	}
 	void stop()
 	{
-		disconnect();
-		if (m_uvLoop != nullptr)
-		{
-			uv_loop_close(m_uvLoop);
-			m_uvLoop = nullptr;
-		}
+		IO::stop();	// safe in the signal handler: run() closes the connection once the loop is out
 	}
 };
+#endif
 
-void on_connect(uv_connect_t* connection, int status)
-{
-	if (status < 0)
-		return;	// some error happened, just return (not sure if we have to clean this uv_connection stuff)
-
-	_dsclientUVDriver* pdscUV = (_dsclientUVDriver*)connection->data;
-
-	uv_stream_t* stream = connection->handle;	// this stream is same as the _dsclientUVDriver::m_socket
-	uv_stream_set_blocking(stream, false);
-	stream->data = pdscUV;
-
-	pdscUV->register_rpc_provider("echo", [](unique_ptr<DSCPP::_rpcCall> spCall, typename _dsclientUVDriver::TBase* pDSCBase) {
-		pDSCBase->send_rpc_call_result(*spCall.get(), "echo", 4);
-		//std::cerr << spCall->methodName << " called";
-		return 0;
-	});
-
-	/* Start reading */
-	int r = uv_read_start(stream, alloc_cb, on_stream_read);
-}
-
-void on_stream_read(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf)
-{
-	if (nread >= 0)
-	{
-		//std::cout << "\nread done: " << buf->base;
-		_dsclientUVDriver* pdscUV = (_dsclientUVDriver*) stream->data;
-		pdscUV->handle_server_directive(_dsclientUVDriver::unique_bufptr(buf->base), nread); // buf->base is allocated through alloc_cb(), will be owned by handle_server_directive()
-	}
-	else
-	{
-		std::cout << "\nSocket Read Failure: connection lost with server";
-		uv_close((uv_handle_t*)stream, on_stream_close); // closes the stream and stops the uv_run (endgame !!); this stream == _dsclientUVDriver::m_socket;
-		if (buf->base != nullptr && buf->len > 0) 
-			POOLED_FREE(buf->base); // this was allocated through alloc_cb() by libuv from uv_read_start()
-	}
-}
-
-void on_stream_close(uv_handle_t* handle)
-{
-	// nothing to delete here because the socket (==handle) is stack allocated (m_socket)
-}
-
-_dsclientUVDriver gClientDriver;
+std::function<void()> gStopClient;
 
 void interrupt_handler(int sig)
 {
-	std::cerr << "\n Received Interrupt. Stopping the server loop";
-	gClientDriver.stop();
+	std::cerr << "\n Received Interrupt. Stopping the client loop";
+	if (gStopClient) gStopClient();
 }
 void setup_signal_handlers(void)
 {
@@ -177,14 +77,96 @@ void setup_signal_handlers(void)
 #endif
 }
 
-int main()
+// producer of the "count" result: the numbers below the limit, separated by commas, in pieces as the socket drains
+int produce_count(DSCPP::_rpcResultStream& stream, char* buf, size_t len)
 {
-	if (gClientDriver.connect() >= 0)
+	uint64_t* pCount = (uint64_t*)stream.pState;	// the next number, and the limit
+	if (buf == nullptr || pCount[0] >= pCount[1]) { delete[] pCount; return DSCPP::RPC_RESULT_END; }	// done, or dropped
+	size_t n = 0;
+	for (; pCount[0] < pCount[1] && n + 22 <= len; ++pCount[0])
+		n += sprintf(buf + n, "%s%llu", pCount[0] > 0 ? "," : "", (unsigned long long)pCount[0]);
+	return (int)n;
+}
+
+// handler of the "length" batches: the length of the params of every call, answered in one write
+template<typename TBase>
+int answer_lengths(unique_ptr<DSCPP::_rpcCall>* calls, size_t nCalls, TBase* pDSCBase)
+{
+	std::vector<char> lengths(nCalls * 12);
+	std::vector<const char*> results(nCalls);
+	std::vector<int> resultLens(nCalls);
+	for (size_t i = 0; i < nCalls; ++i)
 	{
-		setup_signal_handlers();
-		gClientDriver.run();
-		std::cerr << "\nClient loop stopped";
+		results[i] = &lengths[i * 12];
+		resultLens[i] = sprintf(&lengths[i * 12], "%d", calls[i]->paramsLen - 2);	// without the type prefix and the separator
 	}
-	else
+	return pDSCBase->send_rpc_call_results(calls, nCalls, results.data(), resultLens.data());
+}
+
+template<typename TDriver>
+int run_client(TDriver& driver, const char* szServer, int nPort)
+{
+	driver.register_rpc_provider("echo", [](unique_ptr<DSCPP::_rpcCall> spCall, typename TDriver::TBase* pDSCBase) {
+		pDSCBase->send_rpc_call_result(*spCall.get(), "echo", 4);
+		//std::cerr << spCall->methodName << " called";
+		return 0;
+	});	// providers are (re)sent to the server on every login
+	driver.register_rpc_provider("count", [](unique_ptr<DSCPP::_rpcCall> spCall, typename TDriver::TBase* pDSCBase) {
+		uint64_t* pCount = new uint64_t[2] { 0, strtoull(spCall->params + 1, nullptr, 10) };	// params: N<limit>
+		int r = pDSCBase->send_rpc_call_result_stream(std::move(spCall), DSCPP::RPC_STREAMED_RESULT, produce_count, pCount);
+		if (r < 0) delete[] pCount;
+		return r;
+	});
+	driver.register_rpc_batch_provider("length", answer_lengths<typename TDriver::TBase>, 64, 1000);	// up to 64 calls, or 1ms
+
+	DSCPP::_rpcLimitOptions limits;	// busy providers reject the calls, for the server to route them elsewhere
+	limits.nMaxInFlight = 256;
+	limits.bAdaptive = true;
+	driver.set_rpc_limits(limits);
+
+	if (driver.connect(szServer, nPort) < 0)
+	{
 		std::cerr << "\nCould not establish connection";
-}
\ No newline at end of file
+		return -1;
+	}
+	gStopClient = [&driver]() { driver.stop(); };
+	setup_signal_handlers();
+	driver.run();
+	std::cerr << "\nClient loop stopped";
+	return 0;
+}
+
+// usage: dsclientTest [--tcp | --uring] [--spin us]
+//	connects to the deepstream server on localhost over WebSocket (port 6020, with permessage-deflate if
+//	built with zlib), or over TCP (port 6021) with --tcp (libuv) or --uring (io_uring, Linux only).
+//	--spin keeps the libuv loop polling for that many microseconds after every read before it parks.
+int main(int argc, char* argv[])
+{
+	DSCPP::_connectionOptions options;	// the same for every transport
+	options.bNoDelay = true;	// the acks and rpc replies are small, and should not wait for the Nagle delay
+	DSCPP::uvSpinPolicy spinPolicy;
+	for (int i = 1; i + 1 < argc; ++i)
+		if (strcmp(argv[i], "--spin") == 0) spinPolicy.nSpinUs = (uint32_t)atoi(argv[i + 1]);
+#ifdef __linux__
+	if (argc > 1 && strcmp(argv[1], "--uring") == 0)
+	{
+		static _dsclientUringDriver uringClient;
+		uringClient.set_options(options);
+		return run_client(uringClient, "127.0.0.1", 6021);
+	}
+#endif
+	if (argc > 1 && strcmp(argv[1], "--tcp") == 0)
+	{
+		static _dsclientUVDriver<DSCPP::uvIOHandler> tcpClient;
+		tcpClient.set_options(options);
+		tcpClient.set_spin_policy(spinPolicy);
+		return run_client(tcpClient, "127.0.0.1", 6021);
+	}
+	static _dsclientUVDriver<DSCPP::wsIOHandler> wsClient;
+	wsClient.set_options(options);
+	wsClient.set_spin_policy(spinPolicy);
+#ifdef DSCPP_WITH_ZLIB
+	wsClient.enable_compression();	// used only if the server agrees
+#endif
+	return run_client(wsClient, "127.0.0.1", 6020);
+}
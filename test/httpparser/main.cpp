@@ -0,0 +1,145 @@
+/*
+	Copyright (c) 2016 Cenacle Research India Private Limited
+*/
+
+#define CATCH_CONFIG_MAIN  // This tells Catch to provide a main()
+#include "catch.hpp"
+#include "httpParser.h"
+#include <string>
+#include <vector>
+
+static _knownStrings gStrings;
+
+// a connection's view of the parser: the receive buffer, fed a piece at a time, and the requests taken off its front
+struct _connection
+{
+	_httpParser					parser{ gStrings, 32, 256 };
+	std::string					buf;
+	size_t						nScanned = 0;
+	size_t						nSearches = 0;	// no. of bytes looked at by findHeadersEnd()
+	std::vector<_httpRequest>	requests;
+	std::vector<std::string>	bodies;
+
+	// appends the data and takes off all the complete requests. Returns the error response, or RESP_NONE
+	int feed(const std::string& data)
+	{
+		buf += data;
+		for (;;)
+		{
+			size_t nFrom = nScanned;
+			const char* pHeadersEnd = _httpParser::findHeadersEnd(buf.data(), buf.size(), nScanned);
+			nSearches += (pHeadersEnd != nullptr ? (size_t)(pHeadersEnd - buf.data()) : buf.size()) - std::min(nFrom, buf.size());
+			if (pHeadersEnd == nullptr) return _httpStaticResponses::RESP_NONE;
+			_httpRequest req;
+			size_t nRequestLen = 0;
+			int nError = parser.parse(buf.data(), pHeadersEnd, buf.size(), req, nRequestLen);
+			if (nError != _httpStaticResponses::RESP_NONE) return nError;
+			if (nRequestLen == 0) { nScanned = 0; return _httpStaticResponses::RESP_NONE; }	// body is not complete yet
+			requests.push_back(req);
+			bodies.push_back(std::string(req.body, req.bodyLen));
+			buf.erase(0, nRequestLen);
+			nScanned = 0;
+		}
+	}
+};
+
+static int parseOne(const std::string& request)
+{
+	_connection c;
+	return c.feed(request);
+}
+
+TEST_CASE("HTTP Parser", "[http_parser]")
+{
+	SECTION("Header search resumes across reads")
+	{
+		const std::string request = "GET /health HTTP/1.1\r\nHost: localhost\r\nUser-Agent: test\r\n\r\n";
+		// every split point, including the ones inside the blank line
+		for (size_t i = 1; i < request.size(); ++i)
+		{
+			_connection c;
+			REQUIRE(c.feed(request.substr(0, i)) == _httpStaticResponses::RESP_NONE);
+			REQUIRE(c.requests.empty());
+			REQUIRE(c.feed(request.substr(i)) == _httpStaticResponses::RESP_NONE);
+			REQUIRE(c.requests.size() == 1);
+			REQUIRE(std::string(c.requests[0].uri, c.requests[0].uriLen) == "/health");
+			REQUIRE(c.buf.empty());
+		}
+		// a byte at a time: the bytes searched already are not searched again (but for the last 3)
+		_connection c;
+		for (char ch : request)
+			REQUIRE(c.feed(std::string(1, ch)) == _httpStaticResponses::RESP_NONE);
+		REQUIRE(c.requests.size() == 1);
+		REQUIRE(c.nSearches <= request.size() * 4);
+	}
+
+	SECTION("Pipelined requests with Content-Length bodies")
+	{
+		const std::string requests =
+			"POST /a HTTP/1.1\r\nContent-Length: 5\r\n\r\nhello"
+			"GET /b HTTP/1.1\r\n\r\n"
+			"POST /c HTTP/1.1\r\ncontent-length: 0\r\n\r\n"
+			"PUT /d HTTP/1.1\r\nCONTENT-LENGTH: 11\r\n\r\nhello\r\n\r\nxy";
+		for (size_t nPiece : { requests.size(), (size_t)1, (size_t)7 })
+		{
+			_connection c;
+			for (size_t i = 0; i < requests.size(); i += nPiece)
+				REQUIRE(c.feed(requests.substr(i, nPiece)) == _httpStaticResponses::RESP_NONE);
+			REQUIRE(c.requests.size() == 4);
+			REQUIRE(c.requests[0].verb == _knownStrings::VERB_POST);
+			REQUIRE(c.bodies[0] == "hello");
+			REQUIRE(c.requests[1].verb == _knownStrings::VERB_GET);
+			REQUIRE(c.bodies[1].empty());
+			REQUIRE(c.bodies[2].empty());
+			REQUIRE(c.requests[3].verb == _knownStrings::VERB_PUT);
+			REQUIRE(c.bodies[3] == "hello\r\n\r\nxy");	// (a blank line in the body is not the end of headers)
+			REQUIRE(c.buf.empty());
+		}
+		// the body is held till it is complete
+		_connection c;
+		REQUIRE(c.feed("POST /a HTTP/1.1\r\nContent-Length: 4\r\n\r\nab") == _httpStaticResponses::RESP_NONE);
+		REQUIRE(c.requests.empty());
+		REQUIRE(c.feed("cdGET /") == _httpStaticResponses::RESP_NONE);
+		REQUIRE(c.requests.size() == 1);
+		REQUIRE(c.bodies[0] == "abcd");
+		REQUIRE(c.buf == "GET /");
+	}
+
+	SECTION("Keep-alive")
+	{
+		_connection c;
+		REQUIRE(c.feed("GET / HTTP/1.1\r\n\r\n"
+			"GET / HTTP/1.1\r\nConnection: close\r\n\r\n"
+			"GET / HTTP/1.0\r\n\r\n"
+			"GET / HTTP/1.0\r\nconnection: Keep-Alive\r\n\r\n"
+			"HEAD / HTTP/1.1\r\n\r\n") == _httpStaticResponses::RESP_NONE);
+		REQUIRE(c.requests.size() == 5);
+		REQUIRE(c.requests[0].bKeepAlive);
+		REQUIRE(!c.requests[1].bKeepAlive);
+		REQUIRE(!c.requests[2].bKeepAlive);
+		REQUIRE(c.requests[3].bKeepAlive);
+		REQUIRE(c.requests[4].verb == _knownStrings::VERB_HEAD);
+	}
+
+	SECTION("Error statuses")
+	{
+		REQUIRE(parseOne("FETCH / HTTP/1.1\r\n\r\n") == _httpStaticResponses::RESP_METHOD_NOT_ALLOWED);
+		REQUIRE(parseOne("GET /" + std::string(40, 'x') + " HTTP/1.1\r\n\r\n") == _httpStaticResponses::RESP_URI_TOO_LONG);
+		REQUIRE(parseOne("GET /x\r\n\r\n") == _httpStaticResponses::RESP_BAD_REQUEST);	// (no version: not too long)
+		REQUIRE(parseOne("GET /" + std::string(40, 'x') + "\r\n\r\n") == _httpStaticResponses::RESP_URI_TOO_LONG);
+		REQUIRE(parseOne("GET / HTTP/2.0\r\n\r\n") == _httpStaticResponses::RESP_VERSION_NOT_SUPPORTED);
+		REQUIRE(parseOne("GET / HTTP/1.1\r\nNoColon\r\n\r\n") == _httpStaticResponses::RESP_BAD_REQUEST);
+		REQUIRE(parseOne("POST / HTTP/1.1\r\nContent-Length: 1x\r\n\r\n") == _httpStaticResponses::RESP_BAD_REQUEST);
+		REQUIRE(parseOne("POST / HTTP/1.1\r\nContent-Length: 257\r\n\r\n") == _httpStaticResponses::RESP_PAYLOAD_TOO_LARGE);
+		REQUIRE(parseOne("POST / HTTP/1.1\r\nContent-Length: 99999999999999999999\r\n\r\n") == _httpStaticResponses::RESP_PAYLOAD_TOO_LARGE);
+		REQUIRE(parseOne("POST / HTTP/1.1\r\nContent-Length: 250\r\n\r\n") == _httpStaticResponses::RESP_PAYLOAD_TOO_LARGE);	// (headers + body over the buffer)
+		REQUIRE(parseOne("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n") == _httpStaticResponses::RESP_LENGTH_REQUIRED);
+		std::string headers;
+		for (int i = 0; i <= _httpParser::MAX_HEADER_COUNT; ++i) headers += "X: y\r\n";
+		REQUIRE(parseOne("GET / HTTP/1.1\r\n" + headers + "\r\n") == _httpStaticResponses::RESP_HEADERS_TOO_LARGE);
+		// the error stops the parsing: the requests before it are taken, the rest are not
+		_connection c;
+		REQUIRE(c.feed("GET /a HTTP/1.1\r\n\r\nBREW / HTTP/1.1\r\n\r\nGET /b HTTP/1.1\r\n\r\n") == _httpStaticResponses::RESP_METHOD_NOT_ALLOWED);
+		REQUIRE(c.requests.size() == 1);
+	}
+}
@@ -0,0 +1,150 @@
+/*
+	Copyright (c) 2016 Cenacle Research India Private Limited
+*/
+
+// Benchmark: round-trip latency of uvIOHandler, parked in epoll (UV_RUN_DEFAULT) versus spinning (uvSpinPolicy).
+// usage: latencyBench [samples] [gap_us] [cpu] [node]
+//	A peer thread sends a small message every gap_us, the client echoes it back in place (as it does the
+//	rpc replies) and the peer records the round trips. The loop of the client is pinned to cpu, if given,
+//	else to the cores of the NUMA node. The nodes of the loop, the peer and a sample of the read buffers
+//	are reported, so that the cross-node traffic shows.
+
+#include "uvIOHandler.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+#if !defined(_WIN32)
+#include <netinet/tcp.h>
+#endif
+
+using namespace DSCPP;
+
+// echoes everything back, till the peer hangs up
+struct _echoClient : public uvIOHandler<_echoClient>
+{
+	enum { NODE_SAMPLE_INTERVAL = 1024 };	// (the node lookup is a syscall: one in so many reads)
+	timer_wheel	wheel;
+	size_t		nReads = 0;
+	size_t		nSampled = 0;
+	size_t		nOffNode = 0;	// the sampled read buffers not in the memory of the loop's node
+
+	timer_wheel& timers() { return wheel; }
+	void on_timers_tick(uint64_t nowMs) { wheel.advance(nowMs); }
+	void on_writable() { }
+	void on_connection_established() { }
+	void on_connection_lost() { shutdown(); }
+	int handle_server_data(unique_bufptr spOwner, char* pData, size_t len)
+	{
+		if (numa_node() >= 0 && nReads++ % NODE_SAMPLE_INTERVAL == 0)
+		{
+			int nNode = numa_node_of_address(pData);
+			if (nNode >= 0) { ++nSampled; if (nNode != numa_node()) ++nOffNode; }
+		}
+		return send(pData, len, release_send_buffer, spOwner.release());
+	}
+};
+
+// sends the pings (after the warm-up ones) and records the round trips in microseconds
+void run_peer(uv_os_sock_t fdListen, size_t nSamples, int nGapUs, std::vector<double>& rtts, int& nPeerNode)
+{
+	enum { MSG_LEN = 64, WARMUP = 1000 };
+	nPeerNode = numa_current_node();
+	uv_os_sock_t fd = accept(fdListen, nullptr, nullptr);
+	int nOn = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (char*)&nOn, sizeof(nOn));
+	char msg[MSG_LEN], reply[MSG_LEN];
+	memset(msg, 'x', MSG_LEN);
+	msg[MSG_LEN - 1] = 30;
+	for (size_t i = 0; i < nSamples + WARMUP; ++i)
+	{
+		if (nGapUs > 0) std::this_thread::sleep_for(std::chrono::microseconds(nGapUs));	// lets the client go idle
+		auto t0 = std::chrono::steady_clock::now();
+		if (send(fd, msg, MSG_LEN, 0) != MSG_LEN) break;
+		int nRead = 0;
+		while (nRead < MSG_LEN)
+		{
+			int n = (int)recv(fd, reply + nRead, MSG_LEN - nRead, 0);
+			if (n <= 0) break;
+			nRead += n;
+		}
+		if (nRead < MSG_LEN) break;
+		if (i >= WARMUP) rtts.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count());
+	}
+#ifdef _WIN32
+	closesocket(fd);
+#else
+	close(fd);
+#endif
+}
+
+uv_os_sock_t listen_loopback(int& nPort)
+{
+	uv_os_sock_t fd = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in addr;
+	uv_ip4_addr("127.0.0.1", 0, &addr);
+	socklen_t nLen = sizeof(addr);
+	bind(fd, (const sockaddr*)&addr, nLen);
+	listen(fd, 1);
+	getsockname(fd, (sockaddr*)&addr, &nLen);
+	nPort = ntohs(addr.sin_port);
+	return fd;
+}
+
+int main(int argc, char* argv[])
+{
+	size_t nSamples = (argc > 1) ? (size_t)atoi(argv[1]) : 100000;
+	int nGapUs = (argc > 2) ? atoi(argv[2]) : 20;
+	int nCpu = (argc > 3) ? atoi(argv[3]) : -1;
+	int nNode = (argc > 4) ? atoi(argv[4]) : -1;
+
+	struct { const char* szName; uint32_t nSpinUs; } modes[] =
+	{
+		{ "park (UV_RUN_DEFAULT)",	0 },
+		{ "spin 1 ms, then park",	1000 },
+		{ "spin only",				UINT32_MAX },
+	};
+	printf("%zu round trips of 64 bytes, %d us apart%s, %d NUMA node(s)\n\n", nSamples, nGapUs,
+		nCpu >= 0 ? ", client loop pinned" : (nNode >= 0 ? ", client loop on its node" : ""), numa_node_count());
+	printf("%-24s %10s %10s %10s %10s %10s %10s %6s %6s %10s\n", "", "p50 us", "p90 us", "p99 us", "p99.9 us", "max us", "mean us",
+		"loop", "peer", "off-node");
+	for (auto& mode : modes)
+	{
+		int nPort = 0;
+		uv_os_sock_t fdListen = listen_loopback(nPort);
+		std::vector<double> rtts;
+		rtts.reserve(nSamples);
+		int nPeerNode = -1;
+		std::thread peer(run_peer, fdListen, nSamples, nGapUs, std::ref(rtts), std::ref(nPeerNode));
+
+		_echoClient client;
+		_connectionOptions options;
+		options.bNoDelay = true;
+		options.nCpu = nCpu;
+		options.nNumaNode = nNode;
+		client.set_options(options);
+		uvSpinPolicy policy;
+		policy.nSpinUs = mode.nSpinUs;
+		client.set_spin_policy(policy);
+		if (client.open(uv_default_loop(), "127.0.0.1", nPort) < 0) { fprintf(stderr, "could not connect\n"); return -1; }
+		client.run_loop();
+		peer.join();
+#ifdef _WIN32
+		closesocket(fdListen);
+#else
+		close(fdListen);
+#endif
+		if (rtts.empty()) { printf("%-24s no samples\n", mode.szName); continue; }
+		std::sort(rtts.begin(), rtts.end());
+		double fSum = 0;
+		for (double rtt : rtts) fSum += rtt;
+		auto percentile = [&rtts](double p) { return rtts[std::min(rtts.size() - 1, (size_t)(p * rtts.size()))]; };
+		char szOffNode[32] = "-";
+		if (client.nSampled > 0) snprintf(szOffNode, sizeof(szOffNode), "%zu/%zu", client.nOffNode, client.nSampled);
+		printf("%-24s %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f %6d %6d %10s\n", mode.szName, percentile(0.5), percentile(0.9),
+			percentile(0.99), percentile(0.999), rtts.back(), fSum / rtts.size(), client.numa_node(), nPeerNode, szOffNode);
+	}
+	return 0;
+}
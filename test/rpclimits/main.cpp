@@ -0,0 +1,176 @@
+/*
+	Copyright (c) 2016 Cenacle Research India Private Limited
+*/
+
+#define CATCH_CONFIG_MAIN  // This tells Catch to provide a main()
+#include "catch.hpp"
+#include "rpcLimiter.h"
+
+using namespace DSCPP;
+
+// runs nWindows windows of the method at the given latency, each of them filled up to the limit
+void run_windows(_rpcLimiter& limiter, int methodId, int nWindows, uint64_t nLatencyUs)
+{
+	for (int w = 0; w < nWindows; ++w)
+	{
+		int nCalls = 0;
+		while (limiter.try_acquire(methodId)) nCalls++;
+		for (int i = 0; i < nCalls; ++i) limiter.release(methodId, nLatencyUs);
+	}
+}
+
+TEST_CASE("RPC Limiter", "[rpc]")
+{
+	_rpcLimiter limiter;
+
+	SECTION("No Limits")
+	{
+		for (int i = 0; i < 10000; ++i) REQUIRE(limiter.try_acquire(0));
+		REQUIRE(limiter.nInFlight == 10000);
+		for (int i = 0; i < 10000; ++i) limiter.release(0, 100);
+		REQUIRE(limiter.nInFlight == 0);
+	}
+	SECTION("Per Method")
+	{
+		_rpcLimitOptions options;
+		options.nMaxInFlightPerMethod = 4;
+		limiter.options = options;
+		limiter.set_method_limit(1, 2);
+		for (int i = 0; i < 4; ++i) REQUIRE(limiter.try_acquire(0));
+		REQUIRE(!limiter.try_acquire(0));
+		REQUIRE(limiter.try_acquire(1));
+		REQUIRE(limiter.try_acquire(1));
+		REQUIRE(!limiter.try_acquire(1));	// its own limit
+		REQUIRE(limiter.methods[0].nRejected == 1);
+		REQUIRE(limiter.methods[1].nRejected == 1);
+		limiter.release(0, 100);
+		REQUIRE(limiter.try_acquire(0));	// room again
+		REQUIRE(limiter.nInFlight == 6);
+	}
+	SECTION("Global")
+	{
+		_rpcLimitOptions options;
+		options.nMaxInFlight = 3;
+		limiter.options = options;
+		REQUIRE(limiter.try_acquire(0));
+		REQUIRE(limiter.try_acquire(1));
+		REQUIRE(limiter.try_acquire(2));
+		REQUIRE(!limiter.try_acquire(3));
+		REQUIRE(limiter.nRejected == 1);
+		limiter.release(1, 100);
+		REQUIRE(limiter.try_acquire(3));
+	}
+	SECTION("Adaptive")
+	{
+		_rpcLimitOptions options;
+		options.bAdaptive = true;
+		options.nMaxInFlightPerMethod = 64;
+		options.nMinLimit = 2;
+		limiter.options = options;
+		REQUIRE(limiter.limit(limiter.method(0)) == _rpcLimiter::ADAPTIVE_INITIAL_LIMIT);
+
+		// saturated at a steady latency: grows by one a window, up to the cap
+		run_windows(limiter, 0, 10, 1000);
+		REQUIRE(limiter.limit(limiter.method(0)) == _rpcLimiter::ADAPTIVE_INITIAL_LIMIT + 10);
+		run_windows(limiter, 0, 100, 1000);
+		REQUIRE(limiter.limit(limiter.method(0)) == 64);
+
+		// queueing (latency well above the lowest): backs off, down to the floor
+		run_windows(limiter, 0, 1, 5000);
+		REQUIRE(limiter.limit(limiter.method(0)) == (int)(64 * _rpcLimiter::BACKOFF));
+		run_windows(limiter, 0, 100, 5000);
+		REQUIRE(limiter.limit(limiter.method(0)) < 64);
+
+		// stays slow for good: the lowest latency follows, and the limit grows again
+		run_windows(limiter, 0, 400, 5000);
+		REQUIRE(limiter.methods[0].nMinLatencyUs > 2500);
+		REQUIRE(limiter.limit(limiter.method(0)) == 64);
+		REQUIRE(limiter.nInFlight == 0);
+	}
+	SECTION("Adaptive, not saturated")
+	{
+		_rpcLimitOptions options;
+		options.bAdaptive = true;
+		limiter.options = options;
+		for (int i = 0; i < 1000; ++i)	// one call at a time: no reason to raise the limit
+		{
+			REQUIRE(limiter.try_acquire(0));
+			limiter.release(0, 100);
+		}
+		REQUIRE(limiter.limit(limiter.method(0)) == _rpcLimiter::ADAPTIVE_INITIAL_LIMIT);
+	}
+	SECTION("Adaptive, batched")
+	{
+		limiter.options.bAdaptive = true;
+		limiter.set_method_min_limit(0, 64);	// a batch of 64 calls is in flight at once
+		REQUIRE(limiter.limit(limiter.method(0)) == 64);
+		run_windows(limiter, 0, 1, 1000);
+		run_windows(limiter, 0, 20, 5000);
+		REQUIRE(limiter.limit(limiter.method(0)) == 64);	// does not back off below a batch
+	}
+	SECTION("Deadline")
+	{
+		REQUIRE(!limiter.count_if_expired(0, 1000000000));	// no deadline
+		limiter.options.nDeadlineMs = 100;
+		limiter.set_method_deadline(1, 10);
+		REQUIRE(limiter.deadline_us(0) == 100000);
+		REQUIRE(limiter.deadline_us(1) == 10000);
+		for (int i = 0; i < 8; ++i)
+		{
+			REQUIRE(limiter.try_acquire(1));
+			limiter.release(1, 2000);
+		}
+		REQUIRE(!limiter.count_if_expired(0, 50000));
+		REQUIRE(limiter.count_if_expired(0, 150000));
+		REQUIRE(!limiter.count_if_expired(1, 10000));
+		REQUIRE(limiter.count_if_expired(1, 10001));
+		REQUIRE(limiter.count_if_expired(1, 20000));
+		REQUIRE(limiter.methods[0].nExpired == 1);
+		REQUIRE(limiter.methods[0].nSavedUs == 0);	// no latency known yet
+		REQUIRE(limiter.methods[1].nExpired == 2);
+		REQUIRE(limiter.methods[1].nSavedUs == 2 * 2000);
+		REQUIRE(limiter.nExpired == 3);
+		REQUIRE(limiter.nSavedUs == 2 * 2000);
+		REQUIRE(limiter.nInFlight == 0);	// not counted in
+	}
+	SECTION("Method Reset")
+	{
+		limiter.set_method_limit(0, 1);
+		REQUIRE(limiter.try_acquire(0));
+		REQUIRE(!limiter.try_acquire(0));
+		limiter.set_method_limit(0, 0);	// (re)registered: no limit, with the call still in flight
+		REQUIRE(limiter.try_acquire(0));
+		REQUIRE(limiter.methods[0].nInFlight == 2);
+	}
+	SECTION("Calls in flight")
+	{
+		limiter.options.nMaxInFlight = 2;
+		_rpcInFlight a, b, c;
+		REQUIRE(limiter.try_acquire(0, a));
+		REQUIRE(limiter.try_acquire(0, b));
+		REQUIRE(!limiter.try_acquire(1, c));
+		REQUIRE(c.pLimiter == nullptr);
+
+		// the id goes to another method: the calls of the old one are out of its count, but not of the global one
+		limiter.let_go_of_method(0);
+		REQUIRE(limiter.methods[0].nInFlight == 0);
+		REQUIRE(limiter.nInFlight == 2);
+		limiter.release(a, 100);
+		REQUIRE(limiter.methods[0].nInFlight == 0);
+		REQUIRE(limiter.methods[0].nAvgLatencyUs == 0);	// (not the latency of the new method)
+		REQUIRE(limiter.nInFlight == 1);
+		limiter.release(a, 100);	// released already
+		REQUIRE(limiter.nInFlight == 1);
+
+		// the calls that outlive the limiter are let go
+		{
+			_rpcLimiter shortLived;
+			REQUIRE(shortLived.try_acquire(0, c));
+		}
+		REQUIRE(c.pLimiter == nullptr);
+		REQUIRE(b.pLimiter == &limiter);
+		limiter.release(b, 100);
+		REQUIRE(limiter.nInFlight == 0);
+		REQUIRE(limiter.calls.pNext == &limiter.calls);
+	}
+}
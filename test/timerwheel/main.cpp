@@ -0,0 +1,137 @@
+/*
+	Copyright (c) 2016 Cenacle Research India Private Limited
+*/
+
+#define CATCH_CONFIG_MAIN  // This tells Catch to provide a main()
+#include "catch.hpp"
+#include "timer_wheel.h"
+#include <vector>
+#include <random>
+#include <algorithm>
+
+struct _firedTimer
+{
+	timer_wheel::entry	e;
+	uint64_t			due = 0;		// expected time of firing (ms)
+	uint64_t			firedAt = 0;
+	int					nFired = 0;
+	static uint64_t		s_now;
+
+	static void on_expired(timer_wheel::entry* pEntry)
+	{
+		_firedTimer* pTimer = (_firedTimer*)pEntry->data;
+		pTimer->firedAt = s_now;
+		pTimer->nFired++;
+	}
+};
+uint64_t _firedTimer::s_now = 0;
+
+TEST_CASE("Timer Wheel", "[timer_wheel]")
+{
+	const uint32_t RES = 10;
+
+	SECTION("Fires on time")
+	{
+		timer_wheel wheel(0, RES);
+		_firedTimer::s_now = 0;
+		// spans all the levels of the wheel, and beyond
+		std::vector<uint64_t> delays = { 1, 9, 10, 11, 639, 640, 641, 650, 40959, 40960, 40970, 2621439, 2621440, 2700000, 170000000, 200000000 };
+		std::vector<_firedTimer> timers(delays.size());
+		for (size_t i = 0; i < delays.size(); ++i)
+		{
+			wheel.init(timers[i].e, _firedTimer::on_expired, &timers[i]);
+			wheel.schedule(timers[i].e, delays[i]);
+			timers[i].due = delays[i];
+		}
+		REQUIRE(wheel.size() == delays.size());
+
+		// drive the wheel with irregular steps: within a tick while the near timers are due, long strides later
+		std::mt19937 rng(7);
+		uint64_t maxStep = 0;
+		while (!wheel.empty())
+		{
+			uint64_t step = (_firedTimer::s_now < 3000000) ? 1 + rng() % RES : 1 + rng() % 50000;
+			maxStep = std::max(maxStep, step);
+			_firedTimer::s_now += step;
+			wheel.advance(_firedTimer::s_now);
+		}
+		for (auto& t : timers)
+		{
+			REQUIRE(t.nFired == 1);
+			REQUIRE(t.firedAt >= t.due);	// never early
+			REQUIRE(t.firedAt < t.due + RES + (t.due < 3000000 ? RES : maxStep));	// at most a tick (plus the step) late
+		}
+	}
+	SECTION("Refresh and Cancel")
+	{
+		timer_wheel wheel(0, RES);
+		_firedTimer idle, other;
+		wheel.init(idle.e, _firedTimer::on_expired, &idle);
+		wheel.init(other.e, _firedTimer::on_expired, &other);
+		wheel.schedule(other.e, 1000);
+		for (uint64_t t = RES; t <= 5000; t += RES)	// activity every tick keeps pushing the timeout
+		{
+			wheel.schedule(idle.e, 100);
+			_firedTimer::s_now = t;
+			wheel.advance(t);
+		}
+		REQUIRE(idle.nFired == 0);
+		REQUIRE(other.nFired == 1);
+		REQUIRE(wheel.size() == 1);
+		REQUIRE(wheel.remaining(idle.e) == 100 - RES);	// scheduled a tick ago
+
+		wheel.cancel(idle.e);
+		wheel.cancel(idle.e);	// cancelling twice is harmless
+		REQUIRE(wheel.empty());
+		wheel.advance(100000);
+		REQUIRE(idle.nFired == 0);
+	}
+	SECTION("Callbacks reschedule")
+	{
+		timer_wheel wheel(0, RES);
+		struct _periodic
+		{
+			timer_wheel::entry e;
+			timer_wheel* pWheel;
+			int nFired;
+		} periodic;
+		periodic.pWheel = &wheel;
+		periodic.nFired = 0;
+		wheel.init(periodic.e, [](timer_wheel::entry* pEntry) {
+			_periodic* p = (_periodic*)pEntry->data;
+			if (++p->nFired < 10) p->pWheel->schedule(p->e, 1000);
+		}, &periodic);
+		wheel.schedule(periodic.e, 1000);
+		wheel.advance(100000);	// one long stall: catches up tick by tick
+		REQUIRE(periodic.nFired == 10);
+		REQUIRE(wheel.empty());
+	}
+	SECTION("Many timers")
+	{
+		timer_wheel wheel(0, RES);
+		const int N = 20000;
+		std::vector<_firedTimer> timers(N);
+		std::mt19937 rng(11);
+		for (int i = 0; i < N; ++i)
+		{
+			wheel.init(timers[i].e, _firedTimer::on_expired, &timers[i]);
+			timers[i].due = 1 + rng() % 600000;
+			wheel.schedule(timers[i].e, timers[i].due);
+		}
+		for (int i = 0; i < N; i += 2)	// cancel half of them
+			wheel.cancel(timers[i].e);
+		REQUIRE(wheel.size() == N / 2);
+		for (uint64_t t = RES; !wheel.empty(); t += RES)
+		{
+			_firedTimer::s_now = t;
+			wheel.advance(t);
+		}
+		for (int i = 0; i < N; ++i)
+		{
+			if (i % 2 == 0) { REQUIRE(timers[i].nFired == 0); continue; }
+			REQUIRE(timers[i].nFired == 1);
+			REQUIRE(timers[i].firedAt >= timers[i].due);
+			REQUIRE(timers[i].firedAt < timers[i].due + RES);
+		}
+	}
+}
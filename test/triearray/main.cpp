@@ -5,8 +5,13 @@
 #define CATCH_CONFIG_MAIN  // This tells Catch to provide a main()
 #include "catch.hpp"
 #include "trie_array.h"
+#include "trie_image.h"
+#include "rcu_trie_array.h"
 #include <string>
 #include <vector>
+#include <thread>
+#include <atomic>
+#include <memory>
 
 TEST_CASE("Trie Array", "[trie_array]") 
 {
@@ -59,6 +64,25 @@ TEST_CASE("Trie Array", "[trie_array]")
 
 			REQUIRE(nCount == sizeof(strings) / sizeof(strings[0]));
 		}
+		SECTION("Bulk Build")
+		{
+			const char* unsorted[] = { "https", "GET", "abc", "GET", "/route1", "/" };
+			trie_hash tb;
+			trie_hash::HASH h[sizeof(unsorted) / sizeof(unsorted[0])];
+			tb.hash("abc", 3);
+			tb.build(unsorted, sizeof(unsorted) / sizeof(unsorted[0]), h);
+
+			REQUIRE(tb.size() == 5);
+			REQUIRE(h[2] == 0);			// existing key retains its hash
+			REQUIRE(h[0] == 1);			// new keys are hashed in the input order
+			REQUIRE(h[1] == 2);
+			REQUIRE(h[3] == h[1]);		// repeated key gets the same hash
+			REQUIRE(h[4] == 3);
+			REQUIRE(h[5] == 4);
+			for (int i = 0; i < sizeof(unsorted) / sizeof(unsorted[0]); ++i)
+				REQUIRE(tb.getHash(unsorted[i]) == h[i]);
+			REQUIRE(tb.hash("http", 4) == 5);
+		}
 	}
 	SECTION("trie_prefixed_hash")
 	{
@@ -114,4 +138,169 @@ TEST_CASE("Trie Array", "[trie_array]")
 			}
 		}
 	}
-};
\ No newline at end of file
+}
+
+TEST_CASE("Trie Array Bulk Insertion", "[trie_array]")
+{
+	enum { NUM_KEYS = 50000 };
+	std::vector<std::string> keyStore(NUM_KEYS);
+	std::vector<const char*> keys(NUM_KEYS);
+	std::vector<size_t> keyLens(NUM_KEYS);
+	std::vector<int> values(NUM_KEYS);
+	for (int i = 0; i < NUM_KEYS; ++i)
+	{
+		keyStore[i] = "method/" + std::to_string((i * 7919) % NUM_KEYS);	// not in sorted order
+		keys[i] = keyStore[i].c_str();
+		keyLens[i] = keyStore[i].length();
+		values[i] = i;
+	}
+
+	trie_array<int> ta;
+	std::vector<trie_array<int>::KEY> hashes(NUM_KEYS);
+	ta.insertkv(keys.data(), keyLens.data(), values.data(), NUM_KEYS, hashes.data());
+
+	for (int i = 0; i < NUM_KEYS; ++i)
+	{
+		REQUIRE(hashes[i] == i);
+		REQUIRE(ta.at(keys[i], keyLens[i], -1) == i);
+	}
+	REQUIRE(ta.at("method/", 7, -1) == -1);
+
+	SECTION("Single insertions after reserve")
+	{
+		trie_array<int> ta2;
+		REQUIRE(ta2.reserve(NUM_KEYS));
+		for (int i = 0; i < NUM_KEYS; ++i)
+			ta2.insertkv(keys[i], keyLens[i], values[i]);
+		for (int i = 0; i < NUM_KEYS; ++i)
+			REQUIRE(ta2.at(keys[i], keyLens[i], -1) == i);
+	}
+}
+
+TEST_CASE("Trie Array Image", "[trie_array]")
+{
+	const char* keys[] = { "P|REQ|", "P|A|S|", "echo", "add", "multiply", "echo/stream" };
+	const int values[] = { 10, 20, 30, 40, 50, 60 };
+	const int nKeys = sizeof(keys) / sizeof(keys[0]);
+	const char* szImageFile = "trie_array_test.img";
+
+	trie_array<int> ta;
+	ta.insertkv(keys, values, nKeys);
+	REQUIRE(trie_image::save(szImageFile, ta) == 0);
+
+	SECTION("Mapped Lookups")
+	{
+		trie_array_image<int> tai;
+		REQUIRE(tai.open(szImageFile) == 0);
+		for (int i = 0; i < nKeys; ++i)
+		{
+			REQUIRE(tai.findKey(keys[i], strlen(keys[i])) == ta.findKey(keys[i], strlen(keys[i])));
+			REQUIRE(tai.at(keys[i], strlen(keys[i]), -1) == values[i]);
+		}
+		REQUIRE(tai.at("ech", 3, -1) == -1);
+		REQUIRE(tai.at("unknown", 7, -1) == -1);
+	}
+	SECTION("Invalid Images")
+	{
+		trie_array_image<double> taiMismatch;	// value size differs from the saved image
+		REQUIRE(taiMismatch.open(szImageFile) == -1);
+		trie_array_image<int> taiMissing;
+		REQUIRE(taiMissing.open("no_such_trie_image.img") == -1);
+	}
+	remove(szImageFile);
+}
+
+TEST_CASE("RCU Trie Array", "[trie_array]")
+{
+	enum { NUM_KEYS = 2000, NUM_READERS = 4 };
+	std::vector<std::string> keys(NUM_KEYS);
+	for (int i = 0; i < NUM_KEYS; ++i) keys[i] = "event/" + std::to_string(i);
+
+	rcu_trie_array<int> rta;
+	std::atomic<int> nPublished(0);
+	std::atomic<bool> bFailed(false);
+
+	// readers keep looking up while the writer keeps adding keys in the background.
+	// A key that has been published should always be found with its value.
+	std::vector<std::thread> readers;
+	for (int t = 0; t < NUM_READERS; ++t)
+		readers.emplace_back([&]() {
+			rcu_trie_array<int>::reader r(rta);
+			while (nPublished.load() < NUM_KEYS)
+			{
+				int nLast = nPublished.load() - 1;
+				if (nLast >= 0 && r.at(keys[nLast].c_str(), keys[nLast].length(), -1) != nLast)
+					bFailed = true;
+			}
+		});
+
+	for (int i = 0; i < NUM_KEYS; ++i)
+	{
+		rta.insertkv(keys[i].c_str(), keys[i].length(), i);
+		nPublished = i + 1;
+	}
+	for (auto& t : readers) t.join();
+
+	REQUIRE(!bFailed);
+	REQUIRE(rta.reclaim() == 0);	// no readers left, all old versions should be released
+
+	rcu_trie_array<int>::reader r(rta);
+	for (int i = 0; i < NUM_KEYS; ++i)
+	{
+		trie_array<int>::KEY key = r.findKey(keys[i].c_str(), keys[i].length());
+		REQUIRE(key >= 0);
+		REQUIRE(r.at(key, -1) == i);
+	}
+	REQUIRE(r.at("event/", 6, -1) == -1);
+
+	// the readers beyond the slots fall back to the writers' lock
+	std::vector<std::unique_ptr<rcu_trie_array<int>::reader>> extra;
+	for (int i = 0; i < _epochDomain::MAX_READERS; ++i)
+		extra.emplace_back(new rcu_trie_array<int>::reader(rta));
+	REQUIRE(!extra.back()->isValid());
+	REQUIRE(extra.back()->at(keys[7].c_str(), keys[7].length(), -1) == 7);
+	extra.clear();
+	REQUIRE(rta.reclaim() == 0);
+}
+
+TEST_CASE("Trie Array Erase", "[trie_array]")
+{
+	trie_array<int> ta;
+	const char* keys[] = { "add", "echo", "multiply", "echo/stream" };
+	const int values[] = { 1, 2, 3, 4 };
+	ta.insertkv(keys, values, 4);
+
+	SECTION("Erase and Reuse")
+	{
+		REQUIRE(ta.erase("echo") == 1);
+		REQUIRE(ta.findKey("echo", 4) == -1);
+		REQUIRE(ta.at("echo", 4, -1) == -1);
+		REQUIRE(ta.at("echo/stream", 11, -1) == 4);	// keys sharing the prefix are not affected
+		REQUIRE(ta.erase("echo") == -1);			// already erased
+		REQUIRE(ta.erase("unknown") == -1);
+
+		REQUIRE(ta.insertkv("subtract", 5) == 1);	// reuses the slot of the erased key
+		REQUIRE(ta.at("subtract", 8, -1) == 5);
+		REQUIRE(ta.insertkv("divide", 6) == 4);
+	}
+	SECTION("Churn and Compaction")
+	{
+		// keep adding and removing dynamic names: the hashes (and the array) should not keep growing
+		for (int i = 0; i < 10000; ++i)
+		{
+			std::string key = "dynamic/" + std::to_string(i);
+			trie_array<int>::KEY h = ta.insertkv(key.c_str(), key.length(), i);
+			REQUIRE(h < 6);
+			REQUIRE(ta.erase(key.c_str(), key.length()) == h);
+		}
+		ta.compact();
+		REQUIRE(ta.m_array.reserved() <= 8);
+		for (int i = 0; i < 4; ++i)
+			REQUIRE(ta.at(keys[i], strlen(keys[i]), -1) == values[i]);
+
+		int nCount = 0;
+		for (trie_array<int>::iterator iter = ta.begin(), iterEnd = ta.end(); iter != iterEnd; ++iter)
+			++nCount;
+		REQUIRE(nCount == 4);
+	}
+}
@@ -0,0 +1,177 @@
+/*
+	Copyright (c) 2016 Cenacle Research India Private Limited
+*/
+
+#define CATCH_CONFIG_MAIN  // This tells Catch to provide a main()
+#include "catch.hpp"
+#include "uringIOHandler.h"
+#include <algorithm>
+#include <string>
+
+using namespace DSCPP;
+
+// records what the handler reports
+struct _uringClient : public uringIOHandler<_uringClient>
+{
+	timer_wheel	wheel;
+	std::string	received;
+	int			nEstablished = 0;
+	int			nLost = 0;
+	int			nTicks = 0;
+	size_t		nLargestRead = 0;
+
+	_uringClient() : wheel(0, 10) { }
+	timer_wheel& timers() { return wheel; }
+	void on_timers_tick(uint64_t nowMs) { nTicks++; }
+	void on_writable() { }
+	void on_connection_established() { nEstablished++; }
+	void on_connection_lost() { nLost++; }
+	int handle_server_data(unique_bufptr spOwner, char* pData, size_t len)
+	{
+		REQUIRE(spOwner.get() == pData);	// the read buffer itself, not a copy
+		received.append(pData, len);
+		nLargestRead = std::max(nLargestRead, len);
+		return 0;
+	}
+	size_t send_queue_length() const { return m_sendQueue.size(); }
+	template<typename TCondition>
+	bool run_until(TCondition condition)
+	{
+		for (int i = 0; i < 1000 && !condition(); ++i)
+			if (run_once() < 0) return false;
+		return condition();
+	}
+};
+
+// a listening socket on the loopback, at an ephemeral port
+int listen_loopback(int& nPort)
+{
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t nLen = sizeof(addr);
+	if (bind(fd, (sockaddr*)&addr, nLen) < 0 || listen(fd, 4) < 0 || getsockname(fd, (sockaddr*)&addr, &nLen) < 0) return -1;
+	nPort = ntohs(addr.sin_port);
+	return fd;
+}
+
+TEST_CASE("io_uring Transport", "[uring]")
+{
+	int nPort = 0;
+	int fdListen = listen_loopback(nPort);
+	REQUIRE(fdListen >= 0);
+	_uringClient client;
+	_connectionOptions options;
+	options.bNoDelay = true;
+	options.nReadBufferSize = 1024;
+	client.set_options(options);
+	if (client.open("127.0.0.1", nPort) < 0)
+	{
+		WARN("io_uring (with provided buffer rings) is not available: skipped");
+		::close(fdListen);
+		return;
+	}
+	REQUIRE(client.run_until([&]() { return client.nEstablished == 1; }));
+	int fdServer = accept(fdListen, nullptr, nullptr);
+	REQUIRE(fdServer >= 0);
+
+	SECTION("Reads")
+	{
+		std::string data;	// more than all the provided buffers together
+		for (int i = 0; data.length() < 8 * _uringClient::READ_BUFFERS * _uringClient::READ_BUFFER_SIZE; ++i)
+			data += "E\x1f" "EVT\x1f" "event-" + std::to_string(i) + "\x1e";
+		size_t nWritten = 0;
+		while (nWritten < data.length())
+		{
+			ssize_t n = ::send(fdServer, data.data() + nWritten, data.length() - nWritten, MSG_DONTWAIT);
+			if (n > 0) nWritten += n;
+			client.run_once();
+		}
+		REQUIRE(client.run_until([&]() { return client.received.length() == data.length(); }));
+		REQUIRE(client.received == data);
+		REQUIRE(client.nLargestRead <= 1024);	// the read buffer size of the options
+		REQUIRE(client.nLost == 0);
+	}
+	SECTION("Batched Sends")
+	{
+		std::string expected;
+		uint64_t nSendCalls = client.m_stats.nSendCalls;
+		for (int i = 0; i < 100; ++i)
+		{
+			std::string msg = "P\x1fRES\x1f" "echo\x1f" + std::to_string(i) + "\x1fSok\x1e";
+			char* buf = (char*)client.alloc_send_buffer(msg.length());
+			memcpy(buf, msg.data(), msg.length());
+			REQUIRE(client.send(buf, msg.length()) == 0);
+			expected += msg;
+		}
+		std::string sent(expected.length(), '\0');
+		size_t nRead = 0;
+		while (nRead < expected.length())
+		{
+			REQUIRE(client.run_once() == 0);
+			ssize_t n = recv(fdServer, &sent[nRead], sent.length() - nRead, MSG_DONTWAIT);
+			if (n > 0) nRead += n;
+		}
+		REQUIRE(sent == expected);
+		REQUIRE(client.m_stats.nSendCalls - nSendCalls <= 2);	// 64 to a sendmsg
+	}
+	SECTION("Streaming Sends")
+	{
+		// every send completed queues the next: the queue never drains, yet the sent ones do not pile up in it
+		enum { MESSAGES = 5000, QUEUED = 100, MSG_LEN = 16 };
+		static _uringClient* s_pClient;
+		static int s_nLeft;
+		s_pClient = &client;
+		s_nLeft = MESSAGES;
+		struct _streamer
+		{
+			static void send_next()
+			{
+				if (s_nLeft <= 0) return;
+				s_nLeft--;
+				void* buf = s_pClient->alloc_send_buffer(MSG_LEN);
+				memset(buf, 'x', MSG_LEN);
+				s_pClient->send(buf, MSG_LEN, &_streamer::on_sent);
+			}
+			static void on_sent(void* buf, size_t len)
+			{
+				_uringClient::release_send_buffer(buf, len);
+				send_next();
+			}
+		};
+		for (int i = 0; i < QUEUED; ++i) _streamer::send_next();
+		std::string sent(MESSAGES * MSG_LEN, '\0');
+		size_t nRead = 0, nLongest = 0;
+		while (nRead < sent.length())
+		{
+			REQUIRE(client.run_once() == 0);
+			nLongest = std::max(nLongest, client.send_queue_length());
+			ssize_t n = recv(fdServer, &sent[nRead], sent.length() - nRead, MSG_DONTWAIT);
+			if (n > 0) nRead += n;
+		}
+		REQUIRE(sent == std::string(MESSAGES * MSG_LEN, 'x'));
+		REQUIRE(nLongest <= 4 * QUEUED);
+	}
+	SECTION("Connection Lost")
+	{
+		::close(fdServer);
+		fdServer = -1;
+		REQUIRE(client.run_until([&]() { return client.nLost == 1; }));
+		REQUIRE(client.run_until([&]() { return !client.is_connected(); }));
+		REQUIRE(client.send(client.alloc_send_buffer(8), 8) < 0);	// released right away
+		REQUIRE(client.reconnect() == 0);
+		REQUIRE(client.run_until([&]() { return client.nEstablished == 2; }));
+		fdServer = accept(fdListen, nullptr, nullptr);
+		REQUIRE(fdServer >= 0);
+	}
+	SECTION("Timers Tick")
+	{
+		int nTicks = client.nTicks;
+		REQUIRE(client.run_until([&]() { return client.nTicks >= nTicks + 3; }));
+	}
+	client.close();
+	if (fdServer >= 0) ::close(fdServer);
+	::close(fdListen);
+}
@@ -0,0 +1,297 @@
+/*
+	Copyright (c) 2016 Cenacle Research India Private Limited
+*/
+
+#define CATCH_CONFIG_MAIN  // This tells Catch to provide a main()
+#include "catch.hpp"
+#include "wsIOHandler.h"
+#include <vector>
+#include <string>
+
+using namespace DSCPP;
+
+// collects what the parser hands out
+struct _wsSink
+{
+	std::string			data;			// the payload of the data frames, concatenated
+	std::vector<size_t>	messageEnds;	// offsets in data at which the messages ended
+	std::vector<std::pair<int, std::string>> controls;
+	int					nStopAfter = -1;	// stop the parsing after these many data pieces
+
+	int on_ws_data(char* p, size_t n, bool bMessageEnd)
+	{
+		data.append(p, n);
+		if (bMessageEnd) messageEnds.push_back(data.length());
+		return (nStopAfter >= 0 && --nStopAfter < 0) ? -1 : 0;
+	}
+	int on_ws_control(int nOpcode, char* p, size_t n)
+	{
+		controls.push_back(std::make_pair(nOpcode, std::string(p, n)));
+		return 0;
+	}
+};
+typedef _wsFrameParser<_wsSink> TParser;
+
+// an unmasked (server) frame
+std::string ws_frame(int nOpcode, const std::string& payload, bool bFin = true, unsigned char rsv = 0)
+{
+	std::string frame(1, (char)((bFin ? 0x80 : 0) | rsv | nOpcode));
+	size_t len = payload.length();
+	if (len < 126) frame += (char)len;
+	else if (len <= 0xFFFF) { frame += (char)126; frame += (char)(len >> 8); frame += (char)len; }
+	else { frame += (char)127; for (int i = 7; i >= 0; --i) frame += (char)((uint64_t)len >> (8 * i)); }
+	return frame + payload;
+}
+
+// parses the stream in pieces of nPiece bytes (0 for split at nSplit only)
+int parse_in_pieces(TParser& parser, _wsSink& sink, std::string stream, size_t nPiece, size_t nSplit = 0)
+{
+	if (nPiece == 0)
+	{
+		if (parser.parse(&sink, &stream[0], nSplit) < 0) return -1;
+		return parser.parse(&sink, &stream[0] + nSplit, stream.length() - nSplit);
+	}
+	for (size_t i = 0; i < stream.length(); i += nPiece)
+		if (parser.parse(&sink, &stream[0] + i, std::min(nPiece, stream.length() - i)) < 0) return -1;
+	return 0;
+}
+
+TEST_CASE("Handshake Keys", "[websocket]")
+{
+	char szAccept[WS_ACCEPT_LEN + 1];
+	ws_accept_key("dGhlIHNhbXBsZSBub25jZQ==", szAccept);	// the sample of RFC 6455, 1.3
+	REQUIRE(std::string(szAccept) == "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=");
+
+	unsigned char digest[20];
+	char szDigest[64];
+	ws_sha1("abc", 3, digest);
+	ws_base64(digest, 20, szDigest);
+	REQUIRE(std::string(szDigest) == "qZk+NkcGgWq6PiVxeFDCbJzQ2J0=");
+	std::string strLong(1000, 'a');	// spans blocks
+	ws_sha1(strLong.c_str(), strLong.length(), digest);
+	ws_base64(digest, 20, szDigest);
+	REQUIRE(std::string(szDigest) == "KR6abGaZSUm1e6XmUDYemPw2sbo=");
+
+	REQUIRE(ws_base64((const unsigned char*)"f", 1, szDigest) == 4);
+	REQUIRE(std::string(szDigest) == "Zg==");
+	ws_base64((const unsigned char*)"fo", 2, szDigest);
+	REQUIRE(std::string(szDigest) == "Zm8=");
+	ws_base64((const unsigned char*)"foo", 3, szDigest);
+	REQUIRE(std::string(szDigest) == "Zm9v");
+}
+
+TEST_CASE("Masking", "[websocket]")
+{
+	const unsigned char key[4] = { 0x37, 0xfa, 0x21, 0x3d };
+	std::vector<char> data(300);
+	for (size_t i = 0; i < data.size(); ++i) data[i] = (char)(i * 7 + 1);
+	for (size_t len = 0; len < 100; ++len)
+		for (size_t offset = 0; offset < 4; ++offset)
+		{
+			std::vector<char> masked(data.begin() + 3, data.begin() + 3 + len);	// unaligned start
+			ws_mask(masked.data(), len, key, offset);
+			for (size_t i = 0; i < len; ++i)
+				REQUIRE(masked[i] == (char)(data[3 + i] ^ key[(i + offset) & 3]));
+		}
+
+	// in pieces, with the offsets
+	std::vector<char> whole(data), pieces(data);
+	ws_mask(whole.data(), whole.size(), key);
+	for (size_t i = 0; i < pieces.size(); i += 37)
+		ws_mask(pieces.data() + i, std::min((size_t)37, pieces.size() - i), key, i);
+	REQUIRE(whole == pieces);
+	ws_mask(whole.data(), whole.size(), key);	// masking twice gives back the data
+	REQUIRE(whole == data);
+
+	// the RFC sample: a masked "Hello"
+	char hello[] = "Hello";
+	ws_mask(hello, 5, key);
+	REQUIRE(memcmp(hello, "\x7f\x9f\x4d\x51\x58", 5) == 0);
+}
+
+TEST_CASE("Frame Parser", "[websocket]")
+{
+	std::string strMedium(300, 'm'), strLarge(70000, 'L');
+	std::string stream =
+		ws_frame(TParser::WS_TEXT, "Hel", false) +
+		ws_frame(TParser::WS_PING, "beat") +			// control frames can come in between the fragments
+		ws_frame(TParser::WS_CONTINUATION, "lo", false) +
+		ws_frame(TParser::WS_CONTINUATION, "!") +
+		ws_frame(TParser::WS_BINARY, strMedium) +		// 16-bit length
+		ws_frame(TParser::WS_TEXT, "") +
+		ws_frame(TParser::WS_TEXT, strLarge) +			// 64-bit length
+		ws_frame(TParser::WS_CLOSE, "\x03\xe8");
+	std::string expected = "Hello!" + strMedium + strLarge;
+
+	SECTION("Split at every byte")
+	{
+		for (size_t nSplit = 0; nSplit <= 400; ++nSplit)
+		{
+			TParser parser;
+			_wsSink sink;
+			REQUIRE(parse_in_pieces(parser, sink, stream, 0, nSplit) == 0);
+			REQUIRE(sink.data == expected);
+			REQUIRE(sink.messageEnds == std::vector<size_t>({ 6, 306, 306, expected.length() }));
+			REQUIRE(sink.controls.size() == 2);
+			REQUIRE(sink.controls[0] == std::make_pair((int)TParser::WS_PING, std::string("beat")));
+			REQUIRE(sink.controls[1] == std::make_pair((int)TParser::WS_CLOSE, std::string("\x03\xe8")));
+		}
+	}
+	SECTION("Byte at a time")
+	{
+		TParser parser;
+		_wsSink sink;
+		REQUIRE(parse_in_pieces(parser, sink, stream, 1) == 0);
+		REQUIRE(sink.data == expected);
+		REQUIRE(sink.controls.size() == 2);
+	}
+	SECTION("Payloads are not copied")
+	{
+		std::string frame = ws_frame(TParser::WS_TEXT, "payload");
+		struct _pointerSink : _wsSink
+		{
+			char* p = nullptr;
+			int on_ws_data(char* pData, size_t n, bool) { p = pData; return 0; }
+		} ptrSink;
+		_wsFrameParser<_pointerSink> ptrParser;
+		REQUIRE(ptrParser.parse(&ptrSink, &frame[0], frame.length()) == 0);
+		REQUIRE(ptrSink.p == &frame[2]);
+	}
+	SECTION("Sink stops the parsing")
+	{
+		TParser parser;
+		_wsSink sink;
+		sink.nStopAfter = 0;
+		std::string two = ws_frame(TParser::WS_TEXT, "one") + ws_frame(TParser::WS_TEXT, "two");
+		REQUIRE(parser.parse(&sink, &two[0], two.length()) == -1);
+		REQUIRE(sink.data == "one");
+	}
+}
+
+TEST_CASE("Frame Parser Errors", "[websocket]")
+{
+	auto fails = [](std::string stream) {
+		TParser parser;
+		_wsSink sink;
+		return parser.parse(&sink, &stream[0], stream.length()) < 0;
+	};
+	std::string masked = ws_frame(TParser::WS_TEXT, "abc");
+	masked[1] |= 0x80;
+	masked.insert(2, "\x01\x02\x03\x04");
+	REQUIRE(fails(masked));												// servers do not mask
+	REQUIRE(fails(ws_frame(TParser::WS_TEXT, "abc", true, 0x40)));		// RSV1 without an extension
+	REQUIRE(fails(ws_frame(TParser::WS_PING, std::string(126, 'p'))));	// control frames are <= 125 bytes
+	REQUIRE(fails(ws_frame(TParser::WS_PING, "p", false)));				// and not fragmented
+	REQUIRE(fails(ws_frame(TParser::WS_CONTINUATION, "c")));			// nothing to continue
+	REQUIRE(fails(ws_frame(TParser::WS_TEXT, "a", false) + ws_frame(TParser::WS_TEXT, "b")));	// previous message is not finished
+	REQUIRE(fails(ws_frame(0x3, "r")));									// reserved opcodes
+	REQUIRE(fails(ws_frame(0xB, "r")));
+	REQUIRE(!fails(ws_frame(TParser::WS_PONG, std::string(125, 'p'))));
+
+	// with permessage-deflate, RSV1 marks the first frame of a compressed message
+	auto failsCompressed = [](std::string stream) {
+		TParser parser;
+		_wsSink sink;
+		parser.allow_compressed(true);
+		return parser.parse(&sink, &stream[0], stream.length()) < 0;
+	};
+	REQUIRE(!failsCompressed(ws_frame(TParser::WS_TEXT, "a", false, 0x40) + ws_frame(TParser::WS_CONTINUATION, "b")));
+	REQUIRE(failsCompressed(ws_frame(TParser::WS_TEXT, "a", false, 0x40) + ws_frame(TParser::WS_CONTINUATION, "b", true, 0x40)));
+	REQUIRE(failsCompressed(ws_frame(TParser::WS_PING, "p", true, 0x40)));	// control frames are never compressed
+	REQUIRE(failsCompressed(ws_frame(TParser::WS_TEXT, "a", true, 0x20)));	// RSV2 is still unknown
+}
+
+TEST_CASE("permessage-deflate Negotiation", "[websocket]")
+{
+	_wsDeflateParams params;
+	REQUIRE(params.parse("permessage-deflate\r\n"));
+	REQUIRE((!params.bServerNoContextTakeover && !params.bClientNoContextTakeover && params.nClientMaxWindowBits == 15));
+	REQUIRE(params.parse("permessage-deflate; server_no_context_takeover ;client_max_window_bits=\"10\"; server_max_window_bits=12"));
+	REQUIRE(params.bServerNoContextTakeover);
+	REQUIRE(params.nClientMaxWindowBits == 10);
+	REQUIRE(params.nServerMaxWindowBits == 12);
+
+	_wsDeflateParams bad;
+	REQUIRE(!bad.parse("x-webkit-deflate-frame"));
+	REQUIRE(!bad.parse("permessage-deflate; client_max_window_bits=16"));
+	REQUIRE(!bad.parse("permessage-deflate; server_no_context_takeover=1"));
+	REQUIRE(!bad.parse("permessage-deflate; unknown_param"));
+	REQUIRE(!bad.parse("permessage-deflate, permessage-deflate"));	// we offer one
+}
+
+#ifdef DSCPP_WITH_ZLIB
+// compresses with one side and decompresses (in pieces) with the other, like a client and a server
+struct _deflatePeers
+{
+	wsDeflate	client;
+	wsDeflate	server;
+	inline _deflatePeers(const _wsDeflateParams& params = _wsDeflateParams())
+	{
+		client.set_options(0, Z_DEFAULT_COMPRESSION);
+		REQUIRE(client.init(params) == 0);
+		REQUIRE(server.init(params) == 0);
+	}
+	inline std::string roundtrip(const std::string& msg, size_t& nCompressedLen, size_t nPiece = 1000)
+	{
+		char* pCompressed = client.compress(msg.data(), msg.length(), nCompressedLen);
+		REQUIRE(pCompressed != nullptr);
+		std::string out;
+		for (size_t i = 0; i < nCompressedLen || i == 0; i += nPiece)
+		{
+			size_t n = std::min(nPiece, nCompressedLen - i);
+			REQUIRE(server.decompress(pCompressed + i, n, i + n == nCompressedLen, [&out](char* pChunk, size_t nLen) {
+				out.append(pChunk, nLen);
+				POOLED_FREE(pChunk);	// the chunks are owned by the receiver
+			}) == 0);
+		}
+		POOLED_FREE(pCompressed);
+		return out;
+	}
+};
+
+TEST_CASE("permessage-deflate", "[websocket]")
+{
+	std::string record = "R\x1fU\x1fusers/1042\x1f" "17\x1f{\"name\":\"Kavya\",\"status\":\"online\",\"score\":1200,\"tags\":[\"gold\",\"early\"]}\x1e";
+
+	SECTION("Context takeover")
+	{
+		_deflatePeers peers;
+		size_t nFirst = 0, nSecond = 0;
+		REQUIRE(peers.roundtrip(record, nFirst) == record);
+		REQUIRE(peers.roundtrip(record, nSecond, 1) == record);	// decompressed a byte at a time
+		REQUIRE(nSecond < nFirst / 4);	// the window remembers the first message
+		REQUIRE(peers.roundtrip("", nFirst) == "");
+	}
+	SECTION("No context takeover")
+	{
+		_wsDeflateParams params;
+		params.bClientNoContextTakeover = params.bServerNoContextTakeover = true;
+		_deflatePeers peers(params);
+		size_t nFirst = 0, nSecond = 0;
+		REQUIRE(peers.roundtrip(record, nFirst) == record);
+		REQUIRE(peers.roundtrip(record, nSecond) == record);
+		REQUIRE(nSecond == nFirst);
+	}
+	SECTION("Large messages")
+	{
+		_deflatePeers peers;
+		std::string large;
+		for (int i = 0; large.length() < 5 * wsDeflate::INFLATE_CHUNK_SIZE; ++i)
+			large += std::to_string(i * 7919 % 10007) + ",";	// spans several output chunks
+		size_t nLen = 0;
+		REQUIRE(peers.roundtrip(large, nLen, 333) == large);
+		REQUIRE(peers.roundtrip(large, nLen) == large);
+	}
+	SECTION("Threshold and corrupt data")
+	{
+		wsDeflate deflate;
+		deflate.set_options(256, 1);
+		REQUIRE(!deflate.should_compress(1000));	// not started
+		REQUIRE(deflate.init(_wsDeflateParams()) == 0);
+		REQUIRE(!deflate.should_compress(100));		// acks and pings are left alone
+		REQUIRE(deflate.should_compress(256));
+		const char garbage[] = "\xff\xff\xff\xff\xff";
+		REQUIRE(deflate.decompress(garbage, 5, true, [](char* pChunk, size_t) { POOLED_FREE(pChunk); }) == -1);
+	}
+}
+#endif // DSCPP_WITH_ZLIB